@@ -31,6 +31,7 @@
 #define _MIPS_SPINLOCK_H_
 
 #include <cdefs.h>
+#include <atomic.h>
 
 
 /* Type of value needed to actually spin on */
@@ -45,7 +46,7 @@ void spinlock_data_set(volatile spinlock_data_t *sd, unsigned val);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
-spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+spinlock_data_t spinlock_data_fetchinc(volatile spinlock_data_t *sd);
 
 ////////////////////////////////////////////////////////////
 
@@ -73,50 +74,16 @@ spinlock_data_get(volatile spinlock_data_t *sd)
 }
 
 /*
- * Test-and-set a spinlock_data_t. Use the LL/SC instructions to
- * make it atomic.
- *
- * LL (load linked) loads a machine word from memory, and marks the
- * address. SC (store conditional) stores a machine word to memory,
- * but succeeds only if the address is marked from a previous LL on
- * the same processor. Stores from other processors clear that mark,
- * as do traps on the current processor. Note that there may be no
- * other memory accesses (besides instruction fetches) between the LL
- * and the SC or the behavior is *undefined*. You can only use LL/SC
- * to atomically update one machine word.
+ * Add one to a spinlock_data_t and return what it was before, for
+ * handing out tickets. This is atomic_add, so there's only the one
+ * LL/SC loop to get right; a spinlock_data_t is a plain 32-bit word,
+ * so it can be treated as an int, and wrapping around is harmless.
  */
 SPINLOCK_INLINE
 spinlock_data_t
-spinlock_data_testandset(volatile spinlock_data_t *sd)
+spinlock_data_fetchinc(volatile spinlock_data_t *sd)
 {
-	spinlock_data_t x;
-	spinlock_data_t y;
-
-	/*
-	 * Test-and-set using LL/SC.
-	 *
-	 * Load the existing value into X, and use Y to store 1.
-	 * After the SC, Y contains 1 if the store succeeded,
-	 * 0 if it failed.
-	 *
-	 * On failure, return 1 to pretend that the spinlock
-	 * was already held.
-	 */
-
-	y = 1;
-	__asm volatile(
-		".set push;"		/* save assembler mode */
-		".set mips32;"		/* allow MIPS32 instructions */
-		".set volatile;"	/* avoid unwanted optimization */
-		"ll %0, 0(%2);"		/*   x = *sd */
-		"sc %1, 0(%2);"		/*   *sd = y; y = success? */
-		".set pop"		/* restore assembler mode */
-		: "=&r" (x), "+r" (y) : "r" (sd));
-	if (y == 0) {
-		return 1;
-	}
-	return x;
+	return (spinlock_data_t)atomic_add((volatile int *)sd, 1) - 1;
 }
 
-
 #endif /* _MIPS_SPINLOCK_H_ */
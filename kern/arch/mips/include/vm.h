@@ -120,10 +120,7 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;	/* page to invalidate, in whatever address space */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -40,6 +40,7 @@
 #include <mainbus.h>
 #include <syscall.h>
 #include <process.h>
+#include <proc.h>
 
 
 /* in exception-*.S */
@@ -202,6 +203,19 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * Interrupted user code of an exiting process (another
+		 * thread of it called _exit), or one whose alarm went
+		 * off: turn interrupts back on, as for a syscall, so it
+		 * can exit at done.
+		 */
+		if (!iskern && curproc != NULL &&
+		    (curproc->p_exiting || curproc->p_alarm)) {
+			spl = splhigh();
+			splx(spl);
+			goto done;
+		}
 		goto done2;
 	}
 
@@ -323,6 +337,11 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/* Don't go back to user mode if the process is exiting. */
+	if (!iskern) {
+		proc_checkexiting();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -41,6 +41,7 @@
 #include <proc.h>
 #include <addrspace.h>
 #include <process.h>
+#include <objcache.h>
 
 /*
  * System call dispatcher.
@@ -139,6 +140,34 @@ syscall(struct trapframe *tf)
 				is64bit = false;
 				break;
 
+			case SYS_readv:
+				err = sys_readv((int)tf->tf_a0, (const_userptr_t)tf->tf_a1, (int)tf->tf_a2, &retval);
+				is64bit = false;
+				break;
+
+			case SYS_writev:
+				err = sys_writev((int)tf->tf_a0, (const_userptr_t)tf->tf_a1, (int)tf->tf_a2, &retval);
+				is64bit = false;
+				break;
+
+			case SYS_pread:
+			case SYS_pwrite:
+				//The offset is 64-bit and a3 isn't an aligned pair, so it's on the stack
+				;
+				off_t pos;
+				err = copyin((userptr_t)(tf->tf_sp + 16), &pos, sizeof(pos));
+				if(err){
+					break;
+				}
+				if(callno == SYS_pread){
+					err = sys_pread((int)tf->tf_a0, (void *)tf->tf_a1, (size_t)tf->tf_a2, pos, &retval);
+				}
+				else{
+					err = sys_pwrite((int)tf->tf_a0, (const_userptr_t)tf->tf_a1, (size_t)tf->tf_a2, pos, &retval);
+				}
+				is64bit = false;
+				break;
+
 			case SYS_lseek:
 				//C has a quirk where you can't have a variable declaration on the first line after certain keywords
 				;
@@ -154,6 +183,28 @@ syscall(struct trapframe *tf)
 				is64bit = false;
 				break;
 
+			case SYS_pipe:
+				err = sys_pipe((userptr_t)tf->tf_a0, &retval);
+				is64bit = false;
+				break;
+
+			case SYS_poll:
+				err = sys_poll((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1, (int)tf->tf_a2, &retval);
+				is64bit = false;
+				break;
+
+			case SYS_select:
+				//The timeout pointer is the fifth argument, so it's on the stack
+				;
+				userptr_t timeoutp;
+				err = copyin((userptr_t)(tf->tf_sp + 16), &timeoutp, sizeof(timeoutp));
+				if(err){
+					break;
+				}
+				err = sys_select((int)tf->tf_a0, (userptr_t)tf->tf_a1, (userptr_t)tf->tf_a2, (userptr_t)tf->tf_a3, timeoutp, &retval);
+				is64bit = false;
+				break;
+
 			case SYS_chdir:
 				err = sys_chdir((char *)tf->tf_a0);
 				is64bit = false;
@@ -174,6 +225,18 @@ syscall(struct trapframe *tf)
 				is64bit = false;
 				break;
 
+			case SYS_vfork:
+				err = sys_vfork(tf, (pid_t *)&retval);
+				is64bit = false;
+				break;
+
+			case SYS_spawn:
+				err = sys_spawn((const char *)tf->tf_a0, (char **)tf->tf_a1,
+				                (const struct spawn_action *)tf->tf_a2, (int)tf->tf_a3,
+				                (pid_t *)&retval);
+				is64bit = false;
+				break;
+
 			case SYS_execv:
 				err = sys_execv((const char *)tf->tf_a0,(char**) tf->tf_a1);
 				is64bit = false;
@@ -190,6 +253,58 @@ syscall(struct trapframe *tf)
 				is64bit = false;
 				break;
 
+			case SYS___thread_create:
+				err = sys___thread_create(tf, (userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+				                          (userptr_t)tf->tf_a2, &retval);
+				is64bit = false;
+				break;
+
+			case SYS___thread_exit:
+				sys___thread_exit((userptr_t)tf->tf_a0);
+				err = ENOSYS;
+				is64bit = false;
+				break;
+
+			case SYS_thread_join:
+				err = sys_thread_join((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+				is64bit = false;
+				break;
+
+			case SYS_futex:
+				err = sys_futex((userptr_t)tf->tf_a0, (int)tf->tf_a1, (int)tf->tf_a2, &retval);
+				is64bit = false;
+				break;
+
+			case SYS_setaffinity:
+				err = sys_setaffinity((pid_t)tf->tf_a0, (uint32_t)tf->tf_a1);
+				is64bit = false;
+				break;
+
+			case SYS_getaffinity:
+				err = sys_getaffinity((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+				is64bit = false;
+				break;
+
+			case SYS_cpustat:
+				err = sys_cpustat((unsigned)tf->tf_a0, (userptr_t)tf->tf_a1);
+				is64bit = false;
+				break;
+
+			case SYS_nanosleep:
+				err = sys_nanosleep((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+				is64bit = false;
+				break;
+
+			case SYS_getitimer:
+				err = sys_getitimer((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+				is64bit = false;
+				break;
+
+			case SYS_setitimer:
+				err = sys_setitimer((int)tf->tf_a0, (userptr_t)tf->tf_a1, (userptr_t)tf->tf_a2);
+				is64bit = false;
+				break;
+
 			#if OPT_DUMBVM
 			#else
 			case SYS_sbrk:
@@ -255,7 +370,7 @@ enter_forked_process(void *parenttf, long unsigned int blank)
 	//Allocate trapframe on the child process' stack
   struct trapframe childtf;
   childtf = *(struct trapframe *)parenttf;
-	kfree(parenttf);
+	objcache_free(forktf_cache, parenttf);
 	as_activate();
 
 
@@ -272,3 +387,24 @@ enter_forked_process(void *parenttf, long unsigned int blank)
 	//Enter usermode
 	mips_usermode(&childtf);
 }
+
+/*
+ * Enter user mode in a new thread of the current process. TF is the
+ * creating thread's trapframe, already pointed at the new thread's
+ * entry point and stack.
+ */
+void
+enter_user_thread(void *tf, long unsigned int tid)
+{
+	struct trapframe newtf;
+
+	newtf = *(struct trapframe *)tf;
+	objcache_free(forktf_cache, tf);
+	curthread->t_tid = tid;
+	as_activate();
+
+	/* The process may have started exiting since we were made. */
+	proc_checkexiting();
+
+	mips_usermode(&newtf);
+}
@@ -58,7 +58,8 @@
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted and c0_count starts again from 0. Writing to c0_compare
+ * again clears the interrupt.
  */
 static
 void
@@ -76,6 +77,63 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_getcompare(void)
+{
+	uint32_t compare;
+
+	/* $11 == c0_compare */
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		"mfc0 %0, $11;"
+		".set pop"
+		: "=r" (compare));
+	return compare;
+}
+
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		"mfc0 %0, $9;"
+		".set pop"
+		: "=r" (count));
+	return count;
+}
+
+static
+uint32_t
+mips_cause_get(void)
+{
+	uint32_t cause;
+
+	/* $13 == c0_cause */
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		"mfc0 %0, $13;"
+		".set pop"
+		: "=r" (cause));
+	return cause;
+}
+
+/* Nanoseconds per cycle of the on-chip timer. */
+#define TIMER_NSEC_PER_CYCLE	(1000000000 / CPU_FREQUENCY)
+
+/*
+ * Least number of cycles ahead of c0_count to set c0_compare, so the
+ * count doesn't pass it before the write happens.
+ */
+#define TIMER_MINCYCLES		100
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -294,6 +352,44 @@ mainbus_debugger(void)
 #define LAMEBUS_IPI_BIT  0x00000800	/* inter-processor interrupt */
 #define MIPS_TIMER_BIT   0x00008000	/* on-chip timer */
 
+/*
+ * Moving the timer, for sub-tick timeouts and tickless idle. See
+ * mainbus.h.
+ */
+uint32_t
+mainbus_timer_elapsed(void)
+{
+	uint32_t count;
+
+	count = mips_timer_get();
+	if (mips_cause_get() & MIPS_TIMER_BIT) {
+		/* Gone off, and c0_count started over, but not handled */
+		count += mips_timer_getcompare();
+	}
+	return count * TIMER_NSEC_PER_CYCLE;
+}
+
+bool
+mainbus_timer_set(uint32_t nsecs)
+{
+	uint32_t count, now;
+
+	if (mips_cause_get() & MIPS_TIMER_BIT) {
+		/*
+		 * It's already gone off; writing c0_compare now would
+		 * lose the interrupt. The handler sets it again anyway.
+		 */
+		return false;
+	}
+	count = nsecs / TIMER_NSEC_PER_CYCLE;
+	now = mips_timer_get();
+	if (count < now + TIMER_MINCYCLES) {
+		count = now + TIMER_MINCYCLES;
+	}
+	mips_timer_set(count);
+	return true;
+}
+
 void
 mainbus_interrupt(struct trapframe *tf)
 {
@@ -314,7 +410,10 @@ mainbus_interrupt(struct trapframe *tf)
 		seen = true;
 	}
 	if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
+		/*
+		 * Reset the timer (this clears the interrupt). hardclock
+		 * may set it differently.
+		 */
 		mips_timer_set(CPU_FREQUENCY / HZ);
 		/* and call hardclock */
 		hardclock();
@@ -58,6 +58,7 @@
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
+#include <poll.h>
 #include "autoconf.h"
 
 /*
@@ -72,6 +73,11 @@ static struct con_softc *the_console = NULL;
 static struct lock *con_userlock_read = NULL;
 static struct lock *con_userlock_write = NULL;
 
+/*
+ * Pollers waiting for input.
+ */
+static struct pollhead con_pollhead;
+
 //////////////////////////////////////////////////
 
 /*
@@ -174,6 +180,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+	pollhead_wakeup(&con_pollhead);
 }
 
 /*
@@ -302,10 +309,30 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Input is ready if a character has come in that nobody has read
+ * yet. Output never waits for long.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct pollent *pe, int *revents)
+{
+	struct con_softc *cs = dev->d_data;
+
+	/* Register first, so a character arriving now wakes us. */
+	pollhead_register(&con_pollhead, pe);
+	*revents = events & POLLOUT;
+	if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		*revents |= events & POLLIN;
+	}
+	return 0;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -386,6 +413,7 @@ config_con(struct con_softc *cs, int unit)
 	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollhead_init(&con_pollhead);
 
 	the_console = cs;
 	con_userlock_read = rlk;
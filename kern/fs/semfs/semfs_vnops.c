@@ -136,7 +136,7 @@ semfs_getsem(struct semfs_vnode *semv)
  * Wakeup helper. We only need to wake up if there are sleepers, which
  * should only be the case if the old count is 0; and we only
  * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * will be more than 1. The same goes for pollers.
  */
 static
 void
@@ -145,6 +145,7 @@ semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 	if (sem->sems_count > 0 || newcount == 0) {
 		return;
 	}
+	pollhead_wakeup(&sem->sems_pollhead);
 	if (newcount == 1) {
 		cv_signal(sem->sems_cv, sem->sems_lock);
 	}
@@ -222,6 +223,28 @@ semfs_read(struct vnode *vn, struct uio *uio)
 	return 0;
 }
 
+/*
+ * Poll. P would go ahead if the count isn't 0; V always can.
+ */
+static
+int
+semfs_poll(struct vnode *vn, int events, struct pollent *pe, int *revents)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+
+	sem = semfs_getsem(semv);
+
+	*revents = events & POLLOUT;
+	lock_acquire(sem->sems_lock);
+	pollhead_register(&sem->sems_pollhead, pe);
+	if (sem->sems_count > 0) {
+		*revents |= events & POLLIN;
+	}
+	lock_release(sem->sems_lock);
+	return 0;
+}
+
 /*
  * Write. This is V(); increase the count by the amount written.
  * Don't actually bother to transfer any data.
@@ -662,6 +685,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_stat = semfs_dirstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
+	.vop_poll = vop_poll_ready,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
@@ -695,6 +719,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_stat = semfs_semstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
+	.vop_poll = semfs_poll,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
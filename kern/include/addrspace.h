@@ -71,6 +71,9 @@ struct addrspace {
 
         //Page table list head and tail
         struct pte *pt_head;
+        //Lock for walking or changing the page table list, which the
+        //threads of a process may be faulting on at the same time
+        struct lock *as_ptlock;
 
         //Region list head and tail
         struct region *reg_head;
@@ -92,6 +95,9 @@ struct pte{
   //Points to the next pte, null if the last pte
   struct pte *next;
   struct lock *lock;
+  //Evictions that have picked this pte's frame but may not have its
+  //lock yet; the pte isn't freed until there are none. Under cm_lock
+  unsigned int evictors;
 };
 
 struct region{
@@ -155,12 +161,25 @@ struct region{
  * functions are found in dumbvm.c.
  */
 
+//Object caches for ptes and regions, made in as_bootstrap. Get ptes
+//with pte_create rather than straight from pte_cache
+extern struct objcache *pte_cache;
+extern struct objcache *region_cache;
+void as_bootstrap(void);
+
 //Returns a copy of a given region
 struct region * reg_copy(struct region *);
 
 //Returns a copy of a given PTE
 struct pte * pte_copy(struct pte *);
 
+//Returns a new pte with its lock created (and unheld), or NULL
+struct pte * pte_create(void);
+
+//Frees a pte whose frame has already been freed, waiting first for any
+//eviction still looking at it. Call without the pte's lock held
+void pte_destroy(struct pte *);
+
 //Called in vm_fault to swap a page in that is stored on swapdisk
 void swapin(struct pte *);
 
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _ARGBUF_H_
+#define _ARGBUF_H_
+
+#include <limits.h>
+#include <vm.h>
+
+/*
+ * Buffer for the argument strings of a program being started (execv,
+ * spawn). It is made of separate pages, allocated as they fill up, so
+ * a big argument list doesn't need ARG_MAX of contiguous kernel
+ * memory and small ones only cost a page. Each call gets its own, so
+ * any number of execs can run at once.
+ *
+ * Each string is stored with its terminator and padded with zeros to
+ * a multiple of 4, which is exactly how it will sit on the new stack.
+ */
+#define ARGBUF_PAGES DIVROUNDUP(ARG_MAX, PAGE_SIZE)
+
+struct argbuf{
+  char *pages[ARGBUF_PAGES];
+  size_t len;     //bytes of strings stored, padding included
+  int argc;
+};
+
+void argbuf_init(struct argbuf *);
+void argbuf_cleanup(struct argbuf *);
+
+//Copies the arguments in from a user argv, validating every pointer.
+//E2BIG if they don't fit in ARG_MAX
+int argbuf_copyin(struct argbuf *, userptr_t uargv);
+
+//Lays the arguments out at the top of the new stack in the current
+//address space and sets *argvp to the user address of argv, which is
+//also the new stack pointer
+int argbuf_copyout(struct argbuf *, vaddr_t stackptr, vaddr_t *argvp);
+
+#endif /* _ARGBUF_H_ */
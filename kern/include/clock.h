@@ -38,7 +38,7 @@
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
+ * hardclock() is called on every CPU HZ times a second, but only
  * when the CPU is not idle, for scheduling.
  */
 
@@ -37,6 +37,19 @@
 
 extern unsigned num_cpus;
 
+/*
+ * Number of scheduling priorities, each with its own run queue. 0 is
+ * the highest. See schedule() in thread.c.
+ */
+#define SCHED_NPRIO	4
+
+/*
+ * Sets of cpus, as used for thread affinity: bit N is the cpu whose
+ * c_number is N. CPUMASK_ALL includes cpus that don't exist.
+ */
+#define CPUMASK(n)	((uint32_t)1 << (n))
+#define CPUMASK_ALL	0xffffffffU
+
 /*
  * Per-cpu structure
  *
@@ -62,13 +75,20 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct thread *c_migrant;	/* Thread leaving for another cpu */
+	struct thread *c_spare;		/* Stands in while one leaves */
+	struct kmcache *c_kmcache;	/* kmalloc magazines (kmalloc.c) */
+	struct timerwheel *c_timers;	/* Timers started here (timer.c) */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	bool c_needresched;		/* Curthread should yield the cpu */
+	struct threadlist c_runqueue[SCHED_NPRIO]; /* Run queues, by priority */
+	unsigned c_runcount;		/* Threads on all of c_runqueue */
+	unsigned c_epoch;		/* Last priority boost done here */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -93,6 +113,18 @@ struct cpu {
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
 	HANGMAN_ACTOR(c_hangman);
+
+	/*
+	 * Statistics. Counted only by this cpu; read by others
+	 * without locking, so they may be slightly out of date.
+	 */
+	unsigned c_switches;		/* Context switches */
+	unsigned c_stealtries;		/* Other run queues locked to steal */
+	unsigned c_steals;		/* ...and threads got from them */
+	unsigned c_idles;		/* Times idled with the tick stopped */
+	unsigned c_kicks;		/* Idle cpus woken to steal work */
+	unsigned c_wakeups;		/* Threads put on run queues by wakeup */
+	unsigned c_ipis;		/* IPIs sent */
 };
 
 /*
@@ -113,6 +145,17 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Scheduler statistics.
+ *
+ * cpu_getstat fills in CS for cpu NUM (see <kern/cpustat.h>); it
+ * returns EINVAL if there is no such cpu. cpu_printstats prints the
+ * same for every cpu.
+ */
+struct cpustat;
+int cpu_getstat(unsigned num, struct cpustat *cs);
+void cpu_printstats(void);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -156,6 +199,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends one to all CPUs except the current
+ * one, and returns how many that was.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,10 +211,12 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_RESCHED		4	/* A higher-priority thread is ready */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
@@ -50,15 +50,36 @@ int sys_close(int fd);
 /*Read an opened file*/
 ssize_t sys_read(int, void *, size_t, int32_t *);
 
+/*Read an opened file into an array of buffers*/
+ssize_t sys_readv(int, const_userptr_t, int, int32_t *);
+
+/*Read an opened file at a given position, leaving its seek position alone*/
+ssize_t sys_pread(int, void *, size_t, off_t, int32_t *);
+
 /*Write to an opened fileI*/
 ssize_t sys_write(int, const_userptr_t, size_t, int32_t *);
 
+/*Write to an opened file from an array of buffers*/
+ssize_t sys_writev(int, const_userptr_t, int, int32_t *);
+
+/*Write to an opened file at a given position, leaving its seek position alone*/
+ssize_t sys_pwrite(int, const_userptr_t, size_t, off_t, int32_t *);
+
 /*Alters the current seek position of a filehandle based on pos and whence*/
 off_t sys_lseek(int, off_t, int, int64_t *);
 
 /*Clones the filehandle oldfd onto the filehandle newfd. Close newfd if already open*/
 int sys_dup2(int, int, int32_t *);
 
+/*Makes a pipe, storing its read and write fds in the user array*/
+int sys_pipe(userptr_t, int32_t *);
+
+/*Waits for any of an array of fds to be ready to read or write*/
+int sys_poll(userptr_t, unsigned, int, int32_t *);
+
+/*Same as poll, with the fds given as bitmaps*/
+int sys_select(int, userptr_t, userptr_t, userptr_t, userptr_t, int32_t *);
+
 /*The current directory of the current process is set to the directory named by pathname*/
 int sys_chdir(const char *);
 
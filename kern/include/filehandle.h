@@ -40,16 +40,26 @@ struct filehandle {
 	char *fh_name;
 	int fh_flag;
   off_t fh_offset;
-  int fh_refcount;
+  //filetable slots (across processes) pointing here; changed atomically
+  volatile int fh_refcount;
   //pointer to file object
   struct vnode *fh_fileobj;
-	//lock to ensure file operations don't interfere with each other
+	//lock to ensure file operations don't interfere with each other;
+	//only taken to use fh_offset, so not for devices that can't seek
 	struct lock *fh_lock;
 };
 
+//Sets up the object cache filehandles come from
+void filehandle_bootstrap(void);
+
 struct filehandle * filehandle_create(const char *);
 
 /*int filehandle_createnull(struct filehandle*);*/
 
+//Frees a filehandle nothing refers to (refcount 0), closing its vnode
 void filehandle_destroy(struct filehandle *);
+
+//Takes and drops a reference; dropping the last one destroys it
+void filehandle_incref(struct filehandle *);
+void filehandle_decref(struct filehandle *);
 #endif
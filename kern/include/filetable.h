@@ -27,26 +27,60 @@
  * SUCH DAMAGE.
  */
 
+#ifndef _FILETABLE_H_
+#define _FILETABLE_H_
+
 #include <filehandle.h>
+#include <spinlock.h>
 #include <proc.h>
 
+/*
+ * A process's file descriptors. Slot fd points to the open filehandle
+ * for fd; each slot holds one of the filehandle's references. The
+ * table starts small and grows (by doubling) up to OPEN_MAX as fds
+ * are used, and a bitmap of used slots finds the lowest free fd
+ * without walking the slots.
+ *
+ * Threads of a process share its table, so changes are made under
+ * ft_lock. Looking up an fd in a single-threaded process, by far the
+ * common case, takes no lock and no reference at all, since nothing
+ * else can change the table under it.
+ */
+struct filetable {
+  struct spinlock ft_lock;
+  struct filehandle **ft_slots;
+  uint32_t *ft_used;            //bitmap of open fds
+  int ft_size;                  //slots, a multiple of 32
+};
+
+//creates an empty filetable
+struct filetable *filetable_create(void);
+
+//creates a copy of a filetable, for fork: the same filehandles, each
+//with another reference
+struct filetable *filetable_createcopy(struct filetable *);
 
-//creates filetable
-struct filehandle **filetable_create(void);
+//destroys filetable, closing everything in it
+void filetable_destroy(struct filetable *);
 
-struct filehandle **filetable_createcopy(struct filehandle **);
+//puts filehandle in the lowest free fd, which is returned in *fdret,
+//taking a reference to it. Returns EMFILE if all OPEN_MAX are in use
+int filetable_add(struct filetable *, struct filehandle *, int *fdret);
 
-//destroys filetable
-void filetable_destroy(struct filehandle **);
+//puts filehandle in fd, taking a reference to it and closing whatever
+//was there (dup2). Returns EBADF if fd can't be used
+int filetable_place(struct filetable *, int fd, struct filehandle *);
 
-//adds filehandle to end position in filetable and increments end count
-//if reached end, scan and insert at first empty, if not found return 1, else 0
-int filetable_add(struct filehandle **, struct filehandle *);
+//removes a particular filehandle from the filetable, dropping the
+//slot's reference. Returns EBADF if fd isn't open
+int filetable_remove(struct filetable *, int fd);
 
+//looks up fd, returning NULL if it isn't open. Unless the lookup was
+//lock-free, it took a reference, and sets *refp; hand both back to
+//filetable_put when done
+struct filehandle *filetable_get(struct filetable *, int fd, bool *refp);
+void filetable_put(struct filehandle *, bool ref);
 
-//removes a particular filehandle from the filetable
-//if fails returns -1, else 0.
-//usually is not checked, as called in exit sections
-void filetable_remove(struct filehandle **, int fd);
+void filetable_print(struct filetable *);
 
-void filetable_print(struct filehandle**);
+#endif /* _FILETABLE_H_ */
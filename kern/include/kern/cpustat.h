@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KERN_CPUSTAT_H_
+#define _KERN_CPUSTAT_H_
+
+/*
+ * Definitions for cpustat().
+ *
+ * cpustat(n, cs) fills in CS with scheduler counters for cpu N,
+ * counted since boot. It fails with EINVAL if there is no cpu N, so
+ * callers can find how many cpus there are by counting up from 0.
+ * The counters are unsigned and wrap around; take differences.
+ */
+
+struct cpustat {
+	unsigned cs_hardclocks;		/* Timer ticks taken */
+	unsigned cs_switches;		/* Context switches */
+	unsigned cs_stealtries;		/* Times it looked to steal work */
+	unsigned cs_steals;		/* Threads it stole */
+	unsigned cs_idles;		/* Times it went idle, without a tick */
+	unsigned cs_kicks;		/* Idle cpus it woke to take work */
+	unsigned cs_wakeups;		/* Threads it woke up */
+	unsigned cs_ipis;		/* Interprocessor interrupts it sent */
+};
+
+#endif /* _KERN_CPUSTAT_H_ */
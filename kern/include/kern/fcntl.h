@@ -34,10 +34,6 @@
  * Constants for libc's <fcntl.h>.
  */
 
- //Added by Brian or Prashanth
- #define MAX_FILES   64
-
-
 /*
  * Important
  */
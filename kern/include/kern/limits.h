@@ -56,7 +56,7 @@
  * more.
  */
 
-/*Added by Brian: Maximum number of processes open at once */
+/* Initial size of the kernel's process table; it grows up to __PID_MAX */
 #define __PROC_MAX      128
 
 /* Longest filename (without directory) not including null terminator */
@@ -82,8 +82,11 @@
 /* Max value for a process ID (change this to match your implementation) */
 #define __PID_MAX       32767
 
-/* Max open files per process */
-#define __OPEN_MAX      128
+/* Max threads per process, besides the first; each gets a slice of the stack */
+#define __THREAD_MAX    32
+
+/* Max open files per process; the table grows to this as needed */
+#define __OPEN_MAX      1024
 
 /* Max bytes for atomic pipe I/O -- see description in the pipe() man page */
 #define __PIPE_BUF      512
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+/*
+ * Definitions for poll().
+ *
+ * poll(fds, nfds, timeout) waits until at least one of the NFDS file
+ * handles in FDS is ready for one of the events asked for in its
+ * "events", fills in each one's "revents", and returns how many have
+ * something to report. TIMEOUT is in milliseconds; 0 means don't
+ * wait, and -1 means wait as long as it takes. Entries with a
+ * negative fd are skipped.
+ *
+ * POLLERR, POLLHUP and POLLNVAL are reported whether asked for or
+ * not. POLLHUP on a pipe means no writer is left: reads return EOF
+ * once what's left has been read. POLLERR on a pipe means no reader
+ * is left. POLLNVAL means the fd isn't open.
+ */
+
+struct pollfd {
+	int fd;			/* file handle to watch */
+	short events;		/* events of interest */
+	short revents;		/* events that happened */
+};
+
+#define POLLIN     0x001	/* reading won't block */
+#define POLLPRI    0x002	/* urgent data (never happens) */
+#define POLLOUT    0x004	/* writing won't block */
+#define POLLERR    0x008	/* error */
+#define POLLHUP    0x010	/* hung up */
+#define POLLNVAL   0x020	/* not an open file handle */
+
+#endif /* _KERN_POLL_H_ */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_SPAWN_H_
+#define _KERN_SPAWN_H_
+
+/*
+ * Definitions for spawn().
+ *
+ * spawn(prog, args, actions, nactions) creates a child process
+ * running PROG with arguments ARGS, like fork followed by execv in
+ * the child, but without ever copying the parent's address space.
+ * Before the program starts, the ACTIONS are applied in order to the
+ * child's copy of the file table, so the parent can set up the
+ * child's descriptors the way a shell would between fork and exec.
+ * If anything fails, no child is created and the error is returned
+ * to the parent.
+ */
+
+/* Action types. */
+#define SPAWN_CLOSE   1		/* close(sa_fd) */
+#define SPAWN_DUP2    2		/* dup2(sa_fd, sa_newfd) */
+#define SPAWN_OPEN    3		/* open sa_path with sa_flags as sa_fd */
+
+/* Most actions one spawn may take. */
+#define SPAWN_MAXACTIONS 64
+
+struct spawn_action {
+	int sa_type;		/* SPAWN_* */
+	int sa_fd;
+	int sa_newfd;		/* DUP2 only */
+	int sa_flags;		/* OPEN only: O_* flags */
+	const char *sa_path;	/* OPEN only */
+};
+
+#endif /* _KERN_SPAWN_H_ */
@@ -109,12 +109,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -189,14 +189,24 @@
 #define SYS___time       113
 #define SYS___settime    114
 #define SYS_nanosleep    115
-//#define SYS_getitimer  116
-//#define SYS_setitimer  117
+#define SYS_getitimer    116
+#define SYS_setitimer    117
 
 //                              -- Other --
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Local extensions --
+#define SYS_spawn        121
+#define SYS___thread_create 122
+#define SYS___thread_exit 123
+#define SYS_thread_join  124
+#define SYS_futex        125
+#define SYS_setaffinity  126
+#define SYS_getaffinity  127
+#define SYS_cpustat      128
+
 /*CALLEND*/
 
 
@@ -134,6 +134,13 @@ unsigned long kheap_getused(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_printfrag(void);
+
+/*
+ * Set up a new cpu's kmalloc magazines. Called from cpu_create.
+ */
+struct cpu;
+void kheap_cpu_init(struct cpu *c);
 
 /*
  * C string functions.
@@ -49,6 +49,7 @@
 #define OPEN_MAX        __OPEN_MAX
 #define IOV_MAX         __IOV_MAX
 #define PROC_MAX        __PROC_MAX
+#define THREAD_MAX      __THREAD_MAX
 
 #define CLEAN           __CLEAN_STATE
 #define DIRTY           __DIRTY_STATE
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock profiling ("lockstat").
+ *
+ * While switched on, every spinlock and sleep lock acquisition is
+ * counted against a class: for sleep locks the lock's name, so all
+ * the locks of one kind (every vnode's, say) add up together; for
+ * spinlocks, which have no names, the place it was acquired from. A
+ * class records acquisitions, how many found the lock held, how many
+ * sleep lock waits spun and how many went to sleep, the time spent
+ * waiting spinning and, for sleep locks, sleeping, and the average and
+ * longest hold. Times are nanoseconds on timer_now's clock; a sleep
+ * lock wait or hold that moved cpus isn't timed.
+ *
+ * Each cpu counts into its own table, so recording takes no locks of
+ * its own, and the tables are added up when printed. Switched off, it
+ * costs the lock functions a test of lockstat_enabled.
+ *
+ * Functions:
+ *     lockstat_start    - start profiling. Must not be called holding
+ *                         spinlocks. Returns ENOMEM if the tables
+ *                         can't be allocated.
+ *     lockstat_stop     - stop; the counts so far are kept.
+ *     lockstat_reset    - throw the counts away.
+ *     lockstat_print    - print every class seen, most waited for
+ *                         first. Spinlock classes print as the
+ *                         address they were acquired from, for
+ *                         looking up in the kernel's symbol table.
+ *
+ * The rest are called by the lock code, with interrupts off.
+ */
+
+#include <cdefs.h>
+
+struct spinlock;
+struct lock;
+struct lockstat_class;
+
+extern bool lockstat_enabled;
+
+int lockstat_start(void);
+void lockstat_stop(void);
+void lockstat_reset(void);
+void lockstat_print(void);
+
+void lockstat_spinacquired(struct spinlock *splk, const void *pc,
+			   bool contended, uint64_t waitnsec);
+void lockstat_spinreleased(struct spinlock *splk);
+void lockstat_sleepacquired(struct lock *lk, bool spun, bool slept,
+			    uint64_t spinnsec, uint64_t sleepnsec);
+void lockstat_sleepreleased(struct lock *lk, uint64_t holdnsec);
+
+
+#endif /* _LOCKSTAT_H_ */
@@ -52,6 +52,25 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * The current cpu's timer, which calls hardclock() when it goes off.
+ * It's set to go off every 1/HZ seconds, but may be moved for a
+ * particular interrupt. Both of these count nanoseconds from the last
+ * time it went off on this cpu, and are only good for a few seconds.
+ * Call with interrupts off.
+ *
+ *    mainbus_timer_elapsed - time since it last went off, or since
+ *                            the time before if that interrupt is
+ *                            still to be handled.
+ *    mainbus_timer_set     - have it go off next this long after
+ *                            it last did, or as soon as possible if
+ *                            that's already past. Returns false,
+ *                            doing nothing, if it has gone off and
+ *                            that's still to be handled.
+ */
+uint32_t mainbus_timer_elapsed(void);
+bool mainbus_timer_set(uint32_t nsecs);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _OBJCACHE_H_
+#define _OBJCACHE_H_
+
+/*
+ * Object caches.
+ *
+ * An object cache hands out objects of one fixed size. Small objects
+ * are packed into whole pages ("slabs") so they don't pay for
+ * kmalloc's size-class rounding; large ones come from kmalloc. Freed
+ * objects go into a per-cpu magazine and are handed out again from
+ * there without taking any shared lock.
+ *
+ * Objects are cached in their constructed state. The constructor, if
+ * any, runs once when an object is first made, and the destructor
+ * once when its memory is finally given back; neither runs on every
+ * alloc/free. So an object must be in the state the constructor left
+ * it in when it is freed (e.g., any lock the constructor made must
+ * not be held). The constructor returns 0 or an error code.
+ *
+ * Functions:
+ *     objcache_create   - make a new cache. CTOR and DTOR may be NULL.
+ *                         NAME is not copied. Caches are never
+ *                         destroyed. Returns NULL if out of memory.
+ *     objcache_alloc    - get an object. Returns NULL if out of memory.
+ *     objcache_free     - return an object to its cache. NULL is okay.
+ *     objcache_reclaim  - give all cached free memory back to the
+ *                         system. Must not be called holding spinlocks.
+ *     objcache_printstats - print per-cache statistics.
+ */
+
+struct objcache;
+
+struct objcache *objcache_create(const char *name, size_t size,
+				 int (*ctor)(void *obj),
+				 void (*dtor)(void *obj));
+void *objcache_alloc(struct objcache *oc);
+void objcache_free(struct objcache *oc, void *obj);
+void objcache_reclaim(void);
+void objcache_printstats(void);
+
+
+#endif /* _OBJCACHE_H_ */
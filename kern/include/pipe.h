@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Pipes.
+ *
+ * A pipe is a ring buffer in the kernel with a vnode for each end.
+ * Reads block until there is data or no writer is left (EOF); writes
+ * block until there is room, and fail with EPIPE once no reader is
+ * left. Writes of up to PIPE_BUF bytes are atomic. Large writes from
+ * user space don't go through the ring at all: the writer's pages are
+ * pinned and loaned to the pipe, and readers copy straight out of them.
+ *
+ * Functions:
+ *     pipe_bootstrap - set up; call once at boot.
+ *     pipe_create    - make a pipe. Returns its read and write ends,
+ *                      each with one reference; the pipe goes away when
+ *                      both are released (VOP_DECREF / vfs_close).
+ *     pipe_interrupt - get every thread sleeping in a pipe to look
+ *                      at whether its process is exiting.
+ */
+
+struct vnode;
+
+void pipe_bootstrap(void);
+int pipe_create(struct vnode **readret, struct vnode **writeret);
+void pipe_interrupt(void);
+
+
+#endif /* _PIPE_H_ */
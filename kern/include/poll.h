@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Readiness notification, for poll() and select().
+ *
+ * Anything a thread might wait on in poll keeps a pollhead, and calls
+ * pollhead_wakeup whenever it may have become ready (data arrived,
+ * room freed up, the other end went away). Its vop_poll reports what
+ * it is ready for and, if given a pollent, registers it on the
+ * pollhead first, under the same lock as the state it reports, so a
+ * change right after the check can't be missed.
+ *
+ * A poller is one thread waiting in poll. It has a pollent for each
+ * object it is watching; a wakeup on any of them, the timeout running
+ * out, or the process exiting makes poller_wait return, and the
+ * caller looks at everything again.
+ *
+ * Functions:
+ *     pollhead_init      - set up a pollhead.
+ *     pollhead_cleanup   - tear one down. Nothing may be registered.
+ *     pollhead_register  - put PE on PH, if PE isn't NULL and isn't on
+ *                          one already.
+ *     pollhead_wakeup    - wake every poller registered on PH. May be
+ *                          called from an interrupt handler.
+ *
+ *     poller_init        - set up a poller that gives up after
+ *                          TIMEOUT milliseconds (-1: never).
+ *     poller_cleanup     - tear it down, taking its pollents off
+ *                          whatever they are registered on.
+ *     pollent_init       - make PE one of PL's.
+ *     poller_wait        - sleep until woken. Returns 0, ETIMEDOUT
+ *                          once the timeout is up, or EINTR if the
+ *                          process is exiting.
+ *
+ *     poll_bootstrap     - set up; call once at boot.
+ *     poll_interrupt     - wake every poller, for proc_stopthreads.
+ *
+ *     vop_poll_ready     - vop_poll for objects that never block,
+ *                          like regular files.
+ */
+
+#include <kern/poll.h>
+#include <kern/time.h>
+#include <spinlock.h>
+#include <timer.h>
+
+struct vnode;
+struct wchan;
+struct pollhead;
+
+struct poller {
+	struct spinlock pl_lock;
+	struct wchan *pl_wchan;
+	bool pl_woken;			/* something may have changed */
+	bool pl_expired;		/* the timeout ran out */
+	struct timer pl_timer;		/* for the timeout, if any */
+	struct pollent *pl_ents;	/* our pollents */
+	struct poller *pl_next;		/* on the list of all pollers */
+};
+
+struct pollent {
+	struct poller *pe_poller;	/* who's waiting */
+	struct pollhead *pe_head;	/* what on; NULL if nothing yet */
+	struct pollent *pe_next;	/* next on pe_head */
+	struct pollent *pe_pollnext;	/* next of pe_poller's */
+};
+
+struct pollhead {
+	struct spinlock ph_lock;
+	struct pollent *ph_ents;
+};
+
+void pollhead_init(struct pollhead *ph);
+void pollhead_cleanup(struct pollhead *ph);
+void pollhead_register(struct pollhead *ph, struct pollent *pe);
+void pollhead_wakeup(struct pollhead *ph);
+
+int poller_init(struct poller *pl, int timeout);
+void poller_cleanup(struct poller *pl);
+void pollent_init(struct pollent *pe, struct poller *pl);
+int poller_wait(struct poller *pl);
+
+void poll_bootstrap(void);
+void poll_interrupt(void);
+
+int vop_poll_ready(struct vnode *v, int events, struct pollent *pe,
+		   int *revents);
+
+
+#endif /* _POLL_H_ */
@@ -39,12 +39,29 @@
 #include <spinlock.h>
 #include <filehandle.h>
 #include <limits.h>
+#include <timer.h>
 // #include <processtable.h>
 // #include <filetable.h>
 
 struct addrspace;
 struct thread;
 struct vnode;
+struct wchan;
+struct filetable;
+
+/*
+ * A thread made by thread_create, from creation until it's joined, so
+ * its exit value outlives it. The first thread of a process has none
+ * and can't be joined.
+ */
+struct uthread {
+	int ut_tid;
+	int ut_stackslot;		/* which slice of the stack region */
+	bool ut_exited;
+	bool ut_joining;		/* someone is already waiting for it */
+	userptr_t ut_retval;
+	struct uthread *ut_next;
+};
 
 /*
  * Process structure.
@@ -76,7 +93,7 @@ struct proc {
 
 	/* add more material here as needed */
 	//process filetable
-	struct filehandle **p_filetable;
+	struct filetable *p_filetable;
 
 	//process id
 	pid_t pid;
@@ -84,23 +101,61 @@ struct proc {
 	//parent process id
 	pid_t ppid;
 
-	//lock for use in waitpid and exit
-	struct semaphore *p_sem;
+	//Family links, the exit fields and sleeping on p_wchan are all
+	//protected by the global proc_familylock (see proc.c)
+	struct proc *p_parent;		//NULL once orphaned
+	struct proc *p_children;	//first child, linked through p_sibling
+	struct proc *p_sibling;
+
+	//parent sleeps here waiting for any of its children to exit, or for
+	//a vforked child to let go of its address space
+	struct wchan *p_wchan;
+
+	//set while this is a vfork child running in its parent's address
+	//space, until it execs or exits
+	bool p_vfork;
+
+	//set from vfork until the vforking parent thread is done with the
+	//child; until then waitpid leaves it alone even if it has exited
+	bool p_vforkheld;
 
 	//whether or not the process has exited
 	bool exstatus;
 
 	//exit code
 	unsigned excode;
+
+	//User threads, all protected by p_lock
+	struct uthread *p_uthreads;	//made by thread_create, until joined
+	unsigned p_nlive;		//user threads that haven't exited
+	int p_nexttid;
+	uint32_t p_stackslots;		//bit set for each thread stack in use
+	bool p_exiting;			//all threads but one are to exit
+
+	//Cpus the process's threads may run on (CPUMASK), also protected
+	//by p_lock. p_affgen counts changes; threads see it differ from
+	//their t_affgen and copy the new mask, so setaffinity doesn't
+	//have to find them all
+	uint32_t p_affinity;
+	unsigned p_affgen;
+
+	//Interval timer (ITIMER_REAL), also protected by p_lock. It goes
+	//off at p_itdeadline and again every p_itinterval after that, and
+	//sets p_alarm; the process dies of SIGALRM on its way back to user
+	struct timer p_itimer;
+	struct timespec p_itinterval;
+	struct timespec p_itdeadline;
+	bool p_alarm;
+
+	//joiners and proc_stopthreads sleep here
+	struct wchan *p_threadwchan;
 };
 
 
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
-/* The processtable for user processes */
-extern struct proc *processtable[128];
-
+/* Lock for the processtable */
 extern struct lock *ptlock;
 
 
@@ -110,27 +165,105 @@ void proc_bootstrap(void);
 void proctable_bootstrap(void);
 void proctable_lock_bootstrap(void);
 
+/*
+ * Get/release the memory for a proc structure, which comes from an
+ * object cache. proc_alloc does no initialization.
+ */
+struct proc *proc_alloc(void);
+void proc_free(struct proc *);
+
 /* Create a fresh process for use by runprogram(). */
 struct proc *proc_create_runprogram(const char *name);
 
+/*
+ * Create a child of the current process for fork/vfork/spawn: it
+ * gets a pid, the current directory and a copy of the filetable, but
+ * no address space and no place in the parent's child list yet.
+ */
+struct proc *proc_create_child(const char *name);
+
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/* Make child a child of parent. */
+void proc_addchild(struct proc *parent, struct proc *child);
+
+/*
+ * Exit the current process with the given wait status: release its
+ * resources, then either leave it for its parent to collect or, if it
+ * has no parent any more, destroy it. Children it leaves behind are
+ * orphaned, and the ones that already exited are destroyed. Detaches
+ * the current thread from the process; the caller must then call
+ * thread_exit.
+ */
+void proc_exit(int waitstatus);
+
+/*
+ * Wait for a child to exit. PID is a child's pid or -1 for any child.
+ * If NOHANG and no suitable child has exited, returns 0 with *RETPID
+ * set to 0. Otherwise stores the child's wait status in *WAITSTATUS,
+ * its pid in *RETPID, and destroys it.
+ */
+int proc_wait(pid_t pid, bool nohang, int *waitstatus, pid_t *retpid);
+
+/*
+ * vfork support. proc_vforkwait sleeps until the vforked CHILD has
+ * stopped using the current process's address space, and then lets
+ * waitpid reap it; until then CHILD stays even if it exits, so the
+ * vforking thread can still look at it. proc_endvfork is
+ * called by a process that is done with the address space it was
+ * running in (by exec or exit); if PROC was a vfork child it wakes
+ * the parent and returns true, meaning the address space is the
+ * parent's and must not be destroyed.
+ */
+void proc_vforkwait(struct proc *child);
+bool proc_endvfork(struct proc *proc);
+
+/*
+ * Make the current thread the only one in its process. Every other
+ * thread exits the next time it is about to return to user mode (see
+ * proc_checkexiting); this waits until they all have. With FOREXIT
+ * the process stays marked as exiting, otherwise (for exec) it can
+ * carry on with the one thread. Returns false if some other thread
+ * was doing this first; then the caller must leave as well.
+ *
+ * A thread blocked indefinitely in the kernel, other than in
+ * waitpid or thread_join, holds this up until it wakes.
+ */
+bool proc_stopthreads(bool forexit);
+
+/*
+ * Called on the way back to user mode: if the process is exiting,
+ * detach the current thread and exit it instead. If its alarm has
+ * gone off, take the whole process down with SIGALRM first.
+ */
+void proc_checkexiting(void);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Have the current thread work in another process for a while, and go back. */
+int proc_enter(struct proc *proc, struct proc **prevret);
+void proc_leave(struct proc *prev);
+
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
 
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
-/* Add's the given process to the processtable */
+/* Add's the given process to the processtable, giving it a pid */
 int processtable_add(struct proc *);
 
+/* Removes the given process from the processtable, freeing its pid */
+void processtable_remove(struct proc *);
+
+/* Looks up a process by pid, NULL if there is none */
+struct proc *processtable_get(pid_t);
+
 /* Prints the processtable N for NULL otherwise the process pid at that index */
 void processtable_print(void);
 
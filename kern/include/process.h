@@ -49,12 +49,54 @@ pid_t sys_waitpid(pid_t, int *, int, pid_t *);
 /*Duplicates the currently running process*/
 pid_t sys_fork(struct trapframe *, pid_t *);
 
+/*Creates a child that borrows the address space until it execs or exits*/
+pid_t sys_vfork(struct trapframe *, pid_t *);
+
+struct objcache;
+struct spawn_action;
+
+/*Trapframes sys_fork hands to enter_forked_process come from this cache*/
+extern struct objcache *forktf_cache;
+void fork_bootstrap(void);
+
 /*Replaces the currently executing program with a newly loaded program image */
 int sys_execv(const char *, char **);
 
+/*Creates a child process running a new program, in one step*/
+int sys_spawn(const char *, char **, const struct spawn_action *, int, pid_t *);
+
 /*Exits the current process, does not return*/
 void sys__exit(int, bool);
 
+/*User threads: start one at an entry point, exit one, wait for one*/
+int sys___thread_create(struct trapframe *, userptr_t, userptr_t, userptr_t, int32_t *);
+void sys___thread_exit(userptr_t);
+int sys_thread_join(int, userptr_t);
+
+/*Futexes: sleep while a user word holds a value, or wake sleepers on it*/
+int sys_futex(userptr_t, int, int, int32_t *);
+void futex_bootstrap(void);
+/*Wakes every futex waiter, to notice its process is exiting*/
+void futex_interrupt(void);
+
+/*Cpu affinity of a process: set or get the mask of cpus it may use*/
+int sys_setaffinity(pid_t, uint32_t);
+int sys_getaffinity(pid_t, userptr_t);
+
+/*Scheduler counters for one cpu*/
+int sys_cpustat(unsigned, userptr_t);
+
+/*Sleeps for a given time, to well under a hardclock*/
+int sys_nanosleep(userptr_t, userptr_t);
+void nanosleep_bootstrap(void);
+/*Wakes every nanosleeper, to notice its process is exiting or its alarm*/
+void nanosleep_interrupt(void);
+
+/*The real-time interval timer; itimer_expire is its timer function*/
+int sys_getitimer(int, userptr_t);
+int sys_setitimer(int, userptr_t, userptr_t);
+void itimer_expire(void *);
+
 /*Extends the size of the process' addrspace heap*/
 #if OPT_DUMBVM
 #else
@@ -46,29 +46,44 @@
 /* Get the machine-dependent bits. */
 #include <machine/spinlock.h>
 
+struct lockstat_class;	/* from lockstat.h */
+
 /*
  * Basic spinlock.
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * These are ticket locks: each cpu that wants the lock takes the next
+ * number from splk_next, and gets the lock when splk_lock comes round
+ * to it. So cpus get the lock in the order they asked for it, and
+ * none can be starved by the others, and releasing it is a plain
+ * store. Waiters only read splk_lock, backing off in proportion to
+ * how far back in line they are.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t splk_lock; /* Ticket being served; we spin here. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
+	struct lockstat_class *splk_stat;   /* Profiling: holder's class. */
+	uint64_t splk_stattime;		    /* Profiling: when acquired. */
+	unsigned splk_statgen;		    /* Profiling: lockstat_gen then. */
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
-				  HANGMAN_LOCKABLE_INITIALIZER }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  HANGMAN_LOCKABLE_INITIALIZER, NULL, 0, 0 }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, NULL, 0, 0 }
 #endif
 
 /*
@@ -37,6 +37,9 @@
 
 #include <spinlock.h>
 
+struct cpu; /* in cpu.h */
+struct timespec; /* in kern/time.h */
+
 /*
  * Dijkstra-style semaphore.
  *
@@ -71,6 +74,12 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held by a thread
+ * running on another cpu spins for a while, since it'll likely be
+ * let go of soon, and only sleeps if it isn't, or if the holder isn't
+ * running. Each lock counts how often that happens; the counts are
+ * protected by lk_spinlock.
  */
 struct lock {
         char *lk_name;
@@ -78,13 +87,21 @@ struct lock {
 	volatile struct thread *lk_thread;
 	struct spinlock lk_spinlock;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
-/*      // add what you need here
-        // (don't forget to mark things volatile as needed)*/
+
+	/* For timing holds; see lockstat.h */
+	uint64_t lk_acqtime;		/* timer_now() when last acquired */
+	struct cpu *lk_acqcpu;		/* ...and on which cpu, if profiled */
 };
 
 struct lock *lock_create(const char *);
 void lock_destroy(struct lock *);
 
+/*
+ * Call once during system startup, before the first lock_create, to
+ * set up the object cache locks come from.
+ */
+void synch_bootstrap(void);
+
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
@@ -132,16 +149,20 @@ void cv_destroy(struct cv *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - Like cv_wait, but give up waiting after TIMEOUT.
+ *                   Returns 0, or ETIMEDOUT if the time ran out.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
- * For all three operations, the current thread must hold the lock passed
+ * For all of these operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock,
+		 const struct timespec *timeout);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
@@ -47,6 +47,9 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(void *tf, long unsigned int);
 
+/* Helper for thread_create: start a new thread of the current process. */
+void enter_user_thread(void *tf, long unsigned int tid);
+
 /* Enter user mode. Does not return. */
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
@@ -73,6 +73,7 @@ int rwtest2(int, char **);
 int rwtest3(int, char **);
 int rwtest4(int, char **);
 int rwtest5(int, char **);
+int spinlocktest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -116,6 +117,7 @@ int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
 int kmalloctest5(int, char **);
+int kmalloctest6(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
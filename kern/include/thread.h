@@ -92,6 +92,14 @@ struct thread {
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
+	unsigned t_prio;		/* Scheduling priority; 0 is highest */
+	unsigned t_used;		/* Hardclocks run at this priority */
+	unsigned t_epoch;		/* Boost epoch t_prio belongs to */
+	unsigned t_slice;		/* Hardclocks left in time slice */
+	unsigned t_ranat;		/* t_cpu's c_hardclocks when last run */
+	uint32_t t_affinity;		/* Cpus it may run on (CPUMASK) */
+	unsigned t_affgen;		/* p_affgen t_affinity came from */
+	struct wchan *t_wchan;		/* Wchan asleep on, under its lock */
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
@@ -117,6 +125,7 @@ struct thread {
 	 */
 
 	/* add more here as needed */
+	int t_tid;			/* Id within its user process, 0 for the first */
 };
 
 /*
@@ -130,6 +139,7 @@ DECLARRAY(thread, THREADINLINE);
 DEFARRAY(thread, THREADINLINE);
 
 /* Call once during system startup to allocate data structures. */
+void thread_cache_bootstrap(void);
 void thread_bootstrap(void);
 
 /* Call late in system startup to get secondary CPUs running. */
@@ -170,15 +180,23 @@ __DEAD void threadexit_procdest(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Charge the current thread for a tick, adjusting its priority, and
+ * reshuffle the run queue. Called from the timer interrupt. Returns
+ * true if the current thread should now give up the cpu, because its
+ * time slice has run out or a higher-priority thread is waiting.
  */
-void schedule(void);
+bool schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Restrict the current thread to the cpus in MASK, a CPUMASK set.
+ * Cpus that don't exist are ignored; if that leaves none, fails with
+ * EINVAL. If the current cpu isn't in the set the thread moves off
+ * it as soon as the cpu has something else to run, or failing that
+ * when it next sleeps. thread_bind(N) is thread_setaffinity for just
+ * cpu N; it's meant for service threads that belong on one cpu.
  */
-void thread_consider_migration(void);
+int thread_setaffinity(uint32_t mask);
+int thread_bind(unsigned cpunum);
 
 extern unsigned thread_count;
 void thread_wait_for_count(unsigned);
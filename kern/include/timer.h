@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Timers: call a function after a given delay.
+ *
+ * Each cpu keeps the timers started on it in a hashed timing wheel,
+ * an array of lists indexed by the hardclock count they're due at,
+ * so starting or cancelling one is constant time and each hardclock
+ * only looks at one list. A timer due partway through a hardclock
+ * interval has the cpu's timer interrupt moved up for it, where the
+ * hardware allows, so timeouts aren't rounded up to 1/HZ.
+ *
+ * The function is called on the cpu the timer was started on, in
+ * interrupt context: it may not sleep, but may take spinlocks and
+ * wake threads up. It may start its own timer again.
+ *
+ * Functions:
+ *     timer_init      - set up a timer to call FUNC(DATA).
+ *     timer_start     - start it, to go off DELAY from now. It must
+ *                       not already be running.
+ *     timer_cancel    - stop it. Returns true if it hadn't gone off
+ *                       yet, false if it had (or wasn't started). If
+ *                       the function is in progress on another cpu,
+ *                       waits for it to finish, so afterwards it's
+ *                       safe to free the timer. Must not be called
+ *                       holding a spinlock the function takes.
+ *     timer_pending   - true if started and not gone off yet.
+ *     timer_now       - nanoseconds on the current cpu's clock, for
+ *                       measuring short intervals. Each cpu's clock
+ *                       started at its own time, so readings from
+ *                       different cpus can't be compared.
+ *
+ *     timer_cpu_init  - set up CPU's wheel; called from cpu_create.
+ *     timer_tick      - run timers due now; called by hardclock once
+ *                       c_hardclocks has been advanced.
+ *     timer_early     - handle a timer interrupt moved up for a
+ *                       timer. Called first thing by hardclock;
+ *                       returns true if that's what this one was, in
+ *                       which case it isn't a hardclock.
+ *
+ *     timer_idle      - stop the tick while the cpu is idle, until
+ *                       the next timer is due. Called by the idle
+ *                       loop before cpu_idle.
+ *     timer_resume    - start it again. Called by the idle loop when
+ *                       it finds something to run.
+ *
+ * An idle cpu with its tick stopped doesn't call hardclock until its
+ * next timer, or for up to a second, whichever is sooner; then the
+ * ticks it missed are counted in c_hardclocks, and their timers run,
+ * before anything else.
+ */
+
+#include <kern/time.h>
+
+struct cpu;
+
+struct timer {
+	struct timer *tm_next;		/* on its wheel slot */
+	struct timer **tm_prevp;	/* NULL if not on a wheel */
+	struct cpu *tm_cpu;		/* whose wheel */
+	unsigned tm_tick;		/* c_hardclocks it's due at */
+	uint32_t tm_nsec;		/* and how far into that tick */
+	void (*tm_func)(void *);
+	void *tm_data;
+};
+
+void timer_init(struct timer *tm, void (*func)(void *), void *data);
+void timer_start(struct timer *tm, const struct timespec *delay);
+bool timer_cancel(struct timer *tm);
+bool timer_pending(struct timer *tm);
+uint64_t timer_now(void);
+
+void timer_cpu_init(struct cpu *c);
+void timer_tick(void);
+bool timer_early(void);
+void timer_idle(void);
+void timer_resume(void);
+
+
+#endif /* _TIMER_H_ */
@@ -141,5 +141,15 @@ void uio_kinit(struct iovec *, struct uio *,
 void uio_uinit(struct iovec *, struct uio *,
          void *ubuf, size_t len, off_t pos, enum uio_rw rw, struct addrspace *);
 
+/*
+ * Initialize a uio for I/O to or from a user-supplied array of
+ * IOVCNT iovecs at UIOV, as for readv and writev. The array is
+ * copied into KIOV, which must have room for IOVCNT entries. Fails
+ * with EINVAL if the total length doesn't fit in a ssize_t.
+ */
+int uio_uinitv(struct iovec *kiov, struct uio *,
+	       const_userptr_t uiov, int iovcnt, off_t pos, enum uio_rw rw,
+	       struct addrspace *);
+
 
 #endif /* _UIO_H_ */
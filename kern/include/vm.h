@@ -48,6 +48,8 @@
 #define VM_FAULT_WRITE       1    /* A write was attempted */
 #define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
 
+struct pageref;
+
 //Coremap entires that represent physical memory
 struct ppage{
   unsigned int valid: 1;
@@ -56,7 +58,17 @@ struct ppage{
   //recently used
   unsigned int touched: 1;
   unsigned int swapping: 1;
+  //claimed for a contiguous kernel run that is still being assembled
+  unsigned int reserved: 1;
+  //picked by swapout, which gets the frame even if its owner frees it
+  unsigned int evicting: 1;
+  //vm_pinpage holds on it; swapout, the compactor and pte_copy leave it
+  //alone, and if its owner frees it the last vm_unpinpage does the freeing
+  unsigned int pins: 12;
+  unsigned int pinfreed: 1;
   struct pte *pte;
+  //kmalloc's pageref if this is a subpage heap page, else NULL
+  struct pageref *pageref;
 };
 
 //Swaptable entries that represent swapdisk
@@ -78,6 +90,19 @@ paddr_t swapout(bool, bool);
 //Sets the recently touched bit in the coremap entry given
 void cm_touch(paddr_t);
 
+//Record/look up the kmalloc pageref of a kernel heap page
+void cm_setpageref(vaddr_t, struct pageref *);
+struct pageref *cm_getpageref(vaddr_t);
+
+//Free frame count, number of free runs, and longest free run
+void cm_freeruns(unsigned long *, unsigned long *, unsigned long *);
+
+//Keeps the current process's page holding vaddr in memory and returns
+//vaddr's physical address; vm_unpinpage lets it be evicted again. A
+//page may be pinned more than once, and needs unpinning as many times
+int vm_pinpage(vaddr_t vaddr, paddr_t *ret);
+void vm_unpinpage(paddr_t paddr);
+
 
 void cm_bootstrap(void);
 void swap_bootstrap(void);
@@ -108,5 +133,13 @@ unsigned int coremap_used_bytes(void);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Invalidate the page at VADDR, in any address space, in the TLB of
+ * every cpu and wait until they all have. For when a page mapping
+ * goes away while some other cpu may be running the address space.
+ * Call with interrupts on and no spinlocks held.
+ */
+void vm_tlbinvalidate(vaddr_t vaddr);
+
 
 #endif /* _VM_H_ */
@@ -36,6 +36,7 @@
 
 
 struct spinlock; /* in spinlock.h */
+struct timespec; /* in kern/time.h */
 struct wchan; /* Opaque */
 
 /*
@@ -66,6 +67,13 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but give up after TIMEOUT. Returns 0 if woken
+ * up, or ETIMEDOUT if the time ran out first.
+ */
+int wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk,
+			const struct timespec *timeout);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
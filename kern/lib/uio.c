@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
@@ -181,3 +182,40 @@ uio_uinit(struct iovec *iov, struct uio *u,
 	u->uio_rw = rw;
 	u->uio_space = addrspace;
 }
+
+/*
+ * Same again for an array of user iovecs.
+ */
+
+int
+uio_uinitv(struct iovec *kiov, struct uio *u,
+	   const_userptr_t uiov, int iovcnt, off_t pos, enum uio_rw rw,
+	   struct addrspace *addrspace)
+{
+	size_t total, len;
+	int i, result;
+
+	/* A user iovec is the same shape, with iov_ubase in front. */
+	result = copyin(uiov, kiov, iovcnt * sizeof(struct iovec));
+	if (result) {
+		return result;
+	}
+
+	total = 0;
+	for (i=0; i<iovcnt; i++) {
+		len = kiov[i].iov_len;
+		if (len > 0x7fffffff - total) {
+			return EINVAL;
+		}
+		total += len;
+	}
+
+	u->uio_iov = kiov;
+	u->uio_iovcnt = iovcnt;
+	u->uio_offset = pos;
+	u->uio_resid = total;
+	u->uio_segflg = UIO_USERSPACE;
+	u->uio_rw = rw;
+	u->uio_space = addrspace;
+	return 0;
+}
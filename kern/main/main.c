@@ -43,6 +43,11 @@
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <addrspace.h>
+#include <filehandle.h>
+#include <process.h>
+#include <pipe.h>
+#include <poll.h>
 #include <mainbus.h>
 #include <vfs.h>
 #include <device.h>
@@ -112,8 +117,17 @@ boot(void)
   #if OPT_DUMBVM
   #else
   	cm_bootstrap();
+  	as_bootstrap();
     printCoreMap();
   #endif
+	synch_bootstrap();
+	thread_cache_bootstrap();
+	filehandle_bootstrap();
+	fork_bootstrap();
+	futex_bootstrap();
+	pipe_bootstrap();
+	poll_bootstrap();
+	nanosleep_bootstrap();
   	proctable_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
@@ -44,6 +44,9 @@
 #include <syscall.h>
 #include <test.h>
 #include <prompt.h>
+#include <objcache.h>
+#include <lockstat.h>
+#include <cpu.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-synchprobs.h"
@@ -96,7 +99,8 @@ cmd_progthread(void *ptr, unsigned long nargs)
 	if (result) {
 		kprintf("Running program %s failed: %s\n", args[0],
 			strerror(result));
-		return;
+		/* Exit the process so the menu's wait returns. */
+		sys__exit(1, false);
 	}
 
 	/* NOTREACHED: runprogram only returns on error. */
@@ -119,15 +123,17 @@ int
 common_prog(int nargs, char **args)
 {
 	struct proc *proc;
-	int result;
+	int result, status;
 	unsigned tc;
+	pid_t pid;
 
 	/* Create a process for the new program to run in. */
 	proc = proc_create_runprogram(args[0] /* name */);
 	if (proc == NULL) {
 		return ENOMEM;
 	}
-	proc->ppid = curproc->pid;
+	proc_addchild(curproc, proc);
+	pid = proc->pid;
 	tc = thread_count;
 
 	result = thread_fork(args[0] /* thread name */,
@@ -139,15 +145,12 @@ common_prog(int nargs, char **args)
 		proc_destroy(proc);
 		return result;
 	}
-	pid_t whatever;
-	result = sys_waitpid(proc->pid, NULL, 0, &whatever);
-	if(result) return result;
-	//TODO
-	//Upon waking up. destroy the processtable
-	/*
-	 * The new process will be destroyed when the program exits...
-	 * once you write the code for handling that.
-	 */
+
+	/* Wait for the program to exit; this also destroys its process. */
+	result = proc_wait(pid, false, &status, &pid);
+	if (result) {
+		return result;
+	}
 
 	// Wait for all threads to finish cleanup, otherwise khu be a bit behind,
 	// especially once swapping is enabled.
@@ -480,6 +483,57 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_objcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	objcache_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for the lock profiler: "lstat on", "lstat off", "lstat reset",
+ * or just "lstat" to print the profile.
+ */
+static
+int
+cmd_lockprofile(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_print();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		return lockstat_start();
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		lockstat_stop();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+	kprintf("Usage: lstat [on|off|reset]\n");
+	return EINVAL;
+}
+
+static
+int
+cmd_cpustats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpu_printstats();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapused(int nargs, char **args)
@@ -521,6 +575,18 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapfrag(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kheap_printfrag();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -588,6 +654,7 @@ static const char *testmenu[] = {
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
 	"[km5] kmalloc coremap alloc test    ",
+	"[km6] kmalloc throughput test       ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -610,6 +677,7 @@ static const char *testmenu[] = {
 	"[rwt3] RW lock test 3        (1?)   ",
 	"[rwt4] RW lock test 4        (1?)   ",
 	"[rwt5] RW lock test 5        (1?)   ",
+	"[slt]  Spinlock contention test     ",
 #if OPT_SYNCHPROBS
 	"[sp1] Whalemating test       (1)    ",
 	"[sp2] Stoplight test         (1)    ",
@@ -669,9 +737,13 @@ static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
 	"[kh] Kernel heap stats              ",
+	"[khc] Object cache stats            ",
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khfrag] Kernel heap fragmentation  ",
+	"[lstat] Lock profiler               ",
+	"[cpus] Per-cpu scheduler stats      ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -724,9 +796,13 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "khc",        cmd_objcachestats },
+	{ "lstat",      cmd_lockprofile },
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khfrag",     cmd_kheapfrag },
+	{ "cpus",       cmd_cpustats },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -738,6 +814,7 @@ static struct {
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
 	{ "km5",	kmalloctest5 },
+	{ "km6",	kmalloctest6 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -762,6 +839,7 @@ static struct {
 	{ "rwt3",	rwtest3 },
 	{ "rwt4",	rwtest4 },
 	{ "rwt5",	rwtest5 },
+	{ "slt",	spinlocktest },
 #if OPT_SYNCHPROBS
 	{ "sp1",	whalemating },
 	{ "sp2",	stoplight },
@@ -44,6 +44,7 @@
 
 #include <types.h>
 #include <spl.h>
+#include <cpu.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
@@ -54,6 +55,13 @@
 #include <limits.h>
 #include <synch.h>
 #include <kern/errno.h>
+#include <kern/signal.h>
+#include <kern/wait.h>
+#include <objcache.h>
+#include <wchan.h>
+#include <process.h>
+#include <pipe.h>
+#include <poll.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -61,18 +69,39 @@
 struct proc *kproc;
 
 /*
- * The process table for the userspace processes, indexed 0-MAX_PID
+ * The process table, indexed directly by pid. pt_pidmap has a bit set
+ * for every pid in use, including those of exited processes nobody
+ * has waited for yet. Both start with PROC_MAX slots and double as
+ * needed, up to PID_MAX.
+ *
+ * PIDs are handed out next-fit starting at pt_nextpid, so a pid that
+ * was just freed isn't reused until the search has gone all the way
+ * round. Before wrapping around we grow the table instead if it is
+ * at least half full, which keeps the search short.
  */
 
-static int pt_lastindex;
+#define PT_MAXSIZE (PID_MAX + 1)
 
-struct proc *processtable[128];
+static struct proc **processtable;
+static uint32_t *pt_pidmap;
+static unsigned pt_size;	/* slots in processtable, a multiple of 32 */
+static unsigned pt_count;	/* pids in use */
+static unsigned pt_nextpid;	/* where the next search starts */
 
 struct lock *ptlock;
 
 static bool ptlock_created;
 
-static int pidcounter;
+/*
+ * Protects every proc's p_parent, p_children, p_sibling, exstatus and
+ * excode, and is the lock parents sleep on p_wchan with. One lock
+ * for the lot because exit has to look at both its parent and its
+ * children, and a parent and child may be exiting at the same time.
+ */
+static struct spinlock proc_familylock = SPINLOCK_INITIALIZER;
+
+/* Object cache proc structures come from */
+static struct objcache *proc_cache;
 
 /*
  * Lock for processtable modification synchronization
@@ -89,7 +118,7 @@ proc_create(const char *name)
 	(void)name;
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = proc_alloc();
 	if (proc == NULL) {
 		return NULL;
 	}
@@ -97,12 +126,36 @@ proc_create(const char *name)
 	proc->p_numthreads = 0;
 	spinlock_init(&proc->p_lock);
 
-	proc->p_sem = sem_create("p sem", 0);
-	if(proc->p_sem == NULL){
-		kfree(proc->p_name);
-		kfree(proc);
+	proc->p_wchan = wchan_create("proc");
+	if(proc->p_wchan == NULL){
+		spinlock_cleanup(&proc->p_lock);
+		proc_free(proc);
 		return NULL;
 	}
+	proc->p_threadwchan = wchan_create("uthread");
+	if(proc->p_threadwchan == NULL){
+		wchan_destroy(proc->p_wchan);
+		spinlock_cleanup(&proc->p_lock);
+		proc_free(proc);
+		return NULL;
+	}
+	proc->p_uthreads = NULL;
+	proc->p_nlive = 1;
+	proc->p_nexttid = 1;
+	proc->p_stackslots = 0;
+	proc->p_exiting = false;
+	proc->p_affinity = CPUMASK_ALL;
+	proc->p_affgen = 0;
+	timer_init(&proc->p_itimer, itimer_expire, proc);
+	proc->p_itinterval.tv_sec = 0;
+	proc->p_itinterval.tv_nsec = 0;
+	proc->p_itdeadline = proc->p_itinterval;
+	proc->p_alarm = false;
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_sibling = NULL;
+	proc->p_vfork = false;
+	proc->p_vforkheld = false;
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -110,11 +163,17 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-	//Associates a new filetable for every process created
-	proc->p_filetable = filetable_create();
+	//The caller gives it a filetable, fresh or copied
+	proc->p_filetable = NULL;
 
 	// Add's the process to the processtable and sets it PID
-	processtable_add(proc);
+	if(processtable_add(proc)){
+		wchan_destroy(proc->p_threadwchan);
+		wchan_destroy(proc->p_wchan);
+		spinlock_cleanup(&proc->p_lock);
+		proc_free(proc);
+		return NULL;
+	}
 
 	proc->exstatus = false;
 	proc->excode = 0;
@@ -151,6 +210,9 @@ proc_destroy(struct proc *proc)
 	 * incorrect to destroy it.)
 	 */
 
+	/* Not started if it never ran, and stopped by proc_exit if it did. */
+	KASSERT(!timer_pending(&proc->p_itimer));
+
 	/* VFS fields */
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
@@ -204,21 +266,347 @@ proc_destroy(struct proc *proc)
 		}
 		as_destroy(as);
 	}
-	//Prevents race condition in which we are freeing addrspace refernces in free_kpages
-	while(proc->p_numthreads != 0){}
+	//An exiting thread detaches before it lets the parent know, so there
+	//is nothing to wait for here
 	KASSERT(proc->p_numthreads == 0);
-	filetable_destroy(proc->p_filetable);
-	sem_destroy(proc->p_sem);
-	for(int i = 0; i < PROC_MAX; i++){
-    if(processtable[i] != NULL && processtable[i]->pid == proc->pid){
-      processtable[i] = NULL;
-      break;
-    }
-  }
+	KASSERT(!proc->p_vfork);
+	KASSERT(!proc->p_vforkheld);
+	if(proc->p_filetable != NULL) filetable_destroy(proc->p_filetable);
+
+	//Leave the parent's child list
+	spinlock_acquire(&proc_familylock);
+	KASSERT(proc->p_children == NULL);
+	if(proc->p_parent != NULL){
+		struct proc **pp = &proc->p_parent->p_children;
+		while(*pp != proc){
+			KASSERT(*pp != NULL);
+			pp = &(*pp)->p_sibling;
+		}
+		*pp = proc->p_sibling;
+		proc->p_parent = NULL;
+	}
+	spinlock_release(&proc_familylock);
+
+	//Threads nobody joined
+	while (proc->p_uthreads != NULL) {
+		struct uthread *ut = proc->p_uthreads;
+		proc->p_uthreads = ut->ut_next;
+		kfree(ut);
+	}
+
+	wchan_destroy(proc->p_threadwchan);
+	wchan_destroy(proc->p_wchan);
+	processtable_remove(proc);
 	// kprintf("After removal:\n");
 	// processtable_print();
 	spinlock_cleanup(&proc->p_lock);
-	kfree(proc);
+	proc_free(proc);
+}
+
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	spinlock_acquire(&proc_familylock);
+	KASSERT(child->p_parent == NULL);
+	child->p_parent = parent;
+	child->ppid = parent->pid;
+	child->p_sibling = parent->p_children;
+	parent->p_children = child;
+	spinlock_release(&proc_familylock);
+}
+
+void
+proc_exit(int waitstatus)
+{
+	struct proc *proc = curproc;
+	struct proc *child, *next, *zombies = NULL;
+	struct addrspace *as;
+	struct vnode *cwd;
+	bool orphan;
+
+	KASSERT(proc != NULL);
+	KASSERT(proc != kproc);
+
+	/*
+	 * Give back everything but the proc structure itself now,
+	 * rather than whenever the parent gets around to waiting.
+	 */
+	timer_cancel(&proc->p_itimer);
+	as = proc_setas(NULL);
+	as_deactivate();
+	if (!proc_endvfork(proc) && as != NULL) {
+		as_destroy(as);
+	}
+	filetable_destroy(proc->p_filetable);
+	proc->p_filetable = NULL;
+
+	spinlock_acquire(&proc->p_lock);
+	cwd = proc->p_cwd;
+	proc->p_cwd = NULL;
+	spinlock_release(&proc->p_lock);
+	if (cwd != NULL) {
+		VOP_DECREF(cwd);
+	}
+
+	/*
+	 * Detach before telling anyone we've exited, so whoever
+	 * destroys the proc doesn't have to wait for us to let go.
+	 */
+	proc_remthread(curthread);
+
+	spinlock_acquire(&proc_familylock);
+	proc->excode = waitstatus;
+	proc->exstatus = true;
+
+	/* Orphan our children, collecting the ones already dead. */
+	for (child = proc->p_children; child != NULL; child = next) {
+		next = child->p_sibling;
+		child->p_parent = NULL;
+		if (child->exstatus) {
+			child->p_sibling = zombies;
+			zombies = child;
+		}
+		else {
+			child->p_sibling = NULL;
+		}
+	}
+	proc->p_children = NULL;
+
+	orphan = proc->p_parent == NULL;
+	if (!orphan) {
+		wchan_wakeall(proc->p_parent->p_wchan, &proc_familylock);
+	}
+	spinlock_release(&proc_familylock);
+
+	/* Past here the parent may destroy PROC at any time. */
+
+	for (child = zombies; child != NULL; child = next) {
+		next = child->p_sibling;
+		child->p_sibling = NULL;
+		proc_destroy(child);
+	}
+	if (orphan) {
+		proc_destroy(proc);
+	}
+}
+
+int
+proc_wait(pid_t pid, bool nohang, int *waitstatus, pid_t *retpid)
+{
+	struct proc *proc = curproc;
+	struct proc **pp, *child;
+	bool found;
+
+	spinlock_acquire(&proc_familylock);
+	while (1) {
+		child = NULL;
+		found = false;
+		for (pp = &proc->p_children; *pp != NULL;
+		     pp = &(*pp)->p_sibling) {
+			if (pid != -1 && (*pp)->pid != pid) {
+				continue;
+			}
+			found = true;
+			/* A vfork child stays until vfork is done with it. */
+			if ((*pp)->exstatus && !(*pp)->p_vforkheld) {
+				child = *pp;
+				break;
+			}
+		}
+		if (child != NULL) {
+			break;
+		}
+		if (!found) {
+			spinlock_release(&proc_familylock);
+			if (pid != -1 && processtable_get(pid) == NULL) {
+				return ESRCH;
+			}
+			return ECHILD;
+		}
+		if (nohang) {
+			spinlock_release(&proc_familylock);
+			*retpid = 0;
+			return 0;
+		}
+		if (proc->p_exiting) {
+			/* Another thread is taking the process down. */
+			spinlock_release(&proc_familylock);
+			return EINTR;
+		}
+		wchan_sleep(proc->p_wchan, &proc_familylock);
+	}
+
+	/* Take it off our list; after that it's ours alone. */
+	*pp = child->p_sibling;
+	child->p_sibling = NULL;
+	child->p_parent = NULL;
+	spinlock_release(&proc_familylock);
+
+	*waitstatus = child->excode;
+	*retpid = child->pid;
+	proc_destroy(child);
+	return 0;
+}
+
+void
+proc_vforkwait(struct proc *child)
+{
+	spinlock_acquire(&proc_familylock);
+	while (child->p_vfork) {
+		wchan_sleep(curproc->p_wchan, &proc_familylock);
+	}
+	/*
+	 * Until now no other thread's waitpid could reap CHILD, even
+	 * if it has already exited; let them at it.
+	 */
+	child->p_vforkheld = false;
+	if (child->exstatus) {
+		wchan_wakeall(curproc->p_wchan, &proc_familylock);
+	}
+	spinlock_release(&proc_familylock);
+}
+
+bool
+proc_stopthreads(bool forexit)
+{
+	struct proc *proc = curproc;
+	struct uthread *ut, *dead;
+
+	spinlock_acquire(&proc->p_lock);
+	if (proc->p_exiting) {
+		spinlock_release(&proc->p_lock);
+		return false;
+	}
+	proc->p_exiting = true;
+
+	/* Get anyone out of thread_join... */
+	wchan_wakeall(proc->p_threadwchan, &proc->p_lock);
+	spinlock_release(&proc->p_lock);
+
+	/* ...out of waitpid... */
+	spinlock_acquire(&proc_familylock);
+	wchan_wakeall(proc->p_wchan, &proc_familylock);
+	spinlock_release(&proc_familylock);
+
+	/* ...out of futex waits... */
+	futex_interrupt();
+
+	/* ...out of pipes... */
+	pipe_interrupt();
+
+	/* ...out of poll... */
+	poll_interrupt();
+
+	/* ...and out of nanosleep. */
+	nanosleep_interrupt();
+
+	/* proc_remthread wakes us as each one goes. */
+	spinlock_acquire(&proc->p_lock);
+	while (proc->p_numthreads > 1) {
+		wchan_sleep(proc->p_threadwchan, &proc->p_lock);
+	}
+
+	/*
+	 * Nobody is left to join, or to run on those stacks, except
+	 * us: keep our own record and stack in case exec fails.
+	 */
+	dead = proc->p_uthreads;
+	proc->p_uthreads = NULL;
+	proc->p_stackslots = 0;
+	for (ut = dead; ut != NULL; ut = ut->ut_next) {
+		if (ut->ut_tid == curthread->t_tid) {
+			break;
+		}
+	}
+	if (ut != NULL) {
+		struct uthread **pp = &dead;
+		while (*pp != ut) {
+			pp = &(*pp)->ut_next;
+		}
+		*pp = ut->ut_next;
+		ut->ut_next = NULL;
+		proc->p_uthreads = ut;
+		proc->p_stackslots = (uint32_t)1 << ut->ut_stackslot;
+	}
+	proc->p_nlive = 1;
+	if (!forexit) {
+		proc->p_exiting = false;
+	}
+	spinlock_release(&proc->p_lock);
+
+	while (dead != NULL) {
+		ut = dead;
+		dead = ut->ut_next;
+		kfree(ut);
+	}
+	return true;
+}
+
+/*
+ * The alarm went off: the default action for SIGALRM, with no
+ * handlers to catch it, is to terminate. Whoever sees it first does
+ * that; the rest go on to exit as for _exit.
+ */
+static
+void
+proc_alarmexit(struct proc *proc)
+{
+	bool alarm;
+
+	spinlock_acquire(&proc->p_lock);
+	alarm = proc->p_alarm;
+	proc->p_alarm = false;
+	spinlock_release(&proc->p_lock);
+
+	if (!alarm) {
+		return;
+	}
+	if (!proc_stopthreads(true)) {
+		proc_remthread(curthread);
+		thread_exit();
+	}
+	proc_exit(_MKWAIT_SIG(SIGALRM));
+	thread_exit();
+}
+
+void
+proc_checkexiting(void)
+{
+	struct proc *proc = curproc;
+
+	/*
+	 * Unlocked peek: p_exiting only goes true while we run, and
+	 * whoever set it waits for us, so if we miss it now we'll
+	 * see it at the next trap.
+	 */
+	if (proc == NULL || proc == kproc) {
+		return;
+	}
+	if (proc->p_alarm) {
+		proc_alarmexit(proc);
+	}
+	if (!proc->p_exiting) {
+		return;
+	}
+	proc_remthread(curthread);
+	thread_exit();
+}
+
+bool
+proc_endvfork(struct proc *proc)
+{
+	bool wasvfork;
+
+	spinlock_acquire(&proc_familylock);
+	wasvfork = proc->p_vfork;
+	if (wasvfork) {
+		/* The parent is asleep in vfork, so it's still there. */
+		KASSERT(proc->p_parent != NULL);
+		proc->p_vfork = false;
+		wchan_wakeall(proc->p_parent->p_wchan, &proc_familylock);
+	}
+	spinlock_release(&proc_familylock);
+	return wasvfork;
 }
 
 /*
@@ -231,19 +619,47 @@ proc_bootstrap(void)
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
+	kproc->p_filetable = filetable_create();
+	if (kproc->p_filetable == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+}
+
+struct proc *
+proc_alloc(void)
+{
+	return objcache_alloc(proc_cache);
+}
+
+void
+proc_free(struct proc *proc)
+{
+	objcache_free(proc_cache, proc);
 }
 
 void
 proctable_bootstrap(){
-	// Initializes our processtable and pidcounter
-	// spinlock_init(ptlock);
-	pt_lastindex = 0;
+	proc_cache = objcache_create("proc", sizeof(struct proc), NULL, NULL);
+	if (proc_cache == NULL) {
+		panic("proctable_bootstrap: Out of memory\n");
+	}
+
+	// Initializes our processtable and pid bitmap
 	ptlock_created = false;
-	pidcounter = 2;
-	// processtable = kmalloc(sizeof(struct proc *) * PROC_MAX);
-	// for(int i = 0; i < PROC_MAX; i++){
-	// 	processtable[i] = NULL;
-	// }
+	pt_size = PROC_MAX;
+	pt_count = 0;
+	pt_nextpid = PID_MIN;
+	processtable = kmalloc(sizeof(struct proc *) * pt_size);
+	pt_pidmap = kmalloc(sizeof(uint32_t) * (pt_size / 32));
+	if (processtable == NULL || pt_pidmap == NULL) {
+		panic("proctable_bootstrap: Out of memory\n");
+	}
+	for(unsigned i = 0; i < pt_size; i++){
+		processtable[i] = NULL;
+	}
+	for(unsigned i = 0; i < pt_size / 32; i++){
+		pt_pidmap[i] = 0;
+	}
 }
 
 void
@@ -263,13 +679,6 @@ proctable_lock_bootstrap(){
 struct proc *
 proc_create_runprogram(const char *name)
 {
-
-
-	// processtable = kmalloc(sizeof(struct proc *) * PROC_MAX);
-	// for(int i = 0; i < PROC_MAX; i++){
-	// 	processtable[i] = NULL;
-	// }
-
 	struct proc *newproc;
 	struct filehandle *stdin;
 	struct filehandle *stdout;
@@ -278,7 +687,7 @@ proc_create_runprogram(const char *name)
 	struct vnode *vout = NULL;
 	struct vnode *verr = NULL;
 
-	int result;
+	int result, fd;
 
 	newproc = proc_create(name);
 	if (newproc == NULL) {
@@ -291,6 +700,7 @@ proc_create_runprogram(const char *name)
 
 	/* VFS fields */
 
+	newproc->p_filetable = filetable_create();
 	if(newproc->p_filetable == NULL){
 		proc_destroy(newproc);
 		return NULL;
@@ -317,7 +727,7 @@ proc_create_runprogram(const char *name)
 
 	// kfree(con);
 	stdin->fh_fileobj = vin;
-	filetable_add(newproc->p_filetable, stdin);
+	filetable_add(newproc->p_filetable, stdin, &fd);
 
 	char *con2 = kstrdup("con:");
 
@@ -330,7 +740,7 @@ proc_create_runprogram(const char *name)
 
 	// kfree(con);
 	stdout->fh_fileobj = vout;
-	filetable_add(newproc->p_filetable, stdout);
+	filetable_add(newproc->p_filetable, stdout, &fd);
 
 	char *con3 = kstrdup("con:");
 
@@ -345,7 +755,7 @@ proc_create_runprogram(const char *name)
 	kfree(con2);
 	kfree(con3);
 	stderr->fh_fileobj = verr;
-	filetable_add(newproc->p_filetable, stderr);
+	filetable_add(newproc->p_filetable, stderr, &fd);
 
 	/*
 	 * Lock the current process to copy its current directory.
@@ -363,6 +773,33 @@ proc_create_runprogram(const char *name)
 	return newproc;
 }
 
+struct proc *
+proc_create_child(const char *name)
+{
+	struct proc *newproc;
+
+	newproc = proc_create(name);
+	if (newproc == NULL) {
+		return NULL;
+	}
+
+	newproc->p_filetable = filetable_createcopy(curproc->p_filetable);
+	if (newproc->p_filetable == NULL) {
+		proc_destroy(newproc);
+		return NULL;
+	}
+
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != NULL) {
+		VOP_INCREF(curproc->p_cwd);
+		newproc->p_cwd = curproc->p_cwd;
+	}
+	newproc->p_affinity = curproc->p_affinity;
+	spinlock_release(&curproc->p_lock);
+
+	return newproc;
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -380,6 +817,11 @@ proc_addthread(struct proc *proc, struct thread *t)
 	KASSERT(t->t_proc == NULL);
 
 	spinlock_acquire(&proc->p_lock);
+	if (proc->p_exiting) {
+		/* proc_stopthreads is waiting for the count to drop */
+		spinlock_release(&proc->p_lock);
+		return ESRCH;
+	}
 	proc->p_numthreads++;
 	spinlock_release(&proc->p_lock);
 
@@ -411,6 +853,8 @@ proc_remthread(struct thread *t)
 	spinlock_acquire(&proc->p_lock);
 	KASSERT(proc->p_numthreads > 0);
 	proc->p_numthreads--;
+	/* for proc_stopthreads */
+	wchan_wakeall(proc->p_threadwchan, &proc->p_lock);
 	spinlock_release(&proc->p_lock);
 
 	spl = splhigh();
@@ -418,6 +862,55 @@ proc_remthread(struct thread *t)
 	splx(spl);
 }
 
+/*
+ * Have the current thread work in PROC for a while, e.g. to load a
+ * program into a process that has no threads of its own yet, without
+ * changing anything its own process's other threads can see. The
+ * thread still counts as one of its own process's, and also counts as
+ * one of PROC's, so neither can finish exiting meanwhile. Hands back
+ * the thread's own process, for proc_leave.
+ */
+int
+proc_enter(struct proc *proc, struct proc **prevret)
+{
+	int spl;
+
+	spinlock_acquire(&proc->p_lock);
+	if (proc->p_exiting) {
+		spinlock_release(&proc->p_lock);
+		return ESRCH;
+	}
+	proc->p_numthreads++;
+	spinlock_release(&proc->p_lock);
+
+	spl = splhigh();
+	*prevret = curthread->t_proc;
+	curthread->t_proc = proc;
+	splx(spl);
+
+	return 0;
+}
+
+/*
+ * Go back to PREV after proc_enter.
+ */
+void
+proc_leave(struct proc *prev)
+{
+	struct proc *proc = curproc;
+	int spl;
+
+	spl = splhigh();
+	curthread->t_proc = prev;
+	splx(spl);
+
+	spinlock_acquire(&proc->p_lock);
+	KASSERT(proc->p_numthreads > 0);
+	proc->p_numthreads--;
+	wchan_wakeall(proc->p_threadwchan, &proc->p_lock);
+	spinlock_release(&proc->p_lock);
+}
+
 /*
  * Fetch the address space of (the current) process.
  *
@@ -461,38 +954,122 @@ proc_setas(struct addrspace *newas)
 	return oldas;
 }
 
+//The processtable is only touched under ptlock once it exists; before
+//that there is only the boot thread
+static
+void
+pt_lock(void){
+	if(ptlock_created) lock_acquire(ptlock);
+}
+
+static
+void
+pt_unlock(void){
+	if(ptlock_created) lock_release(ptlock);
+}
+
+//Doubles the processtable and pid bitmap, up to PT_MAXSIZE slots
+static
 int
-processtable_add(struct proc *proc){
-	//Gross because i implemented read lock read...getting desparate
-	bool spot = false;
-	if(pt_lastindex == PROC_MAX) pt_lastindex = 0;
-	for(int i = pt_lastindex; i < PROC_MAX; i++){
-		if(processtable[i] == NULL){
-			spot = true;
-			if(ptlock_created) lock_acquire(ptlock);
-			for(int y = i; y < PROC_MAX; y++){
-				if(processtable[y] == NULL){
-					processtable[y] = proc;
-					proc->pid = (pid_t)(pidcounter++);
-					pt_lastindex = y + 1;
-					if(ptlock_created) lock_release(ptlock);
-					return 0;
-				}
-			}
-			for(int y = 0; y < PROC_MAX; y++){
-				if(processtable[y] == NULL){
-					processtable[y] = proc;
-					proc->pid = (pid_t)(pidcounter++);
-					pt_lastindex = y + 1;
-					if(ptlock_created) lock_release(ptlock);
-					return 0;
-				}
-			}
+pt_grow(void){
+	unsigned newsize = pt_size * 2;
+	struct proc **newtable;
+	uint32_t *newmap;
+
+	if(pt_size >= PT_MAXSIZE) return ENPROC;
+	if(newsize > PT_MAXSIZE) newsize = PT_MAXSIZE;
+	KASSERT(newsize % 32 == 0);
+
+	newtable = kmalloc(sizeof(struct proc *) * newsize);
+	newmap = kmalloc(sizeof(uint32_t) * (newsize / 32));
+	if(newtable == NULL || newmap == NULL){
+		kfree(newtable);
+		kfree(newmap);
+		return ENOMEM;
+	}
+	for(unsigned i = 0; i < newsize; i++){
+		newtable[i] = i < pt_size ? processtable[i] : NULL;
+	}
+	for(unsigned i = 0; i < newsize / 32; i++){
+		newmap[i] = i < pt_size / 32 ? pt_pidmap[i] : 0;
+	}
+	kfree(processtable);
+	kfree(pt_pidmap);
+	processtable = newtable;
+	pt_pidmap = newmap;
+	pt_size = newsize;
+	return 0;
+}
+
+//Returns the first unused pid in [from, to), or -1 if there is none.
+//Skips a word of the bitmap at a time when it is full
+static
+int
+pt_findfree(unsigned from, unsigned to){
+	unsigned i = from;
+	while(i < to){
+		if(i % 32 == 0 && pt_pidmap[i / 32] == 0xffffffff){
+			i += 32;
+			continue;
 		}
+		if((pt_pidmap[i / 32] & (1U << (i % 32))) == 0) return (int)i;
+		i++;
+	}
+	return -1;
+}
+
+//Gives proc a pid and enters it in the processtable. Returns ENPROC if
+//every pid up to PID_MAX is taken
+int
+processtable_add(struct proc *proc){
+	int pid;
+
+	pt_lock();
+	pid = pt_findfree(pt_nextpid, pt_size);
+	if(pid < 0 && pt_count >= pt_size / 2 && pt_grow() == 0){
+		pid = pt_findfree(pt_nextpid, pt_size);
 	}
+	//Wrap around
+	if(pid < 0) pid = pt_findfree(PID_MIN, pt_nextpid);
+	if(pid < 0){
+		proc->pid = (pid_t) -1;
+		pt_unlock();
+		return ENPROC;
+	}
+
+	pt_pidmap[pid / 32] |= 1U << (pid % 32);
+	processtable[pid] = proc;
+	proc->pid = (pid_t)pid;
+	pt_count++;
+	pt_nextpid = pid + 1;
+	pt_unlock();
+	return 0;
+}
+
+//Takes proc out of the processtable and frees its pid
+void
+processtable_remove(struct proc *proc){
+	pid_t pid = proc->pid;
+
+	if(pid < 0) return;
+	pt_lock();
+	KASSERT((unsigned)pid < pt_size && processtable[pid] == proc);
+	processtable[pid] = NULL;
+	pt_pidmap[pid / 32] &= ~(1U << (pid % 32));
+	pt_count--;
+	pt_unlock();
 	proc->pid = (pid_t) -1;
-	if(ptlock_created && spot) lock_release(ptlock);
-	return ENPROC;
+}
+
+//Returns the process with the given pid, or NULL if there is none
+struct proc *
+processtable_get(pid_t pid){
+	struct proc *proc = NULL;
+
+	pt_lock();
+	if(pid >= 0 && (unsigned)pid < pt_size) proc = processtable[pid];
+	pt_unlock();
+	return proc;
 }
 
 // void
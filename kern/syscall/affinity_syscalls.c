@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <proc.h>
+#include <process.h>
+#include <copyinout.h>
+
+/*
+ * Cpu affinity for processes. The mask goes in the process, where
+ * new threads and fork/spawn children get it from; threads already
+ * running notice the change themselves (see thread.c), apart from the
+ * caller, which is moved straight away if it has to be.
+ */
+
+//Only the calling process for now: 0 or its own pid
+static
+int
+affinity_proc(pid_t pid, struct proc **ret){
+  if(pid != 0 && pid != curproc->pid){
+    return ESRCH;
+  }
+  *ret = curproc;
+  return 0;
+}
+
+/*
+ * Lets the threads of process PID run only on the cpus in MASK, bit N
+ * for cpu N. Cpus that don't exist are ignored, and if that leaves
+ * none it's EINVAL.
+ */
+int
+sys_setaffinity(pid_t pid, uint32_t mask){
+  struct proc *proc;
+  int result = affinity_proc(pid, &proc);
+  if(result){
+    return result;
+  }
+
+  //Checks and trims the mask, and gets us off a cpu not in it
+  result = thread_setaffinity(mask);
+  if(result){
+    return result;
+  }
+
+  spinlock_acquire(&proc->p_lock);
+  proc->p_affinity = curthread->t_affinity;
+  //Threads read the generation first, then the mask
+  membar_store_store();
+  proc->p_affgen++;
+  curthread->t_affgen = proc->p_affgen;
+  spinlock_release(&proc->p_lock);
+  return 0;
+}
+
+/*
+ * Stores the affinity mask of process PID at MASKP. It goes out
+ * through a pointer since every bit of the mask can be set.
+ */
+int
+sys_getaffinity(pid_t pid, userptr_t maskp){
+  struct proc *proc;
+  uint32_t mask;
+  int result = affinity_proc(pid, &proc);
+  if(result){
+    return result;
+  }
+
+  spinlock_acquire(&proc->p_lock);
+  mask = proc->p_affinity;
+  spinlock_release(&proc->p_lock);
+  return copyout(&mask, maskp, sizeof(mask));
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <copyinout.h>
+#include <argbuf.h>
+
+/*
+ * Argument buffers for starting programs; see argbuf.h.
+ */
+
+void
+argbuf_init(struct argbuf *ab){
+  for(unsigned i = 0; i < ARGBUF_PAGES; i++) ab->pages[i] = NULL;
+  ab->len = 0;
+  ab->argc = 0;
+}
+
+void
+argbuf_cleanup(struct argbuf *ab){
+  for(unsigned i = 0; i < ARGBUF_PAGES; i++) kfree(ab->pages[i]);
+}
+
+//Makes sure the page that byte ab->len falls in exists
+static
+int
+argbuf_getpage(struct argbuf *ab){
+  unsigned pg = ab->len / PAGE_SIZE;
+  KASSERT(pg < ARGBUF_PAGES);
+  if(ab->pages[pg] == NULL){
+    ab->pages[pg] = kmalloc(PAGE_SIZE);
+    if(ab->pages[pg] == NULL) return ENOMEM;
+  }
+  return 0;
+}
+
+//Returns the byte at offset off
+static
+char
+argbuf_byte(struct argbuf *ab, size_t off){
+  return ab->pages[off / PAGE_SIZE][off % PAGE_SIZE];
+}
+
+//Appends the user string at src. Every argument also costs a pointer
+//in argv, which counts towards ARG_MAX along with the strings and the
+//terminating NULL pointer
+static
+int
+argbuf_addstr(struct argbuf *ab, const_userptr_t src){
+  size_t room, got;
+  int result;
+
+  while(1){
+    //Room left under ARG_MAX, keeping space for the argv pointers
+    size_t limit = ARG_MAX - (ab->argc + 2) * sizeof(userptr_t);
+    if(ab->len >= limit) return E2BIG;
+    result = argbuf_getpage(ab);
+    if(result) return result;
+
+    room = PAGE_SIZE - ab->len % PAGE_SIZE;
+    if(room > limit - ab->len) room = limit - ab->len;
+    result = copyinstr(src, &ab->pages[ab->len / PAGE_SIZE][ab->len % PAGE_SIZE], room, &got);
+    if(result == 0) break;
+    if(result != ENAMETOOLONG) return result;
+    //Filled the rest of this page (or hit ARG_MAX), carry on
+    ab->len += room;
+    src = (const_userptr_t)((vaddr_t)src + room);
+  }
+  ab->len += got;
+
+  //Pad with zeros to a multiple of 4
+  while(ab->len % 4 != 0){
+    if(ab->len >= ARG_MAX - (ab->argc + 2) * sizeof(userptr_t)) return E2BIG;
+    result = argbuf_getpage(ab);
+    if(result) return result;
+    ab->pages[ab->len / PAGE_SIZE][ab->len % PAGE_SIZE] = 0;
+    ab->len++;
+  }
+  ab->argc++;
+  return 0;
+}
+
+//Copies the arguments in from the user's argv, validating every pointer
+int
+argbuf_copyin(struct argbuf *ab, userptr_t uargv){
+  userptr_t uarg;
+  int result;
+
+  while(1){
+    result = copyin((const_userptr_t)((vaddr_t)uargv + ab->argc * sizeof(userptr_t)), &uarg, sizeof(userptr_t));
+    if(result) return result;
+    if(uarg == NULL) return 0;
+    result = argbuf_addstr(ab, uarg);
+    if(result) return result;
+  }
+}
+
+//Lays the arguments out at the top of the new stack: the strings
+//highest, then argv below them. Sets *argvp to the user address of argv,
+//which is also the new stack pointer
+int
+argbuf_copyout(struct argbuf *ab, vaddr_t stackptr, vaddr_t *argvp){
+  vaddr_t strbase = stackptr - ab->len;
+  //The stack pointer ends up at argv, so keep it 8-aligned
+  vaddr_t argvbase = (strbase - (ab->argc + 1) * sizeof(userptr_t)) & ~(vaddr_t)7;
+  //Kernel stacks are small, so argv goes out in batches
+  userptr_t ptrs[32];
+  unsigned nptrs = 0;
+  vaddr_t ptrdest = argvbase;
+  size_t off, chunk;
+  int result;
+
+  //The strings, a page of the buffer at a time
+  for(off = 0; off < ab->len; off += chunk){
+    chunk = PAGE_SIZE - off % PAGE_SIZE;
+    if(chunk > ab->len - off) chunk = ab->len - off;
+    result = copyout(&ab->pages[off / PAGE_SIZE][off % PAGE_SIZE], (userptr_t)(strbase + off), chunk);
+    if(result) return result;
+  }
+
+  //argv, by walking the strings; each one starts after the padding
+  //that follows the previous one's terminator
+  off = 0;
+  for(int i = 0; i <= ab->argc; i++){
+    if(i < ab->argc){
+      ptrs[nptrs++] = (userptr_t)(strbase + off);
+      while(argbuf_byte(ab, off) != 0) off++;
+      off = ROUNDUP(off + 1, 4);
+    }else{
+      ptrs[nptrs++] = NULL;
+    }
+    if(nptrs == sizeof(ptrs) / sizeof(ptrs[0]) || i == ab->argc){
+      result = copyout(ptrs, (userptr_t)ptrdest, nptrs * sizeof(userptr_t));
+      if(result) return result;
+      ptrdest += nptrs * sizeof(userptr_t);
+      nptrs = 0;
+    }
+  }
+  KASSERT(off == ab->len);
+
+  *argvp = argvbase;
+  return 0;
+}
@@ -48,17 +48,8 @@ sys_close(int fd){
 
 
 	//Gets the process' filetable
-	struct filehandle **filetable = curproc->p_filetable;
+	struct filetable *filetable = curproc->p_filetable;
 
-	//Checks for validity of fd
-	if(fd < 0 || fd > 63) return EBADF;
-
-	//Acquires the filehandle
-	struct filehandle *filehandle = filetable[fd];
-	if(filehandle == NULL) return EBADF;
-
-	//Removes filehandle from filetable
-	filetable_remove(filetable, fd);
-
-	return 0;
+	//Removes filehandle from filetable; EBADF if fd isn't open
+	return filetable_remove(filetable, fd);
 }
@@ -50,37 +50,24 @@ sys_dup2(int oldfd, int newfd, int32_t *retaddr){
     *retaddr = newfd;
     return 0;
   }
-  //Checks oldfd and newfd values for index out of bounds
-  if(oldfd >= MAX_FILES || oldfd < 0 || newfd >= MAX_FILES || newfd < 0){
-    return EBADF;
-  }
-
   //Gets the current process' filetable
-  struct filehandle **filetable = curthread->t_proc->p_filetable;
+  struct filetable *filetable = curthread->t_proc->p_filetable;
   KASSERT(filetable != NULL);
 
-  if(filetable[oldfd] == NULL){
+  bool ref;
+  struct filehandle *oldfh = filetable_get(filetable, oldfd, &ref);
+  if(oldfh == NULL){
     return EBADF;
   }
 
-  //Removes the pointer to the filehandle from the filetable if there is one there
-  //in the first place. Otherwise does nothing.
-  struct filehandle *newfh = filetable[newfd];
-  if(newfh != NULL){
-    lock_acquire(newfh->fh_lock);
-    vfs_close(newfh->fh_fileobj);
-    filetable_remove(filetable, newfd);
-    if(newfh != NULL) lock_release(newfh->fh_lock);
+  //Has the filetable at newfd point to the filehandle opened at oldfd,
+  //closing whatever was there and bumping the refcount of the old one
+  int result = filetable_place(filetable, newfd, oldfh);
+  filetable_put(oldfh, ref);
+  if(result){
+    return result;
   }
 
-  //Has the filetable at newfd point to the filehandle opened at oldfd
-  filetable[newfd] = filetable[oldfd];
-
-  //Appropriately increments the refcount of the old filehandle
-  lock_acquire(filetable[oldfd]->fh_lock);
-  filetable[oldfd]->fh_refcount++;
-  lock_release(filetable[oldfd]->fh_lock);
-
   *retaddr = newfd;
 
   return 0;
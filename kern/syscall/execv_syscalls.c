@@ -40,14 +40,12 @@
 #include <vfs.h>
 #include <kern/limits.h>
 #include <copyinout.h>
+#include <argbuf.h>
 /*
  * Process syscall execv replaces the currently executing program with a newly
  * loaded program image.
  */
 
-static char final_args[ARG_MAX];
-static int arg_lengths[4000];
-
 int
 sys_execv(const char *prognam, char **args){
 //check if the prognam is valid
@@ -55,44 +53,33 @@ sys_execv(const char *prognam, char **args){
 		return EFAULT;
 	}
 
-	bzero(final_args, ARG_MAX);
 	char safeprognam[__PATH_MAX];
 	size_t actsize;
 	int result = copyinstr((const_userptr_t)prognam, safeprognam, (size_t) __PATH_MAX, &actsize);
 	if(result)return result;
 
-	int total_size = 0;
-	int copy_position = 0;
-	int size_with_pad = 0;
-	int arg_count = 0;
-	actsize = 0;
-
-
-	result = copyin((userptr_t)args, &final_args, sizeof(userptr_t));
- 	if(result) return result;
-
-
-	while(args[arg_count] != NULL){
-		result = copyinstr((const_userptr_t) args[arg_count], &final_args[copy_position], (size_t) ARG_MAX, &actsize);
-		if(result)	return result;
-		int padding = (4 - (actsize-1)%4 - 1);
-		arg_lengths[arg_count] = actsize + padding;
-		arg_count++;
-		copy_position += actsize;
-
-		//try adding the padding here
+	struct argbuf ab;
+	argbuf_init(&ab);
+	result = argbuf_copyin(&ab, (userptr_t)args);
+	if(result){
+		argbuf_cleanup(&ab);
+		return result;
+	}
 
-		copy_position+=padding;
-		size_with_pad += actsize+padding;
+	//The other threads are running in the address space we're about to
+	//replace, so they go now
+	if(!proc_stopthreads(false)){
+		argbuf_cleanup(&ab);
+		return EINTR;
 	}
 
-	total_size = size_with_pad + (4*arg_count) + 4;
 	struct addrspace *as;
 	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
+	vaddr_t entrypoint, stackptr, argvptr;
 	// open the prognam's file
 	result = vfs_open(safeprognam, O_RDONLY, 0, &v);
 	if (result) {
+		argbuf_cleanup(&ab);
 		return result;
 	}
 
@@ -101,52 +88,43 @@ sys_execv(const char *prognam, char **args){
 
 	if(as == NULL){
 		vfs_close(v);
+		argbuf_cleanup(&ab);
 		return ENOMEM;
 	}
-	struct addrspace *oldas = curproc->p_addrspace;
-	//set the addrspace to the current process'
-	proc_setas(as);
+	//set the addrspace to the current process', keeping the old one
+	//until we're sure we won't have to go back to it
+	struct addrspace *oldas = proc_setas(as);
 	//activate the process
 	as_activate();
 
 	/* Load the executable. */
 	result = load_elf(v, &entrypoint);
-	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
-		vfs_close(v);
-		return result;
-	}
 
 	/* Done with the file now. */
 	vfs_close(v);
 
 	/* Define the user stack in the address space */
-	result = as_define_stack(as, &stackptr);
+	if(result == 0) result = as_define_stack(as, &stackptr);
+
+	/* Put the arguments on it */
+	if(result == 0) result = argbuf_copyout(&ab, stackptr, &argvptr);
+
+	argbuf_cleanup(&ab);
 	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
+		/* Go back to the old program */
+		proc_setas(oldas);
+		as_activate();
+		as_destroy(as);
 		return result;
 	}
-	vaddr_t bottom_of_stack = stackptr - total_size;
-	vaddr_t lower = stackptr - total_size;
-	vaddr_t upper = stackptr - size_with_pad;
-	vaddr_t upper2 = stackptr - size_with_pad;
-	for(int i=0; i<arg_count; i++){
-
-		copyout( &upper,(userptr_t) lower, sizeof(void **));
-		lower+=4;
-		upper+=arg_lengths[i];
-	}
-
-	copyout( &final_args[0], (userptr_t) upper2, sizeof(char) * size_with_pad);
-	for(int i=0; i<size_with_pad; i++){
-	 }
 
-	as_destroy(oldas);
+	//A vfork child gives the addrspace back to its parent instead
+	if(!proc_endvfork(curproc)) as_destroy(oldas);
 
-	enter_new_process(arg_count,
-			(userptr_t) bottom_of_stack,
+	enter_new_process(ab.argc,
+			(userptr_t) argvptr,
 			NULL ,
-			bottom_of_stack, entrypoint);
+			argvptr, entrypoint);
 		panic("enter_new_process returned\n");
 
 	return EINVAL;
@@ -45,8 +45,14 @@ sys__exit(int exitcode, bool fatal){
   int exit;
   if(fatal) exit = _MKWAIT_CORE(exitcode);
   else exit = _MKWAIT_EXIT(exitcode);
-  curproc->excode = exit;
-  curproc->exstatus = true;
-  V(curproc->p_sem);
+  //Takes the whole process down: get the other threads out first. If
+  //one of them is already doing that, just go with it
+  if(!proc_stopthreads(true)){
+    proc_remthread(curthread);
+    thread_exit();
+  }
+  //Frees everything but the proc, which waits for the parent to collect
+  //it, or is destroyed now if there is no parent
+  proc_exit(exit);
   thread_exit();
 }
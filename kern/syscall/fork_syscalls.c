@@ -35,100 +35,114 @@
 #include <syscall.h>
 #include <process.h>
 #include <limits.h>
-/*
- * Duplicates the currently running process.
- * Identical except for pid
- */
+#include <objcache.h>
 
-pid_t
-sys_fork(struct trapframe *parenttf, pid_t *retaddr){
+struct objcache *forktf_cache;
 
-  //Allocates new process for child
-  struct proc *child = kmalloc(sizeof(struct proc));
-  if(child == NULL){
-    return ENOMEM;
+void
+fork_bootstrap(void){
+  forktf_cache = objcache_create("fork trapframe", sizeof(struct trapframe), NULL, NULL);
+  if(forktf_cache == NULL){
+    panic("fork_bootstrap: Out of memory\n");
   }
+}
 
-  //Adds the process to the process table and gives it a pid
-  int result = processtable_add(child);
-  if(result){
-    kfree(child);
-    return result;
-  }
+/*
+ * Common part of fork and vfork. A forked child gets a copy of the
+ * parent's address space; a vforked one borrows the parent's, and
+ * the parent sleeps until the child is done with it (it execs or
+ * exits), which saves copying an address space that exec is about to
+ * throw away.
+ */
+static
+int
+fork_common(struct trapframe *parenttf, bool vfork, pid_t *retaddr){
 
   //For reference to the parent
   struct proc *parent = curproc;
-  //Initialize the child process
-
-  child->p_numthreads = 0;
-	spinlock_init(&child->p_lock);
-
 
-  //Give the child a semaphore
-  child->p_sem = sem_create("", 0);
-  if(child->p_sem == NULL){
-    spinlock_cleanup(&child->p_lock);
-    kfree(child);
+  //Allocates the child with a pid, the parent's cwd and a copy of
+  //its filetable
+  struct proc *child = proc_create_child(curthread->t_name);
+  if(child == NULL){
     return ENOMEM;
   }
 
-  //Declare an addrspace as_copy to then copy into
-  struct addrspace *tempas;
-  result = as_copy(parent->p_addrspace, &tempas);
-  if(result){
-    sem_destroy(child->p_sem);
-    spinlock_cleanup(&child->p_lock);
-    kfree(child);
-    return result;
+  int result;
+  if(vfork){
+    child->p_addrspace = parent->p_addrspace;
+    child->p_vfork = true;
+    child->p_vforkheld = true;
   }
-  child->p_addrspace = tempas;
-
-  //Copy cwd
-  child->p_cwd = parent->p_cwd;
-  VOP_INCREF(child->p_cwd);
-
-
-  //Copy the parent filetable
-  child->p_filetable = filetable_createcopy(parent->p_filetable);
-  if(child->p_filetable == NULL){
-    as_destroy(tempas);
-    sem_destroy(child->p_sem);
-    spinlock_cleanup(&child->p_lock);
-    kfree(child);
-    return ENOMEM;
+  else{
+    //Declare an addrspace as_copy to then copy into
+    struct addrspace *tempas;
+    result = as_copy(parent->p_addrspace, &tempas);
+    if(result){
+      proc_destroy(child);
+      return result;
+    }
+    child->p_addrspace = tempas;
   }
 
-  //Assigns the new process' PPID to the caller's PID
-  child->ppid = parent->pid;
-
-  child->exstatus = false;
-	child->excode = 0;
-
   //Make a copy of the parenttf onto the heap to be passed to forkentry
-  struct trapframe *temptf = kmalloc(sizeof(struct trapframe));
-  temptf = memcpy(temptf, parenttf, sizeof(struct trapframe));
+  struct trapframe *temptf = objcache_alloc(forktf_cache);
   if(temptf == NULL){
-    filetable_destroy(child->p_filetable);
-    as_destroy(tempas);
-    sem_destroy(child->p_sem);
-    spinlock_cleanup(&child->p_lock);
-    kfree(child);
-    return ENOMEM;
+    result = ENOMEM;
+    goto fail;
   }
+  memcpy(temptf, parenttf, sizeof(struct trapframe));
+
+  //Links the child into the parent's child list and sets its PPID
+  proc_addchild(parent, child);
+  pid_t childpid = child->pid;
 
   result = thread_fork(curthread->t_name, child, enter_forked_process, (void *)temptf, 0);
   if(result){
-    kfree(temptf);
-    sem_destroy(child->p_sem);
-    as_destroy(tempas);
-    spinlock_cleanup(&child->p_lock);
-    filetable_destroy(child->p_filetable);
-    kfree(child);
-    return ENOMEM;
+    objcache_free(forktf_cache, temptf);
+    result = ENOMEM;
+    goto fail;
   }
+
+  //Don't touch the address space again until the child lets go of it.
+  //p_vforkheld keeps other threads' waitpid from destroying the child
+  //before we've looked, and proc_vforkwait clears it
+  if(vfork){
+    proc_vforkwait(child);
+  }
+
   //Ensures that the parent gets the expected return value
-  *retaddr = child->pid;
+  *retaddr = childpid;
 
   return 0;
 
+fail:
+  //Never ran, so a borrowed addrspace is still only the parent's
+  if(vfork){
+    child->p_addrspace = NULL;
+    child->p_vfork = false;
+    child->p_vforkheld = false;
+  }
+  proc_destroy(child);
+  return result;
+}
+
+/*
+ * Duplicates the currently running process.
+ * Identical except for pid
+ */
+
+pid_t
+sys_fork(struct trapframe *parenttf, pid_t *retaddr){
+  return fork_common(parenttf, false, retaddr);
+}
+
+/*
+ * Like fork, but the child runs in the parent's address space and the
+ * parent doesn't return until the child has called execv or _exit.
+ */
+
+pid_t
+sys_vfork(struct trapframe *parenttf, pid_t *retaddr){
+  return fork_common(parenttf, true, retaddr);
 }
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <current.h>
+#include <proc.h>
+#include <process.h>
+#include <copyinout.h>
+
+/*
+ * Futexes. Waiters are kept in a fixed table of wait queues hashed
+ * by address space and user address, each a spinlock and a wchan.
+ * Nothing is allocated per futex, and an address nobody waits on
+ * costs nothing, so userland only comes here when it has to sleep.
+ *
+ * Several futexes can share a queue, so each waiter has a record on
+ * its own stack naming the address it waits on; a wake marks the
+ * records it picks and wakes the queue, and the others go back to
+ * sleep.
+ */
+
+#define FUTEX_HASHSIZE 64
+
+struct futex_waiter {
+  struct addrspace *fw_as;
+  vaddr_t fw_uaddr;
+  bool fw_woken;
+  struct futex_waiter *fw_next;
+};
+
+struct futex_queue {
+  struct spinlock fq_lock;
+  struct wchan *fq_wchan;
+  struct futex_waiter *fq_waiters;
+};
+
+static struct futex_queue futex_table[FUTEX_HASHSIZE];
+
+void
+futex_bootstrap(void){
+  for(int i = 0; i < FUTEX_HASHSIZE; i++){
+    spinlock_init(&futex_table[i].fq_lock);
+    futex_table[i].fq_wchan = wchan_create("futex");
+    if(futex_table[i].fq_wchan == NULL){
+      panic("futex_bootstrap: Out of memory\n");
+    }
+    futex_table[i].fq_waiters = NULL;
+  }
+}
+
+static
+struct futex_queue *
+futex_hash(struct addrspace *as, vaddr_t uaddr){
+  return &futex_table[(((vaddr_t)as >> 4) ^ (uaddr >> 2)) % FUTEX_HASHSIZE];
+}
+
+//Takes W off its queue if a wake hasn't already. Called with fq_lock held
+static
+void
+futex_unlink(struct futex_queue *fq, struct futex_waiter *w){
+  struct futex_waiter **pp;
+  for(pp = &fq->fq_waiters; *pp != NULL; pp = &(*pp)->fw_next){
+    if(*pp == w){
+      *pp = w->fw_next;
+      return;
+    }
+  }
+}
+
+/*
+ * Gets every futex waiter to look at its process again, for one that
+ * is exiting. Rare enough that waking everyone is fine.
+ */
+void
+futex_interrupt(void){
+  for(int i = 0; i < FUTEX_HASHSIZE; i++){
+    spinlock_acquire(&futex_table[i].fq_lock);
+    wchan_wakeall(futex_table[i].fq_wchan, &futex_table[i].fq_lock);
+    spinlock_release(&futex_table[i].fq_lock);
+  }
+}
+
+static
+int
+futex_wait(struct futex_queue *fq, userptr_t uaddr, int val){
+  struct futex_waiter w;
+  int cur, result;
+
+  w.fw_as = curproc->p_addrspace;
+  w.fw_uaddr = (vaddr_t)uaddr;
+  w.fw_woken = false;
+
+  //Queue up before looking at the value, so a wake that comes after
+  //the value changes can't be missed; copyin may sleep, so not under
+  //the spinlock
+  spinlock_acquire(&fq->fq_lock);
+  w.fw_next = fq->fq_waiters;
+  fq->fq_waiters = &w;
+  spinlock_release(&fq->fq_lock);
+
+  result = copyin(uaddr, &cur, sizeof(cur));
+
+  spinlock_acquire(&fq->fq_lock);
+  if(result == 0 && cur == val){
+    while(!w.fw_woken && !curproc->p_exiting){
+      wchan_sleep(fq->fq_wchan, &fq->fq_lock);
+    }
+  }
+  if(!w.fw_woken){
+    futex_unlink(fq, &w);
+    if(result == 0){
+      result = cur != val ? EAGAIN : EINTR;
+    }
+  }
+  spinlock_release(&fq->fq_lock);
+
+  return w.fw_woken ? 0 : result;
+}
+
+static
+int
+futex_wake(struct futex_queue *fq, userptr_t uaddr, int n){
+  struct futex_waiter **pp, *w;
+  struct addrspace *as = curproc->p_addrspace;
+  int woken = 0;
+
+  spinlock_acquire(&fq->fq_lock);
+  pp = &fq->fq_waiters;
+  while(*pp != NULL && woken < n){
+    w = *pp;
+    if(w->fw_as == as && w->fw_uaddr == (vaddr_t)uaddr){
+      *pp = w->fw_next;
+      w->fw_woken = true;
+      woken++;
+    }
+    else{
+      pp = &w->fw_next;
+    }
+  }
+  if(woken > 0){
+    wchan_wakeall(fq->fq_wchan, &fq->fq_lock);
+  }
+  spinlock_release(&fq->fq_lock);
+
+  return woken;
+}
+
+/*
+ * futex(uaddr, op, val): see kern/futex.h.
+ */
+int
+sys_futex(userptr_t uaddr, int op, int val, int32_t *retval){
+  struct futex_queue *fq;
+  int result;
+
+  if((vaddr_t)uaddr % sizeof(int) != 0){
+    return EINVAL;
+  }
+  fq = futex_hash(curproc->p_addrspace, (vaddr_t)uaddr);
+
+  switch(op){
+    case FUTEX_WAIT:
+      result = futex_wait(fq, uaddr, val);
+      *retval = 0;
+      return result;
+    case FUTEX_WAKE:
+      if(val < 0){
+        return EINVAL;
+      }
+      *retval = futex_wake(fq, uaddr, val);
+      return 0;
+  }
+  return EINVAL;
+}
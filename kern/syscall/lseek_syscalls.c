@@ -40,6 +40,8 @@
 #include <kern/seek.h>
 #include <kern/stat.h>
 
+static int lseek_locked(struct filehandle *, off_t, int, int64_t *);
+
 /*
  * System call: change the offset of the file handle associated to the given fd
  */
@@ -49,32 +51,36 @@ sys_lseek(int fd, off_t pos, int whence, int64_t *retaddr){
 
 
 
-  //Checks if the given fd is a valid index, if not, return error
-  if(fd >= MAX_FILES || fd < 0){
-		return EBADF;
-	}
-
   //Get's the current process' filetable
-  struct filehandle **filetable = curthread->t_proc->p_filetable;
+  struct filetable *filetable = curthread->t_proc->p_filetable;
   KASSERT(filetable != NULL);
 
-
-
   //Get's the filehandle at the given index (fd)
-  struct filehandle *filehandle = filetable[fd];
+  bool ref;
+  struct filehandle *filehandle = filetable_get(filetable, fd, &ref);
 
   //Checks if the filehandle exists, if it doesn't, return error
   if(filehandle == NULL){
 		return EBADF;
 	}
 
-  lock_acquire(filehandle->fh_lock);
-
   if(!VOP_ISSEEKABLE(filehandle->fh_fileobj)){
-    lock_release(filehandle->fh_lock);
+    filetable_put(filehandle, ref);
     return ESPIPE;
   }
 
+  int result = lseek_locked(filehandle, pos, whence, retaddr);
+  filetable_put(filehandle, ref);
+  return result;
+}
+
+//Does the seek with fh_lock held
+static
+int
+lseek_locked(struct filehandle *filehandle, off_t pos, int whence, int64_t *retaddr){
+
+  lock_acquire(filehandle->fh_lock);
+
   switch(whence){
     case SEEK_SET:
       //If pos is negative that would result in a negative seek value for our file
@@ -67,29 +67,29 @@ sys_open(const char *filename, int flags, int32_t *retaddr){
 	}
 
 	//get the filetable from the current process
-	struct filehandle **filetable = curproc->p_filetable;
+	struct filetable *filetable = curproc->p_filetable;
 
 	//create the file handle
 	struct filehandle *filehandle = filehandle_create(name);
-	KASSERT(filehandle != NULL);
-
-	lock_acquire(filehandle->fh_lock);
+	if(filehandle == NULL){
+		vfs_close(vnode);
+		return ENOMEM;
+	}
 
-	//sets the filehandles access flags
+	//sets the filehandles access flags; nobody else can see it yet
 	filehandle->fh_flag = (flags & O_ACCMODE) + 1;
 
 	filehandle->fh_fileobj = vnode;
 
 	int fd;
-	fd = filetable_add(filetable, filehandle);
-
-	if(fd == -1){
-		lock_release(filehandle->fh_lock);
-		return EMFILE;
+	result = filetable_add(filetable, filehandle, &fd);
+	if(result){
+		//closes the vnode too
+		filehandle_destroy(filehandle);
+		return result;
 	}
 
 	*retaddr = fd;
 
-	lock_release(filehandle->fh_lock);
 	return 0;
 }
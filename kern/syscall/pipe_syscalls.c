@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <types.h>
+#include <syscall.h>
+#include <file.h>
+#include <filehandle.h>
+#include <filetable.h>
+#include <vfs.h>
+#include <pipe.h>
+#include <proc.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <copyinout.h>
+/*
+ * System call: makes a pipe and puts its read end in fds[0] and its
+ * write end in fds[1].
+ */
+
+//Wraps one end of the pipe in a filehandle. Consumes the vnode
+static int
+pipe_openend(struct vnode *vnode, int flags, struct filehandle **ret){
+  struct filehandle *filehandle = filehandle_create("pipe");
+  if(filehandle == NULL){
+    vfs_close(vnode);
+    return ENOMEM;
+  }
+  filehandle->fh_flag = flags + 1;
+  filehandle->fh_fileobj = vnode;
+  *ret = filehandle;
+  return 0;
+}
+
+int
+sys_pipe(userptr_t fdsp, int32_t *retaddr){
+  struct vnode *readvn, *writevn;
+  struct filehandle *readfh, *writefh;
+  struct filetable *filetable = curproc->p_filetable;
+  int fds[2];
+  int result;
+
+  result = pipe_create(&readvn, &writevn);
+  if(result) return result;
+
+  result = pipe_openend(readvn, O_RDONLY, &readfh);
+  if(result){
+    vfs_close(writevn);
+    return result;
+  }
+  result = pipe_openend(writevn, O_WRONLY, &writefh);
+  if(result){
+    filehandle_destroy(readfh);
+    return result;
+  }
+
+  result = filetable_add(filetable, readfh, &fds[0]);
+  if(result){
+    filehandle_destroy(readfh);
+    filehandle_destroy(writefh);
+    return result;
+  }
+  result = filetable_add(filetable, writefh, &fds[1]);
+  if(result){
+    //Drops the table's reference, which destroys it
+    filetable_remove(filetable, fds[0]);
+    filehandle_destroy(writefh);
+    return result;
+  }
+
+  //Another thread could have closed them already, but then that's its
+  //business; the pipe itself stays consistent
+  result = copyout(fds, fdsp, sizeof(fds));
+  if(result){
+    filetable_remove(filetable, fds[0]);
+    filetable_remove(filetable, fds[1]);
+    return result;
+  }
+
+  *retaddr = 0;
+  return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <types.h>
+#include <syscall.h>
+#include <file.h>
+#include <filehandle.h>
+#include <filetable.h>
+#include <vnode.h>
+#include <poll.h>
+#include <proc.h>
+#include <current.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <kern/select.h>
+#include <copyinout.h>
+/*
+ * System calls: poll and select, waiting for any of several file
+ * handles to be ready.
+ */
+
+//What the wait needs for each fd it watches
+struct pollslot{
+  struct pollent ps_ent;
+  struct filehandle *ps_fh;
+  bool ps_ref;
+};
+
+//Waits until one of the fds in FDS is ready or TIMEOUT milliseconds
+//pass, filling in each revents, and stores how many are ready in
+//nreadyp. The fds' objects wake us when they change, so nothing is
+//looked at more than once per wakeup
+static int
+poll_wait(struct pollfd *fds, unsigned nfds, int timeout, int *nreadyp){
+  struct filetable *filetable = curproc->p_filetable;
+  struct pollslot *slots = NULL;
+  struct poller poller;
+  unsigned i;
+  int nready, nbad, revents;
+  int result = 0;
+
+  if(nfds > 0){
+    slots = kmalloc(nfds * sizeof(*slots));
+    if(slots == NULL) return ENOMEM;
+  }
+  result = poller_init(&poller, timeout);
+  if(result){
+    kfree(slots);
+    return result;
+  }
+
+  nbad = 0;
+  for(i = 0; i < nfds; i++){
+    pollent_init(&slots[i].ps_ent, &poller);
+    slots[i].ps_fh = NULL;
+    slots[i].ps_ref = false;
+    fds[i].revents = 0;
+    if(fds[i].fd < 0) continue;
+    slots[i].ps_fh = filetable_get(filetable, fds[i].fd, &slots[i].ps_ref);
+    if(slots[i].ps_fh == NULL){
+      fds[i].revents = POLLNVAL;
+      nbad++;
+    }
+  }
+
+  while(1){
+    nready = nbad;
+    for(i = 0; i < nfds; i++){
+      if(slots[i].ps_fh == NULL) continue;
+      result = VOP_POLL(slots[i].ps_fh->fh_fileobj, fds[i].events,
+                        &slots[i].ps_ent, &revents);
+      if(result) break;
+      fds[i].revents = revents;
+      if(revents) nready++;
+    }
+    if(result || nready > 0 || timeout == 0) break;
+
+    result = poller_wait(&poller);
+    if(result == ETIMEDOUT){
+      result = 0;
+      break;
+    }
+    if(result) break;
+  }
+
+  //Unregisters everything before the filehandles can go away
+  poller_cleanup(&poller);
+  for(i = 0; i < nfds; i++){
+    if(slots[i].ps_fh != NULL) filetable_put(slots[i].ps_fh, slots[i].ps_ref);
+  }
+  kfree(slots);
+
+  *nreadyp = nready;
+  return result;
+}
+
+int
+sys_poll(userptr_t fdsp, unsigned nfds, int timeout, int32_t *retaddr){
+  struct pollfd *fds = NULL;
+  int nready;
+  int result;
+
+  if(nfds > __OPEN_MAX) return EINVAL;
+  if(timeout < -1) return EINVAL;
+
+  if(nfds > 0){
+    fds = kmalloc(nfds * sizeof(*fds));
+    if(fds == NULL) return ENOMEM;
+    result = copyin(fdsp, fds, nfds * sizeof(*fds));
+    if(result){
+      kfree(fds);
+      return result;
+    }
+  }
+
+  result = poll_wait(fds, nfds, timeout, &nready);
+  if(!result && nfds > 0){
+    result = copyout(fds, fdsp, nfds * sizeof(*fds));
+  }
+  kfree(fds);
+  if(result) return result;
+
+  *retaddr = nready;
+  return 0;
+}
+
+#define FDSET_ISSET(set, fd) (((set)->fds_bits[(fd) / __NFDBITS] >> ((fd) % __NFDBITS)) & 1)
+#define FDSET_SET(set, fd) ((set)->fds_bits[(fd) / __NFDBITS] |= 1U << ((fd) % __NFDBITS))
+
+//Copies in one of select's sets, all empty if the pointer is null
+static int
+select_getset(userptr_t setp, fd_set *set){
+  if(setp == NULL){
+    bzero(set, sizeof(*set));
+    return 0;
+  }
+  return copyin(setp, set, sizeof(*set));
+}
+
+//Select is poll with the fds given as bitmaps, so it's done as one
+int
+sys_select(int nfds, userptr_t readp, userptr_t writep, userptr_t exceptp,
+           userptr_t timeoutp, int32_t *retaddr){
+  //Too big for the stack all at once
+  struct selectsets{
+    fd_set read, write, except;
+  } *sets;
+  struct pollfd *fds;
+  struct timeval tv;
+  unsigned n, i;
+  int fd, timeout, nready, count;
+  int result;
+
+  if(nfds < 0 || nfds > __FD_SETSIZE) return EINVAL;
+
+  timeout = -1;
+  if(timeoutp != NULL){
+    result = copyin(timeoutp, &tv, sizeof(tv));
+    if(result) return result;
+    if(tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000) return EINVAL;
+    //Rounds up, and a day is as good as forever
+    if(tv.tv_sec > 86400) tv.tv_sec = 86400;
+    timeout = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+  }
+
+  sets = kmalloc(sizeof(*sets));
+  fds = kmalloc((nfds > 0 ? nfds : 1) * sizeof(*fds));
+  if(sets == NULL || fds == NULL){
+    kfree(sets);
+    kfree(fds);
+    return ENOMEM;
+  }
+  result = select_getset(readp, &sets->read);
+  if(!result) result = select_getset(writep, &sets->write);
+  if(!result) result = select_getset(exceptp, &sets->except);
+  if(result) goto out;
+
+  n = 0;
+  for(fd = 0; fd < nfds; fd++){
+    short events = 0;
+    if(FDSET_ISSET(&sets->read, fd)) events |= POLLIN;
+    if(FDSET_ISSET(&sets->write, fd)) events |= POLLOUT;
+    if(FDSET_ISSET(&sets->except, fd)) events |= POLLPRI;
+    if(events == 0) continue;
+    fds[n].fd = fd;
+    fds[n].events = events;
+    n++;
+  }
+
+  result = poll_wait(fds, n, timeout, &nready);
+  if(result) goto out;
+
+  //Hands back just the ones that are ready; select counts bits, not fds
+  bzero(sets, sizeof(*sets));
+  count = 0;
+  for(i = 0; i < n; i++){
+    fd = fds[i].fd;
+    if(fds[i].revents & POLLNVAL){
+      result = EBADF;
+      goto out;
+    }
+    if(fds[i].revents & (POLLIN | POLLHUP | POLLERR) && fds[i].events & POLLIN){
+      FDSET_SET(&sets->read, fd);
+      count++;
+    }
+    if(fds[i].revents & (POLLOUT | POLLERR) && fds[i].events & POLLOUT){
+      FDSET_SET(&sets->write, fd);
+      count++;
+    }
+    if(fds[i].revents & POLLPRI){
+      FDSET_SET(&sets->except, fd);
+      count++;
+    }
+  }
+  if(readp != NULL) result = copyout(&sets->read, readp, sizeof(fd_set));
+  if(!result && writep != NULL) result = copyout(&sets->write, writep, sizeof(fd_set));
+  if(!result && exceptp != NULL) result = copyout(&sets->except, exceptp, sizeof(fd_set));
+  if(!result) *retaddr = count;
+
+ out:
+  kfree(fds);
+  kfree(sets);
+  return result;
+}
@@ -32,31 +32,26 @@
 #include <file.h>
 #include <filetable.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <uio.h>
 #include <proc.h>
+#include <limits.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 
 
-/*
- * System call: read an open file
- */
-
-//const void buf
-ssize_t
-sys_read(int fd, void *buf, size_t nbytes, int32_t *retaddr){
+//Gets the filehandle for fd, if it's open for reading. Hand it back with
+//filetable_put and REF when done
+static
+int
+read_getfh(int fd, struct filehandle **ret, bool *ref){
 
   //Get's the current process' filetable
-  struct filehandle **filetable = curproc->p_filetable;
+  struct filetable *filetable = curproc->p_filetable;
   KASSERT(filetable != NULL);
 
-  //Checks if the given fd is a valid index, if not, return error
-  if(fd >= MAX_FILES || fd < 0){
-		return EBADF;
-	}
-
   //Get's the filehandle at the given index (fd)
-  struct filehandle *filehandle = filetable[fd];
+  struct filehandle *filehandle = filetable_get(filetable, fd, ref);
 
   //Checks if the filehandle exists, if it doesn't, return error
   if(filehandle == NULL){
@@ -65,29 +60,47 @@ sys_read(int fd, void *buf, size_t nbytes, int32_t *retaddr){
 
   // Checks filehandle flags to make sure we can read
   if(filehandle->fh_flag == O_WRONLY + 1){
+    filetable_put(filehandle, *ref);
     return EBADF;
   }
 
-  lock_acquire(filehandle->fh_lock);
+  *ret = filehandle;
+  return 0;
+}
 
-  //Allocate space for uio and iovec to assure they arn't passed in unitialized
-  struct uio uio;
-  struct iovec iovec;
+//Does the read UIO describes. With a seek position of its own (pread),
+//or on a device that can't seek, the filehandle's seek position isn't
+//used and there's no need for its lock; otherwise it reads at, and
+//moves, the filehandle's seek position
+static
+int
+read_uio(struct filehandle *filehandle, struct uio *uio, bool positional,
+         int32_t *retaddr){
+  size_t nbytes = uio->uio_resid;
+  int result;
+
+  if(positional || !VOP_ISSEEKABLE(filehandle->fh_fileobj)){
+    result = VOP_READ(filehandle->fh_fileobj, uio);
+    if(result){
+      return result;
+    }
+    *retaddr = nbytes - uio->uio_resid;
+    return 0;
+  }
 
-  //Initialize the uio with a userpointer
-  uio_uinit(&iovec, &uio, buf, nbytes, filehandle->fh_offset, UIO_READ, curproc->p_addrspace);
+  lock_acquire(filehandle->fh_lock);
+  uio->uio_offset = filehandle->fh_offset;
 
-  //Writes to the file for us
-  int result = VOP_READ(filehandle->fh_fileobj, &uio);
+  //Reads from the file for us
+  result = VOP_READ(filehandle->fh_fileobj, uio);
   if(result){
     //signal error return by vop_read
     lock_release(filehandle->fh_lock);
     return result;
   }
 
-
   //Calculates how much of the read we wanted done was actually done
-  int32_t retval = nbytes - uio.uio_resid;
+  int32_t retval = nbytes - uio->uio_resid;
 
   //update the filehandles seek position based on how much was read
   filehandle->fh_offset += retval;
@@ -96,9 +109,94 @@ sys_read(int fd, void *buf, size_t nbytes, int32_t *retaddr){
   *retaddr = retval;
 
   lock_release(filehandle->fh_lock);
-
-  //returns 0 to signal no error occured
   return 0;
+}
+
+/*
+ * System call: read an open file
+ */
+
+//const void buf
+ssize_t
+sys_read(int fd, void *buf, size_t nbytes, int32_t *retaddr){
+  struct filehandle *filehandle;
+  bool ref;
+
+  int result = read_getfh(fd, &filehandle, &ref);
+  if(result){
+    return result;
+  }
 
+  //Allocate space for uio and iovec to assure they arn't passed in unitialized
+  struct uio uio;
+  struct iovec iovec;
 
+  //Initialize the uio with a userpointer; read_uio fills in the offset
+  uio_uinit(&iovec, &uio, buf, nbytes, 0, UIO_READ, curproc->p_addrspace);
+
+  result = read_uio(filehandle, &uio, false, retaddr);
+  filetable_put(filehandle, ref);
+  return result;
+}
+
+/*
+ * System call: read an open file into several buffers
+ */
+ssize_t
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int32_t *retaddr){
+  struct filehandle *filehandle;
+  struct uio uio;
+  bool ref;
+
+  if(iovcnt <= 0 || iovcnt > IOV_MAX){
+    return EINVAL;
+  }
+
+  //Up to IOV_MAX of them is too many for the stack
+  struct iovec *kiov = kmalloc(iovcnt * sizeof(struct iovec));
+  if(kiov == NULL){
+    return ENOMEM;
+  }
+
+  int result = read_getfh(fd, &filehandle, &ref);
+  if(result){
+    kfree(kiov);
+    return result;
+  }
+  result = uio_uinitv(kiov, &uio, iov, iovcnt, 0, UIO_READ, curproc->p_addrspace);
+  if(result == 0){
+    result = read_uio(filehandle, &uio, false, retaddr);
+  }
+  filetable_put(filehandle, ref);
+  kfree(kiov);
+  return result;
+}
+
+/*
+ * System call: read an open file at a given position, without using
+ * or moving its seek position
+ */
+ssize_t
+sys_pread(int fd, void *buf, size_t nbytes, off_t pos, int32_t *retaddr){
+  struct filehandle *filehandle;
+  struct uio uio;
+  struct iovec iovec;
+  bool ref;
+
+  int result = read_getfh(fd, &filehandle, &ref);
+  if(result){
+    return result;
+  }
+  if(!VOP_ISSEEKABLE(filehandle->fh_fileobj)){
+    result = ESPIPE;
+  }
+  else if(pos < 0){
+    result = EINVAL;
+  }
+  else{
+    uio_uinit(&iovec, &uio, buf, nbytes, pos, UIO_READ, curproc->p_addrspace);
+    result = read_uio(filehandle, &uio, true, retaddr);
+  }
+  filetable_put(filehandle, ref);
+  return result;
 }
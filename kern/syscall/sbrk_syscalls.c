@@ -83,31 +83,38 @@ sys_sbrk(intptr_t amount, void** retaddr){
     struct addrspace *as = curproc->p_addrspace;
     vaddr_t top = heap->vaddr + heap->size - amount;
     vaddr_t bottom = heap->vaddr + heap->size;
-    //Iterate through our page table handleing entires within the range of where our heap is no longer
-    bool head_safe = false;
-  	struct pte *pte_cur = as->pt_head;
-  	struct pte *pte_next = NULL;
-  	while(pte_cur != NULL){
-      //If we have iterated past our head, we can assure that the head pointer is safe
-      if(pte_cur != as->pt_head) head_safe = true;
-      vaddr_t vaddr = pte_cur->vpn & PAGE_FRAME;
-      //Within range
-      if(vaddr >= bottom && vaddr < top){
-        //If our head pointer has not been secured yet we increment it
-        if(!head_safe) as->pt_head = pte_cur->next;
-        //Shoots down the tlb entry in question if it is currently in the tlb
-        int i = tlb_probe(pte_cur->vpn & PAGE_FRAME, 0);
-        if(i > 0) tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-        //Frees page
-    		free_kpages(PADDR_TO_KVADDR(pte_cur->ppn & PAGE_FRAME));
-    		pte_next = pte_cur->next;
-    		kfree(pte_cur);
-        pte_cur = pte_next;
-      }else{
-        pte_next = pte_cur->next;
-    		pte_cur = pte_next;
+    //Unlink and free every pte within range. Other threads may be
+    //faulting pages in meanwhile, and a pipe may have one of the pages
+    //pinned, in which case free_kpages leaves it to the last unpin
+    lock_acquire(as->as_ptlock);
+    struct pte **ptep = &as->pt_head;
+    while(*ptep != NULL){
+      struct pte *pte_cur = *ptep;
+      vaddr_t vaddr = pte_cur->vpn << 12;
+      if(vaddr < bottom || vaddr >= top){
+        ptep = &pte_cur->next;
+        continue;
       }
-  	}
+      *ptep = pte_cur->next;
+
+      lock_acquire(pte_cur->lock);
+      paddr_t ppn = pte_cur->ppn;
+      int slot = pte_cur->slot;
+      pte_cur->ppn = INVAL_PPN;
+      pte_cur->slot = -1;
+      //Shoots down the tlb entry in question on every cpu, since other
+      //threads of the process may have it too
+      vm_tlbinvalidate(vaddr);
+      if(ppn != INVAL_PPN) free_kpages(PADDR_TO_KVADDR(ppn << 12));
+      if(slot >= 0){
+        lock_acquire(swaptable_lock);
+        swaptable[slot].occupied = 0;
+        lock_release(swaptable_lock);
+      }
+      lock_release(pte_cur->lock);
+      pte_destroy(pte_cur);
+    }
+    lock_release(as->as_ptlock);
   }
 
   *retaddr = (void *)ret;
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <timer.h>
+#include <current.h>
+#include <proc.h>
+#include <process.h>
+#include <copyinout.h>
+
+/*
+ * nanosleep and the real-time interval timer. Both are built on the
+ * per-cpu timers (timer.h), so they're good to well under a hardclock
+ * where the hardware allows.
+ *
+ * Every nanosleeper shares one wait channel. Its own timer wakes each
+ * one when its time is up; the channel only matters for getting them
+ * all up early, when their process is exiting or its alarm has gone
+ * off, which is rare enough that waking everyone is fine.
+ */
+
+static struct spinlock nanosleep_lock;
+static struct wchan *nanosleep_wchan;
+
+void
+nanosleep_bootstrap(void){
+  spinlock_init(&nanosleep_lock);
+  nanosleep_wchan = wchan_create("nanosleep");
+  if(nanosleep_wchan == NULL){
+    panic("nanosleep_bootstrap: Out of memory\n");
+  }
+}
+
+/*
+ * Gets every nanosleeper to look at its process again. Called by
+ * proc_stopthreads and, from interrupt context, when an alarm goes off.
+ */
+void
+nanosleep_interrupt(void){
+  spinlock_acquire(&nanosleep_lock);
+  wchan_wakeall(nanosleep_wchan, &nanosleep_lock);
+  spinlock_release(&nanosleep_lock);
+}
+
+//True if A is before B
+static
+bool
+ts_before(const struct timespec *a, const struct timespec *b){
+  if(a->tv_sec != b->tv_sec){
+    return a->tv_sec < b->tv_sec;
+  }
+  return a->tv_nsec < b->tv_nsec;
+}
+
+static
+bool
+ts_valid(const struct timespec *ts){
+  return ts->tv_sec >= 0 && ts->tv_nsec >= 0 && ts->tv_nsec < 1000000000;
+}
+
+/*
+ * Sleeps for the time at REQP. If the process is exiting or its alarm
+ * goes off first, stores the time that was left at REMP (unless it's
+ * NULL) and fails with EINTR.
+ */
+int
+sys_nanosleep(userptr_t reqp, userptr_t remp){
+  struct timespec req, now, deadline, left;
+  bool interrupted = false;
+  int result;
+
+  result = copyin(reqp, &req, sizeof(req));
+  if(result){
+    return result;
+  }
+  if(!ts_valid(&req)){
+    return EINVAL;
+  }
+
+  gettime(&now);
+  timespec_add(&now, &req, &deadline);
+  left = req;
+
+  spinlock_acquire(&nanosleep_lock);
+  while(1){
+    if(curproc->p_exiting || curproc->p_alarm){
+      interrupted = true;
+      break;
+    }
+    if(wchan_sleep_timeout(nanosleep_wchan, &nanosleep_lock, &left) == ETIMEDOUT){
+      break;
+    }
+    //Woken early, maybe for some other process: see what's left
+    gettime(&now);
+    if(!ts_before(&now, &deadline)){
+      break;
+    }
+    timespec_sub(&deadline, &now, &left);
+  }
+  spinlock_release(&nanosleep_lock);
+
+  if(!interrupted){
+    return 0;
+  }
+  if(remp != NULL){
+    gettime(&now);
+    if(ts_before(&now, &deadline)){
+      timespec_sub(&deadline, &now, &left);
+    }
+    else{
+      left.tv_sec = 0;
+      left.tv_nsec = 0;
+    }
+    result = copyout(&left, remp, sizeof(left));
+    if(result){
+      return result;
+    }
+  }
+  return EINTR;
+}
+
+////////////////////////////////////////////////////////////
+// Interval timer
+
+/*
+ * Only ITIMER_REAL: there is no per-process cpu time accounting to run
+ * the other two off. Its timer lives in the process and is protected
+ * by p_lock. There are no signal handlers, so when it goes off the
+ * process is killed with SIGALRM (see proc_checkexiting).
+ */
+
+static
+void
+tv_to_ts(const struct timeval *tv, struct timespec *ts){
+  ts->tv_sec = tv->tv_sec;
+  ts->tv_nsec = tv->tv_usec * 1000;
+}
+
+//Rounds up, so a timer with any time left doesn't read as stopped
+static
+void
+ts_to_tv(const struct timespec *ts, struct timeval *tv){
+  tv->tv_sec = ts->tv_sec;
+  tv->tv_usec = (ts->tv_nsec + 999) / 1000;
+  if(tv->tv_usec == 1000000){
+    tv->tv_sec++;
+    tv->tv_usec = 0;
+  }
+}
+
+static
+bool
+tv_valid(const struct timeval *tv){
+  return tv->tv_sec >= 0 && tv->tv_usec >= 0 && tv->tv_usec < 1000000;
+}
+
+static
+bool
+ts_zero(const struct timespec *ts){
+  return ts->tv_sec == 0 && ts->tv_nsec == 0;
+}
+
+/*
+ * Timer function for p_itimer: raise the alarm, start the next
+ * interval if there is one, and get the process out of nanosleep.
+ */
+void
+itimer_expire(void *data){
+  struct proc *proc = data;
+  struct timespec now;
+
+  spinlock_acquire(&proc->p_lock);
+  proc->p_alarm = true;
+  if(!ts_zero(&proc->p_itinterval)){
+    gettime(&now);
+    timespec_add(&now, &proc->p_itinterval, &proc->p_itdeadline);
+    timer_start(&proc->p_itimer, &proc->p_itinterval);
+  }
+  spinlock_release(&proc->p_lock);
+
+  nanosleep_interrupt();
+}
+
+//Reads PROC's timer into IT. Called with p_lock held
+static
+void
+itimer_read(struct proc *proc, struct itimerval *it){
+  struct timespec now, left;
+
+  left.tv_sec = 0;
+  left.tv_nsec = 0;
+  if(timer_pending(&proc->p_itimer)){
+    gettime(&now);
+    if(ts_before(&now, &proc->p_itdeadline)){
+      timespec_sub(&proc->p_itdeadline, &now, &left);
+    }
+  }
+  ts_to_tv(&left, &it->it_value);
+  ts_to_tv(&proc->p_itinterval, &it->it_interval);
+}
+
+int
+sys_getitimer(int which, userptr_t valuep){
+  struct proc *proc = curproc;
+  struct itimerval it;
+
+  if(which != ITIMER_REAL){
+    return EINVAL;
+  }
+  spinlock_acquire(&proc->p_lock);
+  itimer_read(proc, &it);
+  spinlock_release(&proc->p_lock);
+  return copyout(&it, valuep, sizeof(it));
+}
+
+/*
+ * Starts the timer to go off after the it_value at VALUEP and every
+ * it_interval after that, or stops it if it_value is zero. The old
+ * setting goes to OVALUEP unless it's NULL.
+ */
+int
+sys_setitimer(int which, userptr_t valuep, userptr_t ovaluep){
+  struct proc *proc = curproc;
+  struct itimerval it, old;
+  struct timespec value, now, left;
+  int result;
+
+  if(which != ITIMER_REAL){
+    return EINVAL;
+  }
+  result = copyin(valuep, &it, sizeof(it));
+  if(result){
+    return result;
+  }
+  if(!tv_valid(&it.it_value) || !tv_valid(&it.it_interval)){
+    return EINVAL;
+  }
+  tv_to_ts(&it.it_value, &value);
+
+  //Stop it without p_lock, which its function takes. Only another
+  //setitimer can start it again in between; if one did, go again
+  while(1){
+    timer_cancel(&proc->p_itimer);
+    spinlock_acquire(&proc->p_lock);
+    if(!timer_pending(&proc->p_itimer)){
+      break;
+    }
+    spinlock_release(&proc->p_lock);
+  }
+
+  //It's stopped now, but the deadline says what was left of it:
+  //one that went off, or was stopped, has a deadline in the past
+  old.it_value.tv_sec = 0;
+  old.it_value.tv_usec = 0;
+  ts_to_tv(&proc->p_itinterval, &old.it_interval);
+  gettime(&now);
+  if(ts_before(&now, &proc->p_itdeadline)){
+    timespec_sub(&proc->p_itdeadline, &now, &left);
+    ts_to_tv(&left, &old.it_value);
+  }
+
+  tv_to_ts(&it.it_interval, &proc->p_itinterval);
+  if(ts_zero(&value)){
+    proc->p_itdeadline = now;
+  }
+  else{
+    timespec_add(&now, &value, &proc->p_itdeadline);
+    timer_start(&proc->p_itimer, &value);
+  }
+  spinlock_release(&proc->p_lock);
+
+  if(ovaluep != NULL){
+    return copyout(&old, ovaluep, sizeof(old));
+  }
+  return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/limits.h>
+#include <kern/spawn.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <filehandle.h>
+#include <filetable.h>
+#include <file.h>
+#include <vfs.h>
+#include <syscall.h>
+#include <process.h>
+#include <copyinout.h>
+#include <argbuf.h>
+
+/*
+ * Process syscall spawn creates a child process running a new program
+ * in one step. The program is loaded into a fresh address space
+ * straight from the parent, so unlike fork+execv nothing of the
+ * parent's address space is ever copied. See <kern/spawn.h>.
+ */
+
+//What the child's first thread needs to get to usermode
+struct spawnentry{
+  int argc;
+  vaddr_t argv;
+  vaddr_t entrypoint;
+};
+
+static
+void
+enter_spawned_process(void *data, unsigned long unused){
+  (void)unused;
+
+  struct spawnentry se = *(struct spawnentry *)data;
+  kfree(data);
+  as_activate();
+
+  //The argv array is at the top of the stack, so it is also the stack pointer
+  enter_new_process(se.argc, (userptr_t)se.argv, NULL, se.argv, se.entrypoint);
+  panic("enter_new_process returned\n");
+}
+
+//Opens ACT's path in place of ACT->sa_fd in the child's filetable
+static
+int
+spawn_open(struct filetable *filetable, const struct spawn_action *act){
+  char *path = kmalloc(__PATH_MAX);
+  if(path == NULL) return ENOMEM;
+
+  int result = copyinstr((const_userptr_t)act->sa_path, path, __PATH_MAX, NULL);
+  if(result){
+    kfree(path);
+    return result;
+  }
+
+  //Made before vfs_open, which may mangle the path
+  struct filehandle *filehandle = filehandle_create(path);
+  if(filehandle == NULL){
+    kfree(path);
+    return ENOMEM;
+  }
+
+  struct vnode *vnode;
+  result = vfs_open(path, act->sa_flags, 0, &vnode);
+  kfree(path);
+  if(result){
+    filehandle_destroy(filehandle);
+    return result;
+  }
+  filehandle->fh_flag = (act->sa_flags & O_ACCMODE) + 1;
+  filehandle->fh_fileobj = vnode;
+
+  result = filetable_place(filetable, act->sa_fd, filehandle);
+  if(result){
+    filehandle_destroy(filehandle);
+  }
+  return result;
+}
+
+//Applies the file actions to the child's filetable. The child isn't
+//running yet, so the table is ours alone
+static
+int
+spawn_doactions(struct filetable *filetable, const struct spawn_action *acts, int nacts){
+  int result;
+
+  for(int i = 0; i < nacts; i++){
+    const struct spawn_action *act = &acts[i];
+    int fd = act->sa_fd;
+    int newfd = act->sa_newfd;
+
+    struct filehandle *filehandle;
+    bool ref;
+
+    if(fd < 0 || fd >= OPEN_MAX) return EBADF;
+
+    switch(act->sa_type){
+      case SPAWN_CLOSE:
+        result = filetable_remove(filetable, fd);
+        if(result) return result;
+        break;
+
+      case SPAWN_DUP2:
+        if(newfd < 0 || newfd >= OPEN_MAX) return EBADF;
+        filehandle = filetable_get(filetable, fd, &ref);
+        if(filehandle == NULL) return EBADF;
+        result = fd == newfd ? 0 : filetable_place(filetable, newfd, filehandle);
+        filetable_put(filehandle, ref);
+        if(result) return result;
+        break;
+
+      case SPAWN_OPEN:
+        result = spawn_open(filetable, act);
+        if(result) return result;
+        break;
+
+      default:
+        return EINVAL;
+    }
+  }
+  return 0;
+}
+
+//Loads PATH into a new address space for CHILD and puts the arguments on
+//its stack. load_elf and copyout work on the current process's address
+//space, so this thread works in the child while loading; switching the
+//parent's address space instead would pull it out from under the
+//parent's other threads
+static
+int
+spawn_load(struct proc *child, char *path, struct argbuf *ab, struct spawnentry *se){
+  struct vnode *v;
+  struct proc *parent;
+  vaddr_t stackptr;
+
+  int result = vfs_open(path, O_RDONLY, 0, &v);
+  if(result) return result;
+
+  struct addrspace *as = as_create();
+  if(as == NULL){
+    vfs_close(v);
+    return ENOMEM;
+  }
+
+  result = proc_enter(child, &parent);
+  if(result){
+    vfs_close(v);
+    as_destroy(as);
+    return result;
+  }
+  proc_setas(as);
+  as_activate();
+
+  result = load_elf(v, &se->entrypoint);
+  vfs_close(v);
+  if(result == 0) result = as_define_stack(as, &stackptr);
+  if(result == 0) result = argbuf_copyout(ab, stackptr, &se->argv);
+
+  //proc_destroy of the child disposes of as if we fail
+  proc_leave(parent);
+  as_activate();
+
+  if(result) return result;
+  se->argc = ab->argc;
+  return 0;
+}
+
+int
+sys_spawn(const char *prognam, char **args, const struct spawn_action *actions,
+          int nactions, pid_t *retaddr){
+  if(prognam == NULL || args == NULL){
+    return EFAULT;
+  }
+  if(nactions < 0 || nactions > SPAWN_MAXACTIONS){
+    return EINVAL;
+  }
+
+  int result;
+  struct spawn_action *acts = NULL;
+  struct spawnentry *se = NULL;
+  struct proc *child = NULL;
+  struct argbuf ab;
+  argbuf_init(&ab);
+
+  //Everything coming from the parent's memory is copied in up front
+  char *path = kmalloc(__PATH_MAX);
+  if(path == NULL){
+    result = ENOMEM;
+    goto out;
+  }
+  result = copyinstr((const_userptr_t)prognam, path, __PATH_MAX, NULL);
+  if(result) goto out;
+
+  result = argbuf_copyin(&ab, (userptr_t)args);
+  if(result) goto out;
+
+  if(nactions > 0){
+    acts = kmalloc(sizeof(struct spawn_action) * nactions);
+    if(acts == NULL){
+      result = ENOMEM;
+      goto out;
+    }
+    result = copyin((const_userptr_t)actions, acts, sizeof(struct spawn_action) * nactions);
+    if(result) goto out;
+  }
+
+  se = kmalloc(sizeof(struct spawnentry));
+  if(se == NULL){
+    result = ENOMEM;
+    goto out;
+  }
+
+  child = proc_create_child(path);
+  if(child == NULL){
+    result = ENOMEM;
+    goto out;
+  }
+
+  result = spawn_doactions(child->p_filetable, acts, nactions);
+  if(result) goto out;
+
+  result = spawn_load(child, path, &ab, se);
+  if(result) goto out;
+
+  proc_addchild(curproc, child);
+  pid_t childpid = child->pid;
+
+  result = thread_fork(curthread->t_name, child, enter_spawned_process, se, 0);
+  if(result){
+    result = ENOMEM;
+    goto out;
+  }
+  //The child owns these now
+  se = NULL;
+  child = NULL;
+
+  *retaddr = childpid;
+
+out:
+  if(child != NULL) proc_destroy(child);
+  kfree(se);
+  kfree(acts);
+  kfree(path);
+  argbuf_cleanup(&ab);
+  return result;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <limits.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <wchan.h>
+#include <addrspace.h>
+#include <syscall.h>
+#include <process.h>
+#include <copyinout.h>
+#include <objcache.h>
+
+/*
+ * User threads. All threads of a process share its address space and
+ * filetable; each has its own kernel thread, and its own user stack,
+ * which is one of THREAD_MAX slices of the bottom half of the stack
+ * region (the first thread keeps the top half, as before). The slices
+ * are handed out by the kernel, so libc needs no locking to make one,
+ * and pages are only allocated as a stack actually touches them.
+ *
+ * libc points the new thread at a trampoline that calls the thread's
+ * function and then __thread_exit with what it returned.
+ */
+
+#define UTHREAD_STACKSIZE ((STACKSIZE) / 2 / THREAD_MAX)
+
+//Top of stack slice SLOT, less the argument slots the MIPS calling
+//convention lets the first function store into
+static
+vaddr_t
+uthread_stackptr(int slot){
+  vaddr_t base = USERSTACK - (STACKSIZE) + slot * UTHREAD_STACKSIZE;
+  return base + UTHREAD_STACKSIZE - 16;
+}
+
+//Finds the record of thread TID. Called with p_lock held
+static
+struct uthread **
+uthread_find(struct proc *proc, int tid){
+  struct uthread **pp;
+  for(pp = &proc->p_uthreads; *pp != NULL; pp = &(*pp)->ut_next){
+    if((*pp)->ut_tid == tid) break;
+  }
+  return pp;
+}
+
+/*
+ * Starts a new thread in the current process at ENTRY with FUNC and
+ * ARG as its first two arguments. Returns its thread id.
+ */
+int
+sys___thread_create(struct trapframe *tf, userptr_t entry, userptr_t func,
+                    userptr_t arg, int32_t *retval){
+  struct proc *proc = curproc;
+  int slot;
+
+  struct uthread *ut = kmalloc(sizeof(struct uthread));
+  if(ut == NULL){
+    return ENOMEM;
+  }
+  //Handed to the new thread like fork's trapframe copy
+  struct trapframe *newtf = objcache_alloc(forktf_cache);
+  if(newtf == NULL){
+    kfree(ut);
+    return ENOMEM;
+  }
+
+  spinlock_acquire(&proc->p_lock);
+  for(slot = 0; slot < THREAD_MAX; slot++){
+    if(!(proc->p_stackslots & ((uint32_t)1 << slot))) break;
+  }
+  if(slot == THREAD_MAX){
+    spinlock_release(&proc->p_lock);
+    objcache_free(forktf_cache, newtf);
+    kfree(ut);
+    return EAGAIN;
+  }
+  proc->p_stackslots |= (uint32_t)1 << slot;
+  ut->ut_tid = proc->p_nexttid++;
+  ut->ut_stackslot = slot;
+  ut->ut_exited = false;
+  ut->ut_joining = false;
+  ut->ut_retval = NULL;
+  //Listed before it runs so it can find itself when it exits
+  ut->ut_next = proc->p_uthreads;
+  proc->p_uthreads = ut;
+  proc->p_nlive++;
+  int tid = ut->ut_tid;
+  spinlock_release(&proc->p_lock);
+
+  //Same registers (notably gp) as the creator, but its own pc and stack
+  *newtf = *tf;
+  newtf->tf_epc = (vaddr_t)entry;
+  newtf->tf_a0 = (vaddr_t)func;
+  newtf->tf_a1 = (vaddr_t)arg;
+  newtf->tf_sp = uthread_stackptr(slot);
+  newtf->tf_ra = 0;
+
+  int result = thread_fork(curthread->t_name, proc, enter_user_thread, newtf, tid);
+  if(result){
+    objcache_free(forktf_cache, newtf);
+    spinlock_acquire(&proc->p_lock);
+    proc->p_stackslots &= ~((uint32_t)1 << slot);
+    proc->p_nlive--;
+    //Someone may have guessed the tid and be waiting already
+    ut->ut_exited = true;
+    if(ut->ut_joining){
+      wchan_wakeall(proc->p_threadwchan, &proc->p_lock);
+      ut = NULL;
+    }
+    else{
+      *uthread_find(proc, tid) = ut->ut_next;
+    }
+    spinlock_release(&proc->p_lock);
+    kfree(ut);
+    return result;
+  }
+
+  *retval = tid;
+  return 0;
+}
+
+/*
+ * Exits the current thread with exit value RETVAL. The last thread to
+ * go takes the process with it, with exit status 0. Does not return.
+ */
+void
+sys___thread_exit(userptr_t retval){
+  struct proc *proc = curproc;
+  struct uthread *ut;
+  bool last;
+
+  spinlock_acquire(&proc->p_lock);
+  //The first thread has no record
+  ut = *uthread_find(proc, curthread->t_tid);
+  if(ut != NULL){
+    ut->ut_exited = true;
+    ut->ut_retval = retval;
+    //We're off the user stack for good
+    proc->p_stackslots &= ~((uint32_t)1 << ut->ut_stackslot);
+    wchan_wakeall(proc->p_threadwchan, &proc->p_lock);
+  }
+  KASSERT(proc->p_nlive > 0);
+  last = --proc->p_nlive == 0;
+  spinlock_release(&proc->p_lock);
+
+  if(last && proc_stopthreads(true)){
+    proc_exit(_MKWAIT_EXIT(0));
+    thread_exit();
+  }
+  proc_remthread(curthread);
+  thread_exit();
+}
+
+/*
+ * Waits for thread TID to exit and stores its exit value at RETVALP,
+ * if not NULL. Each thread can be joined once.
+ */
+int
+sys_thread_join(int tid, userptr_t retvalp){
+  struct proc *proc = curproc;
+  struct uthread *ut;
+
+  if(tid == curthread->t_tid){
+    return EINVAL;
+  }
+
+  spinlock_acquire(&proc->p_lock);
+  ut = *uthread_find(proc, tid);
+  if(ut == NULL){
+    spinlock_release(&proc->p_lock);
+    return ESRCH;
+  }
+  if(ut->ut_joining){
+    spinlock_release(&proc->p_lock);
+    return EINVAL;
+  }
+  ut->ut_joining = true;
+  while(!ut->ut_exited && !proc->p_exiting){
+    wchan_sleep(proc->p_threadwchan, &proc->p_lock);
+  }
+  if(!ut->ut_exited){
+    //The process is going away, and us with it
+    ut->ut_joining = false;
+    spinlock_release(&proc->p_lock);
+    return EINTR;
+  }
+  *uthread_find(proc, tid) = ut->ut_next;
+  userptr_t retval = ut->ut_retval;
+  spinlock_release(&proc->p_lock);
+  kfree(ut);
+
+  if(retvalp != NULL){
+    return copyout(&retval, retvalp, sizeof(retval));
+  }
+  return 0;
+}
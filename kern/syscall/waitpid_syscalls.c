@@ -40,66 +40,57 @@
 
 /*
  * Waits until the process identified by pid exits
- * and returns it's exit status to status
+ * and returns it's exit status to status. A pid of -1
+ * waits for any child; WNOHANG returns 0 right away
+ * if no child has exited yet
  */
 
 pid_t
 sys_waitpid(pid_t pid, int *status, int options, pid_t *retaddr){
 
-  if(pid < __PID_MIN || pid > __PID_MAX){
+  if(pid != WAIT_ANY && (pid < __PID_MIN || pid > __PID_MAX)){
     return ESRCH;
   }
 
   //Checks validity of options
-  if(options != 0){
+  if((options & ~WNOHANG) != 0){
     return EINVAL;
   }
 
-  struct proc *parent = curproc;
-  // kprintf("\nProcess %d Waiting On %d", curproc->pid, pid);
-
-  struct proc *child;
-
-  //Checks if the process with the pid given exists on the processtable
-  bool procfound = false;
-  lock_acquire(ptlock);
-  for(int i = 0; i < PROC_MAX; i++){
-    if(processtable[i] != NULL && processtable[i]->pid == pid){
-      child = processtable[i];
-      procfound = true;
-      break;
+  //The child is destroyed as soon as it's reaped, so a bad status
+  //pointer has to be found first or the status would be lost. Writing
+  //back what's already there checks it can be both read and written
+  int waitstatus;
+  int result;
+  if(status != NULL){
+    result = copyin((const_userptr_t)status, &waitstatus, sizeof(int));
+    if(result){
+      return result;
+    }
+    result = copyout(&waitstatus, (userptr_t)status, sizeof(int));
+    if(result){
+      return result;
     }
   }
-  lock_release(ptlock);
 
-  //If we didn't find the process to wait on, return error
-  if(!procfound){
-    return ESRCH;
+  //Finds the child on our child list, sleeping until it exits
+  //unless WNOHANG, and destroys it once it has
+  result = proc_wait(pid, (options & WNOHANG) != 0, &waitstatus, retaddr);
+  if(result){
+    return result;
   }
 
-  //If the child's ppid isnt the curproc's pid, return error
-  if(child->ppid != parent->pid){
-    return ECHILD;
+  //Nothing exited yet under WNOHANG
+  if(*retaddr == 0){
+    return 0;
   }
 
-  //If the process hasn't exited, we wait
-  if(!child->exstatus) P(child->p_sem);
-  // kprintf("\nProcess %d No Longer Waiting\n", curproc->pid);
-
-  *retaddr = child->pid;
-  //Otherwise, we go through signaling the necessary processes
   if(status != NULL){
-    int result = copyout(&child->excode, (userptr_t)status, sizeof(int));
+    result = copyout(&waitstatus, (userptr_t)status, sizeof(int));
     if(result){
-      proc_destroy(child);
       return result;
     }
   }
-
-
-
-  //Done using child process, can now safely destory it
-  proc_destroy(child);
   return 0;
 
 }
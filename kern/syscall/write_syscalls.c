@@ -32,61 +32,76 @@
 #include <file.h>
 #include <filetable.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <uio.h>
 #include <proc.h>
+#include <limits.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <copyinout.h>
 
-/*
- * System call: write to an open file
- */
 
-//const void buf
-ssize_t
-sys_write(int fd, const_userptr_t buf, size_t buflen, int32_t *retaddr){
+//Gets the filehandle for fd, if it's open for writing. Hand it back with
+//filetable_put and REF when done
+static
+int
+write_getfh(int fd, struct filehandle **ret, bool *ref){
 
   //Get's the current process' filetable
-  struct filehandle **filetable = curproc->p_filetable;
-
-  //Checks if the given fd is a valid index, if not, return error
-  if(fd >= MAX_FILES || fd < 0){
-		return EBADF;
-	}
+  struct filetable *filetable = curproc->p_filetable;
+  KASSERT(filetable != NULL);
 
   //Get's the filehandle at the given index (fd)
-  struct filehandle *filehandle = filetable[fd];
+  struct filehandle *filehandle = filetable_get(filetable, fd, ref);
 
   //Checks if the filehandle exists, if it doesn't, return error
   if(filehandle == NULL){
 		return EBADF;
 	}
 
-  // Checks the filehandle accessor flags
-  if (filehandle->fh_flag == O_RDONLY + 1){
+  // Checks filehandle flags to make sure we can write
+  if(filehandle->fh_flag == O_RDONLY + 1){
+    filetable_put(filehandle, *ref);
     return EBADF;
   }
 
-  //Acquires filehandle's lock
-  lock_acquire(filehandle->fh_lock);
+  *ret = filehandle;
+  return 0;
+}
 
-  //Allocate space for uio and iovec to assure they arn't passed in unitialized
-  struct uio uio;
-  struct iovec iovec;
+//Does the write UIO describes. With a seek position of its own
+//(pwrite), or on a device that can't seek, the filehandle's seek
+//position isn't used and there's no need for its lock; otherwise it
+//writes at, and moves, the filehandle's seek position
+static
+int
+write_uio(struct filehandle *filehandle, struct uio *uio, bool positional,
+          int32_t *retaddr){
+  size_t buflen = uio->uio_resid;
+  int result;
+
+  if(positional || !VOP_ISSEEKABLE(filehandle->fh_fileobj)){
+    result = VOP_WRITE(filehandle->fh_fileobj, uio);
+    if(result){
+      return result;
+    }
+    *retaddr = buflen - uio->uio_resid;
+    return 0;
+  }
 
-  //Initialize the uio with a userpointer
-  uio_uinit(&iovec, &uio, (void *)buf, buflen, filehandle->fh_offset, UIO_WRITE, curproc->p_addrspace);
+  //Acquires filehandle's lock
+  lock_acquire(filehandle->fh_lock);
+  uio->uio_offset = filehandle->fh_offset;
 
 	//Writes to the file for us
-  int result = VOP_WRITE(filehandle->fh_fileobj, &uio);
+  result = VOP_WRITE(filehandle->fh_fileobj, uio);
   if(result){
     lock_release(filehandle->fh_lock);
     return result;
   }
 
-
 	//Calculates how much of the write we wanted done was actually done
-  size_t retval = buflen - uio.uio_resid;
+  size_t retval = buflen - uio->uio_resid;
 
   //update the filehandles seek position based on how much was written
   filehandle->fh_offset += retval;
@@ -95,7 +110,94 @@ sys_write(int fd, const_userptr_t buf, size_t buflen, int32_t *retaddr){
   *retaddr = retval;
 
   lock_release(filehandle->fh_lock);
+  return 0;
+}
+
+/*
+ * System call: write to an open file
+ */
+
+//const void buf
+ssize_t
+sys_write(int fd, const_userptr_t buf, size_t buflen, int32_t *retaddr){
+  struct filehandle *filehandle;
+  bool ref;
+
+  int result = write_getfh(fd, &filehandle, &ref);
+  if(result){
+    return result;
+  }
+
+  //Allocate space for uio and iovec to assure they arn't passed in unitialized
+  struct uio uio;
+  struct iovec iovec;
 
-  //returns 0 to signal no error occured
-	return 0;
+  //Initialize the uio with a userpointer; write_uio fills in the offset
+  uio_uinit(&iovec, &uio, (void *)buf, buflen, 0, UIO_WRITE, curproc->p_addrspace);
+
+	result = write_uio(filehandle, &uio, false, retaddr);
+  filetable_put(filehandle, ref);
+  return result;
+}
+
+/*
+ * System call: write to an open file from several buffers
+ */
+ssize_t
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int32_t *retaddr){
+  struct filehandle *filehandle;
+  struct uio uio;
+  bool ref;
+
+  if(iovcnt <= 0 || iovcnt > IOV_MAX){
+    return EINVAL;
+  }
+
+  //Up to IOV_MAX of them is too many for the stack
+  struct iovec *kiov = kmalloc(iovcnt * sizeof(struct iovec));
+  if(kiov == NULL){
+    return ENOMEM;
+  }
+
+  int result = write_getfh(fd, &filehandle, &ref);
+  if(result){
+    kfree(kiov);
+    return result;
+  }
+  result = uio_uinitv(kiov, &uio, iov, iovcnt, 0, UIO_WRITE, curproc->p_addrspace);
+  if(result == 0){
+    result = write_uio(filehandle, &uio, false, retaddr);
+  }
+  filetable_put(filehandle, ref);
+  kfree(kiov);
+  return result;
+}
+
+/*
+ * System call: write to an open file at a given position, without
+ * using or moving its seek position
+ */
+ssize_t
+sys_pwrite(int fd, const_userptr_t buf, size_t buflen, off_t pos, int32_t *retaddr){
+  struct filehandle *filehandle;
+  struct uio uio;
+  struct iovec iovec;
+  bool ref;
+
+  int result = write_getfh(fd, &filehandle, &ref);
+  if(result){
+    return result;
+  }
+  if(!VOP_ISSEEKABLE(filehandle->fh_fileobj)){
+    result = ESPIPE;
+  }
+  else if(pos < 0){
+    result = EINVAL;
+  }
+  else{
+    uio_uinit(&iovec, &uio, (void *)buf, buflen, pos, UIO_WRITE, curproc->p_addrspace);
+    result = write_uio(filehandle, &uio, true, retaddr);
+  }
+  filetable_put(filehandle, ref);
+  return result;
 }
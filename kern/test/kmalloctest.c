@@ -36,6 +36,7 @@
 #include <cpu.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <vm.h> /* for PAGE_SIZE */
 #include <test.h>
 #include <kern/test161.h>
@@ -606,3 +607,106 @@ kmalloctest5(int nargs, char **args)
 
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km6
+
+/*
+ * kmalloc throughput benchmark. Each thread repeatedly allocates a
+ * handful of small blocks of assorted sizes and then frees them again,
+ * which is what most kernel allocations look like. The total number
+ * of kmalloc and kfree calls per second is reported; run it with
+ * several cpus to see how well the allocator scales.
+ *
+ * The argument, if given, is the number of threads.
+ */
+
+#define KM6_NTHREADS 8
+#define KM6_ROUNDS   2000
+#define KM6_BATCH    8
+
+static const size_t km6_sizes[KM6_BATCH] = {
+	12, 24, 40, 64, 100, 200, 500, 1000
+};
+
+static
+void
+kmalloctest6thread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	void *ptrs[KM6_BATCH];
+	unsigned i, j;
+
+	for (i=0; i<KM6_ROUNDS; i++) {
+		for (j=0; j<KM6_BATCH; j++) {
+			ptrs[j] = kmalloc(km6_sizes[(i + j) % KM6_BATCH]);
+			if (ptrs[j] == NULL) {
+				panic("km6: thread %lu: kmalloc returned NULL\n",
+				      num);
+			}
+		}
+		for (j=0; j<KM6_BATCH; j++) {
+			kfree(ptrs[j]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+kmalloctest6(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after;
+	uint64_t nsecs, ops;
+	unsigned nthreads, i;
+	int result;
+
+	nthreads = KM6_NTHREADS;
+	if (nargs > 2) {
+		kprintf("Usage: km6 [nthreads]\n");
+		return 0;
+	}
+	if (nargs == 2) {
+		nthreads = atoi(args[1]);
+		if (nthreads == 0) {
+			kprintf("Usage: km6 [nthreads]\n");
+			return 0;
+		}
+	}
+
+	sem = sem_create("km6", 0);
+	if (sem == NULL) {
+		panic("km6: sem_create failed\n");
+	}
+
+	kprintf("Starting kmalloc throughput test with %u threads...\n",
+		nthreads);
+
+	gettime(&before);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("km6", NULL, kmalloctest6thread, sem, i);
+		if (result) {
+			panic("km6: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(sem);
+	}
+	gettime(&after);
+
+	sem_destroy(sem);
+
+	timespec_sub(&after, &before, &after);
+	nsecs = after.tv_sec * 1000000000ULL + after.tv_nsec;
+	ops = (uint64_t)nthreads * KM6_ROUNDS * KM6_BATCH * 2;
+	kprintf("km6: %llu kmalloc/kfree calls in %llu.%09lu seconds "
+		"on %u cpus (%llu calls/sec)\n",
+		(unsigned long long)ops, (unsigned long long)after.tv_sec,
+		(unsigned long)after.tv_nsec, num_cpus,
+		(unsigned long long)(nsecs ? ops * 1000000000ULL / nsecs : 0));
+
+	success(TEST161_SUCCESS, SECRET, "km6");
+	return 0;
+}
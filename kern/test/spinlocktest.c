@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Spinlock contention test.
+ *
+ * One thread per cpu, each bound to its own cpu, takes and releases
+ * one shared spinlock as fast as it can for a while, doing a little
+ * work both holding it and not. Reports the throughput, how often the
+ * lock went to a different cpu from the last time (handoffs), and how
+ * evenly it was shared out. Fails if the counts don't add up, or if
+ * any cpu got less than half as many turns as the luckiest one, which
+ * a fair lock shouldn't allow.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <atomic.h>
+#include <platform/maxcpus.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define SLT_SECONDS	2	/* how long to run */
+#define SLT_WORK	20	/* delay loop iterations, in and out */
+
+static struct spinlock slt_lock;
+static volatile int slt_ready;
+static volatile bool slt_go, slt_stop;
+
+/* Protected by slt_lock */
+static unsigned long slt_total;
+static unsigned long slt_handoffs;
+static unsigned slt_last;
+
+/* Each thread's own count, written only by it. */
+static unsigned long slt_counts[MAXCPUS];
+
+static
+void
+slt_delay(void)
+{
+	volatile unsigned i;
+
+	for (i=0; i<SLT_WORK; i++) {
+		/* nothing */
+	}
+}
+
+static
+void
+slt_thread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	unsigned long count;
+	int result;
+
+	result = thread_bind(num);
+	if (result) {
+		panic("slt: thread_bind(%lu): %s\n", num, strerror(result));
+	}
+
+	atomic_add(&slt_ready, 1);
+	while (!slt_go) {
+		/* wait for everyone */
+	}
+
+	count = 0;
+	while (!slt_stop) {
+		spinlock_acquire(&slt_lock);
+		slt_total++;
+		if (slt_last != num) {
+			slt_handoffs++;
+			slt_last = num;
+		}
+		slt_delay();
+		spinlock_release(&slt_lock);
+		count++;
+		slt_delay();
+	}
+	slt_counts[num] = count;
+
+	V(sem);
+}
+
+int
+spinlocktest(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after;
+	unsigned long sum, least, most;
+	uint64_t nsecs;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	sem = sem_create("slt", 0);
+	if (sem == NULL) {
+		panic("slt: sem_create failed\n");
+	}
+	spinlock_init(&slt_lock);
+	slt_ready = 0;
+	slt_go = slt_stop = false;
+	slt_total = slt_handoffs = 0;
+	slt_last = num_cpus;
+
+	kprintf("Starting spinlock contention test on %u cpus...\n",
+		num_cpus);
+
+	for (i=0; i<num_cpus; i++) {
+		result = thread_fork("slt", NULL, slt_thread, sem, i);
+		if (result) {
+			panic("slt: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	while (slt_ready < (int)num_cpus) {
+		thread_yield();
+	}
+
+	gettime(&before);
+	slt_go = true;
+	clocksleep(SLT_SECONDS);
+	slt_stop = true;
+	for (i=0; i<num_cpus; i++) {
+		P(sem);
+	}
+	gettime(&after);
+
+	sem_destroy(sem);
+	spinlock_cleanup(&slt_lock);
+
+	sum = 0;
+	least = most = slt_counts[0];
+	for (i=0; i<num_cpus; i++) {
+		kprintf("slt: cpu %u: %lu\n", i, slt_counts[i]);
+		sum += slt_counts[i];
+		if (slt_counts[i] < least) {
+			least = slt_counts[i];
+		}
+		if (slt_counts[i] > most) {
+			most = slt_counts[i];
+		}
+	}
+
+	timespec_sub(&after, &before, &after);
+	nsecs = after.tv_sec * 1000000000ULL + after.tv_nsec;
+	kprintf("slt: %lu acquisitions in %llu.%09lu seconds "
+		"(%llu/sec), %lu handoffs, fewest %lu, most %lu\n",
+		sum, (unsigned long long)after.tv_sec,
+		(unsigned long)after.tv_nsec,
+		(unsigned long long)(nsecs ? sum * 1000000000ULL / nsecs : 0),
+		slt_handoffs, least, most);
+
+	if (sum != slt_total) {
+		kprintf("slt: %lu acquisitions counted, but %lu recorded\n",
+			sum, slt_total);
+		success(TEST161_FAIL, SECRET, "slt");
+		return 0;
+	}
+	if (least * 2 < most) {
+		kprintf("slt: the lock wasn't shared out fairly\n");
+		success(TEST161_FAIL, SECRET, "slt");
+		return 0;
+	}
+
+	success(TEST161_SUCCESS, SECRET, "slt");
+	return 0;
+}
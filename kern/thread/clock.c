@@ -34,6 +34,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <timer.h>
 
 /*
  * Time handling.
@@ -46,13 +47,6 @@
  * skimp on that because we have a known-good hardware clock.
  */
 
-/*
- * Timing constants. These should be tuned along with any work done on
- * the scheduler.
- */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
-
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
  */
@@ -87,23 +81,30 @@ timerclock(void)
 
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, and also when the timer has been moved up to go off early for
+ * a timer (see timer.c). An idle processor stops its tick, and the
+ * first call after that accounts for the ones it missed.
  */
 void
 hardclock(void)
 {
+	/*
+	 * The timer may have been moved up for a timer due before the
+	 * end of the tick; if so, that's all this is.
+	 */
+	if (timer_early()) {
+		return;
+	}
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
 	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
-	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
-		schedule();
+	timer_tick();
+	if (schedule()) {
+		thread_yield();
 	}
-	thread_yield();
 }
 
 /*
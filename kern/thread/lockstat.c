@@ -0,0 +1,451 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock profiling. See lockstat.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <timer.h>
+#include <membar.h>
+#include <platform/maxcpus.h>
+#include <lockstat.h>
+
+/* Classes each cpu can keep track of. */
+#define LOCKSTAT_NCLASSES	128
+
+/* Sleep lock names are kept to this length, including the null. */
+#define LOCKSTAT_NAMELEN	16
+
+struct lockstat_class {
+	bool lc_used;
+	const void *lc_pc;		/* spinlocks: where acquired */
+	char lc_name[LOCKSTAT_NAMELEN];	/* sleep locks: lock name */
+	unsigned lc_acquires;
+	unsigned lc_contended;		/* found it held */
+	unsigned lc_spins;		/* ...and spun (sleep locks) */
+	unsigned lc_sleeps;		/* ...and slept (sleep locks) */
+	uint64_t lc_spinnsec;		/* time waited spinning */
+	uint64_t lc_sleepnsec;		/* ...and sleeping */
+	unsigned lc_holds;		/* holds timed */
+	uint64_t lc_holdnsec;		/* ...and their total */
+	uint64_t lc_maxhold;
+};
+
+/*
+ * One cpu's classes, open hashed. lt_gen is the lockstat_gen the
+ * counts belong to; a reset just advances lockstat_gen, and each
+ * table is cleared the next time its cpu records something, so reset
+ * doesn't have to reach into other cpus' tables while they use them.
+ */
+struct lockstat_table {
+	unsigned lt_gen;
+	unsigned lt_overflow;		/* acquisitions with no room */
+	struct lockstat_class lt_classes[LOCKSTAT_NCLASSES];
+};
+
+bool lockstat_enabled;
+static volatile unsigned lockstat_gen;
+static struct lockstat_table *lockstat_tables[MAXCPUS];
+
+////////////////////////////////////////////////////////////
+// Recording; all with interrupts off, on the current cpu's table
+
+static
+void
+lt_clear(struct lockstat_table *lt)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NCLASSES; i++) {
+		lt->lt_classes[i].lc_used = false;
+	}
+	lt->lt_overflow = 0;
+	lt->lt_gen = lockstat_gen;
+}
+
+/*
+ * Get the current cpu's table, up to date, or NULL if it hasn't got
+ * one (it started after lockstat_start).
+ */
+static
+struct lockstat_table *
+lt_get(void)
+{
+	struct lockstat_table *lt;
+
+	lt = lockstat_tables[curcpu->c_number];
+	if (lt != NULL && lt->lt_gen != lockstat_gen) {
+		lt_clear(lt);
+	}
+	return lt;
+}
+
+static
+unsigned
+lt_hashname(const char *name)
+{
+	unsigned h = 0;
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+		h = h * 31 + (unsigned char)name[i];
+	}
+	return h;
+}
+
+/*
+ * Compare NAME, cut to LOCKSTAT_NAMELEN-1 characters, with a name in
+ * a class.
+ */
+static
+bool
+lc_samename(const char *lcname, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN-1; i++) {
+		if (lcname[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+static
+bool
+lc_matches(struct lockstat_class *lc, const void *pc, const char *name)
+{
+	if (pc != NULL) {
+		return lc->lc_pc == pc;
+	}
+	return lc->lc_pc == NULL && lc_samename(lc->lc_name, name);
+}
+
+/*
+ * Count a hold of HOLD nanoseconds.
+ */
+static
+void
+lc_hold(struct lockstat_class *lc, uint64_t hold)
+{
+	lc->lc_holds++;
+	lc->lc_holdnsec += hold;
+	if (hold > lc->lc_maxhold) {
+		lc->lc_maxhold = hold;
+	}
+}
+
+/*
+ * Find the class for spinlocks acquired at PC, or if PC is NULL for
+ * sleep locks called NAME, making it if need be. NULL if the table is
+ * full.
+ */
+static
+struct lockstat_class *
+lt_lookup(struct lockstat_table *lt, const void *pc, const char *name)
+{
+	struct lockstat_class *lc;
+	unsigned h, i, j;
+
+	h = pc != NULL ? (uintptr_t)pc >> 2 : lt_hashname(name);
+	for (i=0; i<LOCKSTAT_NCLASSES; i++) {
+		lc = &lt->lt_classes[(h + i) % LOCKSTAT_NCLASSES];
+		if (!lc->lc_used) {
+			lc->lc_used = true;
+			lc->lc_pc = pc;
+			lc->lc_name[0] = 0;
+			if (pc == NULL) {
+				for (j=0; j<LOCKSTAT_NAMELEN-1 && name[j]; j++) {
+					lc->lc_name[j] = name[j];
+				}
+				lc->lc_name[j] = 0;
+			}
+			lc->lc_acquires = 0;
+			lc->lc_contended = 0;
+			lc->lc_spins = 0;
+			lc->lc_sleeps = 0;
+			lc->lc_spinnsec = 0;
+			lc->lc_sleepnsec = 0;
+			lc->lc_holds = 0;
+			lc->lc_holdnsec = 0;
+			lc->lc_maxhold = 0;
+			return lc;
+		}
+		if (lc_matches(lc, pc, name)) {
+			return lc;
+		}
+	}
+	lt->lt_overflow++;
+	return NULL;
+}
+
+void
+lockstat_spinacquired(struct spinlock *splk, const void *pc,
+		      bool contended, uint64_t waitnsec)
+{
+	struct lockstat_table *lt;
+	struct lockstat_class *lc;
+
+	lt = lt_get();
+	if (lt == NULL) {
+		return;
+	}
+	lc = lt_lookup(lt, pc, NULL);
+	if (lc == NULL) {
+		return;
+	}
+	lc->lc_acquires++;
+	if (contended) {
+		lc->lc_contended++;
+		lc->lc_spinnsec += waitnsec;
+	}
+	splk->splk_stat = lc;
+	splk->splk_statgen = lt->lt_gen;
+	splk->splk_stattime = timer_now();
+}
+
+void
+lockstat_spinreleased(struct spinlock *splk)
+{
+	struct lockstat_class *lc = splk->splk_stat;
+	uint64_t hold;
+
+	splk->splk_stat = NULL;
+	/*
+	 * Spinlocks don't move cpus, so LC is in our table; but if it's
+	 * been reset since, the slot may have been cleared and given to
+	 * another class, so only count it if still the same generation.
+	 */
+	if (splk->splk_statgen == lockstat_gen &&
+	    lockstat_tables[curcpu->c_number]->lt_gen == lockstat_gen) {
+		hold = timer_now() - splk->splk_stattime;
+		lc_hold(lc, hold);
+	}
+}
+
+void
+lockstat_sleepacquired(struct lock *lk, bool spun, bool slept,
+		       uint64_t spinnsec, uint64_t sleepnsec)
+{
+	struct lockstat_table *lt;
+	struct lockstat_class *lc;
+
+	lt = lt_get();
+	if (lt == NULL) {
+		return;
+	}
+	lc = lt_lookup(lt, NULL, lk->lk_name);
+	if (lc == NULL) {
+		return;
+	}
+	lc->lc_acquires++;
+	if (spun || slept) {
+		lc->lc_contended++;
+		lc->lc_spinnsec += spinnsec;
+		lc->lc_sleepnsec += sleepnsec;
+	}
+	if (spun) {
+		lc->lc_spins++;
+	}
+	if (slept) {
+		lc->lc_sleeps++;
+	}
+}
+
+void
+lockstat_sleepreleased(struct lock *lk, uint64_t holdnsec)
+{
+	struct lockstat_table *lt;
+	struct lockstat_class *lc;
+
+	lt = lt_get();
+	if (lt == NULL) {
+		return;
+	}
+	lc = lt_lookup(lt, NULL, lk->lk_name);
+	if (lc != NULL) {
+		lc_hold(lc, holdnsec);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Control
+
+int
+lockstat_start(void)
+{
+	struct lockstat_table *lt;
+	unsigned i;
+
+	for (i=0; i<num_cpus; i++) {
+		if (lockstat_tables[i] != NULL) {
+			continue;
+		}
+		lt = kmalloc(sizeof(*lt));
+		if (lt == NULL) {
+			return ENOMEM;
+		}
+		/* Different from lockstat_gen, so it's cleared first. */
+		lt->lt_gen = lockstat_gen - 1;
+		lockstat_tables[i] = lt;
+	}
+	membar_store_store();
+	lockstat_enabled = true;
+	return 0;
+}
+
+void
+lockstat_stop(void)
+{
+	lockstat_enabled = false;
+}
+
+void
+lockstat_reset(void)
+{
+	lockstat_gen++;
+}
+
+/*
+ * Add LC into the summary SUM of NSUM classes, which has room for
+ * LOCKSTAT_NCLASSES. Returns false if it's full.
+ */
+static
+bool
+lockstat_merge(struct lockstat_class *sum, unsigned *nsum,
+	       const struct lockstat_class *lc)
+{
+	struct lockstat_class *s;
+	unsigned i;
+
+	for (i=0; i<*nsum; i++) {
+		s = &sum[i];
+		if (lc->lc_pc != NULL ? s->lc_pc == lc->lc_pc :
+		    (s->lc_pc == NULL && !strcmp(s->lc_name, lc->lc_name))) {
+			s->lc_acquires += lc->lc_acquires;
+			s->lc_contended += lc->lc_contended;
+			s->lc_spins += lc->lc_spins;
+			s->lc_sleeps += lc->lc_sleeps;
+			s->lc_spinnsec += lc->lc_spinnsec;
+			s->lc_sleepnsec += lc->lc_sleepnsec;
+			s->lc_holds += lc->lc_holds;
+			s->lc_holdnsec += lc->lc_holdnsec;
+			if (lc->lc_maxhold > s->lc_maxhold) {
+				s->lc_maxhold = lc->lc_maxhold;
+			}
+			return true;
+		}
+	}
+	if (*nsum == LOCKSTAT_NCLASSES) {
+		return false;
+	}
+	sum[(*nsum)++] = *lc;
+	return true;
+}
+
+void
+lockstat_print(void)
+{
+	struct lockstat_class *sum, *lc, tmp;
+	unsigned nsum, overflow, i, j;
+	struct lockstat_table *lt;
+
+	sum = kmalloc(LOCKSTAT_NCLASSES * sizeof(*sum));
+	if (sum == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	/*
+	 * Read the other cpus' tables as they go; the counts may be a
+	 * little off, which is fine for this.
+	 */
+	nsum = 0;
+	overflow = 0;
+	for (i=0; i<num_cpus; i++) {
+		lt = lockstat_tables[i];
+		if (lt == NULL || lt->lt_gen != lockstat_gen) {
+			continue;
+		}
+		overflow += lt->lt_overflow;
+		for (j=0; j<LOCKSTAT_NCLASSES; j++) {
+			lc = &lt->lt_classes[j];
+			if (lc->lc_used && !lockstat_merge(sum, &nsum, lc)) {
+				overflow += lc->lc_acquires;
+			}
+		}
+	}
+
+	/* Most time waited first */
+	for (i=1; i<nsum; i++) {
+		tmp = sum[i];
+		for (j=i; j>0 && sum[j-1].lc_spinnsec + sum[j-1].lc_sleepnsec <
+			     tmp.lc_spinnsec + tmp.lc_sleepnsec; j--) {
+			sum[j] = sum[j-1];
+		}
+		sum[j] = tmp;
+	}
+
+	kprintf("Lock profile (%s), times in ns; spinlocks are listed "
+		"by where acquired:\n", lockstat_enabled ? "on" : "off");
+	kprintf("%-11s %8s %7s %5s %6s %9s %9s %8s %8s\n", "class",
+		"acquires", "contend", "spins", "sleeps", "spin ns",
+		"sleep ns", "avg hold", "max hold");
+	for (i=0; i<nsum; i++) {
+		lc = &sum[i];
+		if (lc->lc_pc != NULL) {
+			kprintf("%-11p", lc->lc_pc);
+		}
+		else {
+			kprintf("%-11s", lc->lc_name);
+		}
+		kprintf(" %8u %7u %5u %6u %9llu %9llu %8llu %8llu\n",
+			lc->lc_acquires, lc->lc_contended, lc->lc_spins,
+			lc->lc_sleeps, (unsigned long long)lc->lc_spinnsec,
+			(unsigned long long)lc->lc_sleepnsec,
+			(unsigned long long)(lc->lc_holds > 0 ?
+				lc->lc_holdnsec / lc->lc_holds : 0),
+			(unsigned long long)lc->lc_maxhold);
+	}
+	if (overflow > 0) {
+		kprintf("lockstat: %u acquisitions not recorded: "
+			"too many classes\n", overflow);
+	}
+
+	kfree(sum);
+}
@@ -30,6 +30,7 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define ATOMIC_INLINE     /* empty */
 
 #include <types.h>
 #include <lib.h>
@@ -37,12 +38,21 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <atomic.h>
 #include <current.h>	/* for curcpu */
+#include <timer.h>
+#include <lockstat.h>
 
 /*
  * Spinlocks.
  */
 
+/*
+ * Delay loop iterations, per cpu ahead of us in line, between looks
+ * at the lock word.
+ */
+#define SPINLOCK_BACKOFF	16
+
 
 /*
  * Initialize spinlock.
@@ -50,8 +60,12 @@
 void
 spinlock_init(struct spinlock *splk)
 {
+	spinlock_data_set(&splk->splk_next, 0);
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+	splk->splk_stat = NULL;
+	splk->splk_stattime = 0;
+	splk->splk_statgen = 0;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
@@ -62,7 +76,8 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	KASSERT(spinlock_data_get(&splk->splk_lock) ==
+		spinlock_data_get(&splk->splk_next));
 }
 
 /*
@@ -70,12 +85,16 @@ spinlock_cleanup(struct spinlock *splk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket, and wait for it to be served.
  */
 void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, serving;
+	volatile unsigned delay;
+	bool stat, contended;
+	uint64_t waitstart;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,29 +112,45 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
+	/*
+	 * The only write to the lock while waiting; after that we
+	 * just read splk_lock, which changes once per release.
+	 * Tickets wrap around, which is fine as long as there are
+	 * fewer than 2^32 cpus.
+	 */
+	stat = lockstat_enabled && mycpu != NULL;
+	contended = false;
+	waitstart = 0;
+	ticket = spinlock_data_fetchinc(&splk->splk_next);
 	while (1) {
+		serving = spinlock_data_get(&splk->splk_lock);
+		if (serving == ticket) {
+			break;
+		}
+		if (stat && !contended) {
+			contended = true;
+			waitstart = timer_now();
+		}
 		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
+		 * Hold off longer the further back in line we are,
+		 * so the cpu that's next isn't competing for the
+		 * lock word with everyone else.
 		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
+		for (delay = (ticket - serving) * SPINLOCK_BACKOFF;
+		     delay > 0; delay--) {
+			/* nothing */
 		}
-		break;
 	}
 
-	membar_store_any();
+	membar_any_any();
 	splk->splk_holder = mycpu;
 
+	if (stat) {
+		lockstat_spinacquired(splk, __builtin_return_address(0),
+				      contended,
+				      contended ? timer_now() - waitstart : 0);
+	}
+
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
@@ -135,9 +170,16 @@ spinlock_release(struct spinlock *splk)
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 
+	/* Set only if profiling was on when it was acquired. */
+	if (splk->splk_stat != NULL) {
+		lockstat_spinreleased(splk);
+	}
+
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	/* Only the holder writes this, so no atomic op is needed. */
+	spinlock_data_set(&splk->splk_lock,
+			  spinlock_data_get(&splk->splk_lock) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
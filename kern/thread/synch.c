@@ -38,6 +38,10 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <objcache.h>
+#include <cpu.h>
+#include <timer.h>
+#include <lockstat.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -137,20 +141,37 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Most times a thread looks at a held lock, while its holder is
+ * running on another cpu, before going to sleep on it.
+ */
+#define LOCK_SPINS	1000
+
+static struct objcache *lock_cache;
+
+void
+synch_bootstrap(void)
+{
+	lock_cache = objcache_create("lock", sizeof(struct lock), NULL, NULL);
+	if (lock_cache == NULL) {
+		panic("synch_bootstrap: Out of memory\n");
+	}
+}
+
 struct lock *
 lock_create(const char *name)
 {
 
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(*lock));
+	lock = objcache_alloc(lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
 	lock->lk_name = kstrdup(name);
 	if (lock->lk_name == NULL) {
-		kfree(lock);
+		objcache_free(lock_cache, lock);
 		return NULL;
 	}
 
@@ -164,7 +185,7 @@ lock_create(const char *name)
 	lock->lk_wchan = wchan_create(lock->lk_name);
 	if (lock->lk_wchan == NULL) {
 		kfree(lock->lk_name);
-		kfree(lock);
+		objcache_free(lock_cache, lock);
 		return NULL;
 	}
 
@@ -172,6 +193,9 @@ lock_create(const char *name)
 	KASSERT(lock->lk_thread == NULL);
 	spinlock_init(&lock->lk_spinlock);
 
+	lock->lk_acqtime = 0;
+	lock->lk_acqcpu = NULL;
+
 	return lock;
 }
 
@@ -179,20 +203,42 @@ void
 lock_destroy(struct lock *lock)
 {
 	KASSERT(lock != NULL);
-	// add stuff here as needed
-
 
 	spinlock_cleanup(&lock->lk_spinlock);
 	wchan_destroy(lock->lk_wchan);
 	kfree(lock->lk_name);
 	KASSERT(lock->lk_thread == NULL);
-	kfree(lock);
+	objcache_free(lock_cache, lock);
+}
+
+/*
+ * True if OWNER is running right now on cpu C, which isn't ours. C is
+ * where OWNER was when last looked at under lk_spinlock. Once we let
+ * go of that OWNER may release the lock, exit and be freed, so this
+ * only compares OWNER, never follows it; cpus are never freed. If
+ * OWNER has moved this says no, and the caller looks again. C is
+ * volatile since the caller spins on this: each call has to read
+ * c_curthread and c_isidle again, not reuse what it got last time.
+ */
+static
+bool
+lock_ownerrunning(volatile struct cpu *c, volatile struct thread *owner)
+{
+	/* A cpu idling after OWNER slept still has it as c_curthread. */
+	return c != curcpu->c_self && c->c_curthread == owner &&
+		!c->c_isidle;
 }
 
 void
 lock_acquire(struct lock *lock)
 {
-	//write this
+	volatile struct thread *owner;
+	struct cpu *ownercpu;
+	unsigned spins;
+	bool spun, slept, stat;
+	struct cpu *startcpu;
+	uint64_t start, spinnsec, sleepnsec;
+
 	KASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
 
@@ -200,12 +246,43 @@ lock_acquire(struct lock *lock)
 	spinlock_acquire(&lock->lk_spinlock);
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
-	//If some other thread holds our lock, we join the wchan and sleep
-
-	//While used in the case of wakeall when another thread already acquires the lock before this one when woken up
-	while(lock->lk_thread != NULL) {
+	//If some other thread holds our lock, spin while it's running
+	//elsewhere, as it'll probably let go soon; otherwise join the wchan
+	//and sleep. Either way look again after, as someone else may have
+	//got in first. When profiling, each spell of spinning or sleeping
+	//is timed, unless it ended on another cpu, whose clock won't agree
+	spins = 0;
+	spun = slept = false;
+	stat = lockstat_enabled;
+	startcpu = NULL;
+	start = spinnsec = sleepnsec = 0;
+	while((owner = lock->lk_thread) != NULL) {
+		if(stat){
+			startcpu = curcpu->c_self;
+			start = timer_now();
+		}
+		//OWNER can't be freed while it holds the lock and we hold
+		//lk_spinlock, so this is the one place to follow it
+		ownercpu = owner->t_cpu;
+		if(spins < LOCK_SPINS && lock_ownerrunning(ownercpu, owner)) {
+			spinlock_release(&lock->lk_spinlock);
+			spun = true;
+			while(spins < LOCK_SPINS && lock->lk_thread == owner &&
+			      lock_ownerrunning(ownercpu, owner)) {
+				spins++;
+			}
+			spinlock_acquire(&lock->lk_spinlock);
+			if(stat && startcpu == curcpu->c_self){
+				spinnsec += timer_now() - start;
+			}
+			continue;
+		}
 		/* Call this (atomically) before waiting for a lock */
 		wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
+		slept = true;
+		if(stat && startcpu == curcpu->c_self){
+			sleepnsec += timer_now() - start;
+		}
 	}
 
 	//At this point, the lock shouldnt be held by any thread
@@ -216,21 +293,38 @@ lock_acquire(struct lock *lock)
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
 
-	spinlock_release(&lock->lk_spinlock);
-	// Write this
+	//Hold times are only taken while profiling, so the clock isn't read
+	//on every acquire and release otherwise
+	if(stat){
+		lockstat_sleepacquired(lock, spun, slept, spinnsec, sleepnsec);
+		lock->lk_acqcpu = curcpu->c_self;
+		lock->lk_acqtime = timer_now();
+	}
 
-	//(void)lock;  // suppress warning until code gets written
+	spinlock_release(&lock->lk_spinlock);
 }
 
 void
 lock_release(struct lock *lock)
 {
+	uint64_t hold;
+
 	// Write this
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
 
 	spinlock_acquire(&lock->lk_spinlock);
 
+	//Set only if profiling when it was acquired. Clocks on different
+	//cpus don't agree, so if we moved while holding it, leave this one out
+	if(lock->lk_acqcpu != NULL){
+		if(lock->lk_acqcpu == curcpu->c_self){
+			hold = timer_now() - lock->lk_acqtime;
+			lockstat_sleepreleased(lock, hold);
+		}
+		lock->lk_acqcpu = NULL;
+	}
+
 	//Sets lock's thread to NULL so when another thread is woken up, it can acquire the lock
 	lock->lk_thread = NULL;
 	/* Call this (atomically) when the lock is released */
@@ -314,6 +408,25 @@ cv_wait(struct cv *cv, struct lock *lock)
 
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, const struct timespec *timeout)
+{
+	int result;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock->lk_thread == curthread);
+
+	spinlock_acquire(&cv->cv_spinlock);
+	lock_release(lock);
+
+	result = wchan_sleep_timeout(cv->cv_wchan, &cv->cv_spinlock, timeout);
+
+	spinlock_release(&cv->cv_spinlock);
+	lock_acquire(lock);
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
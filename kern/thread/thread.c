@@ -35,6 +35,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/cpustat.h>
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
@@ -50,6 +51,10 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <objcache.h>
+#include <clock.h>
+#include <membar.h>
+#include <timer.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -75,6 +80,10 @@ unsigned thread_count = 0;
 static struct spinlock thread_count_lock = SPINLOCK_INITIALIZER;
 static struct wchan *thread_count_wchan;
 
+/* Object caches for thread stacks and wait channels. */
+static struct objcache *stack_cache;
+static struct objcache *wchan_cache;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -144,7 +153,16 @@ thread_create(const char *name)
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
+	thread->t_prio = 0;
+	thread->t_used = 0;
+	thread->t_epoch = 0;
+	thread->t_slice = 0;
+	thread->t_ranat = 0;
+	thread->t_affinity = CPUMASK_ALL;
+	thread->t_affgen = 0;
+	thread->t_wchan = NULL;
 	thread->t_proc = NULL;
+	thread->t_tid = 0;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
 	/* Interrupt state fields */
@@ -171,6 +189,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -184,15 +203,32 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_migrant = NULL;
+	c->c_spare = NULL;
+	kheap_cpu_init(c);
+	timer_cpu_init(c);
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	c->c_needresched = false;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+	c->c_epoch = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
 
+	c->c_switches = 0;
+	c->c_stealtries = 0;
+	c->c_steals = 0;
+	c->c_idles = 0;
+	c->c_kicks = 0;
+	c->c_wakeups = 0;
+	c->c_ipis = 0;
+
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
@@ -215,7 +251,7 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		c->c_curthread->t_stack = objcache_alloc(stack_cache);
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -278,7 +314,7 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		objcache_free(stack_cache, thread->t_stack);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -316,6 +352,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *rq;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -330,9 +369,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		rq = &curcpu->c_runqueue[i];
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -367,6 +410,25 @@ thread_shutdown(void)
 	ipi_broadcast(IPI_OFFLINE);
 }
 
+/*
+ * Make the object caches used by the thread system. This must happen
+ * before anything creates a wait channel, which is rather earlier
+ * than thread_bootstrap.
+ */
+void
+thread_cache_bootstrap(void)
+{
+	stack_cache = objcache_create("thread stack", STACK_SIZE, NULL, NULL);
+	if (stack_cache == NULL) {
+		panic("thread_cache_bootstrap: Out of memory\n");
+	}
+	wchan_cache = objcache_create("wchan", sizeof(struct wchan),
+				      NULL, NULL);
+	if (wchan_cache == NULL) {
+		panic("thread_cache_bootstrap: Out of memory\n");
+	}
+}
+
 /*
  * Thread system initialization.
  */
@@ -420,6 +482,59 @@ cpu_hatch(unsigned software_number)
 	thread_exit();
 }
 
+/*
+ * Each cpu gets a spare thread to switch to when the thread running
+ * there has to leave and there's nothing else to run; idling on the
+ * leaving thread's stack would keep it from running anywhere else.
+ * The spare is never on a run queue except while being switched to.
+ * It hands the other thread on (in the tail of thread_switch, or in
+ * thread_startup the first time) and then yields, which thread_switch
+ * treats as parking it.
+ */
+static
+void
+thread_sparemain(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		thread_yield();
+	}
+}
+
+static
+void
+thread_makespare(struct cpu *c)
+{
+	char name[16];
+	struct thread *t;
+
+	snprintf(name, sizeof(name), "<spare%u>", c->c_number);
+	t = thread_create(name);
+	if (t == NULL) {
+		panic("thread_makespare: Out of memory\n");
+	}
+	t->t_stack = objcache_alloc(stack_cache);
+	if (t->t_stack == NULL) {
+		panic("thread_makespare: Out of memory\n");
+	}
+	thread_checkstack_init(t);
+	t->t_cpu = c;
+	t->t_affinity = CPUMASK(c->c_number);
+	t->t_affgen = kproc->p_affgen;
+	if (proc_addthread(kproc, t)) {
+		panic("thread_makespare: proc_addthread failed\n");
+	}
+	/* Comes out holding the run queue lock, as in thread_fork. */
+	t->t_iplhigh_count++;
+	switchframe_init(t, thread_sparemain, NULL, 0);
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	c->c_spare = t;
+	spinlock_release(&c->c_runqueue_lock);
+}
+
 /*
  * Start up secondary cpus. Called from boot().
  */
@@ -448,6 +563,10 @@ thread_start_cpus(void)
 	}
 	cpu_startup_sem = NULL;
 
+	for (i=0; i<num_cpus; i++) {
+		thread_makespare(cpuarray_get(&allcpus, i));
+	}
+
 	// Gross hack to deal with os/161 "idle" threads. Hardcode the thread count
 	// to 1 so the inc/dec properly works in thread_[fork/exit]. The one thread
 	// is the cpu0 boot thread (menu), which is the only thread that hasn't
@@ -455,6 +574,456 @@ thread_start_cpus(void)
 	thread_count = 1;
 }
 
+/*
+ * Get the statistics for cpu NUM.
+ */
+int
+cpu_getstat(unsigned num, struct cpustat *cs)
+{
+	struct cpu *c;
+
+	if (num >= cpuarray_num(&allcpus)) {
+		return EINVAL;
+	}
+	c = cpuarray_get(&allcpus, num);
+	cs->cs_hardclocks = c->c_hardclocks;
+	cs->cs_switches = c->c_switches;
+	cs->cs_stealtries = c->c_stealtries;
+	cs->cs_steals = c->c_steals;
+	cs->cs_idles = c->c_idles;
+	cs->cs_kicks = c->c_kicks;
+	cs->cs_wakeups = c->c_wakeups;
+	cs->cs_ipis = c->c_ipis;
+	return 0;
+}
+
+/*
+ * Print every cpu's statistics.
+ */
+void
+cpu_printstats(void)
+{
+	struct cpustat cs;
+	unsigned i;
+
+	kprintf("cpu    ticks  switches  stealtries  steals    idles"
+		"   kicks  wakeups     ipis\n");
+	for (i=0; cpu_getstat(i, &cs) == 0; i++) {
+		kprintf("%3u %8u  %8u  %10u  %6u  %7u  %6u  %7u  %7u\n",
+			i, cs.cs_hardclocks, cs.cs_switches,
+			cs.cs_stealtries, cs.cs_steals, cs.cs_idles,
+			cs.cs_kicks, cs.cs_wakeups, cs.cs_ipis);
+	}
+}
+
+/*
+ * Run queues.
+ *
+ * Each cpu has one run queue per priority level; level 0 is the
+ * highest. Threads are always taken from the highest nonempty level.
+ * A thread that uses up its allotment of ticks at one level is moved
+ * down a level (see schedule() below); a thread that sleeps and is
+ * woken moves back up. Every SCHED_BOOST_HARDCLOCKS the global epoch
+ * advances and everything goes back to level 0, so CPU-bound threads
+ * can't be starved for good by a stream of interactive ones.
+ *
+ * A thread runs until its time slice is used up or a thread at a
+ * higher level becomes runnable on its cpu, not just for one tick.
+ * Slices get longer further down, so batch jobs that have sunk to
+ * the bottom switch less often. A thread preempted early keeps what
+ * is left of its slice; one that used it all, or changed level, gets
+ * a fresh one the next time it is picked to run.
+ *
+ * All of this is protected by the cpu's run queue lock.
+ */
+
+/* Ticks a thread may run at level P before being demoted. */
+#define SCHED_ALLOT(p)		(5U << (p))
+
+/* Length of a time slice at level P, in ticks. */
+#define SCHED_QUANTUM(p)	(1U << (p))
+
+/* A thread that ran this recently still has its cache on its cpu. */
+#define SCHED_HOT_HARDCLOCKS	2
+
+/* Raise everything to the top level once a second. */
+#define SCHED_BOOST_HARDCLOCKS	HZ
+
+static volatile unsigned sched_epoch;
+static unsigned sched_boostat;		/* cpu 0's c_hardclocks at the last */
+
+static
+void
+runq_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_prio < SCHED_NPRIO);
+	threadlist_addtail(&c->c_runqueue[t->t_prio], t);
+	c->c_runcount++;
+}
+
+/*
+ * Take the next thread to run: the first one at the highest level.
+ */
+static
+struct thread *
+runq_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned p;
+
+	for (p=0; p<SCHED_NPRIO; p++) {
+		t = threadlist_remhead(&c->c_runqueue[p]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * A sleeping thread has been woken up: move it up a level, or all
+ * the way to the top if a boost happened while it was asleep. Its
+ * tick count starts over either way.
+ */
+static
+void
+thread_wakeboost(struct thread *t)
+{
+	if (t->t_epoch != sched_epoch) {
+		t->t_epoch = sched_epoch;
+		t->t_prio = 0;
+	}
+	else if (t->t_prio > 0) {
+		t->t_prio--;
+	}
+	t->t_used = 0;
+	t->t_slice = 0;
+}
+
+/*
+ * Affinity.
+ *
+ * A thread may only be put on the run queue of a cpu in its
+ * t_affinity. A process-wide change (see sys_setaffinity) is picked
+ * up lazily: each thread copies p_affinity when it sees p_affgen has
+ * moved on, which it checks when it's woken and on each tick it runs.
+ * That's done without p_lock, which can't be taken here since the
+ * wakeup may be coming from under it; the setter stores the mask
+ * before bumping the generation, and we read them the other way
+ * round.
+ *
+ * A thread can't be moved while a cpu is still running on its stack.
+ * So when the current thread finds it isn't allowed where it is, it
+ * yields; thread_switch parks it in c_migrant rather than on the run
+ * queue, and whatever runs next hands it on with thread_migrate().
+ * If there is nothing else to run, the cpu's spare thread (see
+ * thread_makespare) is run instead, so the cpu idles on its stack.
+ */
+
+static
+bool
+thread_allowed(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & CPUMASK(c->c_number)) != 0;
+}
+
+static
+void
+thread_syncaffinity(struct thread *t)
+{
+	struct proc *p;
+	unsigned gen;
+
+	p = t->t_proc;
+	if (p == NULL) {
+		return;
+	}
+	gen = p->p_affgen;
+	if (gen != t->t_affgen) {
+		membar_load_load();
+		t->t_affinity = p->p_affinity;
+		t->t_affgen = gen;
+	}
+}
+
+/*
+ * Choose the cpu a thread being made runnable should go to: where it
+ * was, if it's allowed there or that cpu is still on its stack, and
+ * otherwise the least busy cpu it's allowed on.
+ */
+static
+struct cpu *
+thread_place(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+	bool busy;
+
+	thread_syncaffinity(t);
+	if (thread_allowed(t, t->t_cpu)) {
+		return t->t_cpu;
+	}
+
+	spinlock_acquire(&t->t_cpu->c_runqueue_lock);
+	busy = t->t_cpu->c_curthread == t;
+	spinlock_release(&t->t_cpu->c_runqueue_lock);
+	if (busy) {
+		/* It'll move when it's next switched out. */
+		return t->t_cpu;
+	}
+
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (thread_allowed(t, c) &&
+		    (best == NULL || c->c_runcount < best->c_runcount)) {
+			best = c;
+		}
+	}
+	if (best == NULL) {
+		/* Can't happen unless the mask was never checked */
+		return t->t_cpu;
+	}
+	/*
+	 * t_ranat was on the old cpu's clock. T has nothing in BEST's
+	 * cache, so count it as cold there.
+	 */
+	t->t_cpu = best;
+	t->t_ranat = best->c_hardclocks - SCHED_HOT_HARDCLOCKS;
+	return best;
+}
+
+/*
+ * Work stealing.
+ *
+ * There is no periodic load balancing. A cpu that runs out of things
+ * to do goes looking for work instead: it picks the cpu with the most
+ * threads waiting and pulls one of them across. Idle cpus don't
+ * tick (see timer.c), so busy cpus point them at work instead: when a
+ * thread is queued behind something, and on each tick while a
+ * backlog is waiting (thread_kickidle, thread_kickbacklog).
+ *
+ * Moving a thread costs it its cache, so one that ran on its cpu in
+ * the last SCHED_HOT_HARDCLOCKS stays put, as does one whose affinity
+ * doesn't include the thief.
+ */
+
+/*
+ * Check if T, waiting on C's run queue, may be moved to another cpu.
+ */
+static
+bool
+thread_stealable(struct cpu *c, struct thread *t)
+{
+	/*
+	 * Curthread can turn up on its own cpu's run queue if it went
+	 * to sleep and was woken again before the cpu finished
+	 * switching away from it. Moving it then would be fatal.
+	 */
+	if (t == c->c_curthread) {
+		return false;
+	}
+	if (!thread_allowed(t, curcpu->c_self)) {
+		return false;
+	}
+	if (c->c_hardclocks - t->t_ranat < SCHED_HOT_HARDCLOCKS) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * T has just been queued on busy cpu C, or is still waiting there (see
+ * thread_kickbacklog). Idle cpus don't have a tick to go looking for
+ * work with, so if T could be stolen, wake one that may run it to
+ * come and take it. Unlocked peeks: at worst a
+ * cpu wakes for nothing, or T waits for C. Returns true if some cpu
+ * was pointed at T.
+ */
+static
+bool
+thread_kickidle(struct cpu *c, struct thread *t)
+{
+	struct cpu *idle;
+	unsigned i, numcpus;
+
+	if (t == c->c_curthread ||
+	    c->c_hardclocks - t->t_ranat < SCHED_HOT_HARDCLOCKS) {
+		return false;
+	}
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<numcpus; i++) {
+		idle = cpuarray_get(&allcpus, (c->c_number + i) % numcpus);
+		if (idle->c_isidle && idle->c_runcount == 0 &&
+		    thread_allowed(t, idle)) {
+			if (idle != curcpu->c_self) {
+				ipi_send(idle, IPI_UNIDLE);
+				curcpu->c_kicks++;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Called on each tick of busy cpu C, whose run queue lock we hold.
+ * Threads queued here without a kick, such as ones preempted while
+ * hot, would otherwise wait for C while idle cpus sleep out their
+ * whole idle timeout. So if any of them may be stolen by now, wake an
+ * idle cpu that may run it. Looks from where runq_steal does.
+ */
+static
+void
+thread_kickbacklog(struct cpu *c)
+{
+	struct threadlistnode *tln;
+	unsigned i, numcpus, p;
+	bool anyidle;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	/* Usually nobody is idle; don't walk the queue for nothing. */
+	anyidle = false;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus && !anyidle; i++) {
+		anyidle = cpuarray_get(&allcpus, i)->c_isidle;
+	}
+	if (!anyidle) {
+		return;
+	}
+
+	for (p=SCHED_NPRIO; p-- > 0; ) {
+		for (tln = c->c_runqueue[p].tl_tail.tln_prev;
+		     tln->tln_self != NULL;
+		     tln = tln->tln_prev) {
+			if (thread_kickidle(c, tln->tln_self)) {
+				return;
+			}
+		}
+	}
+}
+
+/*
+ * Take a thread off C's run queue for some other cpu: the last one
+ * at the lowest level that may be moved.
+ */
+static
+struct thread *
+runq_steal(struct cpu *c)
+{
+	struct threadlistnode *tln;
+	struct thread *t;
+	unsigned p;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (p=SCHED_NPRIO; p-- > 0; ) {
+		for (tln = c->c_runqueue[p].tl_tail.tln_prev;
+		     tln->tln_self != NULL;
+		     tln = tln->tln_prev) {
+			t = tln->tln_self;
+			if (thread_stealable(c, t)) {
+				threadlist_remove(&c->c_runqueue[p], t);
+				c->c_runcount--;
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Find a thread on some other cpu and move it to the current cpu's
+ * run queue. Returns true if one was found. Must be called without
+ * holding any run queue lock.
+ */
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, most;
+
+	/*
+	 * Look for the busiest cpu without locking anything; the
+	 * counts are only a hint, and rechecked under the lock below.
+	 * Start with our neighbor so ties don't all go to cpu 0.
+	 */
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, (curcpu->c_number + i) % numcpus);
+		if (c->c_runcount > most) {
+			most = c->c_runcount;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	curcpu->c_stealtries++;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = runq_steal(victim);
+	spinlock_release(&victim->c_runqueue_lock);
+	if (t == NULL) {
+		return false;
+	}
+	curcpu->c_steals++;
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	t->t_cpu = curcpu->c_self;
+	/* Count it as hot here, so it doesn't get bounced straight on. */
+	t->t_ranat = curcpu->c_hardclocks;
+	runq_add(curcpu, t);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return true;
+}
+
+/*
+ * Put TARGET on cpu C's run queue, whose lock we hold. Returns the
+ * interprocessor interrupt C needs to notice it, or -1 if none: idle
+ * cpus are woken, and busy ones told to reschedule when TARGET
+ * outranks what they're running. The caller sends it, so wakeups
+ * going to the same cpu can share one.
+ */
+static
+int
+runq_wake(struct cpu *c, struct thread *target)
+{
+	target->t_state = S_READY;
+	runq_add(c, target);
+	curcpu->c_wakeups++;
+
+	if (c == curcpu->c_self) {
+		if (!c->c_isidle &&
+		    target->t_prio < c->c_curthread->t_prio) {
+			c->c_needresched = true;
+		}
+		return -1;
+	}
+	if (c->c_isidle) {
+		return IPI_UNIDLE;
+	}
+	if (target->t_prio < c->c_curthread->t_prio) {
+		/*
+		 * Target outranks what the cpu is running now; have
+		 * that give way as soon as it can.
+		 */
+		c->c_needresched = true;
+		return IPI_RESCHED;
+	}
+	return -1;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -465,28 +1034,28 @@ void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
+	int ipi;
 
 	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
-
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
+		targetcpu = target->t_cpu;
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
 	else {
+		/* This may move it, if its affinity says so. */
+		targetcpu = thread_place(target);
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
-	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
-
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
+	ipi = runq_wake(targetcpu, target);
+	if (!targetcpu->c_isidle) {
+		/* It'll have to wait; maybe someone else can take it. */
+		thread_kickidle(targetcpu, target);
+	}
+	if (ipi >= 0) {
+		ipi_send(targetcpu, ipi);
 	}
 
 	if (!already_have_lock) {
@@ -494,6 +1063,24 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 }
 
+/*
+ * Hand on the thread the previous context switch on this cpu parked
+ * in c_migrant, now that we're off its stack. Like exorcise(), must
+ * be called after every switch, with the run queue lock released.
+ */
+static
+void
+thread_migrate(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_migrant;
+	if (t != NULL) {
+		curcpu->c_migrant = NULL;
+		thread_make_runnable(t, false);
+	}
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -519,7 +1106,7 @@ thread_fork(const char *name,
 	}
 
 	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	newthread->t_stack = objcache_alloc(stack_cache);
 	if (newthread->t_stack == NULL) {
 		thread_destroy(newthread);
 		return ENOMEM;
@@ -537,6 +1124,8 @@ thread_fork(const char *name,
 	if (proc == NULL) {
 		proc = curthread->t_proc;
 	}
+	newthread->t_affinity = proc->p_affinity;
+	newthread->t_affgen = proc->p_affgen;
 	result = proc_addthread(proc, newthread);
 	if (result) {
 		/* thread_destroy will clean up the stack */
@@ -580,6 +1169,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
+	bool idled;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -604,9 +1194,23 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	curcpu->c_needresched = false;
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. The
+	 * thread keeps the cpu, on a fresh slice if it used this one
+	 * up; otherwise schedule() would have it yield every tick.
+	 * Not if it isn't allowed here any more, though (unless there's
+	 * no spare yet, early in boot), and never for the spare, which
+	 * yields to park.
+	 */
+	if (newstate == S_READY && curcpu->c_runcount == 0 &&
+	    cur != curcpu->c_spare &&
+	    (thread_allowed(cur, curcpu->c_self) ||
+	     curcpu->c_spare == NULL)) {
+		if (cur->t_slice == 0) {
+			cur->t_slice = SCHED_QUANTUM(cur->t_prio);
+		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -617,7 +1221,24 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (cur == curcpu->c_spare) {
+			/* Parked until the next thread leaves. */
+		}
+		else if (thread_allowed(cur, curcpu->c_self)) {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
+		else {
+			/*
+			 * Not allowed here any more; the next thread
+			 * will pass it on. If there's nothing else to
+			 * run, that's the spare.
+			 */
+			KASSERT(curcpu->c_migrant == NULL);
+			curcpu->c_migrant = cur;
+			if (curcpu->c_runcount == 0) {
+				runq_add(curcpu, curcpu->c_spare);
+			}
+		}
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
@@ -630,6 +1251,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		 * on the list.
 		 */
 		threadlist_addtail(&wc->wc_threads, cur);
+		cur->t_wchan = wc;
 		spinlock_release(lk);
 		break;
 	    case S_ZOMBIE:
@@ -638,6 +1260,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		break;
 	}
 	cur->t_state = newstate;
+	cur->t_ranat = curcpu->c_hardclocks;
 
 	/*
 	 * Get the next thread. While there isn't one, call cpu_idle().
@@ -656,17 +1279,37 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
+	/*
+	 * While there's nothing to do the cpu's tick is stopped (see
+	 * timer.c), so it only wakes up for an interrupt or its next
+	 * timer; work queued on busy cpus is pointed out to it by
+	 * thread_kickidle.
+	 */
+
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	idled = false;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runq_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal()) {
+				timer_idle();
+				curcpu->c_idles++;
+				cpu_idle();
+				idled = true;
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	if (idled) {
+		timer_resume();
+	}
+
+	if (next->t_slice == 0) {
+		next->t_slice = SCHED_QUANTUM(next->t_prio);
+	}
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -677,6 +1320,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 */
 	curcpu->c_curthread = next;
 	curthread = next;
+	if (next != cur) {
+		curcpu->c_switches++;
+	}
 
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
@@ -741,6 +1387,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on a thread leaving this cpu. */
+	thread_migrate();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -774,6 +1423,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on a thread leaving this cpu. */
+	thread_migrate();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -808,10 +1460,11 @@ thread_exit(void)
 	cur = curthread;
 
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * Detach from our process, unless proc_exit already did.
 	 */
-	proc_remthread(cur);
+	if (cur->t_proc != NULL) {
+		proc_remthread(cur);
+	}
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -881,144 +1534,118 @@ thread_yield(void)
 	thread_switch(S_READY, NULL, NULL);
 }
 
-////////////////////////////////////////////////////////////
-
 /*
- * Scheduler.
- *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Set the current thread's affinity. See thread.h.
  */
+int
+thread_setaffinity(uint32_t mask)
+{
+	unsigned numcpus;
 
-void
-schedule(void)
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 32) {
+		mask &= CPUMASK(numcpus) - 1;
+	}
+	if (mask == 0) {
+		return EINVAL;
+	}
+
+	curthread->t_affinity = mask;
+	if (!thread_allowed(curthread, curcpu->c_self)) {
+		thread_yield();
+	}
+	return 0;
+}
+
+int
+thread_bind(unsigned cpunum)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	if (cpunum >= 32) {
+		return EINVAL;
+	}
+	return thread_setaffinity(CPUMASK(cpunum));
 }
 
+////////////////////////////////////////////////////////////
+
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
+ * Scheduler.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * This is called from hardclock() on every tick. It charges the
+ * current thread for the tick, demoting it when it has used up its
+ * allotment at its level, and applies any pending priority boost to
+ * the current CPU's run queue. Returns true if the current thread
+ * should yield: its slice is over, or something of higher priority
+ * is waiting.
  */
-void
-thread_consider_migration(void)
+
+bool
+schedule(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
 	struct thread *t;
-
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
+	unsigned p;
+	bool resched;
+
+	/* Not every tick: cpu 0 may skip some while idle. */
+	if (curcpu->c_number == 0 &&
+	    curcpu->c_hardclocks - sched_boostat >= SCHED_BOOST_HARDCLOCKS) {
+		sched_boostat = curcpu->c_hardclocks;
+		sched_epoch++;
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
-	}
-
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
-	}
-	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
+	if (curcpu->c_epoch != sched_epoch) {
+		curcpu->c_epoch = sched_epoch;
+		for (p=1; p<SCHED_NPRIO; p++) {
+			while ((t = threadlist_remhead(&curcpu->c_runqueue[p]))
+			       != NULL) {
+				t->t_prio = 0;
+				t->t_used = 0;
+				t->t_epoch = curcpu->c_epoch;
+				threadlist_addtail(&curcpu->c_runqueue[0], t);
 			}
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	if (!curcpu->c_isidle) {
+		t = curthread;
+		thread_syncaffinity(t);
+		if (!thread_allowed(t, curcpu->c_self)) {
+			curcpu->c_needresched = true;
+		}
+		if (t->t_epoch != curcpu->c_epoch) {
+			t->t_epoch = curcpu->c_epoch;
+			t->t_prio = 0;
+			t->t_used = 0;
+		}
+		t->t_used++;
+		if (t->t_used >= SCHED_ALLOT(t->t_prio) &&
+		    t->t_prio < SCHED_NPRIO - 1) {
+			t->t_prio++;
+			t->t_used = 0;
+			t->t_slice = 0;
+		}
+		else if (t->t_slice > 0) {
+			t->t_slice--;
+		}
+		if (t->t_slice == 0) {
+			curcpu->c_needresched = true;
+		}
+		for (p=0; p<t->t_prio; p++) {
+			if (!threadlist_isempty(&curcpu->c_runqueue[p])) {
+				curcpu->c_needresched = true;
+				break;
+			}
+		}
+		if (curcpu->c_runcount > 0) {
+			thread_kickbacklog(curcpu->c_self);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
+	resched = curcpu->c_needresched;
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return resched;
 }
 
 ////////////////////////////////////////////////////////////
@@ -1040,7 +1667,7 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = objcache_alloc(wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
@@ -1058,7 +1685,7 @@ void
 wchan_destroy(struct wchan *wc)
 {
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	objcache_free(wchan_cache, wc);
 }
 
 /*
@@ -1084,6 +1711,67 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * A timed sleep. The timer finds the thread still on the wchan,
+ * checking t_wchan under the wchan's lock, or knows someone else has
+ * already woken it.
+ */
+struct wchan_timeout {
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	bool wt_timedout;
+};
+
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *target = wt->wt_thread;
+
+	spinlock_acquire(wt->wt_lock);
+	if (target->t_wchan == wt->wt_wchan) {
+		threadlist_remove(&wt->wt_wchan->wc_threads, target);
+		target->t_wchan = NULL;
+		wt->wt_timedout = true;
+		thread_wakeboost(target);
+		thread_make_runnable(target, false);
+	}
+	spinlock_release(wt->wt_lock);
+}
+
+int
+wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk,
+		    const struct timespec *timeout)
+{
+	struct wchan_timeout wt;
+	struct timer tm;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+
+	/* must hold the spinlock */
+	KASSERT(spinlock_do_i_hold(lk));
+
+	/* must not hold other spinlocks */
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	wt.wt_thread = curthread;
+	wt.wt_wchan = wc;
+	wt.wt_lock = lk;
+	wt.wt_timedout = false;
+	timer_init(&tm, wchan_timeout, &wt);
+	timer_start(&tm, timeout);
+
+	thread_switch(S_SLEEP, wc, lk);
+
+	/* Not holding LK, which the timer function takes. */
+	timer_cancel(&tm);
+	spinlock_acquire(lk);
+	return wt.wt_timedout ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1101,6 +1789,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 		/* Nobody was sleeping. */
 		return;
 	}
+	target->t_wchan = NULL;
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1110,6 +1799,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	thread_wakeboost(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1119,8 +1809,12 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 void
 wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 {
-	struct thread *target;
+	struct thread *target, *t;
+	struct threadlistnode *tln, *next;
 	struct threadlist list;
+	struct cpu *c;
+	bool kicked;
+	int ipi, tipi;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
@@ -1128,19 +1822,46 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 
 	/*
 	 * Grab all the threads from the channel, moving them to a
-	 * private list.
+	 * private list, and decide where each is to run.
 	 */
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
+		thread_wakeboost(target);
+		thread_place(target);
 		threadlist_addtail(&list, target);
 	}
 
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Then make them runnable a cpu at a time: take the cpu of the
+	 * first one left, and move everything going there to its run
+	 * queue under one acquisition of the lock, with at most one
+	 * interrupt to tell it so afterwards.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+		c = target->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		ipi = runq_wake(c, target);
+		kicked = c->c_isidle || thread_kickidle(c, target);
+		for (tln = list.tl_head.tln_next; tln != &list.tl_tail;
+		     tln = next) {
+			next = tln->tln_next;
+			t = tln->tln_self;
+			if (t->t_cpu != c) {
+				continue;
+			}
+			threadlist_remove(&list, t);
+			tipi = runq_wake(c, t);
+			if (tipi >= 0) {
+				ipi = tipi;
+			}
+			if (!kicked) {
+				kicked = thread_kickidle(c, t);
+			}
+		}
+		spinlock_release(&c->c_runqueue_lock);
+		if (ipi >= 0) {
+			ipi_send(c, ipi);
+		}
 	}
 
 	threadlist_cleanup(&list);
@@ -1178,6 +1899,10 @@ ipi_send(struct cpu *target, int code)
 	spinlock_acquire(&target->c_ipi_lock);
 	target->c_ipi_pending |= (uint32_t)1 << code;
 	mainbus_send_ipi(target);
+	/* Holding the lock keeps us on this cpu. */
+	if (CURCPU_EXISTS()) {
+		curcpu->c_ipis++;
+	}
 	spinlock_release(&target->c_ipi_lock);
 }
 
@@ -1232,6 +1957,25 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to all CPUs.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n = 0;
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1266,6 +2010,12 @@ interprocessor_interrupt(void)
 		 * interrupt; don't need to do anything else.
 		 */
 	}
+	if (bits & (1U << IPI_RESCHED)) {
+		/*
+		 * Handled below, once the IPI lock is released; the
+		 * sender has already set c_needresched.
+		 */
+	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
 		 * Note: depending on your VM system locking you might
@@ -1280,6 +2030,10 @@ interprocessor_interrupt(void)
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	if (curcpu->c_needresched) {
+		thread_yield();
+	}
 }
 
 /*
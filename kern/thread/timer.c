@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timers. See timer.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <clock.h>
+#include <mainbus.h>
+#include <timer.h>
+
+/* Slots in each wheel. Timers a multiple of this many ticks apart share. */
+#define TIMER_WHEELSIZE	256
+
+/* Length of a hardclock interval. */
+#define TICK_NSEC	(1000000000 / HZ)
+
+/* Longest delay, in seconds; longer ones are cut to this. */
+#define TIMER_MAXSEC	(0x40000000 / HZ)
+
+/*
+ * Most ticks an idle cpu skips in one go. Keeps the timer's
+ * nanosecond count well inside 32 bits, and bounds the catching up.
+ */
+#define TIMER_MAXIDLE	HZ
+
+/*
+ * One cpu's timers. tw_offset is how far into the current tick the
+ * last timer interrupt was: 0 after a hardclock, more after an early
+ * one. tw_early is how far into the tick the next early interrupt is
+ * set for, or 0 if there isn't one.
+ *
+ * While the cpu is idle its tick is stopped (tw_idle) and the timer
+ * set for tw_idlensec past the last interrupt, which may be many
+ * ticks on. c_hardclocks stands still meanwhile and is brought up to
+ * date when the timer next goes off.
+ */
+struct timerwheel {
+	struct spinlock tw_lock;
+	struct timer *tw_slots[TIMER_WHEELSIZE];
+	uint32_t tw_offset;
+	uint32_t tw_early;
+	bool tw_idle;
+	uint32_t tw_idlensec;
+	struct timer *tw_running;	/* whose function is being called */
+};
+
+void
+timer_cpu_init(struct cpu *c)
+{
+	struct timerwheel *tw;
+	unsigned i;
+
+	tw = kmalloc(sizeof(*tw));
+	if (tw == NULL) {
+		panic("timer_cpu_init: Out of memory\n");
+	}
+	spinlock_init(&tw->tw_lock);
+	for (i=0; i<TIMER_WHEELSIZE; i++) {
+		tw->tw_slots[i] = NULL;
+	}
+	tw->tw_offset = 0;
+	tw->tw_early = 0;
+	tw->tw_idle = false;
+	tw->tw_idlensec = 0;
+	tw->tw_running = NULL;
+	c->c_timers = tw;
+}
+
+////////////////////////////////////////////////////////////
+// Wheel internals; all called with tw_lock held
+
+static
+void
+tw_insert(struct timerwheel *tw, struct timer *tm)
+{
+	struct timer **slot;
+
+	slot = &tw->tw_slots[tm->tm_tick % TIMER_WHEELSIZE];
+	tm->tm_next = *slot;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prevp = &tm->tm_next;
+	}
+	*slot = tm;
+	tm->tm_prevp = slot;
+}
+
+static
+void
+tw_remove(struct timer *tm)
+{
+	*tm->tm_prevp = tm->tm_next;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prevp = tm->tm_prevp;
+	}
+	tm->tm_next = NULL;
+	tm->tm_prevp = NULL;
+}
+
+static
+bool
+tw_due(struct timerwheel *tw, struct timer *tm, unsigned now)
+{
+	if ((int)(tm->tm_tick - now) < 0) {
+		return true;
+	}
+	return tm->tm_tick == now && tm->tm_nsec <= tw->tw_offset;
+}
+
+/*
+ * Call the function of everything due in tick NOW. The lock is
+ * dropped around each call, so look for the next one afresh each
+ * time: the list may have changed.
+ */
+static
+void
+tw_run(struct timerwheel *tw, unsigned now)
+{
+	struct timer **slot, *tm;
+
+	slot = &tw->tw_slots[now % TIMER_WHEELSIZE];
+	while (1) {
+		for (tm = *slot; tm != NULL; tm = tm->tm_next) {
+			if (tw_due(tw, tm, now)) {
+				break;
+			}
+		}
+		if (tm == NULL) {
+			break;
+		}
+		tw_remove(tm);
+		tw->tw_running = tm;
+		spinlock_release(&tw->tw_lock);
+		tm->tm_func(tm->tm_data);
+		spinlock_acquire(&tw->tw_lock);
+		tw->tw_running = NULL;
+	}
+}
+
+/*
+ * Set the timer interrupt for the next thing due later in tick NOW,
+ * if anything is; otherwise, if we're partway through the tick, for
+ * the end of it.
+ */
+static
+void
+tw_setearly(struct timerwheel *tw, unsigned now)
+{
+	struct timer *tm;
+	uint32_t next;
+
+	next = 0;
+	for (tm = tw->tw_slots[now % TIMER_WHEELSIZE]; tm != NULL;
+	     tm = tm->tm_next) {
+		if (tm->tm_tick == now && tm->tm_nsec > tw->tw_offset &&
+		    (next == 0 || tm->tm_nsec < next)) {
+			next = tm->tm_nsec;
+		}
+	}
+
+	tw->tw_early = 0;
+	if (next != 0) {
+		if (mainbus_timer_set(next - tw->tw_offset)) {
+			tw->tw_early = next;
+		}
+	}
+	else if (tw->tw_offset > 0) {
+		mainbus_timer_set(TICK_NSEC - tw->tw_offset);
+	}
+}
+
+/*
+ * Time from the last timer interrupt until TM is due, given the tick
+ * NOW we're in.
+ */
+static
+uint32_t
+tw_until(struct timerwheel *tw, struct timer *tm, unsigned now)
+{
+	return (tm->tm_tick - now) * TICK_NSEC + tm->tm_nsec - tw->tw_offset;
+}
+
+/*
+ * The timer went off while the tick was stopped: tw_idlensec past
+ * the last interrupt. Run the ticks that were skipped. Returns true
+ * if that leaves us partway through a tick, like an early interrupt,
+ * or false if it's exactly on a tick, which is for hardclock to do.
+ */
+static
+bool
+tw_catchup(struct timerwheel *tw)
+{
+	uint32_t passed;
+	unsigned ticks;
+
+	tw->tw_idle = false;
+	passed = tw->tw_offset + tw->tw_idlensec;
+	ticks = passed / TICK_NSEC;
+	tw->tw_offset = passed % TICK_NSEC;
+	if (tw->tw_offset == 0) {
+		/* hardclock does the last one */
+		ticks--;
+	}
+	while (ticks > 0) {
+		curcpu->c_hardclocks++;
+		tw_run(tw, curcpu->c_hardclocks);
+		ticks--;
+	}
+	return tw->tw_offset != 0;
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+void
+timer_init(struct timer *tm, void (*func)(void *), void *data)
+{
+	tm->tm_next = NULL;
+	tm->tm_prevp = NULL;
+	tm->tm_cpu = NULL;
+	tm->tm_tick = 0;
+	tm->tm_nsec = 0;
+	tm->tm_func = func;
+	tm->tm_data = data;
+}
+
+void
+timer_start(struct timer *tm, const struct timespec *delay)
+{
+	struct timerwheel *tw;
+	unsigned now, sec;
+	uint32_t nsec;
+	int spl;
+
+	KASSERT(tm->tm_prevp == NULL);
+
+	sec = 0;
+	nsec = 0;
+	if (delay->tv_sec > 0) {
+		sec = delay->tv_sec > TIMER_MAXSEC ?
+			TIMER_MAXSEC : delay->tv_sec;
+	}
+	if (delay->tv_nsec > 0) {
+		nsec = delay->tv_nsec;
+	}
+
+	/* Stay on this cpu until it's on the wheel. */
+	spl = splhigh();
+	tm->tm_cpu = curcpu->c_self;
+	tw = tm->tm_cpu->c_timers;
+	spinlock_acquire(&tw->tw_lock);
+
+	/*
+	 * Count from where we are in the current tick, and always at
+	 * least a little, so it's never due in the past.
+	 */
+	now = curcpu->c_hardclocks;
+	nsec += tw->tw_offset + mainbus_timer_elapsed() + 1;
+	tm->tm_tick = now + sec * HZ + nsec / TICK_NSEC;
+	tm->tm_nsec = nsec % TICK_NSEC;
+	tw_insert(tw, tm);
+
+	if (tw->tw_idle) {
+		/* The tick is stopped; don't sleep past this one. */
+		nsec = tw_until(tw, tm, now);
+		if (nsec < tw->tw_idlensec && mainbus_timer_set(nsec)) {
+			tw->tw_idlensec = nsec;
+		}
+	}
+	else if (tm->tm_tick == now &&
+	    (tw->tw_early == 0 || tm->tm_nsec < tw->tw_early)) {
+		if (mainbus_timer_set(tm->tm_nsec - tw->tw_offset)) {
+			tw->tw_early = tm->tm_nsec;
+		}
+	}
+
+	spinlock_release(&tw->tw_lock);
+	splx(spl);
+}
+
+bool
+timer_cancel(struct timer *tm)
+{
+	struct timerwheel *tw;
+	bool pending;
+
+	if (tm->tm_cpu == NULL) {
+		return false;
+	}
+	tw = tm->tm_cpu->c_timers;
+
+	spinlock_acquire(&tw->tw_lock);
+	while (tm->tm_prevp == NULL && tw->tw_running == tm) {
+		/* Its function is running on that cpu; wait it out. */
+		spinlock_release(&tw->tw_lock);
+		spinlock_acquire(&tw->tw_lock);
+	}
+	pending = tm->tm_prevp != NULL;
+	if (pending) {
+		tw_remove(tm);
+	}
+	spinlock_release(&tw->tw_lock);
+	return pending;
+}
+
+bool
+timer_pending(struct timer *tm)
+{
+	return tm->tm_prevp != NULL;
+}
+
+uint64_t
+timer_now(void)
+{
+	struct timerwheel *tw;
+	uint64_t now;
+	int spl;
+
+	/* Only this cpu's interrupts change these. */
+	spl = splhigh();
+	tw = curcpu->c_timers;
+	now = (uint64_t)curcpu->c_hardclocks * TICK_NSEC + tw->tw_offset +
+		mainbus_timer_elapsed();
+	splx(spl);
+	return now;
+}
+
+/*
+ * Run this cpu's timers for a new tick.
+ */
+void
+timer_tick(void)
+{
+	struct timerwheel *tw = curcpu->c_timers;
+	unsigned now = curcpu->c_hardclocks;
+
+	spinlock_acquire(&tw->tw_lock);
+	tw->tw_offset = 0;
+	tw->tw_early = 0;
+	tw_run(tw, now);
+	tw_setearly(tw, now);
+	spinlock_release(&tw->tw_lock);
+}
+
+bool
+timer_early(void)
+{
+	struct timerwheel *tw = curcpu->c_timers;
+	unsigned now = curcpu->c_hardclocks;
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_idle) {
+		if (!tw_catchup(tw)) {
+			spinlock_release(&tw->tw_lock);
+			return false;
+		}
+		now = curcpu->c_hardclocks;
+	}
+	else if (tw->tw_early == 0) {
+		spinlock_release(&tw->tw_lock);
+		return false;
+	}
+	else {
+		tw->tw_offset = tw->tw_early;
+	}
+	tw_run(tw, now);
+	tw_setearly(tw, now);
+	spinlock_release(&tw->tw_lock);
+	return true;
+}
+
+/*
+ * Stop the tick on an idle cpu: set the timer for the next timer due
+ * on its wheel, or TIMER_MAXIDLE ticks on if none is sooner. Called
+ * by the idle loop, with interrupts off, before it waits.
+ */
+void
+timer_idle(void)
+{
+	struct timerwheel *tw = curcpu->c_timers;
+	struct timer *tm, *first;
+	unsigned now, i;
+	uint32_t until;
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_early != 0) {
+		/* Something is due later this tick; don't bother. */
+		spinlock_release(&tw->tw_lock);
+		return;
+	}
+
+	now = curcpu->c_hardclocks;
+	first = NULL;
+	for (i=1; i<TIMER_MAXIDLE && first == NULL; i++) {
+		for (tm = tw->tw_slots[(now + i) % TIMER_WHEELSIZE];
+		     tm != NULL; tm = tm->tm_next) {
+			if (tm->tm_tick == now + i &&
+			    (first == NULL || tm->tm_nsec < first->tm_nsec)) {
+				first = tm;
+			}
+		}
+	}
+	if (first != NULL) {
+		until = tw_until(tw, first, now);
+	}
+	else {
+		until = TIMER_MAXIDLE * TICK_NSEC - tw->tw_offset;
+	}
+
+	if (mainbus_timer_set(until)) {
+		tw->tw_idle = true;
+		tw->tw_idlensec = until;
+	}
+	spinlock_release(&tw->tw_lock);
+}
+
+/*
+ * Start the tick again on a cpu leaving the idle loop, if it was
+ * stopped: set the timer for the next tick boundary, where it
+ * catches up. Called with interrupts off.
+ */
+void
+timer_resume(void)
+{
+	struct timerwheel *tw = curcpu->c_timers;
+	uint32_t elapsed, next;
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_idle) {
+		elapsed = mainbus_timer_elapsed();
+		/* If it's already gone off, hardclock is on the way. */
+		if (elapsed < tw->tw_idlensec) {
+			next = ((tw->tw_offset + elapsed) / TICK_NSEC + 1)
+				* TICK_NSEC - tw->tw_offset;
+			if (next < tw->tw_idlensec &&
+			    mainbus_timer_set(next)) {
+				tw->tw_idlensec = next;
+			}
+		}
+	}
+	spinlock_release(&tw->tw_lock);
+}
@@ -42,6 +42,7 @@
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include <poll.h>
 
 /*
  * Called for each open().
@@ -150,6 +151,22 @@ dev_ioctl(struct vnode *v, int op, userptr_t data)
 	return DEVOP_IOCTL(d, op, data);
 }
 
+/*
+ * Called for poll(). Hand off to DEVOP_POLL if the device has one;
+ * if not, it never blocks.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollent *pe, int *revents)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_poll == NULL) {
+		return vop_poll_ready(v, events, pe, revents);
+	}
+	return DEVOP_POLL(d, events, pe, revents);
+}
+
 /*
  * Called for stat().
  * Set the type and the size (block devices only).
@@ -335,6 +352,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_stat = dev_stat,
 	.vop_gettype = dev_gettype,
 	.vop_isseekable = dev_isseekable,
+	.vop_poll = dev_poll,
 	.vop_fsync = null_fsync,
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
@@ -33,29 +33,52 @@
  #include <current.h>
  #include <filehandle.h>
  #include <vfs.h>
+ #include <kern/errno.h>
+ #include <objcache.h>
+ #include <atomic.h>
+
+static struct objcache *filehandle_cache;
+
+//The lock is made once per cached filehandle and kept across reuse
+static int
+filehandle_ctor(void *obj){
+  struct filehandle *filehandle = obj;
+  filehandle->fh_lock = lock_create("lock");
+  if(filehandle->fh_lock == NULL) return ENOMEM;
+  return 0;
+}
+
+static void
+filehandle_dtor(void *obj){
+  struct filehandle *filehandle = obj;
+  lock_destroy(filehandle->fh_lock);
+}
+
+void
+filehandle_bootstrap(void){
+  filehandle_cache = objcache_create("filehandle", sizeof(struct filehandle),
+                                     filehandle_ctor, filehandle_dtor);
+  if(filehandle_cache == NULL){
+    panic("filehandle_bootstrap: Out of memory\n");
+  }
+}
 
  struct filehandle *
  filehandle_create(const char *name){
    struct filehandle *filehandle;
 
-   filehandle = kmalloc(sizeof(struct filehandle));
+   //Comes with its lock already created
+   filehandle = objcache_alloc(filehandle_cache);
  	 if(filehandle == NULL){
  	 	return NULL;
 	 }
 
    filehandle->fh_name = kstrdup(name);
    if(filehandle->fh_name == NULL){
-     kfree(filehandle);
+     objcache_free(filehandle_cache, filehandle);
      return NULL;
    }
 
-  //create and associate lock
-  filehandle->fh_lock = lock_create("lock");
-  if(filehandle->fh_lock == NULL){
-    filehandle_destroy(filehandle);
-    return NULL;
-  }
-
   filehandle->fh_refcount = 0;
   filehandle->fh_offset = 0;
   filehandle->fh_flag = -3;
@@ -69,10 +92,23 @@ void
 filehandle_destroy(struct filehandle *filehandle){
   //No other processes point to this filehandle
   if(filehandle->fh_refcount == 0){
-    vfs_close(filehandle->fh_fileobj);
+    //A handle whose open failed never got a vnode
+    if(filehandle->fh_fileobj != NULL) vfs_close(filehandle->fh_fileobj);
     // if(filehandle->fh_fileobj->vn_refcount == 1) kfree(filehandle->fh_fileobj);
-    lock_destroy(filehandle->fh_lock);
     kfree(filehandle->fh_name);
-    kfree(filehandle);
+    objcache_free(filehandle_cache, filehandle);
+  }
+}
+
+void
+filehandle_incref(struct filehandle *filehandle){
+  atomic_add(&filehandle->fh_refcount, 1);
+}
+
+void
+filehandle_decref(struct filehandle *filehandle){
+  //Whoever takes it to zero is the only one left to see it
+  if(atomic_add(&filehandle->fh_refcount, -1) == 0){
+    filehandle_destroy(filehandle);
   }
 }
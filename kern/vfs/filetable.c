@@ -32,79 +32,303 @@
 #include <filetable.h>
 #include <proc.h>
 #include <lib.h>
+#include <limits.h>
+#include <current.h>
 #include <kern/errno.h>
 #include <file.h>
 
-struct filehandle **
+//Slots a new table starts with
+#define FILETABLE_MINSIZE 32
+
+//Allocates the slot and bitmap arrays for a table of SIZE, all free
+static
+int
+filetable_alloc(int size, struct filehandle ***slotsret, uint32_t **usedret){
+  struct filehandle **slots = kmalloc(sizeof(struct filehandle *) * size);
+  if(slots == NULL){
+    return ENOMEM;
+  }
+  uint32_t *used = kmalloc(sizeof(uint32_t) * (size / 32));
+  if(used == NULL){
+    kfree(slots);
+    return ENOMEM;
+  }
+  for(int i = 0; i < size; i++){
+    slots[i] = NULL;
+  }
+  for(int i = 0; i < size / 32; i++){
+    used[i] = 0;
+  }
+  *slotsret = slots;
+  *usedret = used;
+  return 0;
+}
+
+struct filetable *
 filetable_create(){
-  struct filehandle **filetable;
-  filetable = kmalloc(sizeof(struct filehandle *) * 64);
-  for(int i = 0; i < 64; i++){
-    filetable[i] = NULL;
+  struct filetable *ft;
+  ft = kmalloc(sizeof(struct filetable));
+  if(ft == NULL){
+    return NULL;
   }
+  if(filetable_alloc(FILETABLE_MINSIZE, &ft->ft_slots, &ft->ft_used)){
+    kfree(ft);
+    return NULL;
+  }
+  spinlock_init(&ft->ft_lock);
+  ft->ft_size = FILETABLE_MINSIZE;
 
-  return filetable;
+  return ft;
 }
 
-struct filehandle **
-filetable_createcopy(struct filehandle **src){
+struct filetable *
+filetable_createcopy(struct filetable *src){
   KASSERT(src != NULL);
-  struct filehandle **filetable;
-  filetable = kmalloc(sizeof(struct filehandle *) * 64);
-  if(filetable == NULL){
-    return NULL;
+  struct filehandle **slots;
+  uint32_t *used;
+  int size;
+
+  //kmalloc can sleep, so size the copy first and check it's still
+  //right once we hold the lock
+  spinlock_acquire(&src->ft_lock);
+  while(1){
+    size = src->ft_size;
+    spinlock_release(&src->ft_lock);
+    if(filetable_alloc(size, &slots, &used)){
+      return NULL;
+    }
+    spinlock_acquire(&src->ft_lock);
+    if(size == src->ft_size){
+      break;
+    }
+    kfree(slots);
+    kfree(used);
   }
-  for(int i = 0; i < 64; i++){
-    filetable[i] = src[i];
-    if(filetable[i] != NULL){
-      lock_acquire(filetable[i]->fh_lock);
-      filetable[i]->fh_refcount++;
-      // kprintf("\nFilehandle copied Refcount: %d\n", filetable[i]->fh_refcount);
-      lock_release(filetable[i]->fh_lock);
+
+  //Just a reference count bump per open file: no filehandle locks
+  for(int i = 0; i < size; i++){
+    slots[i] = src->ft_slots[i];
+    if(slots[i] != NULL){
+      filehandle_incref(slots[i]);
     }
   }
+  for(int i = 0; i < size / 32; i++){
+    used[i] = src->ft_used[i];
+  }
+  spinlock_release(&src->ft_lock);
 
-  return filetable;
+  struct filetable *ft = kmalloc(sizeof(struct filetable));
+  if(ft == NULL){
+    for(int i = 0; i < size; i++){
+      if(slots[i] != NULL) filehandle_decref(slots[i]);
+    }
+    kfree(slots);
+    kfree(used);
+    return NULL;
+  }
+  spinlock_init(&ft->ft_lock);
+  ft->ft_slots = slots;
+  ft->ft_used = used;
+  ft->ft_size = size;
+
+  return ft;
 }
 
 void
-filetable_destroy(struct filehandle **filetable){
-  for(unsigned int i = 0; i < 64; i++){
-    if(filetable[i] != NULL)filetable_remove(filetable, i);
+filetable_destroy(struct filetable *ft){
+  //Nobody else is using it by now
+  for(int i = 0; i < ft->ft_size; i++){
+    if(ft->ft_slots[i] != NULL) filehandle_decref(ft->ft_slots[i]);
   }
-  kfree(filetable);
+  spinlock_cleanup(&ft->ft_lock);
+  kfree(ft->ft_slots);
+  kfree(ft->ft_used);
+  kfree(ft);
 }
 
+//Makes the table at least big enough for fd. Called and returns with
+//ft_lock held, but drops it to allocate
+static
 int
-filetable_add(struct filehandle **filetable, struct filehandle *filehandle){
-  //Searchs for spot in filetable
-  for(int i = 0; i < 64; i++){
+filetable_grow(struct filetable *ft, int fd){
+  struct filehandle **slots, **oldslots;
+  uint32_t *used, *oldused;
+  int size;
 
-    //Spot found
-    if(filetable[i] == NULL){
-      filetable[i] = filehandle;
+  while(fd >= ft->ft_size){
+    size = ft->ft_size * 2;
+    while(fd >= size) size *= 2;
+    spinlock_release(&ft->ft_lock);
+    int result = filetable_alloc(size, &slots, &used);
+    spinlock_acquire(&ft->ft_lock);
+    if(result){
+      return result;
+    }
+    if(size <= ft->ft_size){
+      //Someone else grew it meanwhile
+      oldslots = slots;
+      oldused = used;
+    }
+    else{
+      for(int i = 0; i < ft->ft_size; i++){
+        slots[i] = ft->ft_slots[i];
+      }
+      for(int i = 0; i < ft->ft_size / 32; i++){
+        used[i] = ft->ft_used[i];
+      }
+      oldslots = ft->ft_slots;
+      oldused = ft->ft_used;
+      ft->ft_slots = slots;
+      ft->ft_used = used;
+      ft->ft_size = size;
+    }
+    spinlock_release(&ft->ft_lock);
+    kfree(oldslots);
+    kfree(oldused);
+    spinlock_acquire(&ft->ft_lock);
+  }
+  return 0;
+}
 
-      //Increment filehandles reference count
-      filehandle->fh_refcount++;
-      return i;
+//Lowest fd not in use, or ft_size if they all are. Called with ft_lock held
+static
+int
+filetable_lowestfree(struct filetable *ft){
+  int word;
+  for(word = 0; word < ft->ft_size / 32; word++){
+    if(ft->ft_used[word] != 0xffffffff){
+      uint32_t bits = ft->ft_used[word];
+      int bit = 0;
+      while(bits & ((uint32_t)1 << bit)) bit++;
+      return word * 32 + bit;
     }
   }
-  return -1;
+  return ft->ft_size;
 }
 
-void
-filetable_remove(struct filehandle **filetable, int fd){
+int
+filetable_add(struct filetable *ft, struct filehandle *filehandle, int *fdret){
+  int fd;
+
+  spinlock_acquire(&ft->ft_lock);
+  //Growing drops the lock, so others may fill slots meanwhile
+  while(1){
+    fd = filetable_lowestfree(ft);
+    if(fd >= OPEN_MAX){
+      spinlock_release(&ft->ft_lock);
+      return EMFILE;
+    }
+    if(fd < ft->ft_size){
+      break;
+    }
+    int result = filetable_grow(ft, fd);
+    if(result){
+      spinlock_release(&ft->ft_lock);
+      return result;
+    }
+  }
+
+  //Spot found
+  ft->ft_slots[fd] = filehandle;
+  ft->ft_used[fd / 32] |= (uint32_t)1 << (fd % 32);
+
+  //Increment filehandles reference count
+  filehandle_incref(filehandle);
+  spinlock_release(&ft->ft_lock);
+
+  *fdret = fd;
+  return 0;
+}
+
+int
+filetable_place(struct filetable *ft, int fd, struct filehandle *filehandle){
+  struct filehandle *old;
+
+  if(fd < 0 || fd >= OPEN_MAX){
+    return EBADF;
+  }
+
+  spinlock_acquire(&ft->ft_lock);
+  if(fd >= ft->ft_size){
+    int result = filetable_grow(ft, fd);
+    if(result){
+      spinlock_release(&ft->ft_lock);
+      return result;
+    }
+  }
+  old = ft->ft_slots[fd];
+  ft->ft_slots[fd] = filehandle;
+  ft->ft_used[fd / 32] |= (uint32_t)1 << (fd % 32);
+  filehandle_incref(filehandle);
+  spinlock_release(&ft->ft_lock);
+
+  //Closing may sleep, so not under the spinlock
+  if(old != NULL){
+    filehandle_decref(old);
+  }
+  return 0;
+}
+
+int
+filetable_remove(struct filetable *ft, int fd){
+  struct filehandle *filehandle;
+
+  if(fd < 0){
+    return EBADF;
+  }
+
+  spinlock_acquire(&ft->ft_lock);
+  if(fd >= ft->ft_size || ft->ft_slots[fd] == NULL){
+    spinlock_release(&ft->ft_lock);
+    return EBADF;
+  }
+  filehandle = ft->ft_slots[fd];
+  ft->ft_slots[fd] = NULL;
+  ft->ft_used[fd / 32] &= ~((uint32_t)1 << (fd % 32));
+  spinlock_release(&ft->ft_lock);
 
   //Decrements the amount of references to the filehandle
-  filetable[fd]->fh_refcount--;
+  filehandle_decref(filehandle);
+  return 0;
+}
+
+struct filehandle *
+filetable_get(struct filetable *ft, int fd, bool *refp){
+  struct filehandle *filehandle;
+
+  if(fd < 0 || fd >= ft->ft_size){
+    *refp = false;
+    return NULL;
+  }
+
+  //Only another thread of ours could change the table, and only we
+  //could start one
+  if(ft == curproc->p_filetable && curproc->p_numthreads == 1){
+    *refp = false;
+    return ft->ft_slots[fd];
+  }
+
+  //A concurrent close can't free it once we have a reference
+  spinlock_acquire(&ft->ft_lock);
+  filehandle = fd < ft->ft_size ? ft->ft_slots[fd] : NULL;
+  if(filehandle != NULL){
+    filehandle_incref(filehandle);
+  }
+  spinlock_release(&ft->ft_lock);
+  *refp = filehandle != NULL;
+  return filehandle;
+}
 
-  filehandle_destroy(filetable[fd]);
-  filetable[fd] = NULL;
+void
+filetable_put(struct filehandle *filehandle, bool ref){
+  if(ref){
+    filehandle_decref(filehandle);
+  }
 }
 
 void
-filetable_print(struct filehandle **filetable){
-  for(int i = 0; i < 64; i++){
-    if(filetable[i] != NULL) kprintf("%d", i);
+filetable_print(struct filetable *ft){
+  for(int i = 0; i < ft->ft_size; i++){
+    if(ft->ft_slots[i] != NULL) kprintf("%d", i);
   }
 }
@@ -0,0 +1,755 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes. See pipe.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stattypes.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <vm.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+/* Size of the ring buffer. */
+#define PIPE_SIZE	PAGE_SIZE
+
+/* Smallest write that is loaned instead of copied through the ring. */
+#define PIPE_LOANMIN	(2 * PAGE_SIZE)
+
+/* Most pages a writer loans at once. */
+#define PIPE_LOANPAGES	16
+
+/*
+ * One piece of a loan: part of a pinned user page. The physical
+ * address includes the offset into the page. A page that more than
+ * one piece is on is pinned once, by the first of them.
+ */
+struct pipe_loan {
+	paddr_t pl_paddr;
+	size_t pl_len;
+	vaddr_t pl_uva;		/* user address the piece came from */
+	bool pl_pinned;		/* this piece holds the page's pin */
+};
+
+struct pipe {
+	struct vnode pp_readvn;		/* read end */
+	struct vnode pp_writevn;	/* write end */
+
+	struct lock *pp_lock;		/* protects everything below */
+	struct cv *pp_readcv;		/* readers wait for data or EOF */
+	struct cv *pp_writecv;		/* writers wait for room or a reader */
+
+	char *pp_buf;			/* ring buffer, PIPE_SIZE bytes */
+	unsigned pp_head;		/* where the next read comes from */
+	unsigned pp_count;		/* bytes in the ring */
+	bool pp_readers;		/* read end still open */
+	bool pp_writers;		/* write end still open */
+
+	/*
+	 * Loaned pages. While pp_loaning a writer owns pp_loan and
+	 * nobody else may put anything in the pipe; readers take data
+	 * from the loan while pp_loanresid is nonzero.
+	 */
+	bool pp_loaning;
+	struct pipe_loan pp_loan[PIPE_LOANPAGES];
+	unsigned pp_loanpos;		/* piece the next read comes from */
+	size_t pp_loanoff;		/* offset into that piece */
+	size_t pp_loanresid;		/* loaned bytes not yet read */
+
+	struct pollhead pp_pollhead;	/* pollers on either end */
+
+	struct pipe *pp_next;		/* on pipe_list */
+};
+
+/* All pipes, for pipe_interrupt. */
+static struct lock *pipe_listlock;
+static struct pipe *pipe_list;
+
+static const struct vnode_ops pipe_vnode_ops;
+
+////////////////////////////////////////////////////////////
+// Setup and teardown
+
+void
+pipe_bootstrap(void)
+{
+	pipe_listlock = lock_create("pipelist");
+	if (pipe_listlock == NULL) {
+		panic("pipe_bootstrap: Out of memory\n");
+	}
+	pipe_list = NULL;
+}
+
+static
+void
+pipe_destroy(struct pipe *pp)
+{
+	struct pipe **ppp;
+
+	lock_acquire(pipe_listlock);
+	for (ppp = &pipe_list; *ppp != NULL; ppp = &(*ppp)->pp_next) {
+		if (*ppp == pp) {
+			*ppp = pp->pp_next;
+			break;
+		}
+	}
+	lock_release(pipe_listlock);
+
+	KASSERT(!pp->pp_loaning);
+	pollhead_cleanup(&pp->pp_pollhead);
+	kfree(pp->pp_buf);
+	cv_destroy(pp->pp_writecv);
+	cv_destroy(pp->pp_readcv);
+	lock_destroy(pp->pp_lock);
+	kfree(pp);
+}
+
+int
+pipe_create(struct vnode **readret, struct vnode **writeret)
+{
+	struct pipe *pp;
+	int result;
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pp->pp_lock = lock_create("pipe");
+	pp->pp_readcv = cv_create("piperead");
+	pp->pp_writecv = cv_create("pipewrite");
+	pp->pp_buf = kmalloc(PIPE_SIZE);
+	if (pp->pp_lock == NULL || pp->pp_readcv == NULL ||
+	    pp->pp_writecv == NULL || pp->pp_buf == NULL) {
+		kfree(pp->pp_buf);
+		if (pp->pp_writecv != NULL) {
+			cv_destroy(pp->pp_writecv);
+		}
+		if (pp->pp_readcv != NULL) {
+			cv_destroy(pp->pp_readcv);
+		}
+		if (pp->pp_lock != NULL) {
+			lock_destroy(pp->pp_lock);
+		}
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_head = 0;
+	pp->pp_count = 0;
+	pp->pp_readers = true;
+	pp->pp_writers = true;
+	pp->pp_loaning = false;
+	pp->pp_loanpos = 0;
+	pp->pp_loanoff = 0;
+	pp->pp_loanresid = 0;
+	pollhead_init(&pp->pp_pollhead);
+
+	result = vnode_init(&pp->pp_readvn, &pipe_vnode_ops, NULL, pp);
+	if (result) {
+		panic("pipe_create: vnode_init: %s\n", strerror(result));
+	}
+	result = vnode_init(&pp->pp_writevn, &pipe_vnode_ops, NULL, pp);
+	if (result) {
+		panic("pipe_create: vnode_init: %s\n", strerror(result));
+	}
+
+	lock_acquire(pipe_listlock);
+	pp->pp_next = pipe_list;
+	pipe_list = pp;
+	lock_release(pipe_listlock);
+
+	*readret = &pp->pp_readvn;
+	*writeret = &pp->pp_writevn;
+	return 0;
+}
+
+/*
+ * Wake everyone sleeping in any pipe so threads of an exiting process
+ * notice. Rare enough that waking everyone is fine.
+ */
+void
+pipe_interrupt(void)
+{
+	struct pipe *pp;
+
+	lock_acquire(pipe_listlock);
+	for (pp = pipe_list; pp != NULL; pp = pp->pp_next) {
+		lock_acquire(pp->pp_lock);
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+		lock_release(pp->pp_lock);
+	}
+	lock_release(pipe_listlock);
+}
+
+////////////////////////////////////////////////////////////
+// Moving data
+
+/*
+ * Sleep on CV, unless our process is exiting. Called with pp_lock
+ * held; pipe_interrupt takes it too, so its wakeup can't be missed.
+ */
+static
+int
+pipe_sleep(struct pipe *pp, struct cv *cv)
+{
+	if (curproc->p_exiting) {
+		return EINTR;
+	}
+	cv_wait(cv, pp->pp_lock);
+	return 0;
+}
+
+/*
+ * Wake whoever waits on CV, and any pollers, after a change.
+ */
+static
+void
+pipe_wakeup(struct pipe *pp, struct cv *cv)
+{
+	cv_broadcast(cv, pp->pp_lock);
+	pollhead_wakeup(&pp->pp_pollhead);
+}
+
+/*
+ * Move LEN bytes between the ring and UIO: out of the front for a
+ * read, onto the back for a write.
+ */
+static
+int
+pipe_ringio(struct pipe *pp, size_t len, struct uio *uio)
+{
+	unsigned pos;
+	size_t n;
+	int result;
+
+	if (uio->uio_rw == UIO_READ) {
+		pos = pp->pp_head;
+	}
+	else {
+		pos = (pp->pp_head + pp->pp_count) % PIPE_SIZE;
+	}
+
+	while (len > 0) {
+		n = len;
+		if (n > PIPE_SIZE - pos) {
+			n = PIPE_SIZE - pos;
+		}
+		result = uiomove(pp->pp_buf + pos, n, uio);
+		if (result) {
+			return result;
+		}
+		pos = (pos + n) % PIPE_SIZE;
+		len -= n;
+		if (uio->uio_rw == UIO_READ) {
+			pp->pp_head = pos;
+			pp->pp_count -= n;
+		}
+		else {
+			pp->pp_count += n;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read out of the loaned pages straight into UIO.
+ */
+static
+int
+pipe_loanread(struct pipe *pp, struct uio *uio)
+{
+	struct pipe_loan *pl;
+	size_t n;
+	int result;
+
+	while (uio->uio_resid > 0 && pp->pp_loanresid > 0) {
+		pl = &pp->pp_loan[pp->pp_loanpos];
+		n = pl->pl_len - pp->pp_loanoff;
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = uiomove((char *)PADDR_TO_KVADDR(pl->pl_paddr) +
+				 pp->pp_loanoff, n, uio);
+		if (result) {
+			return result;
+		}
+		pp->pp_loanoff += n;
+		pp->pp_loanresid -= n;
+		if (pp->pp_loanoff == pl->pl_len) {
+			pp->pp_loanpos++;
+			pp->pp_loanoff = 0;
+		}
+	}
+	return 0;
+}
+
+#if OPT_DUMBVM
+#else
+/*
+ * Advance UIO past LEN bytes without moving them, for data that went
+ * out by loan.
+ */
+static
+void
+pipe_uioskip(struct uio *uio, size_t len)
+{
+	struct iovec *iov;
+	size_t n;
+
+	while (len > 0) {
+		KASSERT(uio->uio_iovcnt > 0);
+		iov = uio->uio_iov;
+		if (iov->iov_len == 0) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+		n = len;
+		if (n > iov->iov_len) {
+			n = iov->iov_len;
+		}
+		iov->iov_ubase += n;
+		iov->iov_len -= n;
+		uio->uio_offset += n;
+		uio->uio_resid -= n;
+		len -= n;
+	}
+}
+
+/*
+ * Write from user space by loaning the pages holding the data, up to
+ * PIPE_LOANPAGES of them, instead of copying into the ring: readers
+ * copy straight out of them, so the data is copied once instead of
+ * twice. We wait until it has all been read before letting the pages
+ * go, as the caller may change them as soon as write returns.
+ *
+ * Called with pp_lock held; drops it while pinning pages.
+ */
+static
+int
+pipe_loanwrite(struct pipe *pp, struct uio *uio)
+{
+	struct iovec *iov;
+	struct pipe_loan *pl;
+	unsigned nloan, i;
+	size_t off, total, done, n;
+	vaddr_t va;
+	int result, pinerr;
+
+	/* Loaned data has to come after what's in the ring. */
+	while (pp->pp_readers && (pp->pp_loaning || pp->pp_count > 0)) {
+		result = pipe_sleep(pp, pp->pp_writecv);
+		if (result) {
+			return result;
+		}
+	}
+	if (!pp->pp_readers) {
+		return EPIPE;
+	}
+	pp->pp_loaning = true;
+	lock_release(pp->pp_lock);
+
+	/*
+	 * Pin each page the data is on. pp_loan is ours while
+	 * pp_loaning, and readers don't look at it until pp_loanresid
+	 * is set.
+	 */
+	pinerr = 0;
+	nloan = 0;
+	total = 0;
+	iov = uio->uio_iov;
+	off = 0;
+	while (nloan < PIPE_LOANPAGES && total < uio->uio_resid) {
+		if (off == iov->iov_len) {
+			iov++;
+			off = 0;
+			continue;
+		}
+		va = (vaddr_t)iov->iov_ubase + off;
+		n = PAGE_SIZE - (va & ~PAGE_FRAME);
+		if (n > iov->iov_len - off) {
+			n = iov->iov_len - off;
+		}
+		pl = &pp->pp_loan[nloan];
+		pl->pl_uva = va;
+		pl->pl_pinned = false;
+		/* The iovecs may name a page more than once. */
+		for (i = 0; i < nloan; i++) {
+			if (pp->pp_loan[i].pl_pinned &&
+			    (pp->pp_loan[i].pl_uva & PAGE_FRAME) ==
+			    (va & PAGE_FRAME)) {
+				break;
+			}
+		}
+		if (i < nloan) {
+			pl->pl_paddr = (pp->pp_loan[i].pl_paddr & PAGE_FRAME) |
+				(va & ~PAGE_FRAME);
+		}
+		else {
+			pinerr = vm_pinpage(va, &pl->pl_paddr);
+			if (pinerr) {
+				break;
+			}
+			pl->pl_pinned = true;
+		}
+		pl->pl_len = n;
+		nloan++;
+		off += n;
+		total += n;
+	}
+
+	lock_acquire(pp->pp_lock);
+	result = 0;
+	done = 0;
+	if (nloan > 0) {
+		pp->pp_loanpos = 0;
+		pp->pp_loanoff = 0;
+		pp->pp_loanresid = total;
+		pipe_wakeup(pp, pp->pp_readcv);
+		while (pp->pp_readers && pp->pp_loanresid > 0) {
+			result = pipe_sleep(pp, pp->pp_writecv);
+			if (result) {
+				break;
+			}
+		}
+		done = total - pp->pp_loanresid;
+		pp->pp_loanresid = 0;
+		if (result == 0 && done < total) {
+			result = EPIPE;
+		}
+	}
+	for (i = 0; i < nloan; i++) {
+		if (pp->pp_loan[i].pl_pinned) {
+			vm_unpinpage(pp->pp_loan[i].pl_paddr);
+		}
+	}
+	pp->pp_loaning = false;
+	pipe_wakeup(pp, pp->pp_writecv);
+
+	pipe_uioskip(uio, done);
+	return result ? result : pinerr;
+}
+#endif
+
+////////////////////////////////////////////////////////////
+// Vnode operations
+
+/*
+ * Called when the last reference to one end goes away.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+	bool gone;
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		pp->pp_readers = false;
+	}
+	else {
+		pp->pp_writers = false;
+	}
+	pipe_wakeup(pp, pp->pp_readcv);
+	pipe_wakeup(pp, pp->pp_writecv);
+	gone = !pp->pp_readers && !pp->pp_writers;
+	lock_release(pp->pp_lock);
+
+	vnode_cleanup(v);
+	if (gone) {
+		pipe_destroy(pp);
+	}
+	return 0;
+}
+
+/*
+ * Read. Wait for data unless all writers are gone, then give back as
+ * much as there is, up to what was asked for.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t n;
+	int result = 0;
+
+	if (v != &pp->pp_readvn) {
+		return EBADF;
+	}
+	KASSERT(uio->uio_rw == UIO_READ);
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (pp->pp_count == 0 && pp->pp_loanresid == 0 && pp->pp_writers) {
+		result = pipe_sleep(pp, pp->pp_readcv);
+		if (result) {
+			lock_release(pp->pp_lock);
+			return result;
+		}
+	}
+
+	if (pp->pp_loanresid > 0) {
+		result = pipe_loanread(pp, uio);
+	}
+	else if (pp->pp_count > 0) {
+		n = pp->pp_count;
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = pipe_ringio(pp, n, uio);
+	}
+	pipe_wakeup(pp, pp->pp_writecv);
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+/*
+ * Write. Wait for room for all of it if it's no more than PIPE_BUF,
+ * so it can't be interleaved with other writes; otherwise put in as
+ * much as fits each time. If the readers go away part way through,
+ * it's a short write; if nothing went, EPIPE.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t start, need, n;
+	int result = 0;
+
+	if (v != &pp->pp_writevn) {
+		return EBADF;
+	}
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	start = uio->uio_resid;
+
+	lock_acquire(pp->pp_lock);
+#if OPT_DUMBVM
+#else
+	if (uio->uio_segflg == UIO_USERSPACE) {
+		while (result == 0 && uio->uio_resid >= PIPE_LOANMIN) {
+			result = pipe_loanwrite(pp, uio);
+		}
+	}
+#endif
+	while (result == 0 && uio->uio_resid > 0) {
+		need = uio->uio_resid <= PIPE_BUF ? uio->uio_resid : 1;
+		while (pp->pp_readers &&
+		       (pp->pp_loaning || PIPE_SIZE - pp->pp_count < need)) {
+			result = pipe_sleep(pp, pp->pp_writecv);
+			if (result) {
+				break;
+			}
+		}
+		if (result) {
+			break;
+		}
+		if (!pp->pp_readers) {
+			result = EPIPE;
+			break;
+		}
+		n = PIPE_SIZE - pp->pp_count;
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = pipe_ringio(pp, n, uio);
+		pipe_wakeup(pp, pp->pp_readcv);
+	}
+	lock_release(pp->pp_lock);
+
+	if (result && uio->uio_resid < start) {
+		/* Report what did get written. */
+		result = 0;
+	}
+	return result;
+}
+
+/*
+ * Poll. The read end is ready when there is something to read or no
+ * writer (EOF; POLLHUP too); the write end when PIPE_BUF bytes would
+ * fit, or there's no reader (EPIPE; POLLERR too).
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollent *pe, int *revents)
+{
+	struct pipe *pp = v->vn_data;
+
+	*revents = 0;
+	lock_acquire(pp->pp_lock);
+	pollhead_register(&pp->pp_pollhead, pe);
+	if (v == &pp->pp_readvn) {
+		if (pp->pp_count > 0 || pp->pp_loanresid > 0) {
+			*revents |= events & POLLIN;
+		}
+		if (!pp->pp_writers) {
+			*revents |= (events & POLLIN) | POLLHUP;
+		}
+	}
+	else {
+		if (!pp->pp_readers) {
+			*revents |= (events & POLLOUT) | POLLERR;
+		}
+		else if (!pp->pp_loaning &&
+			 PIPE_SIZE - pp->pp_count >= PIPE_BUF) {
+			*revents |= events & POLLOUT;
+		}
+	}
+	lock_release(pp->pp_lock);
+	return 0;
+}
+
+/*
+ * Called for stat(). The size is what's waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *pp = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	lock_acquire(pp->pp_lock);
+	statbuf->st_size = pp->pp_count + pp->pp_loanresid;
+	lock_release(pp->pp_lock);
+	statbuf->st_mode = _S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = _S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return ENODEV;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * The ends of a pipe aren't reached by name, so they are never opened
+ * and there is nothing to look up in them.
+ */
+static
+int
+pipe_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+/*
+ * Function table for the ends of a pipe.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_poll = pipe_poll,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = pipe_mmap,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_nosys,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
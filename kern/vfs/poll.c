@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Readiness notification for poll() and select(). See poll.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <poll.h>
+
+/* Every poller, so exits can find them. */
+static struct spinlock poll_listlock;
+static struct poller *poll_list;
+
+void
+poll_bootstrap(void)
+{
+	spinlock_init(&poll_listlock);
+	poll_list = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Pollheads
+
+void
+pollhead_init(struct pollhead *ph)
+{
+	spinlock_init(&ph->ph_lock);
+	ph->ph_ents = NULL;
+}
+
+void
+pollhead_cleanup(struct pollhead *ph)
+{
+	KASSERT(ph->ph_ents == NULL);
+	spinlock_cleanup(&ph->ph_lock);
+}
+
+void
+pollhead_register(struct pollhead *ph, struct pollent *pe)
+{
+	if (pe == NULL || pe->pe_head != NULL) {
+		return;
+	}
+	spinlock_acquire(&ph->ph_lock);
+	pe->pe_head = ph;
+	pe->pe_next = ph->ph_ents;
+	ph->ph_ents = pe;
+	spinlock_release(&ph->ph_lock);
+}
+
+static
+void
+poller_wake(struct poller *pl)
+{
+	spinlock_acquire(&pl->pl_lock);
+	pl->pl_woken = true;
+	wchan_wakeall(pl->pl_wchan, &pl->pl_lock);
+	spinlock_release(&pl->pl_lock);
+}
+
+void
+pollhead_wakeup(struct pollhead *ph)
+{
+	struct pollent *pe;
+
+	spinlock_acquire(&ph->ph_lock);
+	for (pe = ph->ph_ents; pe != NULL; pe = pe->pe_next) {
+		poller_wake(pe->pe_poller);
+	}
+	spinlock_release(&ph->ph_lock);
+}
+
+static
+void
+pollent_unregister(struct pollent *pe)
+{
+	struct pollhead *ph = pe->pe_head;
+	struct pollent **pp;
+
+	if (ph == NULL) {
+		return;
+	}
+	spinlock_acquire(&ph->ph_lock);
+	for (pp = &ph->ph_ents; *pp != NULL; pp = &(*pp)->pe_next) {
+		if (*pp == pe) {
+			*pp = pe->pe_next;
+			break;
+		}
+	}
+	spinlock_release(&ph->ph_lock);
+	pe->pe_head = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Pollers
+
+/* Timer function: the timeout is up. */
+static
+void
+poller_timeout(void *data)
+{
+	struct poller *pl = data;
+
+	spinlock_acquire(&pl->pl_lock);
+	pl->pl_expired = true;
+	pl->pl_woken = true;
+	wchan_wakeall(pl->pl_wchan, &pl->pl_lock);
+	spinlock_release(&pl->pl_lock);
+}
+
+int
+poller_init(struct poller *pl, int timeout)
+{
+	struct timespec delay;
+
+	pl->pl_wchan = wchan_create("poll");
+	if (pl->pl_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&pl->pl_lock);
+	pl->pl_woken = false;
+	pl->pl_expired = false;
+	pl->pl_ents = NULL;
+
+	timer_init(&pl->pl_timer, poller_timeout, pl);
+	if (timeout >= 0) {
+		delay.tv_sec = timeout / 1000;
+		delay.tv_nsec = (timeout % 1000) * 1000000;
+		timer_start(&pl->pl_timer, &delay);
+	}
+
+	spinlock_acquire(&poll_listlock);
+	pl->pl_next = poll_list;
+	poll_list = pl;
+	spinlock_release(&poll_listlock);
+	return 0;
+}
+
+void
+poller_cleanup(struct poller *pl)
+{
+	struct poller **pp;
+	struct pollent *pe;
+
+	timer_cancel(&pl->pl_timer);
+	for (pe = pl->pl_ents; pe != NULL; pe = pe->pe_pollnext) {
+		pollent_unregister(pe);
+	}
+
+	spinlock_acquire(&poll_listlock);
+	for (pp = &poll_list; *pp != NULL; pp = &(*pp)->pl_next) {
+		if (*pp == pl) {
+			*pp = pl->pl_next;
+			break;
+		}
+	}
+	spinlock_release(&poll_listlock);
+
+	/* Nothing can reach us now to wake us. */
+	spinlock_cleanup(&pl->pl_lock);
+	wchan_destroy(pl->pl_wchan);
+}
+
+void
+pollent_init(struct pollent *pe, struct poller *pl)
+{
+	pe->pe_poller = pl;
+	pe->pe_head = NULL;
+	pe->pe_next = NULL;
+	pe->pe_pollnext = pl->pl_ents;
+	pl->pl_ents = pe;
+}
+
+int
+poller_wait(struct poller *pl)
+{
+	bool expired;
+
+	spinlock_acquire(&pl->pl_lock);
+	while (!pl->pl_woken && !curproc->p_exiting) {
+		wchan_sleep(pl->pl_wchan, &pl->pl_lock);
+	}
+	pl->pl_woken = false;
+	expired = pl->pl_expired;
+	spinlock_release(&pl->pl_lock);
+
+	if (curproc->p_exiting) {
+		return EINTR;
+	}
+	return expired ? ETIMEDOUT : 0;
+}
+
+/*
+ * Wake every poller so threads of an exiting process notice.
+ */
+void
+poll_interrupt(void)
+{
+	struct poller *pl;
+
+	spinlock_acquire(&poll_listlock);
+	for (pl = poll_list; pl != NULL; pl = pl->pl_next) {
+		poller_wake(pl);
+	}
+	spinlock_release(&poll_listlock);
+}
+
+////////////////////////////////////////////////////////////
+// Common vop_poll
+
+/*
+ * For things reads and writes of which never wait for anyone else.
+ */
+int
+vop_poll_ready(struct vnode *v, int events, struct pollent *pe, int *revents)
+{
+	(void)v;
+	(void)pe;
+	*revents = events & (POLLIN | POLLOUT);
+	return 0;
+}
@@ -33,8 +33,10 @@
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <thread.h>
 #include <mips/tlb.h>
 #include <uio.h>
+#include <objcache.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -42,6 +44,18 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+struct objcache *pte_cache;
+struct objcache *region_cache;
+
+void
+as_bootstrap(void){
+  pte_cache = objcache_create("pte", sizeof(struct pte), NULL, NULL);
+  region_cache = objcache_create("region", sizeof(struct region), NULL, NULL);
+  if(pte_cache == NULL || region_cache == NULL){
+    panic("as_bootstrap: Out of memory\n");
+  }
+}
+
 struct addrspace *
 as_create(void)
 {
@@ -57,6 +71,12 @@ as_create(void)
 		kfree(as);
 		return NULL;
 	}
+	as->as_ptlock = lock_create("pagetable");
+	if(as->as_ptlock == NULL){
+		lock_destroy(as->hplock);
+		kfree(as);
+		return NULL;
+	}
 
 	//Set the pagetable and region lists to NULL for later initialization
 	as->pt_head = NULL;
@@ -107,9 +127,12 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 
 	//Copies the pagetable
 	//pte_copy will handle allocating new ppages and copying data
+	//Other threads of the old process may be adding pages meanwhile
+	lock_acquire(old->as_ptlock);
 	//Handles copying the first PTE
 	new->pt_head = pte_copy(old->pt_head);
 	if(old->pt_head != NULL && new->pt_head == NULL){
+		lock_release(old->as_ptlock);
 		return ENOMEM;
 	}
 	//Handles the rest if there is any
@@ -119,12 +142,14 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		while(olditer != NULL){
 			newiter->next = pte_copy(olditer->next);
 			if(olditer->next != NULL && newiter->next == NULL){
+				lock_release(old->as_ptlock);
 				return ENOMEM;
 			}
 			olditer = olditer->next;
 			newiter = newiter->next;
 		}
 	}
+	lock_release(old->as_ptlock);
 
 
 
@@ -152,9 +177,8 @@ as_destroy(struct addrspace *as)
 			free_kpages(PADDR_TO_KVADDR(pte_cur->ppn << 12));
 		}
 		lock_release(pte_cur->lock);
-		lock_destroy(pte_cur->lock);
 		// kprintf("\n?\n");
-		kfree(pte_cur);
+		pte_destroy(pte_cur);
 		pte_cur = pte_next;
 	}
 	as->pt_head = NULL;
@@ -164,14 +188,15 @@ as_destroy(struct addrspace *as)
 	struct region *reg_next;
 	while(reg_cur != NULL){
 		reg_next = reg_cur->next;
-		kfree(reg_cur);
+		objcache_free(region_cache, reg_cur);
 		reg_cur = reg_next;
 	}
 	as->reg_head = NULL;
 	as->heap = NULL;
 
-	//Destroy heap lock
+	//Destroy heap and page table locks
 	lock_destroy(as->hplock);
+	lock_destroy(as->as_ptlock);
 
 	//Free addrspace pointer
 	kfree(as);
@@ -226,7 +251,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	//TODO error check here
 	// if(vaddr + memsize > 4MB) return some error;
 	// vaddr = vaddr & PAGE_FRAME;
-	struct region *newreg = kmalloc(sizeof(struct region));
+	struct region *newreg = objcache_alloc(region_cache);
 	if(newreg == NULL) return ENOMEM;
 	newreg->vaddr = vaddr;
 	newreg->size = memsize;
@@ -315,7 +340,7 @@ as_complete_load(struct addrspace *as)
 struct region *
 reg_copy(struct region *oldreg){
 	if(oldreg == NULL) return NULL;
-	struct region *ret = kmalloc(sizeof(struct region));
+	struct region *ret = objcache_alloc(region_cache);
 	if(ret == NULL) return NULL;
 
 	//Copes region values
@@ -334,6 +359,38 @@ reg_copy(struct region *oldreg){
 
 //TODO
 //We are going to want some form of synchronizing our physical pages so that write prevents others from accessing
+//The cache keeps only plain structs; a lock per cached pte would keep
+//a lock and its wchan alive for every free slot too
+struct pte *
+pte_create(void){
+	struct pte *pte = objcache_alloc(pte_cache);
+	if(pte == NULL) return NULL;
+	pte->lock = lock_create("pte");
+	if(pte->lock == NULL){
+		objcache_free(pte_cache, pte);
+		return NULL;
+	}
+	pte->evictors = 0;
+	return pte;
+}
+
+void
+pte_destroy(struct pte *pte){
+	bool held;
+
+	//An eviction that picked the frame before it was freed will find
+	//it gone once it gets the lock, and then lets go of the pte
+	while(1){
+		spinlock_acquire(&cm_lock);
+		held = pte->evictors > 0;
+		spinlock_release(&cm_lock);
+		if(!held) break;
+		thread_yield();
+	}
+	lock_destroy(pte->lock);
+	objcache_free(pte_cache, pte);
+}
+
 //Do we copy it onto whatever what we were copying is on?
 //(i.e. If the oldas's pte is on disk do we make a copy on disk instead of mem?)
 struct pte *
@@ -341,21 +398,21 @@ pte_copy(struct pte *oldpte){
 	if(oldpte == NULL) return NULL;
 	if(haveswap) lock_acquire(oldpte->lock);
 
-	struct pte *ret = kmalloc(sizeof(struct pte));
+	struct pte *ret = pte_create();
 	if(ret == NULL){
 		if(haveswap) lock_release(oldpte->lock);
 		return NULL;
 	}
 
-	ret->lock = lock_create("pte");
-	if(ret->lock == NULL){
-		kfree(ret);
-		if(haveswap) lock_release(oldpte->lock);
-		return NULL;
-	}
-
+	//Keep the old frame where it is while we copy it. If swapout has
+	//already marked it the mark is swapout's, so leave it be after. A
+	//pin is a separate count, which this doesn't touch
+	bool marked = false;
 	spinlock_acquire(&cm_lock);
-	if(oldpte->ppn != INVAL_PPN) coremap[oldpte->ppn].swapping = 1;
+	if(oldpte->ppn != INVAL_PPN && !coremap[oldpte->ppn].swapping){
+		coremap[oldpte->ppn].swapping = 1;
+		marked = true;
+	}
 	spinlock_release(&cm_lock);
 
 
@@ -363,7 +420,13 @@ pte_copy(struct pte *oldpte){
 	//Allocates physical pages and creates the pte
 	paddr_t paddr = getppages(1, false, true);
 	if(haveswap && paddr == 0)panic("nomem?!");
-	else if(paddr == 0) return NULL;
+	else if(paddr == 0){
+		spinlock_acquire(&cm_lock);
+		if(marked) coremap[oldpte->ppn].swapping = 0;
+		spinlock_release(&cm_lock);
+		pte_destroy(ret);
+		return NULL;
+	}
 
 	//Makes sure the addr is page aligned
 	KASSERT((paddr & PAGE_FRAME) == paddr);
@@ -409,8 +472,10 @@ pte_copy(struct pte *oldpte){
 	}
 	ret->slot = -1;
 
+	spinlock_acquire(&cm_lock);
 	coremap[ret->ppn].swapping = 0;
-	coremap[oldpte->ppn].swapping = 0;
+	if(marked) coremap[oldpte->ppn].swapping = 0;
+	spinlock_release(&cm_lock);
 	if(haveswap) lock_release(oldpte->lock);
 
 	return ret;
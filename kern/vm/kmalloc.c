@@ -30,7 +30,10 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <objcache.h>
 #include <kern/test161.h>
 #include <test.h>
 
@@ -127,11 +130,24 @@ fill_deadbeef(void *vptr, size_t len)
 
 #if PAGE_SIZE == 4096
 
-#define NSIZES 8
-static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+/*
+ * Past 2K there are two more sizes, 3K and 4K, each one block to a
+ * page. They waste the rest of the page as before, but freed blocks
+ * go back through the per-cpu magazines like any other, so mid-size
+ * requests that come and go mostly don't touch the coremap at all.
+ * Every heap page still holds blocks of one size only, so no size
+ * needs more than one contiguous frame.
+ *
+ * Requests of LARGEST_SUBPAGE_SIZE and up go straight to
+ * alloc_kpages.
+ */
+#define NSIZES 10
+static const size_t sizes[NSIZES] = {
+	16, 32, 64, 128, 256, 512, 1024, 2048, 3072, 4096
+};
 
 #define SMALLEST_SUBPAGE_SIZE 16
-#define LARGEST_SUBPAGE_SIZE 2048
+#define LARGEST_SUBPAGE_SIZE 4096
 
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
@@ -170,6 +186,57 @@ struct pageref {
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * ...except for the per-cpu magazines in front of it. Each cpu keeps,
+ * for each block size, a small stack ("magazine") of free blocks that
+ * kmalloc and kfree can pop and push without touching
+ * kmalloc_spinlock. An empty magazine is refilled with a batch of
+ * blocks taken off the heap pages in one go, and a full one sends
+ * half of its blocks back the same way.
+ *
+ * Each magazine set has its own spinlock. Normally only the owning
+ * cpu takes it, so it is never contended; it is there so that a
+ * thread that migrates halfway through is still safe, and so the
+ * statistics code can drain every cpu's magazines before counting.
+ *
+ * kfree needs the block size without searching the heap, so heap
+ * pages record their pageref in the coremap. dumbvm has
+ * no coremap, so magazines are only used with the real VM system.
+ * They are also turned off by GUARDS and LABELS, which want every
+ * allocation and free to go through subpage_kmalloc/subpage_kfree.
+ */
+
+#if !OPT_DUMBVM && !defined(GUARDS) && !defined(LABELS)
+#define MAGAZINES
+#endif
+
+#ifdef MAGAZINES
+
+#define MAG_ROUNDS 32
+
+struct magazine {
+	unsigned nrounds;		/* number of blocks held */
+	unsigned capacity;		/* at most MAG_ROUNDS */
+	void *rounds[MAG_ROUNDS];
+};
+
+struct kmcache {
+	struct spinlock kc_lock;
+	struct kmcache *kc_next;	/* all kmcaches, for draining */
+	struct magazine kc_mags[NSIZES];
+};
+
+/* List of all kmcaches; append-only, protected by kmalloc_spinlock */
+static struct kmcache *kmcaches;
+
+static void mag_drainall(void);
+
+#else
+
+#define mag_drainall()
+
+#endif /* MAGAZINES */
+
 ////////////////////////////////////////
 
 /*
@@ -187,48 +254,31 @@ struct pagerefpage {
 };
 
 /*
- * This structure holds a pointer to a pageref page and also its
- * bitmap of free entries.
+ * Free pagerefs are kept on a list, linked through next_all. When the
+ * list runs dry we get another page of them, so there is no fixed cap
+ * on the size of the kernel heap. Pageref pages, once allocated, are
+ * never freed.
  */
 
-#define INUSE_WORDS (NPAGEREFS_PER_PAGE / 32)
-
-struct kheap_root {
-	struct pagerefpage *page;
-	uint32_t pagerefs_inuse[INUSE_WORDS];
-	unsigned numinuse;
-};
+static struct pageref *freepagerefs;
+static unsigned total_pagerefs;
 
 /*
- * It would be better to make this dynamically sizeable. However,
- * since we only actually run on System/161 and System/161 is
- * specifically limited to 16M of RAM, we'll just adopt that as a
- * static size limit.
- *
- * FUTURE: it would be better to pick this number based on the RAM
- * size we find at boot time.
- */
-
-#define NUM_PAGEREFPAGES 16
-#define TOTAL_PAGEREFS (NUM_PAGEREFPAGES * NPAGEREFS_PER_PAGE)
-
-static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
-
-/*
- * Allocate a page to hold pagerefs.
+ * Allocate a page to hold pagerefs and put them all on the free list.
  */
 static
 void
-allocpagerefpage(struct kheap_root *root)
+allocpagerefpage(void)
 {
+	struct pagerefpage *page;
 	vaddr_t va;
-
-	KASSERT(root->page == NULL);
+	unsigned i;
 
 	/*
 	 * We release the spinlock while calling alloc_kpages. This
 	 * avoids deadlock if alloc_kpages needs to come back here.
 	 * Note that this means things can change behind our back...
+	 * but at worst someone else also adds a page, which is harmless.
 	 */
 	spinlock_release(&kmalloc_spinlock);
 	va = alloc_kpages(1);
@@ -239,17 +289,12 @@ allocpagerefpage(struct kheap_root *root)
 	}
 	KASSERT(va % PAGE_SIZE == 0);
 
-	if (root->page != NULL) {
-		/* Oops, somebody else allocated it. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(va);
-		spinlock_acquire(&kmalloc_spinlock);
-		/* Once allocated it isn't ever freed. */
-		KASSERT(root->page != NULL);
-		return;
+	page = (struct pagerefpage *)va;
+	for (i=0; i<NPAGEREFS_PER_PAGE; i++) {
+		page->refs[i].next_all = freepagerefs;
+		freepagerefs = &page->refs[i];
 	}
-
-	root->page = (struct pagerefpage *)va;
+	total_pagerefs += NPAGEREFS_PER_PAGE;
 }
 
 /*
@@ -259,44 +304,20 @@ static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	uint32_t k;
-	unsigned whichroot;
-	struct kheap_root *root;
-
-	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
-		root = &kheaproots[whichroot];
-		if (root->numinuse >= NPAGEREFS_PER_PAGE) {
-			continue;
-		}
+	struct pageref *pr;
 
-		/*
-		 * This should probably not be a linear search.
-		 */
-		for (i=0; i<INUSE_WORDS; i++) {
-			if (root->pagerefs_inuse[i]==0xffffffff) {
-				/* full */
-				continue;
-			}
-			for (k=1,j=0; k!=0; k<<=1,j++) {
-				if ((root->pagerefs_inuse[i] & k)==0) {
-					root->pagerefs_inuse[i] |= k;
-					root->numinuse++;
-					if (root->page == NULL) {
-						allocpagerefpage(root);
-					}
-					if (root->page == NULL) {
-						return NULL;
-					}
-					return &root->page->refs[i*32 + j];
-				}
-			}
-			KASSERT(0);
-		}
-	}
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-	/* ran out */
-	return NULL;
+	if (freepagerefs == NULL) {
+		allocpagerefpage();
+	}
+	if (freepagerefs == NULL) {
+		/* ran out */
+		return NULL;
+	}
+	pr = freepagerefs;
+	freepagerefs = pr->next_all;
+	return pr;
 }
 
 /*
@@ -306,36 +327,10 @@ static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	uint32_t k;
-	unsigned whichroot;
-	struct kheap_root *root;
-	struct pagerefpage *page;
-
-	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
-		root = &kheaproots[whichroot];
-
-		page = root->page;
-		if (page == NULL) {
-			KASSERT(root->numinuse == 0);
-			continue;
-		}
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-		j = p-page->refs;
-		/* note: j is unsigned, don't test < 0 */
-		if (j < NPAGEREFS_PER_PAGE) {
-			/* on this page */
-			i = j/32;
-			k = ((uint32_t)1) << (j%32);
-			KASSERT((root->pagerefs_inuse[i] & k) != 0);
-			root->pagerefs_inuse[i] &= ~k;
-			KASSERT(root->numinuse > 0);
-			root->numinuse--;
-			return;
-		}
-	}
-	/* pageref wasn't on any of the pages */
-	KASSERT(0);
+	p->next_all = freepagerefs;
+	freepagerefs = p;
 }
 
 ////////////////////////////////////////
@@ -590,14 +585,14 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < TOTAL_PAGEREFS);
+			KASSERT(sc < total_pagerefs);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < TOTAL_PAGEREFS);
+		KASSERT(ac < total_pagerefs);
 		ac++;
 	}
 
@@ -783,7 +778,7 @@ subpage_stats(struct pageref *pr, bool quiet)
 	}
 
 	if (!quiet) {
-		kprintf("at 0x%08lx: size %-4lu  %u/%u free\n",
+		kprintf("at 0x%08lx: size %-5lu  %u/%u free\n",
 				(unsigned long)prpage, (unsigned long) sizes[blktype],
 				(unsigned) pr->nfree, n);
 		kprintf("   ");
@@ -807,6 +802,8 @@ kheap_printstats(void)
 {
 	struct pageref *pr;
 
+	mag_drainall();
+
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
@@ -830,6 +827,10 @@ kheap_getused(void) {
 	unsigned long total = 0;
 	unsigned int num_pages = 0, coremap_bytes = 0;
 
+	/* cached free objects and blocks parked in magazines aren't in use */
+	objcache_reclaim();
+	mag_drainall();
+
 	/* compute with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
@@ -862,6 +863,87 @@ kheap_printused(void)
 	secprintf(SECRET, total_string, "khu");
 }
 
+/*
+ * Print how well the heap is packed: for each block size, how many
+ * pages there are and how many of their blocks are in use, parked in
+ * the magazines, or free. Then how broken up free physical memory
+ * is, since that decides whether multi-page allocations succeed.
+ */
+void
+kheap_printfrag(void)
+{
+	struct pageref *pr;
+	unsigned long npages[NSIZES], nblocks[NSIZES];
+	unsigned long nfree[NSIZES], ncached[NSIZES];
+	unsigned long nused, idle, totpages = 0, totidle = 0;
+	unsigned pagerefpages;
+	unsigned i;
+#ifdef MAGAZINES
+	struct kmcache *kc;
+#endif
+#if !OPT_DUMBVM
+	unsigned long freepages, nruns, longest;
+#endif
+
+	for (i=0; i<NSIZES; i++) {
+		npages[i] = nblocks[i] = nfree[i] = ncached[i] = 0;
+	}
+
+#ifdef MAGAZINES
+	spinlock_acquire(&kmalloc_spinlock);
+	kc = kmcaches;
+	spinlock_release(&kmalloc_spinlock);
+
+	for (; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		for (i=0; i<NSIZES; i++) {
+			ncached[i] += kc->kc_mags[i].nrounds;
+		}
+		spinlock_release(&kc->kc_lock);
+	}
+#endif
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<NSIZES; i++) {
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			checksubpage(pr);
+			npages[i]++;
+			nblocks[i] += PAGE_SIZE / sizes[i];
+			nfree[i] += pr->nfree;
+		}
+	}
+	pagerefpages = total_pagerefs / NPAGEREFS_PER_PAGE;
+	spinlock_release(&kmalloc_spinlock);
+
+	kprintf(" size  pages  blocks    used  cached    free  idle bytes\n");
+	for (i=0; i<NSIZES; i++) {
+		if (npages[i] == 0) {
+			continue;
+		}
+		/* The magazine counts were taken a moment earlier. */
+		idle = nfree[i] + ncached[i];
+		if (idle > nblocks[i]) {
+			idle = nblocks[i];
+		}
+		nused = nblocks[i] - idle;
+		kprintf("%5lu  %5lu  %6lu  %6lu  %6lu  %6lu  %10lu\n",
+			(unsigned long)sizes[i], npages[i], nblocks[i], nused,
+			ncached[i], nfree[i], idle * sizes[i]);
+		totpages += npages[i];
+		totidle += idle * sizes[i];
+	}
+	kprintf("Heap: %lu pages, %lu bytes idle (%lu%%), "
+		"%u pageref pages\n", totpages, totidle,
+		totpages == 0 ? 0 : totidle * 100 / (totpages * PAGE_SIZE),
+		pagerefpages);
+
+#if !OPT_DUMBVM
+	cm_freeruns(&freepages, &nruns, &longest);
+	kprintf("Free memory: %lu pages in %lu runs, longest %lu pages\n",
+		freepages, nruns, longest);
+#endif
+}
+
 ////////////////////////////////////////
 
 /*
@@ -914,6 +996,43 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+/*
+ * Take the first block off the freelist of the page managed by PR,
+ * which must not be empty.
+ */
+static
+void *
+subpage_takeblock(struct pageref *pr)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+	return retptr;
+}
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -969,25 +1088,7 @@ subpage_kmalloc(size_t sz
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+			retptr = subpage_takeblock(pr);
 #ifdef GUARDS
 			retptr = establishguardband(retptr, clientsz, sz);
 #endif
@@ -1013,6 +1114,14 @@ subpage_kmalloc(size_t sz
 
 	spinlock_release(&kmalloc_spinlock);
 	prpage = alloc_kpages(1);
+	if (prpage==0) {
+		/*
+		 * Blocks sitting in the magazines may be keeping whole
+		 * pages alive; give them back and try once more.
+		 */
+		mag_drainall();
+		prpage = alloc_kpages(1);
+	}
 	if (prpage==0) {
 		/* Out of memory. */
 		silent("kmalloc: Subpage allocator couldn't get a page\n");
@@ -1036,6 +1145,10 @@ subpage_kmalloc(size_t sz
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
+#if !OPT_DUMBVM
+	/* Record the pageref so kfree can find it at a glance. */
+	cm_setpageref(prpage, pr);
+#endif
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -1065,6 +1178,118 @@ subpage_kmalloc(size_t sz
 	goto doalloc;
 }
 
+/*
+ * Find the pageref for the heap page containing PTRADDR, or NULL if
+ * it is not on any heap page we recognize.
+ */
+static
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
+{
+	struct pageref *pr;	// pageref for page we're freeing in
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+#if !OPT_DUMBVM
+	/* The coremap remembers which pageref owns each heap page. */
+	pr = cm_getpageref(ptraddr);
+	if (pr != NULL) {
+		KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
+		KASSERT(ptraddr >= PR_PAGEADDR(pr) &&
+			ptraddr < PR_PAGEADDR(pr) + PAGE_SIZE);
+		checksubpage(pr);
+	}
+#else
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	int blktype;		// index into sizes[] that we're using
+
+	for (pr = allbase; pr; pr = pr->next_all) {
+		prpage = PR_PAGEADDR(pr);
+		blktype = PR_BLOCKTYPE(pr);
+
+		/* check for corruption */
+		KASSERT(blktype>=0 && blktype<NSIZES);
+		checksubpage(pr);
+
+		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
+			break;
+		}
+	}
+#endif
+	return pr;
+}
+
+/*
+ * Put the block at PTRADDR back on the freelist of PR, the page it
+ * belongs to. If that leaves the whole page free, the page is taken
+ * off the lists and its address is returned; the caller must then
+ * free_kpages it once it has released kmalloc_spinlock. Otherwise
+ * returns 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = ptraddr - prpage;
+
+	/* Check for proper positioning and alignment */
+	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n",
+		      (void *)ptraddr);
+	}
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fla = prpage + offset;
+	fl = (struct freelist *)fla;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
+
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
+			}
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
+#endif
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		remove_lists(pr, blktype);
+#if !OPT_DUMBVM
+		cm_setpageref(prpage, NULL);
+#endif
+		freepageref(pr);
+		return prpage;
+	}
+	return 0;
+}
+
 /*
  * Free a pointer previously returned from subpage_kmalloc. If the
  * pointer is not on any heap page we recognize, return -1.
@@ -1076,10 +1301,7 @@ subpage_kfree(void *ptr)
 	int blktype;		// index into sizes[] that we're using
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
-	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
+	vaddr_t prpage;		// page to release, if any
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
 #endif
@@ -1113,34 +1335,15 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = subpage_findpage(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
+	blktype = PR_BLOCKTYPE(pr);
 
-	offset = ptraddr - prpage;
-
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+	if ((ptraddr - PR_PAGEADDR(pr)) % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
@@ -1156,55 +1359,269 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
+	prpage = subpage_putblock(pr, ptraddr);
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+	if (prpage != 0) {
+		free_kpages(prpage);
+	}
+
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
+
+	return 0;
+}
+
+#ifdef MAGAZINES
+
+/*
+ * Take up to N blocks of type BLKTYPE off the heap pages at once. If
+ * no page of that size has any free blocks, get a fresh page through
+ * subpage_kmalloc and take just the one block. Returns the number of
+ * blocks placed in BLOCKS; 0 means we're out of memory.
+ */
+static
+unsigned
+subpage_getbatch(unsigned blktype, void **blocks, unsigned n)
+{
+	struct pageref *pr;
+	unsigned got = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	for (pr = sizebases[blktype]; pr != NULL && got < n;
+	     pr = pr->next_samesize) {
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		while (pr->nfree > 0 && got < n) {
+			blocks[got++] = subpage_takeblock(pr);
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	if (got == 0) {
+		blocks[0] = subpage_kmalloc(sizes[blktype]);
+		if (blocks[0] != NULL) {
+			got = 1;
+		}
+	}
+	return got;
+}
+
+/*
+ * Return N blocks (already deadbeefed) to their heap pages, taking
+ * kmalloc_spinlock once for the lot unless pages become free.
+ */
+static
+void
+subpage_putbatch(void **blocks, unsigned n)
+{
+	struct pageref *pr;
+	vaddr_t prpage;
+	unsigned i;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<n; i++) {
+		pr = subpage_findpage((vaddr_t)blocks[i]);
+		if (pr == NULL) {
+			panic("kfree: magazine block %p not on any heap page\n",
+			      blocks[i]);
+		}
+		prpage = subpage_putblock(pr, (vaddr_t)blocks[i]);
+		if (prpage != 0) {
+			/* Call free_kpages without kmalloc_spinlock. */
+			spinlock_release(&kmalloc_spinlock);
+			free_kpages(prpage);
+			spinlock_acquire(&kmalloc_spinlock);
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Get the current cpu's magazines, or NULL if there aren't any yet.
+ *
+ * We don't bother disabling interrupts around this; if the thread
+ * migrates before it uses the result, it just works on the old cpu's
+ * magazines, which are locked and therefore still safe.
+ */
+static
+inline
+struct kmcache *
+kmcache_get(void)
+{
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	return curcpu->c_kmcache;
+}
+
+/*
+ * Allocate a block of type BLKTYPE from the magazines in KC.
+ */
+static
+void *
+mag_kmalloc(struct kmcache *kc, unsigned blktype)
+{
+	struct magazine *mag = &kc->kc_mags[blktype];
+	void *blocks[MAG_ROUNDS/2 + 1];
+	void *retptr;
+	unsigned n, i;
+
+	spinlock_acquire(&kc->kc_lock);
+	if (mag->nrounds > 0) {
+		retptr = mag->rounds[--mag->nrounds];
+		spinlock_release(&kc->kc_lock);
+		return retptr;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	/* Empty. Fill it halfway, plus one block to return. */
+	n = subpage_getbatch(blktype, blocks, mag->capacity / 2 + 1);
+	if (n == 0) {
+		return NULL;
+	}
+	retptr = blocks[--n];
+
+	spinlock_acquire(&kc->kc_lock);
+	for (i=0; i<n && mag->nrounds < mag->capacity; i++) {
+		mag->rounds[mag->nrounds++] = blocks[i];
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (i < n) {
+		/* Someone else filled it meanwhile; give the rest back. */
+		subpage_putbatch(blocks + i, n - i);
+	}
+	return retptr;
+}
+
+/*
+ * Free PTR, a block in the page managed by PR, into the magazines in KC.
+ */
+static
+void
+mag_kfree(struct kmcache *kc, struct pageref *pr, void *ptr)
+{
+	unsigned blktype = PR_BLOCKTYPE(pr);
+	struct magazine *mag = &kc->kc_mags[blktype];
+	void *blocks[MAG_ROUNDS/2];
+	unsigned n;
+
+	if (((vaddr_t)ptr - PR_PAGEADDR(pr)) % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
 	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
 	 */
+	fill_deadbeef(ptr, sizes[blktype]);
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	spinlock_acquire(&kc->kc_lock);
+	if (mag->nrounds < mag->capacity) {
+		mag->rounds[mag->nrounds++] = ptr;
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
 
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
+	/*
+	 * Full. Send back the older half, which is least likely to
+	 * still be in the cache, and keep the recently freed ones.
+	 */
+	n = mag->capacity / 2;
+	memcpy(blocks, mag->rounds, n * sizeof(void *));
+	memmove(mag->rounds, mag->rounds + n,
+		(mag->nrounds - n) * sizeof(void *));
+	mag->nrounds -= n;
+	mag->rounds[mag->nrounds++] = ptr;
+	spinlock_release(&kc->kc_lock);
+
+	subpage_putbatch(blocks, n);
+}
 
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
+/*
+ * Return everything in every cpu's magazines to the heap pages, so
+ * the heap statistics reflect what is actually allocated.
+ */
+static
+void
+mag_drainall(void)
+{
+	struct kmcache *kc;
+	struct magazine *mag;
+	void *blocks[MAG_ROUNDS];
+	unsigned i, n;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	kc = kmcaches;
+	spinlock_release(&kmalloc_spinlock);
+
+	for (; kc != NULL; kc = kc->kc_next) {
+		for (i=0; i<NSIZES; i++) {
+			mag = &kc->kc_mags[i];
+			spinlock_acquire(&kc->kc_lock);
+			n = mag->nrounds;
+			memcpy(blocks, mag->rounds, n * sizeof(void *));
+			mag->nrounds = 0;
+			spinlock_release(&kc->kc_lock);
+			subpage_putbatch(blocks, n);
 		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
+}
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+#endif /* MAGAZINES */
+
+/*
+ * Set up the magazines for a new cpu. Until this is done (and for the
+ * boot cpu, until curcpu exists) the cpu goes straight to the heap.
+ */
+void
+kheap_cpu_init(struct cpu *c)
+{
+#ifdef MAGAZINES
+	struct kmcache *kc;
+	unsigned i;
+
+	c->c_kmcache = NULL;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		/* Not fatal; this cpu just won't have magazines. */
+		kprintf("kmalloc: no memory for cpu magazines\n");
+		return;
 	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+	spinlock_init(&kc->kc_lock);
+	for (i=0; i<NSIZES; i++) {
+		kc->kc_mags[i].nrounds = 0;
+		/*
+		 * Don't hold more than a page's worth of any size, but
+		 * keep at least two so the page-sized ones get some
+		 * caching.
+		 */
+		kc->kc_mags[i].capacity = PAGE_SIZE / sizes[i];
+		if (kc->kc_mags[i].capacity > MAG_ROUNDS) {
+			kc->kc_mags[i].capacity = MAG_ROUNDS;
+		}
+		if (kc->kc_mags[i].capacity < 2) {
+			kc->kc_mags[i].capacity = 2;
+		}
+		KASSERT(kc->kc_mags[i].capacity >= 2);
 	}
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
+	kc->kc_next = kmcaches;
+	kmcaches = kc;
 	spinlock_release(&kmalloc_spinlock);
-#endif
 
-	return 0;
+	c->c_kmcache = kc;
+#else
+	c->c_kmcache = NULL;
+#endif
 }
 
 //
@@ -1246,6 +1663,17 @@ kmalloc(size_t sz)
 		return (void *)address;
 	}
 
+#ifdef MAGAZINES
+	{
+		struct kmcache *kc;
+
+		kc = kmcache_get();
+		if (kc != NULL) {
+			return mag_kmalloc(kc, blocktype(sz));
+		}
+	}
+#endif
+
 #ifdef LABELS
 	return subpage_kmalloc(sz, label);
 #else
@@ -1264,7 +1692,27 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#ifdef MAGAZINES
+	{
+		struct kmcache *kc;
+		struct pageref *pr;
+
+		/* Every heap page has a pageref, so none means big. */
+		pr = cm_getpageref((vaddr_t)ptr);
+		if (pr == NULL) {
+			KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+			free_kpages((vaddr_t)ptr);
+			return;
+		}
+		kc = kmcache_get();
+		if (kc != NULL) {
+			mag_kfree(kc, pr, ptr);
+			return;
+		}
+	}
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -0,0 +1,681 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <objcache.h>
+#include <platform/maxcpus.h>
+
+/*
+ * Object caches. See objcache.h for the interface.
+ *
+ * Small objects (up to OC_SLABMAX bytes) live in one-page slabs. A
+ * slab page starts with a struct ocslab, which ends in a stack of the
+ * numbers of its free objects, and the objects follow. The free stack
+ * is kept in the header rather than threaded through the free objects
+ * because free objects are still constructed and we mustn't scribble
+ * on them. An object's slab is found by rounding its address down to
+ * the page.
+ *
+ * Slabs with free objects are kept on a list in the cache; full slabs
+ * aren't on any list. One entirely free slab is kept around so a
+ * cache that hovers at a slab boundary doesn't keep constructing and
+ * destructing a page's worth of objects; any further free slabs are
+ * destructed and given back right away.
+ *
+ * Larger objects are just kmalloc'd one at a time.
+ *
+ * In front of either there is a magazine per cpu, as in kmalloc.c.
+ * A cpu's magazine is made the first time it allocates from the
+ * cache. An empty magazine is refilled halfway with a batch taken
+ * from the slabs under one acquisition of the cache lock; a full one
+ * sends half of its objects back the same way.
+ */
+
+#define OC_ALIGN	8		/* alignment of objects */
+#define OC_SLABMAX	(PAGE_SIZE / 8)	/* largest object put in slabs */
+#define OC_MAGROUNDS	16		/* magazine size, slab objects */
+#define OC_BIGROUNDS	4		/* magazine size, large objects */
+
+struct ocslab {
+	struct ocslab *os_next;		/* on oc_partial */
+	struct ocslab *os_prev;
+	struct objcache *os_cache;	/* cache we belong to */
+	unsigned os_nobjs;		/* number of constructed objects */
+	unsigned os_nfree;		/* number of entries in os_freeidx */
+	uint16_t os_freeidx[];		/* stack of free object numbers */
+};
+
+struct ocmag {
+	struct spinlock om_lock;
+	unsigned om_nrounds;		/* objects held */
+	unsigned om_allocs;		/* statistics */
+	unsigned om_hits;
+	void *om_rounds[OC_MAGROUNDS];
+};
+
+struct objcache {
+	/* Fixed after creation. */
+	const char *oc_name;
+	size_t oc_size;			/* object size, rounded up */
+	int (*oc_ctor)(void *);
+	void (*oc_dtor)(void *);
+	unsigned oc_perslab;		/* objects per slab; 0 if kmalloc'd */
+	size_t oc_objoffset;		/* offset of object 0 in a slab */
+	unsigned oc_magsize;		/* magazine capacity */
+	struct objcache *oc_next;	/* on allcaches */
+
+	/* Protected by oc_lock. */
+	struct spinlock oc_lock;
+	struct ocslab *oc_partial;	/* slabs with free objects */
+	unsigned oc_nslabs;
+	unsigned oc_nempty;		/* slabs with all objects free */
+	unsigned oc_nobjs;		/* constructed objects */
+	unsigned oc_nfree;		/* constructed objects free in slabs */
+	unsigned oc_nctors;		/* statistics */
+	unsigned oc_slowallocs;
+
+	/* Set once, by the cpu in question, under oc_lock. */
+	struct ocmag *oc_mags[MAXCPUS];
+};
+
+#define OS_OBJ(oc, slab, i) \
+	((void *)((vaddr_t)(slab) + (oc)->oc_objoffset + (i) * (oc)->oc_size))
+
+/* List of all caches; append-only. */
+static struct spinlock allcaches_lock = SPINLOCK_INITIALIZER;
+static struct objcache *allcaches;
+
+////////////////////////////////////////////////////////////
+// slab layer
+
+static
+void
+oc_link(struct objcache *oc, struct ocslab *slab)
+{
+	slab->os_prev = NULL;
+	slab->os_next = oc->oc_partial;
+	if (oc->oc_partial != NULL) {
+		oc->oc_partial->os_prev = slab;
+	}
+	oc->oc_partial = slab;
+}
+
+static
+void
+oc_unlink(struct objcache *oc, struct ocslab *slab)
+{
+	if (slab->os_prev != NULL) {
+		slab->os_prev->os_next = slab->os_next;
+	}
+	else {
+		KASSERT(oc->oc_partial == slab);
+		oc->oc_partial = slab->os_next;
+	}
+	if (slab->os_next != NULL) {
+		slab->os_next->os_prev = slab->os_prev;
+	}
+	slab->os_next = slab->os_prev = NULL;
+}
+
+/*
+ * Get a page and construct a slab's worth of objects in it. If the
+ * constructor fails partway we keep what we got, if anything.
+ * Called without oc_lock, as alloc_kpages might sleep.
+ */
+static
+struct ocslab *
+oc_newslab(struct objcache *oc)
+{
+	struct ocslab *slab;
+	vaddr_t page;
+	unsigned i, n;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	slab = (struct ocslab *)page;
+	slab->os_next = slab->os_prev = NULL;
+	slab->os_cache = oc;
+
+	for (n=0; n<oc->oc_perslab; n++) {
+		if (oc->oc_ctor != NULL && oc->oc_ctor(OS_OBJ(oc, slab, n))) {
+			break;
+		}
+	}
+	if (n == 0) {
+		free_kpages(page);
+		return NULL;
+	}
+	slab->os_nobjs = n;
+	slab->os_nfree = n;
+	/* Stack them so object 0 comes off first. */
+	for (i=0; i<n; i++) {
+		slab->os_freeidx[i] = n - 1 - i;
+	}
+	return slab;
+}
+
+/*
+ * Destruct all the objects in a free slab and give back its page.
+ * Called without oc_lock.
+ */
+static
+void
+oc_freeslab(struct objcache *oc, struct ocslab *slab)
+{
+	unsigned i;
+
+	KASSERT(slab->os_nfree == slab->os_nobjs);
+	if (oc->oc_dtor != NULL) {
+		for (i=0; i<slab->os_nobjs; i++) {
+			oc->oc_dtor(OS_OBJ(oc, slab, i));
+		}
+	}
+	free_kpages((vaddr_t)slab);
+}
+
+/*
+ * Take a free object out of SLAB.
+ */
+static
+void *
+oc_take(struct objcache *oc, struct ocslab *slab)
+{
+	KASSERT(spinlock_do_i_hold(&oc->oc_lock));
+	KASSERT(slab->os_nfree > 0);
+	oc->oc_nfree--;
+	return OS_OBJ(oc, slab, slab->os_freeidx[--slab->os_nfree]);
+}
+
+/*
+ * Get up to N constructed objects, making more if there are none.
+ * Returns the number placed in OBJS; 0 means out of memory.
+ */
+static
+unsigned
+oc_getbatch(struct objcache *oc, void **objs, unsigned n)
+{
+	struct ocslab *slab;
+	unsigned got = 0;
+
+	if (oc->oc_perslab == 0) {
+		/* Large objects: make one. */
+		objs[0] = kmalloc(oc->oc_size);
+		if (objs[0] == NULL) {
+			return 0;
+		}
+		if (oc->oc_ctor != NULL && oc->oc_ctor(objs[0])) {
+			kfree(objs[0]);
+			return 0;
+		}
+		spinlock_acquire(&oc->oc_lock);
+		oc->oc_nobjs++;
+		oc->oc_nctors++;
+		spinlock_release(&oc->oc_lock);
+		return 1;
+	}
+
+	spinlock_acquire(&oc->oc_lock);
+	while (got < n && oc->oc_partial != NULL) {
+		slab = oc->oc_partial;
+		if (slab->os_nfree == slab->os_nobjs) {
+			oc->oc_nempty--;
+		}
+		while (got < n && slab->os_nfree > 0) {
+			objs[got++] = oc_take(oc, slab);
+		}
+		if (slab->os_nfree == 0) {
+			oc_unlink(oc, slab);
+		}
+	}
+	spinlock_release(&oc->oc_lock);
+
+	if (got > 0) {
+		return got;
+	}
+
+	slab = oc_newslab(oc);
+	if (slab == NULL) {
+		return 0;
+	}
+
+	spinlock_acquire(&oc->oc_lock);
+	oc->oc_nslabs++;
+	oc->oc_nobjs += slab->os_nobjs;
+	oc->oc_nfree += slab->os_nobjs;
+	oc->oc_nctors += slab->os_nobjs;
+	while (got < n && slab->os_nfree > 0) {
+		objs[got++] = oc_take(oc, slab);
+	}
+	if (slab->os_nfree > 0) {
+		oc_link(oc, slab);
+	}
+	spinlock_release(&oc->oc_lock);
+
+	return got;
+}
+
+/*
+ * Return N objects to their slabs (or, for large objects, destruct
+ * and kfree them).
+ */
+static
+void
+oc_putbatch(struct objcache *oc, void **objs, unsigned n)
+{
+	struct ocslab *slab;
+	unsigned i, idx;
+
+	if (oc->oc_perslab == 0) {
+		for (i=0; i<n; i++) {
+			if (oc->oc_dtor != NULL) {
+				oc->oc_dtor(objs[i]);
+			}
+			kfree(objs[i]);
+		}
+		spinlock_acquire(&oc->oc_lock);
+		KASSERT(oc->oc_nobjs >= n);
+		oc->oc_nobjs -= n;
+		spinlock_release(&oc->oc_lock);
+		return;
+	}
+
+	spinlock_acquire(&oc->oc_lock);
+	for (i=0; i<n; i++) {
+		slab = (struct ocslab *)((vaddr_t)objs[i] & PAGE_FRAME);
+		KASSERT(slab->os_cache == oc);
+		idx = ((vaddr_t)objs[i] - (vaddr_t)slab - oc->oc_objoffset)
+			/ oc->oc_size;
+		KASSERT(idx < slab->os_nobjs);
+		KASSERT(OS_OBJ(oc, slab, idx) == objs[i]);
+		KASSERT(slab->os_nfree < slab->os_nobjs);
+
+		if (slab->os_nfree == 0) {
+			oc_link(oc, slab);
+		}
+		slab->os_freeidx[slab->os_nfree++] = idx;
+		oc->oc_nfree++;
+
+		if (slab->os_nfree < slab->os_nobjs) {
+			continue;
+		}
+		if (oc->oc_nempty == 0) {
+			/* Keep it as the spare. */
+			oc->oc_nempty++;
+			continue;
+		}
+
+		/* Already have a spare; give this one back. */
+		oc_unlink(oc, slab);
+		oc->oc_nslabs--;
+		oc->oc_nobjs -= slab->os_nobjs;
+		oc->oc_nfree -= slab->os_nobjs;
+		spinlock_release(&oc->oc_lock);
+		oc_freeslab(oc, slab);
+		spinlock_acquire(&oc->oc_lock);
+	}
+	spinlock_release(&oc->oc_lock);
+}
+
+////////////////////////////////////////////////////////////
+// magazine layer
+
+/*
+ * Get the current cpu's magazine, making it if CREATE is set and
+ * there isn't one yet. Returns NULL if there's no curcpu yet or no
+ * memory. As in kmalloc.c, if we migrate after looking, we just end
+ * up using another cpu's magazine, which is safe since it's locked.
+ */
+static
+struct ocmag *
+oc_getmag(struct objcache *oc, bool create)
+{
+	struct ocmag *mag;
+	unsigned num;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	num = curcpu->c_number;
+	KASSERT(num < MAXCPUS);
+
+	mag = oc->oc_mags[num];
+	if (mag != NULL || !create) {
+		return mag;
+	}
+
+	mag = kmalloc(sizeof(*mag));
+	if (mag == NULL) {
+		return NULL;
+	}
+	spinlock_init(&mag->om_lock);
+	mag->om_nrounds = 0;
+	mag->om_allocs = 0;
+	mag->om_hits = 0;
+
+	spinlock_acquire(&oc->oc_lock);
+	if (oc->oc_mags[num] == NULL) {
+		oc->oc_mags[num] = mag;
+		mag = NULL;
+	}
+	spinlock_release(&oc->oc_lock);
+
+	if (mag != NULL) {
+		/* Somebody else on this cpu beat us to it. */
+		spinlock_cleanup(&mag->om_lock);
+		kfree(mag);
+	}
+	return oc->oc_mags[num];
+}
+
+/*
+ * Create a cache.
+ */
+struct objcache *
+objcache_create(const char *name, size_t size,
+		int (*ctor)(void *), void (*dtor)(void *))
+{
+	struct objcache *oc;
+	unsigned i, n;
+
+	KASSERT(size > 0);
+
+	oc = kmalloc(sizeof(*oc));
+	if (oc == NULL) {
+		return NULL;
+	}
+
+	oc->oc_name = name;
+	oc->oc_size = ROUNDUP(size, OC_ALIGN);
+	oc->oc_ctor = ctor;
+	oc->oc_dtor = dtor;
+
+	if (oc->oc_size <= OC_SLABMAX) {
+		/* Fit as many as we can along with their free stack slots. */
+		n = (PAGE_SIZE - sizeof(struct ocslab)) /
+			(oc->oc_size + sizeof(uint16_t));
+		while (ROUNDUP(sizeof(struct ocslab) + n * sizeof(uint16_t),
+			       OC_ALIGN) + n * oc->oc_size > PAGE_SIZE) {
+			n--;
+		}
+		KASSERT(n > 1);
+		oc->oc_perslab = n;
+		oc->oc_objoffset = ROUNDUP(sizeof(struct ocslab) +
+					   n * sizeof(uint16_t), OC_ALIGN);
+		oc->oc_magsize = OC_MAGROUNDS;
+	}
+	else {
+		oc->oc_perslab = 0;
+		oc->oc_objoffset = 0;
+		oc->oc_magsize = OC_BIGROUNDS;
+	}
+
+	spinlock_init(&oc->oc_lock);
+	oc->oc_partial = NULL;
+	oc->oc_nslabs = 0;
+	oc->oc_nempty = 0;
+	oc->oc_nobjs = 0;
+	oc->oc_nfree = 0;
+	oc->oc_nctors = 0;
+	oc->oc_slowallocs = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		oc->oc_mags[i] = NULL;
+	}
+
+	spinlock_acquire(&allcaches_lock);
+	oc->oc_next = allcaches;
+	allcaches = oc;
+	spinlock_release(&allcaches_lock);
+
+	return oc;
+}
+
+/*
+ * Allocate an object.
+ */
+void *
+objcache_alloc(struct objcache *oc)
+{
+	struct ocmag *mag;
+	void *objs[OC_MAGROUNDS/2 + 1];
+	void *obj;
+	unsigned i, n;
+
+	mag = oc_getmag(oc, true);
+	if (mag == NULL) {
+		if (oc_getbatch(oc, objs, 1) == 0) {
+			return NULL;
+		}
+		spinlock_acquire(&oc->oc_lock);
+		oc->oc_slowallocs++;
+		spinlock_release(&oc->oc_lock);
+		return objs[0];
+	}
+
+	spinlock_acquire(&mag->om_lock);
+	mag->om_allocs++;
+	if (mag->om_nrounds > 0) {
+		mag->om_hits++;
+		obj = mag->om_rounds[--mag->om_nrounds];
+		spinlock_release(&mag->om_lock);
+		return obj;
+	}
+	spinlock_release(&mag->om_lock);
+
+	/* Empty. Fill it halfway, plus one object to return. */
+	n = oc_getbatch(oc, objs, oc->oc_magsize / 2 + 1);
+	if (n == 0) {
+		return NULL;
+	}
+	obj = objs[--n];
+
+	spinlock_acquire(&mag->om_lock);
+	for (i=0; i<n && mag->om_nrounds < oc->oc_magsize; i++) {
+		mag->om_rounds[mag->om_nrounds++] = objs[i];
+	}
+	spinlock_release(&mag->om_lock);
+
+	if (i < n) {
+		/* Someone else filled it meanwhile; give the rest back. */
+		oc_putbatch(oc, objs + i, n - i);
+	}
+	return obj;
+}
+
+/*
+ * Free an object.
+ */
+void
+objcache_free(struct objcache *oc, void *obj)
+{
+	struct ocmag *mag;
+	void *objs[OC_MAGROUNDS/2];
+	unsigned n;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	/* Don't make a magazine here; kmalloc might sleep. */
+	mag = oc_getmag(oc, false);
+	if (mag == NULL) {
+		oc_putbatch(oc, &obj, 1);
+		return;
+	}
+
+	spinlock_acquire(&mag->om_lock);
+	if (mag->om_nrounds < oc->oc_magsize) {
+		mag->om_rounds[mag->om_nrounds++] = obj;
+		spinlock_release(&mag->om_lock);
+		return;
+	}
+
+	/* Full. Send back the older half and keep the warm ones. */
+	n = oc->oc_magsize / 2;
+	memcpy(objs, mag->om_rounds, n * sizeof(void *));
+	memmove(mag->om_rounds, mag->om_rounds + n,
+		(mag->om_nrounds - n) * sizeof(void *));
+	mag->om_nrounds -= n;
+	mag->om_rounds[mag->om_nrounds++] = obj;
+	spinlock_release(&mag->om_lock);
+
+	oc_putbatch(oc, objs, n);
+}
+
+////////////////////////////////////////////////////////////
+// reclaim and stats
+
+/*
+ * Empty all of OC's magazines and give back its free slabs. Returns
+ * the number of objects and slabs dealt with, so the caller can tell
+ * whether anything happened.
+ */
+static
+unsigned
+oc_reclaim(struct objcache *oc)
+{
+	struct ocmag *mag;
+	struct ocslab *slab;
+	void *objs[OC_MAGROUNDS];
+	unsigned i, n, count = 0;
+
+	for (i=0; i<MAXCPUS; i++) {
+		mag = oc->oc_mags[i];
+		if (mag == NULL) {
+			continue;
+		}
+		spinlock_acquire(&mag->om_lock);
+		n = mag->om_nrounds;
+		memcpy(objs, mag->om_rounds, n * sizeof(void *));
+		mag->om_nrounds = 0;
+		spinlock_release(&mag->om_lock);
+
+		if (n > 0) {
+			oc_putbatch(oc, objs, n);
+			count += n;
+		}
+	}
+
+	spinlock_acquire(&oc->oc_lock);
+	while (oc->oc_nempty > 0) {
+		for (slab = oc->oc_partial; slab != NULL;
+		     slab = slab->os_next) {
+			if (slab->os_nfree == slab->os_nobjs) {
+				break;
+			}
+		}
+		KASSERT(slab != NULL);
+		oc_unlink(oc, slab);
+		oc->oc_nempty--;
+		oc->oc_nslabs--;
+		oc->oc_nobjs -= slab->os_nobjs;
+		oc->oc_nfree -= slab->os_nobjs;
+		spinlock_release(&oc->oc_lock);
+		oc_freeslab(oc, slab);
+		count++;
+		spinlock_acquire(&oc->oc_lock);
+	}
+	spinlock_release(&oc->oc_lock);
+
+	return count;
+}
+
+void
+objcache_reclaim(void)
+{
+	struct objcache *oc;
+	unsigned count;
+
+	/*
+	 * Destructors may free objects into other caches (e.g. a
+	 * destructor that calls lock_destroy), so go round until
+	 * nothing more turns up.
+	 */
+	do {
+		count = 0;
+		spinlock_acquire(&allcaches_lock);
+		oc = allcaches;
+		spinlock_release(&allcaches_lock);
+		for (; oc != NULL; oc = oc->oc_next) {
+			count += oc_reclaim(oc);
+		}
+	} while (count > 0);
+}
+
+void
+objcache_printstats(void)
+{
+	struct objcache *oc;
+	struct ocmag *mag;
+	unsigned i, cached, allocs, hits;
+	unsigned nslabs, nobjs, nfree, nctors;
+
+	spinlock_acquire(&allcaches_lock);
+	oc = allcaches;
+	spinlock_release(&allcaches_lock);
+
+	kprintf("Object cache status:\n");
+	kprintf("%-16s %5s %5s %6s %7s %7s %8s %9s %4s\n",
+		"name", "size", "/slab", "slabs", "in use", "cached",
+		"ctors", "allocs", "hit%");
+
+	for (; oc != NULL; oc = oc->oc_next) {
+		cached = allocs = hits = 0;
+		for (i=0; i<MAXCPUS; i++) {
+			mag = oc->oc_mags[i];
+			if (mag == NULL) {
+				continue;
+			}
+			spinlock_acquire(&mag->om_lock);
+			cached += mag->om_nrounds;
+			allocs += mag->om_allocs;
+			hits += mag->om_hits;
+			spinlock_release(&mag->om_lock);
+		}
+
+		spinlock_acquire(&oc->oc_lock);
+		nslabs = oc->oc_nslabs;
+		nobjs = oc->oc_nobjs;
+		nfree = oc->oc_nfree;
+		nctors = oc->oc_nctors;
+		allocs += oc->oc_slowallocs;
+		spinlock_release(&oc->oc_lock);
+
+		kprintf("%-16s %5u %5u %6u %7u %7u %8u %9u %4u\n",
+			oc->oc_name, (unsigned)oc->oc_size, oc->oc_perslab,
+			nslabs, nobjs - nfree - cached, cached + nfree,
+			nctors, allocs, allocs ? hits * 100 / allocs : 0);
+	}
+}
@@ -33,6 +33,7 @@
 #include <spl.h>
 #include <cpu.h>
 #include <spinlock.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
@@ -43,6 +44,7 @@
 #include <vfs.h>
 #include <stat.h>
 #include <uio.h>
+#include <copyinout.h>
 
 
 static int prevspot;
@@ -61,6 +63,26 @@ struct lock *swaptable_lock;
 
 static int preveviction;
 
+//TLB shootdowns go out one at a time, so no cpu's queue can overflow.
+//tlbsd_pending counts the cpus yet to do the current one; they may
+//answer before the sender has added them in, so it can dip below 0
+static struct lock *tlbsd_lock;
+static struct spinlock tlbsd_spinlock = SPINLOCK_INITIALIZER;
+static volatile int tlbsd_pending;
+
+//Frames [kzone_start, kzone_end) are held back for multi-page kernel
+//allocations, so kernel buffers can usually find a contiguous run
+//without evicting anything. User pages are never placed there.
+#define KZONE_MAXPAGES 32
+static unsigned long kzone_start;
+static unsigned long kzone_end;
+
+//Most pins one frame can carry, from the width of ppage.pins
+#define CM_MAXPINS 4095
+
+static paddr_t cm_assemblerun(unsigned long);
+static void swapframe(unsigned int, struct pte *);
+
 static unsigned long found;
 
 void
@@ -98,15 +120,31 @@ cm_bootstrap(){
     coremap[i].touched = 0;
     coremap[i].swapping = 0;
     coremap[i].chunk = 0;
+    coremap[i].reserved = 0;
+    coremap[i].evicting = 0;
+    coremap[i].pins = 0;
+    coremap[i].pinfreed = 0;
+    coremap[i].pageref = NULL;
     coremap[i].pte = NULL;
   }
+
+  //Sets aside the kernel zone, at most an eighth of the free frames
+  kzone_start = kern_pcount;
+  kzone_end = kzone_start + (cmap_pcount - kern_pcount) / 8;
+  if(kzone_end - kzone_start > KZONE_MAXPAGES) kzone_end = kzone_start + KZONE_MAXPAGES;
+
   //For quicker searching, start looking further in
-  prevspot = kern_pcount;
+  prevspot = kzone_end;
   found = kern_pcount;
 }
 
 void
 swap_bootstrap(){
+  tlbsd_lock = lock_create("tlbshootdown");
+  if(tlbsd_lock == NULL){
+    panic("swap_bootstrap: Out of memory\n");
+  }
+
   //Sets up the swapdisk if available
   prevslot = 0;
   preveviction = kern_pcount;
@@ -134,90 +172,166 @@ swap_bootstrap(){
   }
 }
 
-/*Gets physical pages*/
-paddr_t
-getppages(unsigned long npages, bool kern, bool swapping){
-
-  //Search for a segment of npages in pmem
-  unsigned int start = 0;
+//Returns the first frame of a run of npages free frames within [from, to),
+//or 0 if there is none. Frame 0 always belongs to the kernel so 0 is never
+//a valid answer. Called with cm_lock held.
+static
+unsigned long
+cm_findrun(unsigned long from, unsigned long to, unsigned long npages){
   unsigned long c = 0;
-  for(unsigned long i = prevspot; i < cmap_pcount && c < npages; i++){
-    if(coremap[i].valid == 0 && coremap[i].kern==0) c++;
+  for(unsigned long i = from; i < to; i++){
+    if(coremap[i].valid == 0 && coremap[i].kern == 0) c++;
     else c = 0;
-    if(c == npages){
-      start = i - npages + 1;
-      break;
-    }
+    if(c == npages) return i - npages + 1;
   }
+  return 0;
+}
 
-  if(c != npages){
-    //if spot not found in our optimized location to start, we want to reset that start location
-    prevspot = kern_pcount;
-    for(unsigned long i = kern_pcount; i < cmap_pcount && c < npages; i++){
-      if(coremap[i].valid == 0 && coremap[i].kern==0) c++;
-      else c = 0;
-      if(c == npages){
-        start = i - npages + 1;
-        break;
-      }
-    }
+//Marks the run of npages frames starting at start as allocated
+static
+void
+cm_claim(unsigned long start, unsigned long npages, bool kern, bool swapping){
+  for(unsigned long i = start; i < npages + start; i++){
+    if(i == start) coremap[i].chunk = npages;
+    else coremap[i].chunk = 0;
+    if(kern) coremap[i].kern = 1;
+    else coremap[i].kern = 0;
+    if(swapping) coremap[i].swapping = 1;
+    else coremap[i].swapping = 0;
+    coremap[i].valid = 1;
+    coremap[i].touched = 1;
   }
+}
+
+/*Gets physical pages*/
+paddr_t
+getppages(unsigned long npages, bool kern, bool swapping){
+
+  unsigned long start = 0;
 
-  // Search done without lock, now check with the lock
   spinlock_acquire(&cm_lock);
-  c = 0;
-  for(unsigned long i = start; i < cmap_pcount && c < npages; i++){
-    if(coremap[i].valid == 0 && coremap[i].kern==0) c++;
-    else c = 0;
-    if(c == npages){
-      start = i - npages + 1;
-      break;
-    }
-  }
 
-  if(c != npages){
-    for(unsigned long i = kern_pcount; i < cmap_pcount && c < npages; i++){
-      if(coremap[i].valid == 0 && coremap[i].kern==0) c++;
-      else c = 0;
-      if(c == npages){
-        start = i - npages + 1;
-        break;
-      }
-    }
+  //Multi-page kernel allocations look in the reserved zone first
+  if(kern && npages > 1) start = cm_findrun(kzone_start, kzone_end, npages);
+
+  //Then the general pool, starting where the last search left off
+  if(start == 0){
+    start = cm_findrun(prevspot, cmap_pcount, npages);
+    if(start == 0) start = cm_findrun(kzone_end, cmap_pcount, npages);
+    if(start != 0) prevspot = start + npages;
   }
 
+  //Single kernel pages may dip into the zone before evicting anything,
+  //user pages never go there so the zone stays free of swappable frames
+  if(start == 0 && kern) start = cm_findrun(kzone_start, kzone_end, npages);
+
   //Found a segment of free pages large enough
-  if(c == npages){
-    prevspot = start + npages;
-    //Increment through the coremap at the segment we found
-    //and initialize the ppages
-    for(unsigned int i = start; i < npages + start; i++){
-      if(i == start) coremap[i].chunk = npages;
-      else coremap[i].chunk = 0;
-      if(kern) coremap[i].kern = 1;
-      else coremap[i].kern = 0;
-      if(swapping) coremap[i].swapping = 1;
-      else coremap[i].swapping = 0;
-      coremap[i].valid = 1;
-      coremap[i].touched = 1;
-    }
+  if(start != 0){
+    cm_claim(start, npages, kern, swapping);
     usedbytes += npages * PAGE_SIZE;
+    spinlock_release(&cm_lock);
     paddr_t paddr = start * PAGE_SIZE;
     bzero((void *)PADDR_TO_KVADDR(paddr & PAGE_FRAME), npages * PAGE_SIZE);
-    spinlock_release(&cm_lock);
     return paddr;
   }
   // //Otherwise, we need to swap out npages
   #if OPT_DUMBVM
   #else
   if(haveswap){
-    KASSERT(npages == 1);
-    return swapout(kern, swapping);
+    if(npages == 1) return swapout(kern, swapping);
+    if(kern) return cm_assemblerun(npages);
   }
   #endif
   spinlock_release(&cm_lock);
   return 0;
-  //swapout releases the spinlock
+  //swapout and cm_assemblerun release the spinlock
+}
+
+//Whether frame i could be part of a run assembled by cm_assemblerun:
+//either free, or a settled user page we are allowed to evict
+static
+bool
+cm_movable(unsigned long i){
+  if(coremap[i].valid == 0 && coremap[i].kern == 0) return true;
+  return coremap[i].valid && !coremap[i].kern && !coremap[i].swapping &&
+         coremap[i].pins == 0 && coremap[i].pte != NULL &&
+         (unsigned long)coremap[i].pte->ppn == i;
+}
+
+//Builds a contiguous run of npages frames for the kernel when no free run
+//exists. Chooses the window that needs the fewest evictions, claims every
+//frame in it so nobody else can take them, then pushes the user pages in
+//the window out to swap. Called with cm_lock held; releases it.
+static
+paddr_t
+cm_assemblerun(unsigned long npages){
+  unsigned long best = 0, bestcost = npages + 1;
+  unsigned long len = 0, cost = 0;
+
+  KASSERT(spinlock_do_i_hold(&cm_lock));
+
+  //Slide a window of npages movable frames across memory, counting how
+  //many of them are in use
+  for(unsigned long i = kzone_start; i < cmap_pcount; i++){
+    if(!cm_movable(i)){
+      len = 0;
+      cost = 0;
+      continue;
+    }
+    len++;
+    if(coremap[i].valid) cost++;
+    if(len > npages){
+      if(coremap[i - npages].valid) cost--;
+      len = npages;
+    }
+    if(len == npages && cost < bestcost){
+      best = i - npages + 1;
+      bestcost = cost;
+    }
+  }
+
+  if(best == 0){
+    spinlock_release(&cm_lock);
+    return 0;
+  }
+
+  //Claim the window. Free frames become kernel frames right away; user
+  //frames are marked kern and reserved so swapout and the allocator skip
+  //them and free_kpages hands them to us instead of freeing them
+  for(unsigned long i = best; i < best + npages; i++){
+    if(coremap[i].valid == 0){
+      coremap[i].valid = 1;
+      coremap[i].pte = NULL;
+      usedbytes += PAGE_SIZE;
+    }else{
+      coremap[i].reserved = 1;
+    }
+    coremap[i].kern = 1;
+    coremap[i].touched = 1;
+  }
+  spinlock_release(&cm_lock);
+
+  //Push the user pages out, unless their owner freed them in the meantime.
+  //Holding the pte keeps it from being freed before swapframe locks it
+  for(unsigned long i = best; i < best + npages; i++){
+    spinlock_acquire(&cm_lock);
+    struct pte *pte = coremap[i].pte;
+    if(pte != NULL) pte->evictors++;
+    spinlock_release(&cm_lock);
+    if(pte != NULL) swapframe(i, pte);
+  }
+
+  spinlock_acquire(&cm_lock);
+  cm_claim(best, npages, true, false);
+  for(unsigned long i = best; i < best + npages; i++){
+    KASSERT(coremap[i].pte == NULL);
+    coremap[i].reserved = 0;
+  }
+  spinlock_release(&cm_lock);
+
+  paddr_t paddr = best * PAGE_SIZE;
+  bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+  return paddr;
 }
 
 /* Allocate/free some kernel-space virtual pages */
@@ -228,6 +342,18 @@ alloc_kpages(unsigned npages) {
   return 0;
 }
 
+//Marks frame i free. Called with cm_lock held
+static
+void
+cm_free(unsigned long i){
+  coremap[i].valid = 0;
+  coremap[i].kern = 0;
+  coremap[i].touched = 0;
+  coremap[i].swapping = 0;
+  coremap[i].pinfreed = 0;
+  bzero((void *)PADDR_TO_KVADDR(i * PAGE_SIZE), PAGE_SIZE);
+}
+
 void
 free_kpages(vaddr_t addr) {
   //conversion
@@ -243,21 +369,28 @@ free_kpages(vaddr_t addr) {
   KASSERT(coremap[ppn].chunk != 0);
 
   unsigned npages = coremap[ppn].chunk;
+  unsigned freed = 0;
   coremap[ppn].chunk = 0;
   unsigned int limit = npages + ppn;
   for(unsigned int i = ppn; i < limit; i++){
     // if(coremap[i].pte != NULL) lock_acquire(coremap[i].pte->lock);
-    KASSERT(coremap[i].chunk == 0 && coremap[i].valid == 1 && coremap[i].swapping == 0);
-    coremap[i].valid = 0;
-    coremap[i].kern = 0;
-    coremap[i].touched = 0;
-    coremap[i].swapping = 0;
     coremap[i].pte = NULL;
+    coremap[i].pageref = NULL;
+    //Frame is part of a run cm_assemblerun is building, or swapout is
+    //about to reuse it; either way it stays in use
+    if(coremap[i].reserved || coremap[i].evicting) continue;
+    KASSERT(coremap[i].chunk == 0 && coremap[i].valid == 1 && coremap[i].swapping == 0);
+    //Someone is still reading a pinned page; vm_unpinpage frees it later
+    if(coremap[i].pins > 0){
+      coremap[i].pinfreed = 1;
+      continue;
+    }
+    cm_free(i);
+    freed++;
     // if(coremap[i].pte != NULL) lock_release(coremap[i].pte->lock);
   }
 
-  bzero((void *)PADDR_TO_KVADDR(paddr & PAGE_FRAME), npages * PAGE_SIZE);
-  usedbytes -= npages * PAGE_SIZE;
+  usedbytes -= freed * PAGE_SIZE;
   spinlock_release(&cm_lock);
 
 
@@ -269,9 +402,56 @@ coremap_used_bytes() {
   return usedbytes;
 }
 
+//Drops vaddr from this cpu's TLB, if it's there
+static
+void
+tlb_invalidate(vaddr_t vaddr){
+  int spl = splhigh();
+  int index = tlb_probe(vaddr & PAGE_FRAME, 0);
+  if(index >= 0) tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
+  splx(spl);
+}
+
+//Loads a mapping, replacing any entry for the same page. With several
+//threads of a process faulting on one cpu the page may already be there
+static
+void
+tlb_load(uint32_t hi, uint32_t lo){
+  int spl = splhigh();
+  int index = tlb_probe(hi, 0);
+  if(index >= 0) tlb_write(hi, lo, index);
+  else tlb_random(hi, lo);
+  splx(spl);
+}
+
 void
 vm_tlbshootdown(const struct tlbshootdown *ts) {
-  (void)ts;
+  tlb_invalidate(ts->ts_vaddr);
+  spinlock_acquire(&tlbsd_spinlock);
+  tlbsd_pending--;
+  spinlock_release(&tlbsd_spinlock);
+}
+
+void
+vm_tlbinvalidate(vaddr_t vaddr){
+  struct tlbshootdown ts;
+  unsigned n;
+
+  tlb_invalidate(vaddr);
+
+  //Only one at a time; the last one has been answered by everybody
+  lock_acquire(tlbsd_lock);
+  KASSERT(tlbsd_pending == 0);
+  ts.ts_vaddr = vaddr;
+  n = ipi_tlbshootdown_broadcast(&ts);
+  spinlock_acquire(&tlbsd_spinlock);
+  tlbsd_pending += n;
+  spinlock_release(&tlbsd_spinlock);
+
+  //The others answer from their IPI handlers; interrupts stay on so
+  //we can answer theirs too
+  while(tlbsd_pending > 0);
+  lock_release(tlbsd_lock);
 }
 
 
@@ -283,24 +463,68 @@ cm_touch(paddr_t addr){
   coremap[ppn].touched = 1;
 }
 
+//kmalloc records the pageref of each heap page here so kfree can find
+//it without searching. No cm_lock needed: the pointer is its own word,
+//and only the owner of the page (kmalloc, under its own lock) changes it
+void
+cm_setpageref(vaddr_t addr, struct pageref *pr){
+  unsigned long ppn = KVADDR_TO_PADDR(addr) / PAGE_SIZE;
+  KASSERT(coremap[ppn].valid && coremap[ppn].kern);
+  coremap[ppn].pageref = pr;
+}
+
+struct pageref *
+cm_getpageref(vaddr_t addr){
+  unsigned long ppn = KVADDR_TO_PADDR(addr) / PAGE_SIZE;
+  return coremap[ppn].pageref;
+}
+
+//Counts the free frames, how many separate runs they form and how long
+//the longest run is, for kmalloc's fragmentation report
+void
+cm_freeruns(unsigned long *nfree, unsigned long *nruns, unsigned long *longest){
+  unsigned long run = 0;
+  *nfree = *nruns = *longest = 0;
+  spinlock_acquire(&cm_lock);
+  for(unsigned long i = kern_pcount; i < cmap_pcount; i++){
+    if(coremap[i].valid == 0 && coremap[i].kern == 0){
+      if(run == 0) (*nruns)++;
+      run++;
+      (*nfree)++;
+      if(run > *longest) *longest = run;
+    }else run = 0;
+  }
+  spinlock_release(&cm_lock);
+}
+
+//Whether swapout may take frame i: a settled user page not recently used.
+//Called with cm_lock held
+static
+bool
+cm_evictable(unsigned long i){
+  return coremap[i].valid && !coremap[i].kern && !coremap[i].swapping &&
+         !coremap[i].reserved && !coremap[i].evicting && coremap[i].pins == 0 &&
+         !coremap[i].touched && coremap[i].pte != NULL;
+}
+
 paddr_t
 swapout(bool kern, bool swapping){
   printCoreMap();
   //Find a page that we can evict while resetting the touched bit
   unsigned int found = 0;
   for(unsigned int i = preveviction; i < cmap_pcount; i++){
-    if(!found && !coremap[i].kern && !coremap[i].swapping && (!coremap[i].touched || !coremap[i].valid)) found = i;
+    if(!found && cm_evictable(i)) found = i;
     if(coremap[i].touched) coremap[i].touched = 0;
   }
   if(!found){
     preveviction = kern_pcount;
     for(unsigned int i = kern_pcount; i < cmap_pcount; i++){
-      if(!found && !coremap[i].kern && !coremap[i].swapping && (!coremap[i].touched || !coremap[i].valid)) found = i;
+      if(!found && cm_evictable(i)) found = i;
       if(coremap[i].touched) coremap[i].touched = 0;
     }
     if(!found){
       for(unsigned int i = kern_pcount; i < cmap_pcount; i++){
-        if(!found && !coremap[i].kern && !coremap[i].swapping && (!coremap[i].touched || !coremap[i].valid)) found = i;
+        if(!found && cm_evictable(i)) found = i;
         if(coremap[i].touched) coremap[i].touched = 0;
       }
     }
@@ -313,39 +537,79 @@ swapout(bool kern, bool swapping){
   }
   KASSERT(found >= kern_pcount && found < cmap_pcount);
   //Should never happen
-  //Sets their valid and touched bits to 1 so that they aren't swapped out while swapping out
-  //Actually doesn't completely prevent this but it's possible
   KASSERT(coremap[found].pte->ppn != TEMP_PPN);
   KASSERT(coremap[found].pte->ppn != INVAL_PPN);
   KASSERT((unsigned int)coremap[found].pte->ppn == found);
   KASSERT(coremap[found].kern != 1);
   KASSERT(coremap[found].swapping != 1);
 
-
+  //Mark the frame ours before letting go of cm_lock: nobody else evicts
+  //it, and if its owner frees it meanwhile free_kpages leaves it to us.
+  //Holding the pte keeps it from being freed before swapframe locks it
+  struct pte *pte = coremap[found].pte;
+  pte->evictors++;
   coremap[found].swapping = 1;
+  coremap[found].evicting = 1;
   spinlock_release(&cm_lock);
 
-  KASSERT(coremap[found].pte != NULL);
-  struct pte *ptecheck = coremap[found].pte;
-  lock_acquire(coremap[found].pte->lock);
-  KASSERT(coremap[found].pte->ppn != INVAL_PPN);
+  swapframe(found, pte);
+
+  spinlock_acquire(&cm_lock);
+  coremap[found].evicting = 0;
+  spinlock_release(&cm_lock);
+
+  KASSERT(coremap[found].valid == 1);
+  if(kern) coremap[found].kern = 1;
+  else coremap[found].kern = 0;
+  coremap[found].touched = 1;
+  coremap[found].chunk = 1;
+  if(swapping) coremap[found].swapping = 1;
+  else coremap[found].swapping = 0;
+
+  paddr_t paddr = found * PAGE_SIZE;
+  bzero((void *)PADDR_TO_KVADDR(paddr & PAGE_FRAME), PAGE_SIZE);
+  return paddr;
+}
+
+//Writes the user page held in frame found out to the swapdisk and detaches
+//it from its pte. The caller must already have made sure nobody else will
+//evict or allocate the frame, and have taken a hold on pte (the frame's
+//pte when it looked, under cm_lock), which is given up here. If the owner
+//has freed the page since, there is nothing to write.
+static
+void
+swapframe(unsigned int found, struct pte *pte){
+  lock_acquire(pte->lock);
+  spinlock_acquire(&cm_lock);
+  bool gone = coremap[found].pte != pte;
+  spinlock_release(&cm_lock);
+  if(gone){
+    lock_release(pte->lock);
+    spinlock_acquire(&cm_lock);
+    pte->evictors--;
+    spinlock_release(&cm_lock);
+    return;
+  }
+  KASSERT((unsigned int)pte->ppn == found);
 
   coremap[found].touched = 1;
   coremap[found].valid = 1;
 
   //Swaps out that page
   //Now that we have the PTE, must first remove all TLB entries that map from that PTE's vpn
-  uint32_t hi = coremap[found].pte->vpn << 12;
+  uint32_t hi = pte->vpn << 12;
   int spl = splhigh();
   int index = tlb_probe(hi, 0);
   if(index >= 0) tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
   //Invalidate the ppn and slot number so it doesnt continue adding TLB entires
-  int s = coremap[found].pte->slot;
-  coremap[found].pte->slot = -1;
-  // kprintf("Invalidating PPN 0x%08x\n", iter->ppn << 12);
-  paddr_t oldpaddr = coremap[found].pte->ppn << 12;
-  coremap[found].pte->ppn = INVAL_PPN;
+  int s = pte->slot;
+  pte->slot = -1;
+  paddr_t oldpaddr = pte->ppn << 12;
+  pte->ppn = INVAL_PPN;
   splx(spl);
+  //Other threads of the process may have the page mapped on other cpus;
+  //once they've dropped it nothing more can be written to the frame
+  vm_tlbinvalidate(hi);
   //Now we need to copy to swapdisk, we must first search for an opening if the PTE doesnt already have one
   if(s < 0){
     lock_acquire(swaptable_lock);
@@ -381,25 +645,14 @@ swapout(bool kern, bool swapping){
   }
 
   //Now that we have written our page to disk, we can notify the PTE that it is stored on disk and release lock
-  // kprintf("\n-----%d\n", s);
-  coremap[found].pte->slot = s;
+  pte->slot = s;
 
-  KASSERT(coremap[found].valid == 1);
-  if(kern) coremap[found].kern = 1;
-  else coremap[found].kern = 0;
-  coremap[found].touched = 1;
-  coremap[found].chunk = 1;
-  if(swapping) coremap[found].swapping = 1;
-  else coremap[found].swapping = 0;
-
-  paddr_t paddr = found * PAGE_SIZE;
-  bzero((void *)PADDR_TO_KVADDR(paddr & PAGE_FRAME), PAGE_SIZE);
-  KASSERT(coremap[found].pte == ptecheck);
-  lock_release(coremap[found].pte->lock);
+  spinlock_acquire(&cm_lock);
+  KASSERT(coremap[found].pte == pte);
   coremap[found].pte = NULL;
-  // kprintf("After Swapping: \n");
-  // printPageTable();
-  return paddr;
+  pte->evictors--;
+  spinlock_release(&cm_lock);
+  lock_release(pte->lock);
 }
 
 void
@@ -465,6 +718,46 @@ swapin(struct pte *pte){
 }
 
 
+//Finds the pte for vpn in as. Called with as_ptlock held
+static
+struct pte *
+pt_lookup(struct addrspace *as, vaddr_t vpn){
+  struct pte *iter = as->pt_head;
+  while(iter != NULL){
+    if(iter->vpn == vpn) break;
+    iter = iter->next;
+  }
+  return iter;
+}
+
+//Puts an existing page into the TLB, bringing it in from the swapdisk
+//first if it's out there. Called with iter->lock held, which was taken
+//before letting go of as_ptlock so sbrk can't free the pte first
+static
+int
+vm_loadpte(struct pte *iter){
+  //Must be in swapdisk or in the process of being swapped out, need to swapin
+  #if OPT_DUMBVM
+  #else
+  if(haveswap && iter->ppn == INVAL_PPN){
+    if(iter->slot < 0){
+      lock_release(iter->lock);
+      return 0;
+    }
+    swapin(iter);
+  }
+  #endif
+
+  //Should be in memory otherwise
+  uint32_t hi = (iter->vpn << 12) & PAGE_FRAME;
+  uint32_t lo = (iter->ppn << 12) | TLBLO_DIRTY | TLBLO_VALID;
+  tlb_load(hi, lo);
+  //Alerts the coremap that this page was just used, data is used for eviction
+  cm_touch(iter->ppn << 12);
+  lock_release(iter->lock);
+  return 0;
+}
+
 int
 vm_fault(int faulttype, vaddr_t vaddr) {
   //Gets the address space
@@ -504,92 +797,125 @@ vm_fault(int faulttype, vaddr_t vaddr) {
     return EFAULT;
   }
 
-  //Iterate through the page table and check for a page with that vpn
-  struct pte *iter = as->pt_head;
-  while(iter != NULL){
-    if(iter->vpn == (vaddr >> 12)) break;
-    iter = iter->next;
-  }
-
+  //Look the page up. Other threads of the process may be faulting at
+  //the same time, so the page table list is only walked under as_ptlock
+  vaddr_t vpn = vaddr >> 12;
+  lock_acquire(as->as_ptlock);
+  struct pte *iter = pt_lookup(as, vpn);
+  if(iter != NULL) lock_acquire(iter->lock);
+  lock_release(as->as_ptlock);
 
   //If not found, we must load the TLB
   if(iter == NULL){
 
-    //allocates physical pages and creates the pte
-    struct pte *pte = kmalloc(sizeof(struct pte));
-    //Creates and initializes the pte
-    if(pte == NULL){
-      return ENOMEM;
-    }
-    pte->lock = lock_create("pte");
-    KASSERT(pte->lock != NULL);
-    lock_acquire(pte->lock);
-    pte->vpn = vaddr >> 12;
-    pte->slot = -1;
-    //Found region, check permissions
-    pte->permissions = reg_iter->executable | reg_iter->writeable | reg_iter->readable;
-    pte->next = as->pt_head;
-    pte->ppn = TEMP_PPN;
-    as->pt_head = pte;
-    // kprintf("!");
-
-
-    paddr_t paddr = getppages(1, false, false);
+    //allocates physical pages and creates the pte. The frame is marked
+    //swapping, like pte_copy's, so it isn't evicted before it has a pte
+    paddr_t paddr = getppages(1, false, true);
     //Makes sure the addr is page aligned
     if(!haveswap && paddr == 0){
-      kfree(pte);
       return ENOMEM;
     }
     KASSERT(paddr != 0);
     KASSERT((paddr & PAGE_FRAME) == paddr);
     KASSERT(coremap[paddr / PAGE_SIZE].pte == NULL);
-
     KASSERT((paddr >> 12) != INVAL_PPN);
+
+    struct pte *pte = pte_create();
+    if(pte == NULL){
+      coremap[paddr / PAGE_SIZE].swapping = 0;
+      free_kpages(PADDR_TO_KVADDR(paddr));
+      return ENOMEM;
+    }
+    //Creates and initializes the pte
+    lock_acquire(pte->lock);
+    pte->vpn = vpn;
+    pte->slot = -1;
+    //Found region, check permissions
+    pte->permissions = reg_iter->executable | reg_iter->writeable | reg_iter->readable;
     pte->ppn = paddr >> 12;
 
+    //Another thread may have put the page in while we were allocating
+    lock_acquire(as->as_ptlock);
+    iter = pt_lookup(as, vpn);
+    if(iter == NULL){
+      pte->next = as->pt_head;
+      as->pt_head = pte;
+    }else{
+      lock_acquire(iter->lock);
+    }
+    lock_release(as->as_ptlock);
+
+    if(iter != NULL){
+      lock_release(pte->lock);
+      pte_destroy(pte);
+      coremap[paddr / PAGE_SIZE].swapping = 0;
+      free_kpages(PADDR_TO_KVADDR(paddr));
+      return vm_loadpte(iter);
+    }
+
     //Assigns the pte to the coremap entry just retrieved
     coremap[paddr / PAGE_SIZE].pte = pte;
+    coremap[paddr / PAGE_SIZE].swapping = 0;
 
-    //Masks vaddr
-    uint32_t hi = vaddr & PAGE_FRAME;
-
-    //Combines bits together for lo
-    uint32_t lo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-
-    //Finally, we must load these two arguments into the TLB
-
-    int spl = splhigh();
-    KASSERT(tlb_probe(hi, 0) < 0);
-    tlb_random(hi, lo);
-    splx(spl);
+    //Masks vaddr, combines bits together for lo and loads the TLB
+    tlb_load(vaddr & PAGE_FRAME, paddr | TLBLO_DIRTY | TLBLO_VALID);
     lock_release(pte->lock);
     return 0;
-  }else{
-    //Virtual page found but was not in TLB
-    //Must be in swapdisk or in the process of being swapped out, need to swapin
-    lock_acquire(iter->lock);
-    #if OPT_DUMBVM
-    #else
-    if(haveswap && iter->ppn == INVAL_PPN){
-      if(iter->slot < 0){
-        lock_release(iter->lock);
-        return 0;
+  }
+  //Virtual page found but was not in TLB
+  return vm_loadpte(iter);
+}
+
+//Holds the user page at vaddr in memory for the caller, faulting it in
+//first if need be, and hands back the physical address of vaddr. Until
+//vm_unpinpage the frame's pin count keeps swapout and the compactor off
+//it, and keeps it allocated even if the process frees the page
+int
+vm_pinpage(vaddr_t vaddr, paddr_t *ret){
+  struct addrspace *as = curproc->p_addrspace;
+  vaddr_t vpn = vaddr >> 12;
+  bool pinned;
+  char c;
+  int result;
+
+  while(1){
+    //Fault it in, or find out it isn't a valid page, the usual way
+    result = copyin((const_userptr_t)vaddr, &c, 1);
+    if(result) return result;
+
+    lock_acquire(as->as_ptlock);
+    struct pte *pte = pt_lookup(as, vpn);
+    if(pte != NULL) lock_acquire(pte->lock);
+    lock_release(as->as_ptlock);
+    if(pte == NULL) continue;
+
+    //It may have been evicted again already, or be on its way out, or
+    //(rarely) have as many pins as it can count
+    pinned = false;
+    if(pte->ppn != INVAL_PPN){
+      spinlock_acquire(&cm_lock);
+      if(!coremap[pte->ppn].swapping && coremap[pte->ppn].pins < CM_MAXPINS){
+        coremap[pte->ppn].pins++;
+        *ret = (pte->ppn << 12) | (vaddr & ~PAGE_FRAME);
+        pinned = true;
       }
-      swapin(iter);
+      spinlock_release(&cm_lock);
     }
-    #endif
-
-    //Should be in memory otherwise
-    uint32_t hi = (iter->vpn << 12) & PAGE_FRAME;
-    uint32_t lo = (iter->ppn << 12) | TLBLO_DIRTY | TLBLO_VALID;
-    int spl = splhigh();
-    KASSERT(tlb_probe(hi, 0) < 0);
-    tlb_random(hi, lo);
-    splx(spl);
-    //Alerts the coremap that this page was just used, data is used for eviction
-    cm_touch(iter->ppn << 12);
-    lock_release(iter->lock);
-    return 0;
+    lock_release(pte->lock);
+    if(pinned) return 0;
+    thread_yield();
+  }
+}
+
+void
+vm_unpinpage(paddr_t paddr){
+  unsigned long ppn = paddr / PAGE_SIZE;
+  spinlock_acquire(&cm_lock);
+  KASSERT(coremap[ppn].pins > 0);
+  coremap[ppn].pins--;
+  if(coremap[ppn].pins == 0 && coremap[ppn].pinfreed){
+    cm_free(ppn);
+    usedbytes -= PAGE_SIZE;
   }
- return 0;
+  spinlock_release(&cm_lock);
 }
@@ -0,0 +1,10 @@
+---
+name: "kmalloc Throughput Test"
+description: >
+  Times many small kmalloc/kfree pairs from concurrent threads.
+tags: [coremap]
+depends: [not-dumbvm.t]
+sys161:
+  cpus: 4
+---
+| km6
@@ -0,0 +1,11 @@
+---
+name: "Spinlock Contention Test"
+description: >
+  Has every cpu take and release one spinlock as fast as it can, and
+  checks that the lock is shared out fairly between them.
+tags: [synch]
+depends: [boot]
+sys161:
+  cpus: 4
+---
+| slt
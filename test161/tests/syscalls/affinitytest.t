@@ -0,0 +1,12 @@
+---
+name: "CPU Affinity Test"
+description: >
+  Checks setaffinity and getaffinity, that children and threads
+  inherit the mask, and that children confined to one cpu all finish.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 8M
+  cpus: 4
+---
+$ /testbin/affinitytest -c 4
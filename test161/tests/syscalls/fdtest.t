@@ -0,0 +1,13 @@
+---
+name: "File Table Test"
+description: >
+  Fills the file table well past 64 descriptors, checks that the
+  lowest free descriptor is always used, has several threads open and
+  close at once, and times fork with the table full.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  cpus: 4
+  ram: 8M
+---
+$ /testbin/fdtest -n 300 -f 50
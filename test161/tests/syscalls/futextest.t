@@ -0,0 +1,12 @@
+---
+name: "Futex Test"
+description: >
+  Checks the futex-based mutexes and condition variables in libc with
+  several threads, and times them against semfs semaphores.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  cpus: 4
+  ram: 8M
+---
+$ /testbin/futextest -l 1000 -t 4
@@ -0,0 +1,12 @@
+---
+name: "Exec Throughput Test"
+description: >
+  Times rounds of concurrent execs from several processes to check
+  that execv does not serialize across cpus.
+tags: [sys_exec,procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  cpus: 4
+  ram: 4M
+---
+$ /testbin/multiexec -j 8 -r 5 /testbin/add 3 8
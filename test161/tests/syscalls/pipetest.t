@@ -0,0 +1,13 @@
+---
+name: "Pipe Test"
+description: >
+  Checks pipe EOF and EPIPE, that writes of up to PIPE_BUF bytes from
+  several processes at once don't get mixed, and that a long stream
+  written in large chunks arrives intact. Reports how long the same
+  data takes with small and with large writes.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 8M
+---
+$ /testbin/pipetest -k 1024 -w 4
@@ -0,0 +1,12 @@
+---
+name: "Poll and Select Test"
+description: >
+  Checks poll and select on pipes, the console and semfs semaphores,
+  including timeouts, with one process waiting on many pipes at once
+  while children write to them at staggered times.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 8M
+---
+$ /testbin/polltest -p 8
@@ -0,0 +1,12 @@
+---
+name: "Vectored and Positional I/O Test"
+description: >
+  Checks readv, writev, pread and pwrite, including that pread and
+  pwrite leave the seek position alone, with several processes doing
+  pread through one shared descriptor at once.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 8M
+---
+$ /testbin/rwvtest -r 256 -p 4
@@ -0,0 +1,12 @@
+---
+name: "Scheduler Wakeup Latency Test"
+description: >
+  Sleeps repeatedly for short times while several CPU-bound children
+  spin, and checks that the sleeper is run again promptly when it
+  wakes up, and that the spinners aren't switched on every tick.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 8M
+---
+$ /testbin/schedtest -h 4 -s 3
@@ -0,0 +1,12 @@
+---
+name: "vfork and spawn Test"
+description: >
+  Checks vfork and spawn, including spawn's file actions and error
+  reporting, then times launching a program from a large parent with
+  fork, vfork and spawn.
+tags: [sys_fork,sys_exec,procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 8M
+---
+$ /testbin/spawntest -r 10 -b 512
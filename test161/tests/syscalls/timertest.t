@@ -0,0 +1,12 @@
+---
+name: "Timer Test"
+description: >
+  Checks that nanosleep sleeps as long as asked, including sleeps
+  shorter than a hardclock, that setitimer and getitimer agree, and
+  that an alarm kills a spinning or sleeping child with SIGALRM.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 8M
+---
+$ /testbin/timertest -n 20
@@ -0,0 +1,14 @@
+---
+name: "User Threads Test"
+description: >
+  Runs several threads in one process: checks that they share memory,
+  that join returns each thread's value and that returning from main
+  ends the threads still running, and times a computation split over
+  one thread and over four.
+tags: [procsyscalls,syscalls]
+depends: [shell]
+sys161:
+  cpus: 4
+  ram: 8M
+---
+$ /testbin/userthreads 4
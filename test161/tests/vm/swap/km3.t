@@ -0,0 +1,13 @@
+---
+name: "Large kmalloc Test (Swap)"
+description: >
+  Stresses the subpage allocator while user pages compete for a small
+  amount of physical memory.
+tags: [swap]
+depends: [/coremap/km3.t]
+sys161:
+  ram: 1M
+  disk1:
+    enabled: true
+---
+| km3 5000
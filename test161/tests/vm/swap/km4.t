@@ -0,0 +1,15 @@
+---
+name: "Multipage allocation Test (Swap)"
+description: >
+  Allocates and frees between 1 and 5 contiguous pages from concurrent
+  threads with tight RAM, forcing the coremap to evict user pages to
+  assemble contiguous runs.
+tags: [swap]
+depends: [/coremap/km4.t]
+sys161:
+  cpus: 2
+  ram: 1M
+  disk1:
+    enabled: true
+---
+| km4
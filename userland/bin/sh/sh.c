@@ -421,11 +421,16 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
+	/*
+	 * vfork, so starting a program doesn't cost a copy of the
+	 * shell's address space. The child runs on our memory until
+	 * it execs or exits, so it must not do anything else.
+	 */
+	pid = vfork();
 	switch (pid) {
 		case -1:
 			/* error */
-			warn("fork");
+			warn("vfork");
 			exitinfo_exit(ei, 255);
 			return;
 		case 0:
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYNC_H_
+#define _SYNC_H_
+
+/*
+ * Mutexes and condition variables for user threads.
+ *
+ * These are built on futex(): taking a free mutex, releasing one
+ * nobody waits for, and signaling a condition variable nobody waits
+ * on are done with atomic instructions alone, and only a thread that
+ * actually has to sleep (or wake a sleeper) makes a system call.
+ *
+ * Futexes are private to an address space, so these only work
+ * between threads of one process, not across fork.
+ *
+ * Zero-filled memory is a valid unlocked mutex and a valid condition
+ * variable, and nothing needs to be destroyed.
+ */
+
+struct mutex {
+	volatile int mx_state;	/* 0 free, 1 held, 2 held with waiters */
+};
+
+struct cond {
+	volatile int cv_seq;	/* bumped by every signal/broadcast */
+	volatile int cv_waiters;	/* threads in cond_wait */
+};
+
+#define MUTEX_INITIALIZER	{ 0 }
+#define COND_INITIALIZER	{ 0, 0 }
+
+void mutex_init(struct mutex *mx);
+void mutex_lock(struct mutex *mx);
+int mutex_trylock(struct mutex *mx);	/* 1 if taken, 0 if busy */
+void mutex_unlock(struct mutex *mx);
+
+void cond_init(struct cond *cv);
+void cond_wait(struct cond *cv, struct mutex *mx);
+void cond_signal(struct cond *cv);
+void cond_broadcast(struct cond *cv);
+
+#endif /* _SYNC_H_ */
@@ -38,10 +38,13 @@
  * kernel includes. This way user-level code doesn't need to know
  * about the kern/ headers.
  */
+#include <kern/cpustat.h>
 #include <kern/fcntl.h>
+#include <kern/futex.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/spawn.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
@@ -58,6 +61,8 @@
  *     fstat:    sys/stat.h
  *     lstat:    sys/stat.h
  *     mkdir:    sys/stat.h
+ *     readv:    sys/uio.h
+ *     writev:   sys/uio.h
  *
  * If this were standard Unix, more prototypes would go in other
  * header files as well, as follows:
@@ -129,6 +134,8 @@ int ioctl(int filehandle, int code, void *buf);
 off_t lseek(int filehandle, off_t pos, int code);
 int fsync(int filehandle);
 int ftruncate(int filehandle, off_t size);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
 int remove(const char *filename);
 int rename(const char *oldfile, const char *newfile);
 int link(const char *oldfile, const char *newfile);
@@ -137,12 +144,27 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(__intptr_t change);
+int __thread_create(void (*start)(void *(*)(void *), void *),
+		    void *(*func)(void *), void *arg);
+__DEAD void __thread_exit(void *retval);
+int thread_join(int tid, void **retval);
+int futex(volatile int *addr, int op, int val);
+int setaffinity(pid_t pid, unsigned mask);
+int getaffinity(pid_t pid, unsigned *mask);
+int cpustat(unsigned cpu, struct cpustat *cs);
+pid_t vfork(void);
+pid_t spawn(const char *prog, char *const *args,
+	    const struct spawn_action *actions, int nactions);
 ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+int getitimer(int which, struct itimerval *value);
+int setitimer(int which, const struct itimerval *value,
+	      struct itimerval *ovalue);
 ssize_t __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
@@ -152,6 +174,8 @@ ssize_t __getcwd(char *buf, size_t buflen);
  */
 
 int execvp(const char *prog, char *const *args); /* calls execv */
+int thread_create(void *(*func)(void *), void *arg); /* calls __thread_create */
+__DEAD void thread_exit(void *retval);		/* calls __thread_exit */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
 
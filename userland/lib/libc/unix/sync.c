@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <limits.h>
+#include <sync.h>
+
+/*
+ * Mutexes and condition variables on futexes. The mutex is the
+ * three-state one from Drepper's "Futexes Are Tricky": a waiter
+ * always leaves the state at 2, so the holder knows to make the wake
+ * call when it lets go, and otherwise skips it.
+ */
+
+/*
+ * Atomic operations, with the LL/SC loops written out in assembler
+ * since nothing else may touch memory between the LL and the SC.
+ */
+
+/* If *P is OLD, set it to NEW. Returns what *P was. */
+static
+int
+atomic_cas(volatile int *p, int old, int new)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/* prev = *p */
+		"bne %0, %3, 2f;"	/* not OLD: give up */
+		" move %1, %4;"		/* (delay slot) tmp = new */
+		"sc %1, 0(%2);"		/* *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/* lost the race: again */
+		" nop;"
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return prev;
+}
+
+/* Set *P to VAL. Returns what *P was. */
+static
+int
+atomic_swap(volatile int *p, int val)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		".set noreorder;"
+		"1: ll %0, 0(%2);"	/* prev = *p */
+		"move %1, %3;"		/* tmp = val */
+		"sc %1, 0(%2);"		/* *p = tmp; tmp = success? */
+		"beqz %1, 1b;"
+		" nop;"
+		".set pop"
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (val)
+		: "memory");
+	return prev;
+}
+
+/* Add DELTA to *P. */
+static
+void
+atomic_add(volatile int *p, int delta)
+{
+	int tmp;
+
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		".set noreorder;"
+		"1: ll %0, 0(%1);"	/* tmp = *p */
+		"addu %0, %0, %2;"	/* tmp += delta */
+		"sc %0, 0(%1);"		/* *p = tmp; tmp = success? */
+		"beqz %0, 1b;"
+		" nop;"
+		".set pop"
+		: "=&r" (tmp)
+		: "r" (p), "r" (delta)
+		: "memory");
+}
+
+////////////////////////////////////////////////////////////
+// mutexes
+
+void
+mutex_init(struct mutex *mx)
+{
+	mx->mx_state = 0;
+}
+
+int
+mutex_trylock(struct mutex *mx)
+{
+	return atomic_cas(&mx->mx_state, 0, 1) == 0;
+}
+
+/*
+ * Take MX, marking it contended; for a thread that has already
+ * waited, so may not be the only one.
+ */
+static
+void
+mutex_lock_contended(struct mutex *mx)
+{
+	while (atomic_swap(&mx->mx_state, 2) != 0) {
+		futex(&mx->mx_state, FUTEX_WAIT, 2);
+	}
+}
+
+void
+mutex_lock(struct mutex *mx)
+{
+	int c;
+
+	c = atomic_cas(&mx->mx_state, 0, 1);
+	if (c == 0) {
+		/* The fast path: no system call */
+		return;
+	}
+	if (c == 1 && atomic_swap(&mx->mx_state, 2) == 0) {
+		/* It was let go in between */
+		return;
+	}
+	mutex_lock_contended(mx);
+}
+
+void
+mutex_unlock(struct mutex *mx)
+{
+	if (atomic_swap(&mx->mx_state, 0) == 2) {
+		futex(&mx->mx_state, FUTEX_WAKE, 1);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// condition variables
+
+void
+cond_init(struct cond *cv)
+{
+	cv->cv_seq = 0;
+	cv->cv_waiters = 0;
+}
+
+/*
+ * Sleep until the sequence number moves on from what it was when we
+ * let go of MX; a signal in between changes it, so the futex wait
+ * fails at once and nothing is lost. Wakeups can be spurious, as
+ * usual.
+ *
+ * We count ourselves in before reading the sequence number, so a
+ * signaler that sees no waiters bumped it before we read it, and
+ * can skip the system call.
+ */
+void
+cond_wait(struct cond *cv, struct mutex *mx)
+{
+	int seq;
+
+	atomic_add(&cv->cv_waiters, 1);
+	seq = cv->cv_seq;
+	mutex_unlock(mx);
+	futex(&cv->cv_seq, FUTEX_WAIT, seq);
+	atomic_add(&cv->cv_waiters, -1);
+	/* Others may be waking with us */
+	mutex_lock_contended(mx);
+}
+
+void
+cond_signal(struct cond *cv)
+{
+	atomic_add(&cv->cv_seq, 1);
+	if (cv->cv_waiters > 0) {
+		futex(&cv->cv_seq, FUTEX_WAKE, 1);
+	}
+}
+
+void
+cond_broadcast(struct cond *cv)
+{
+	atomic_add(&cv->cv_seq, 1);
+	if (cv->cv_waiters > 0) {
+		futex(&cv->cv_seq, FUTEX_WAKE, THREAD_MAX);
+	}
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * affinitytest - setaffinity and getaffinity.
+ *
+ * Checks that bad arguments are refused, that a mask can be set and
+ * read back, that cpus that don't exist are dropped from it, and that
+ * children and threads get their parent's mask. Then several children
+ * confined to cpu 0 all spin for a while, to make sure confining
+ * them doesn't keep any from finishing.
+ *
+ * usage: affinitytest [-c children]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define MAXKIDS    16
+#define SPIN       200000
+
+static int nkids = 4;
+
+static
+unsigned
+getmask(void)
+{
+	unsigned mask;
+
+	if (getaffinity(0, &mask) < 0) {
+		err(1, "getaffinity");
+	}
+	return mask;
+}
+
+static
+void
+waitchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+static
+void *
+threadmask(void *arg)
+{
+	(void)arg;
+	return (void *)getmask();
+}
+
+static
+void
+basics(void)
+{
+	unsigned all, mask;
+	void *ret;
+	pid_t pid;
+	int tid;
+
+	all = getmask();
+	if ((all & 1) == 0) {
+		errx(1, "starting mask 0x%x doesn't include cpu 0", all);
+	}
+
+	if (setaffinity(0, 0) == 0 || errno != EINVAL) {
+		errx(1, "an empty mask wasn't EINVAL");
+	}
+	if (setaffinity(getpid() + 1000, 1) == 0 || errno != ESRCH) {
+		errx(1, "somebody else's pid wasn't ESRCH");
+	}
+	if (getaffinity(0, NULL) == 0 || errno != EFAULT) {
+		errx(1, "a NULL mask pointer wasn't EFAULT");
+	}
+
+	if (setaffinity(getpid(), 1) < 0) {
+		err(1, "setaffinity");
+	}
+	if ((mask = getmask()) != 1) {
+		errx(1, "set mask 0x1 but read back 0x%x", mask);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		_exit(getmask() == 1 ? 0 : 1);
+	}
+	waitchild(pid);
+
+	tid = thread_create(threadmask, NULL);
+	if (tid < 0) {
+		err(1, "thread_create");
+	}
+	if (thread_join(tid, &ret) < 0) {
+		err(1, "thread_join");
+	}
+	if ((unsigned)ret != 1) {
+		errx(1, "a new thread got mask 0x%x", (unsigned)ret);
+	}
+
+	/* Every cpu there is, and then some */
+	if (setaffinity(0, 0xffffffff) < 0) {
+		err(1, "setaffinity");
+	}
+	if ((mask = getmask()) != all) {
+		errx(1, "asked for every cpu, got 0x%x, not 0x%x", mask, all);
+	}
+}
+
+/* Children all pinned to cpu 0 each do some work. */
+static
+void
+crowd(void)
+{
+	pid_t pids[MAXKIDS];
+	volatile unsigned n;
+	int i;
+
+	if (setaffinity(0, 1) < 0) {
+		err(1, "setaffinity");
+	}
+	for (i = 0; i < nkids; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			for (n = 0; n < SPIN; n++) {
+				;
+			}
+			_exit(getmask() == 1 ? 0 : 1);
+		}
+	}
+	for (i = 0; i < nkids; i++) {
+		waitchild(pids[i]);
+	}
+	if (setaffinity(0, 0xffffffff) < 0) {
+		err(1, "setaffinity");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+			nkids = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: affinitytest [-c children]");
+		}
+	}
+	if (nkids < 1 || nkids > MAXKIDS) {
+		errx(1, "affinitytest: need 1 to %d children", MAXKIDS);
+	}
+
+	basics();
+	crowd();
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/affinitytest");
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * fdtest - the file descriptor table.
+ *
+ * Opens the console over and over to fill the table well past its
+ * initial size, checking each open gets the lowest free fd and that
+ * a freed fd is handed out again first; checks dup2 far above the
+ * open fds and at OPEN_MAX; has several threads open and close at
+ * once; and times fork with the table full.
+ *
+ * usage: fdtest [-n fds] [-f forks]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define NTHREADS  4
+#define THREADOPS 200
+
+static int nfds = 300;
+static int nforks = 50;
+
+static
+int
+openconsole(void)
+{
+	int fd;
+
+	fd = open("con:", O_WRONLY);
+	if (fd < 0) {
+		err(1, "con:");
+	}
+	return fd;
+}
+
+static
+void
+fill(void)
+{
+	int i, fd;
+
+	/* 0, 1 and 2 are already open */
+	for (i = 3; i < nfds; i++) {
+		fd = openconsole();
+		if (fd != i) {
+			errx(1, "open gave fd %d, expected %d", fd, i);
+		}
+	}
+
+	/* Free a few; they come back lowest first */
+	close(100);
+	close(40);
+	close(70);
+	if ((fd = openconsole()) != 40) {
+		errx(1, "open gave fd %d, expected 40", fd);
+	}
+	if ((fd = openconsole()) != 70) {
+		errx(1, "open gave fd %d, expected 70", fd);
+	}
+	if ((fd = openconsole()) != 100) {
+		errx(1, "open gave fd %d, expected 100", fd);
+	}
+
+	if (dup2(STDOUT_FILENO, OPEN_MAX - 1) != OPEN_MAX - 1) {
+		err(1, "dup2 to %d", OPEN_MAX - 1);
+	}
+	if (write(OPEN_MAX - 1, "", 0) < 0) {
+		err(1, "write to fd %d", OPEN_MAX - 1);
+	}
+	if (dup2(STDOUT_FILENO, OPEN_MAX) >= 0 || errno != EBADF) {
+		errx(1, "dup2 to OPEN_MAX didn't fail with EBADF");
+	}
+	close(OPEN_MAX - 1);
+}
+
+/* Opens and closes; every fd it gets must be one nobody else holds. */
+static
+void *
+churn(void *arg)
+{
+	static volatile char held[OPEN_MAX];
+	int fds[8];
+	int i, j;
+
+	(void)arg;
+	for (i = 0; i < THREADOPS; i++) {
+		for (j = 0; j < 8; j++) {
+			fds[j] = openconsole();
+			if (held[fds[j]]) {
+				errx(1, "fd %d handed out twice", fds[j]);
+			}
+			held[fds[j]] = 1;
+		}
+		for (j = 0; j < 8; j++) {
+			held[fds[j]] = 0;
+			if (close(fds[j]) < 0) {
+				err(1, "close %d", fds[j]);
+			}
+		}
+	}
+	return NULL;
+}
+
+static
+void
+threads(void)
+{
+	int tids[NTHREADS];
+	int i;
+
+	for (i = 0; i < NTHREADS; i++) {
+		tids[i] = thread_create(churn, NULL);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		if (thread_join(tids[i], NULL) < 0) {
+			err(1, "thread_join");
+		}
+	}
+}
+
+/* Milliseconds for NFORKS fork/exit/waitpid rounds. */
+static
+unsigned long
+timeforks(void)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	pid_t pid;
+	int i, status;
+
+	__time(&s0, &ns0);
+	for (i = 0; i < nforks; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long ms;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			nfds = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			nforks = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: fdtest [-n fds] [-f forks]");
+		}
+	}
+	if (nfds <= 100 || nfds > OPEN_MAX - 8 * NTHREADS - 1 || nforks < 1) {
+		errx(1, "fdtest: need 101 to %d fds", OPEN_MAX - 8 * NTHREADS - 1);
+	}
+
+	fill();
+	threads();
+	ms = timeforks();
+	tprintf("%d forks with %d fds open: %lu ms\n", nforks, nfds, ms);
+
+	for (i = 3; i < nfds; i++) {
+		if (close(i) < 0) {
+			err(1, "close %d", i);
+		}
+	}
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/fdtest");
+	return 0;
+}
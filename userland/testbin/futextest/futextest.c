@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futextest - check the futex-based mutexes and condition variables
+ * in libc, and time them against semfs semaphores (as usemtest uses).
+ *
+ * Three rounds, each run once with struct mutex/cond and once with
+ * "sem:" files:
+ *    - uncontended: one thread takes and releases a lock LOOPS times;
+ *    - contended: NTHREADS threads bump a shared counter under a lock;
+ *    - handoff: two threads pass a token back and forth.
+ * The counter and the handoff order are checked; the times are just
+ * printed.
+ *
+ * usage: futextest [-l loops] [-t nthreads]
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+#include <sync.h>
+#include <test161/test161.h>
+
+#define DEFAULT_LOOPS     1000
+#define DEFAULT_THREADS   4
+#define MAXTHREADS        16	/* three semaphores each must fit in the fd table */
+
+static int loops = DEFAULT_LOOPS;
+static int nthreads = DEFAULT_THREADS;
+
+static struct mutex mx = MUTEX_INITIALIZER;
+static struct cond cv = COND_INITIALIZER;
+static volatile int counter;
+static volatile int turn;
+
+/*
+ * semfs semaphore, as in usemtest. A read that blocks holds its file
+ * handle's lock, so each thread gets its own open of each semaphore.
+ */
+struct usem {
+	char name[32];
+	int fds[MAXTHREADS];
+};
+
+static struct usem lock_sem, ping_sem, pong_sem;
+
+////////////////////////////////////////////////////////////
+// semfs semaphores
+
+static
+void
+usem_init(struct usem *sem, const char *tag, unsigned count)
+{
+	char c = 0;
+	int i;
+
+	snprintf(sem->name, sizeof(sem->name), "sem:futextest.%s", tag);
+	for (i = 0; i < nthreads; i++) {
+		sem->fds[i] = open(sem->name,
+				   i == 0 ? O_RDWR|O_CREAT|O_TRUNC : O_RDWR,
+				   0664);
+		if (sem->fds[i] < 0) {
+			err(1, "%s: open", sem->name);
+		}
+	}
+	while (count-- > 0) {
+		if (write(sem->fds[0], &c, 1) != 1) {
+			err(1, "%s: write", sem->name);
+		}
+	}
+}
+
+static
+void
+usem_cleanup(struct usem *sem)
+{
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		close(sem->fds[i]);
+	}
+	(void)remove(sem->name);
+}
+
+/* P and V as thread number WHO */
+static
+void
+P(struct usem *sem, int who)
+{
+	char c;
+
+	if (read(sem->fds[who], &c, 1) != 1) {
+		err(1, "%s: read", sem->name);
+	}
+}
+
+static
+void
+V(struct usem *sem, int who)
+{
+	char c = 0;
+
+	if (write(sem->fds[who], &c, 1) != 1) {
+		err(1, "%s: write", sem->name);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// timing
+
+static time_t startsecs;
+static unsigned long startnsecs;
+
+static
+void
+timer_start(void)
+{
+	__time(&startsecs, &startnsecs);
+}
+
+/* Milliseconds since timer_start */
+static
+unsigned long
+timer_ms(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (secs - startsecs) * 1000
+		+ nsecs / 1000000 - startnsecs / 1000000;
+}
+
+static
+void
+report(const char *what, unsigned long futexms, unsigned long semms)
+{
+	tprintf("%-12s futex %6lu ms   semfs %6lu ms\n", what, futexms, semms);
+}
+
+////////////////////////////////////////////////////////////
+// threads
+
+static
+int
+startthread(void *(*func)(void *), void *arg)
+{
+	int tid;
+
+	tid = thread_create(func, arg);
+	if (tid < 0) {
+		err(1, "thread_create");
+	}
+	return tid;
+}
+
+static
+void
+jointhread(int tid)
+{
+	if (thread_join(tid, NULL) < 0) {
+		err(1, "thread_join");
+	}
+}
+
+/* Runs FUNC in NTHREADS threads, numbered from 0, and waits for them. */
+static
+void
+runthreads(void *(*func)(void *))
+{
+	int tids[MAXTHREADS];
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		tids[i] = startthread(func, (void *)i);
+	}
+	for (i = 0; i < nthreads; i++) {
+		jointhread(tids[i]);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// contended counter
+
+static
+void *
+count_futex(void *arg)
+{
+	int i;
+
+	(void)arg;
+	for (i = 0; i < loops; i++) {
+		mutex_lock(&mx);
+		counter++;
+		mutex_unlock(&mx);
+	}
+	return NULL;
+}
+
+static
+void *
+count_sem(void *arg)
+{
+	int who = (int)arg;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		P(&lock_sem, who);
+		counter++;
+		V(&lock_sem, who);
+	}
+	return NULL;
+}
+
+static
+void
+checkcount(const char *what)
+{
+	if (counter != nthreads * loops) {
+		errx(1, "%s: counter is %d, expected %d", what, counter,
+		     nthreads * loops);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// handoff
+
+/* Waits for TURN to be ME, then hands it to the other thread. */
+static
+void *
+pingpong_futex(void *arg)
+{
+	int me = (int)arg;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		mutex_lock(&mx);
+		while (turn != me) {
+			cond_wait(&cv, &mx);
+		}
+		counter++;
+		turn = !me;
+		cond_signal(&cv);
+		mutex_unlock(&mx);
+	}
+	return NULL;
+}
+
+static
+void *
+pingpong_sem(void *arg)
+{
+	int me = (int)arg;
+	struct usem *mine = me ? &pong_sem : &ping_sem;
+	struct usem *other = me ? &ping_sem : &pong_sem;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		P(mine, me);
+		if (turn != me) {
+			errx(1, "pingpong: thread %d ran out of turn", me);
+		}
+		counter++;
+		turn = !me;
+		V(other, me);
+	}
+	return NULL;
+}
+
+static
+void
+pingpong(void *(*func)(void *))
+{
+	int t0, t1;
+
+	turn = 0;
+	counter = 0;
+	t0 = startthread(func, (void *)0);
+	t1 = startthread(func, (void *)1);
+	jointhread(t0);
+	jointhread(t1);
+	if (counter != 2 * loops) {
+		errx(1, "pingpong: counter is %d, expected %d", counter,
+		     2 * loops);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// main
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long futexms, semms;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			loops = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: futextest [-l loops] [-t nthreads]");
+		}
+	}
+	if (loops < 1 || nthreads < 2 || nthreads > MAXTHREADS) {
+		errx(1, "futextest: bad loop or thread count");
+	}
+
+	/* Open everything up front: the threads only read and write. */
+	usem_init(&lock_sem, "lock", 1);
+	usem_init(&ping_sem, "ping", 1);
+	usem_init(&pong_sem, "pong", 0);
+
+	timer_start();
+	for (i = 0; i < loops; i++) {
+		mutex_lock(&mx);
+		mutex_unlock(&mx);
+	}
+	futexms = timer_ms();
+	if (!mutex_trylock(&mx) || mutex_trylock(&mx)) {
+		errx(1, "mutex_trylock is broken");
+	}
+	mutex_unlock(&mx);
+	timer_start();
+	for (i = 0; i < loops; i++) {
+		P(&lock_sem, 0);
+		V(&lock_sem, 0);
+	}
+	semms = timer_ms();
+	report("uncontended", futexms, semms);
+
+	counter = 0;
+	timer_start();
+	runthreads(count_futex);
+	futexms = timer_ms();
+	checkcount("mutex");
+	counter = 0;
+	timer_start();
+	runthreads(count_sem);
+	semms = timer_ms();
+	checkcount("semaphore");
+	report("contended", futexms, semms);
+
+	timer_start();
+	pingpong(pingpong_futex);
+	futexms = timer_ms();
+	timer_start();
+	pingpong(pingpong_sem);
+	semms = timer_ms();
+	report("handoff", futexms, semms);
+
+	usem_cleanup(&lock_sem);
+	usem_cleanup(&ping_sem);
+	usem_cleanup(&pong_sem);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/futextest");
+	return 0;
+}
@@ -29,7 +29,7 @@
 
 /*
  * multiexec - stuff N procs into exec at once
- * usage: multiexec [-j N] [prog [arg...]]
+ * usage: multiexec [-j N] [-r R] [prog [arg...]]
  *
  * This can be used both to see what happens when you have a lot of
  * execs at once (its original purpose) by running ordinary programs
@@ -50,6 +50,10 @@
  *    multiexec /testbin/factorial 15
  *    multiexec /testbin/bigexec
  *    multiexec /testbin/sort (once you have a VM system)
+ * With -r R, does the whole thing R times and reports how long it
+ * took and how many execs per second that comes to, which is handy
+ * for measuring exec throughput on a multiprocessor:
+ *    multiexec -j 8 -r 10 /testbin/add 3 8
  * Some mean things:
  *    multiexec /testbin/forktest
  *    multiexec /testbin/bloat (once you have sbrk)
@@ -159,8 +163,8 @@ static char *subargv[SUBARGC_MAX];
 static int subargc = 0;
 
 static
-void
-spawn(int njobs)
+int
+spawnall(int njobs)
 {
 	struct usem s1, s2;
 	pid_t pids[njobs];
@@ -230,6 +234,8 @@ spawn(int njobs)
 	semclose(&s2);
 	semdestroy(&s1);
 	semdestroy(&s2);
+
+	return failed;
 }
 
 int
@@ -238,7 +244,10 @@ main(int argc, char *argv[])
 	static char default_prog[] = "/bin/pwd";
 
 	int njobs = 12;
-	int i;
+	int nrounds = 0;
+	int i, failed;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, msecs;
 
 	for (i=1; i<argc; i++) {
 		if (!strcmp(argv[i], "-j")) {
@@ -248,6 +257,13 @@ main(int argc, char *argv[])
 			}
 			njobs = atoi(argv[i]);
 		}
+		else if (!strcmp(argv[i], "-r")) {
+			i++;
+			if (argv[i] == NULL) {
+				errx(1, "Option -r requires an argument");
+			}
+			nrounds = atoi(argv[i]);
+		}
 #if 0 /* XXX we apparently don't have strncmp? */
 		else if (!strncmp(argv[i], "-j", 2)) {
 			njobs = atoi(argv[i] + 2);
@@ -266,7 +282,27 @@ main(int argc, char *argv[])
 	}
 	subargv[subargc] = NULL;
 
-	spawn(njobs);
+	if (nrounds == 0) {
+		spawnall(njobs);
+		return 0;
+	}
+
+	failed = 0;
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<nrounds; i++) {
+		failed += spawnall(njobs);
+	}
+	__time(&endsecs, &endnsecs);
+
+	msecs = (endsecs - startsecs) * 1000;
+	msecs += endnsecs / 1000000;
+	msecs -= startnsecs / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	tprintf("%d execs in %lu.%03lu seconds: %lu execs/sec\n",
+		njobs * nrounds, msecs / 1000, msecs % 1000,
+		(unsigned long)njobs * nrounds * 1000 / msecs);
 
-	return 0;
+	return failed > 0 ? 1 : 0;
 }
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pipetest - pipes.
+ *
+ * Checks EOF once the write end is closed, EPIPE once the read end
+ * is, and that a pipe can't seek. Then several children write
+ * PIPE_BUF-sized records into one pipe at once, which must not come
+ * out mixed together, and one child sends a long stream the parent
+ * checks byte by byte, written from a buffer that doesn't start on a
+ * page so large writes cross page boundaries. Last it times moving
+ * the same amount of data with small and with large writes.
+ *
+ * usage: pipetest [-k kbytes] [-w writers]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define MAXWRITERS  8
+#define RECORDS     64
+#define BIGCHUNK    (64 * 1024)
+#define SMALLCHUNK  512
+
+static int kbytes = 1024;
+static int nwriters = 4;
+
+/* The byte at POS of the stream. */
+static
+char
+streambyte(unsigned long pos)
+{
+	return (char)((pos * 7 + pos / 4096) % 251);
+}
+
+static
+void
+makepipe(int fds[2])
+{
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+}
+
+/* Reads exactly LEN bytes unless EOF comes first; returns the count. */
+static
+size_t
+readall(int fd, char *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t r;
+
+	while (got < len) {
+		r = read(fd, buf + got, len - got);
+		if (r < 0) {
+			err(1, "read");
+		}
+		if (r == 0) {
+			break;
+		}
+		got += r;
+	}
+	return got;
+}
+
+static
+void
+waitchild(pid_t pid, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s child failed", what);
+	}
+}
+
+static
+void
+basics(void)
+{
+	char buf[16];
+	int fds[2];
+	ssize_t r;
+
+	makepipe(fds);
+	if (write(fds[1], "hello", 5) != 5) {
+		err(1, "write");
+	}
+	r = read(fds[0], buf, sizeof(buf));
+	if (r != 5 || memcmp(buf, "hello", 5) != 0) {
+		errx(1, "read back %d bytes, not hello", (int)r);
+	}
+	if (lseek(fds[0], 0, SEEK_SET) >= 0 || errno != ESPIPE) {
+		errx(1, "lseek on a pipe didn't fail with ESPIPE");
+	}
+	if (read(fds[1], buf, 1) >= 0 || errno != EBADF) {
+		errx(1, "read from the write end didn't fail with EBADF");
+	}
+	if (write(fds[0], buf, 1) >= 0 || errno != EBADF) {
+		errx(1, "write to the read end didn't fail with EBADF");
+	}
+
+	/* EOF once no writer is left, after what was left in it */
+	if (write(fds[1], "bye", 3) != 3) {
+		err(1, "write");
+	}
+	close(fds[1]);
+	r = read(fds[0], buf, sizeof(buf));
+	if (r != 3 || memcmp(buf, "bye", 3) != 0) {
+		errx(1, "data written before close was lost");
+	}
+	if (read(fds[0], buf, sizeof(buf)) != 0) {
+		errx(1, "no EOF after the write end was closed");
+	}
+	close(fds[0]);
+
+	/* EPIPE once no reader is left */
+	makepipe(fds);
+	close(fds[0]);
+	if (write(fds[1], "x", 1) >= 0 || errno != EPIPE) {
+		errx(1, "write with no reader didn't fail with EPIPE");
+	}
+	close(fds[1]);
+}
+
+/* Writers put in whole records of their own letter; none may mix. */
+static
+void
+atomicity(void)
+{
+	char rec[PIPE_BUF];
+	pid_t pids[MAXWRITERS];
+	int counts[MAXWRITERS];
+	int fds[2], i, j;
+	size_t got;
+
+	makepipe(fds);
+	for (i = 0; i < nwriters; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			close(fds[0]);
+			memset(rec, 'a' + i, sizeof(rec));
+			for (j = 0; j < RECORDS; j++) {
+				if (write(fds[1], rec, sizeof(rec)) !=
+				    (ssize_t)sizeof(rec)) {
+					err(1, "write");
+				}
+			}
+			_exit(0);
+		}
+		counts[i] = 0;
+	}
+	close(fds[1]);
+
+	while ((got = readall(fds[0], rec, sizeof(rec))) > 0) {
+		if (got != sizeof(rec)) {
+			errx(1, "stream ended partway through a record");
+		}
+		for (j = 1; j < PIPE_BUF; j++) {
+			if (rec[j] != rec[0]) {
+				errx(1, "records from two writers got mixed");
+			}
+		}
+		i = rec[0] - 'a';
+		if (i < 0 || i >= nwriters) {
+			errx(1, "record from nobody");
+		}
+		counts[i]++;
+	}
+	close(fds[0]);
+
+	for (i = 0; i < nwriters; i++) {
+		waitchild(pids[i], "record writer");
+		if (counts[i] != RECORDS) {
+			errx(1, "writer %d: got %d records of %d", i,
+			     counts[i], RECORDS);
+		}
+	}
+}
+
+/*
+ * A child writes kbytes of stream CHUNK bytes at a time; we read it
+ * back RCHUNK at a time, checking it if CHECK. Returns milliseconds.
+ */
+static
+unsigned long
+stream(size_t chunk, size_t rchunk, int check)
+{
+	unsigned long total = (unsigned long)kbytes * 1024;
+	unsigned long pos, i;
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	char *wbuf, *rbuf;
+	size_t n, got;
+	pid_t pid;
+	int fds[2];
+
+	/* Off the start of a page, so loans start and end partway in */
+	wbuf = malloc(chunk + 123);
+	rbuf = malloc(rchunk);
+	if (wbuf == NULL || rbuf == NULL) {
+		errx(1, "malloc failed");
+	}
+	wbuf += 123;
+
+	makepipe(fds);
+	__time(&s0, &ns0);
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (pos = 0; pos < total; pos += n) {
+			n = total - pos < chunk ? total - pos : chunk;
+			if (check) {
+				for (i = 0; i < n; i++) {
+					wbuf[i] = streambyte(pos + i);
+				}
+			}
+			if (write(fds[1], wbuf, n) != (ssize_t)n) {
+				err(1, "write");
+			}
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	pos = 0;
+	while ((got = readall(fds[0], rbuf, rchunk)) > 0) {
+		if (check) {
+			for (i = 0; i < got; i++) {
+				if (rbuf[i] != streambyte(pos + i)) {
+					errx(1, "byte %lu of the stream is "
+					     "wrong", pos + i);
+				}
+			}
+		}
+		pos += got;
+	}
+	close(fds[0]);
+	waitchild(pid, "stream writer");
+	__time(&s1, &ns1);
+
+	if (pos != total) {
+		errx(1, "got %lu bytes of %lu", pos, total);
+	}
+	free(wbuf - 123);
+	free(rbuf);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long smallms, bigms;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+			kbytes = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			nwriters = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: pipetest [-k kbytes] [-w writers]");
+		}
+	}
+	if (kbytes < 1 || nwriters < 1 || nwriters > MAXWRITERS) {
+		errx(1, "pipetest: need 1+ kbytes and 1 to %d writers",
+		     MAXWRITERS);
+	}
+
+	basics();
+	atomicity();
+
+	/* Byte-checked, with reads both smaller and larger than writes */
+	stream(BIGCHUNK, 1000, 1);
+	stream(SMALLCHUNK, 3 * BIGCHUNK, 1);
+
+	smallms = stream(SMALLCHUNK, BIGCHUNK, 0);
+	bigms = stream(BIGCHUNK, BIGCHUNK, 0);
+	tprintf("%d KB through a pipe: %d-byte writes %lu ms, "
+		"%d-byte writes %lu ms\n", kbytes, SMALLCHUNK, smallms,
+		BIGCHUNK, bigms);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/pipetest");
+	return 0;
+}
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * polltest - poll and select.
+ *
+ * Checks the easy cases first: a timeout of 0 doesn't wait, a timeout
+ * does, a bad fd is POLLNVAL, and the ends of a pipe report POLLOUT,
+ * POLLIN, POLLHUP and POLLERR when they should. Then one process
+ * watches the read ends of several pipes at once while children write
+ * to them at staggered times and then exit, reading each message as
+ * its pipe becomes ready, until every pipe has hung up. Last it waits
+ * with poll for a semfs semaphore and with select for a pipe, each
+ * made ready by a child.
+ *
+ * usage: polltest [-p pipes]
+ */
+
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define MAXPIPES   16
+#define STAGGER    50		/* ms between children's writes */
+#define SEMNAME    "sem:polltest"
+
+static int npipes = 8;
+
+/* Milliseconds since some time in the past. */
+static
+unsigned long
+now_ms(void)
+{
+	time_t s;
+	unsigned long ns;
+
+	__time(&s, &ns);
+	return s * 1000 + ns / 1000000;
+}
+
+/* Sleep, by waiting on nothing. */
+static
+void
+msleep(int ms)
+{
+	if (poll(NULL, 0, ms) != 0) {
+		err(1, "poll as sleep");
+	}
+}
+
+static
+void
+waitchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+static
+int
+poll1(int fd, int events, int timeout)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	r = poll(&pfd, 1, timeout);
+	if (r < 0) {
+		err(1, "poll");
+	}
+	if (r != (pfd.revents != 0)) {
+		errx(1, "poll returned %d with revents 0x%x", r, pfd.revents);
+	}
+	return pfd.revents;
+}
+
+static
+void
+basics(void)
+{
+	unsigned long t0, t1;
+	int fds[2], rev;
+	char c;
+
+	t0 = now_ms();
+	msleep(0);
+	msleep(200);
+	t1 = now_ms();
+	if (t1 - t0 < 190) {
+		errx(1, "a 200 ms timeout ended after %lu ms", t1 - t0);
+	}
+
+	if (poll1(1000, POLLIN, 0) != POLLNVAL) {
+		errx(1, "an unopened fd wasn't POLLNVAL");
+	}
+	if (poll1(STDOUT_FILENO, POLLOUT, 0) != POLLOUT) {
+		errx(1, "the console wasn't writable");
+	}
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	if (poll1(fds[0], POLLIN, 0) != 0) {
+		errx(1, "an empty pipe was readable");
+	}
+	if (poll1(fds[0], POLLIN, 100) != 0) {
+		errx(1, "an empty pipe became readable");
+	}
+	if (poll1(fds[1], POLLOUT, 0) != POLLOUT) {
+		errx(1, "an empty pipe wasn't writable");
+	}
+	if (write(fds[1], "x", 1) != 1) {
+		err(1, "write");
+	}
+	if (poll1(fds[0], POLLIN | POLLOUT, -1) != POLLIN) {
+		errx(1, "a pipe with data wasn't just readable");
+	}
+	if (read(fds[0], &c, 1) != 1) {
+		err(1, "read");
+	}
+	close(fds[1]);
+	if ((poll1(fds[0], POLLIN, -1) & POLLHUP) == 0) {
+		errx(1, "no POLLHUP with the write end closed");
+	}
+	close(fds[0]);
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	close(fds[0]);
+	rev = poll1(fds[1], POLLOUT, -1);
+	if ((rev & POLLERR) == 0) {
+		errx(1, "no POLLERR with the read end closed");
+	}
+	close(fds[1]);
+}
+
+/* One process reads from many pipes as each gets something. */
+static
+void
+many(void)
+{
+	struct pollfd pfds[MAXPIPES];
+	pid_t pids[MAXPIPES];
+	int fds[2], i, j, open, got, r;
+	char buf[32], want[32];
+
+	for (i = 0; i < npipes; i++) {
+		if (pipe(fds) < 0) {
+			err(1, "pipe");
+		}
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			close(fds[0]);
+			for (j = 0; j < i; j++) {
+				close(pfds[j].fd);
+			}
+			/* Last pipe first, so the order isn't fd order */
+			msleep((npipes - i) * STAGGER);
+			snprintf(buf, sizeof(buf), "pipe %d", i);
+			if (write(fds[1], buf, strlen(buf)) !=
+			    (ssize_t)strlen(buf)) {
+				err(1, "write");
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		pfds[i].fd = fds[0];
+		pfds[i].events = POLLIN;
+	}
+
+	got = 0;
+	open = npipes;
+	while (open > 0) {
+		r = poll(pfds, npipes, -1);
+		if (r <= 0) {
+			err(1, "poll");
+		}
+		for (i = 0; i < npipes; i++) {
+			if (pfds[i].revents & POLLIN) {
+				r = read(pfds[i].fd, buf, sizeof(buf) - 1);
+				if (r < 0) {
+					err(1, "read");
+				}
+				if (r > 0) {
+					buf[r] = 0;
+					snprintf(want, sizeof(want),
+						 "pipe %d", i);
+					if (strcmp(buf, want)) {
+						errx(1, "pipe %d: got %s", i,
+						     buf);
+					}
+					got++;
+					continue;
+				}
+			}
+			if (pfds[i].revents & POLLHUP) {
+				close(pfds[i].fd);
+				/* poll skips negative fds */
+				pfds[i].fd = -1;
+				open--;
+			}
+			else if (pfds[i].revents) {
+				errx(1, "pipe %d: revents 0x%x", i,
+				     pfds[i].revents);
+			}
+		}
+	}
+	for (i = 0; i < npipes; i++) {
+		waitchild(pids[i]);
+	}
+	if (got != npipes) {
+		errx(1, "got %d messages from %d pipes", got, npipes);
+	}
+}
+
+/* A semaphore becomes readable (P won't block) when a child does V. */
+static
+void
+semaphore(void)
+{
+	pid_t pid;
+	int fd;
+	char c;
+
+	fd = open(SEMNAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SEMNAME);
+	}
+	if (poll1(fd, POLLIN | POLLOUT, 0) != POLLOUT) {
+		errx(1, "a semaphore at 0 was ready for P");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		msleep(100);
+		if (write(fd, "v", 1) != 1) {
+			err(1, "V");
+		}
+		_exit(0);
+	}
+	if (poll1(fd, POLLIN, 5000) != POLLIN) {
+		errx(1, "the semaphore never became ready for P");
+	}
+	if (read(fd, &c, 1) != 1) {
+		err(1, "P");
+	}
+	waitchild(pid);
+	close(fd);
+	remove(SEMNAME);
+}
+
+/* select wakes up for a pipe a child writes to. */
+static
+void
+selecttest(void)
+{
+	struct timeval tv;
+	fd_set rset, wset;
+	int fds[2], r;
+	pid_t pid;
+	char c;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	FD_ZERO(&rset);
+	FD_SET(fds[0], &rset);
+	tv.tv_sec = 0;
+	tv.tv_usec = 50000;
+	r = select(fds[0] + 1, &rset, NULL, NULL, &tv);
+	if (r != 0 || FD_ISSET(fds[0], &rset)) {
+		errx(1, "select: an empty pipe was readable");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		msleep(100);
+		if (write(fds[1], "s", 1) != 1) {
+			err(1, "write");
+		}
+		_exit(0);
+	}
+
+	FD_ZERO(&rset);
+	FD_ZERO(&wset);
+	FD_SET(fds[0], &rset);
+	FD_SET(fds[0], &wset);	/* never: it's the read end */
+	r = select(fds[0] + 1, &rset, &wset, NULL, NULL);
+	if (r < 0) {
+		err(1, "select");
+	}
+	if (r != 1 || !FD_ISSET(fds[0], &rset) || FD_ISSET(fds[0], &wset)) {
+		errx(1, "select: wrong result %d", r);
+	}
+	if (read(fds[0], &c, 1) != 1 || c != 's') {
+		errx(1, "select: read the wrong thing");
+	}
+	waitchild(pid);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			npipes = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: polltest [-p pipes]");
+		}
+	}
+	if (npipes < 1 || npipes > MAXPIPES) {
+		errx(1, "polltest: need 1 to %d pipes", MAXPIPES);
+	}
+
+	basics();
+	many();
+	semaphore();
+	selecttest();
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/polltest");
+	return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * rwvtest - readv, writev, pread and pwrite.
+ *
+ * Writes a file of fixed-size records with writev and checks them
+ * with readv and pread, checks that pread and pwrite leave the seek
+ * position alone and refuse the console, then has several processes
+ * pread random records through one shared descriptor at once. Last
+ * it times writing the records one write() at a time against batches
+ * of IOV_BATCH with writev.
+ *
+ * usage: rwvtest [-r records] [-p procs]
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define FILENAME   "rwvtest.dat"
+#define RECSIZE    64
+#define IOV_BATCH  16
+#define MAXPROCS   8
+#define READS      200
+
+static int nrecs = 256;
+static int nprocs = 4;
+
+/* Fills BUF with the contents record NUM should have. */
+static
+void
+fillrec(char *buf, int num)
+{
+	int i;
+
+	for (i = 0; i < RECSIZE; i++) {
+		buf[i] = (char)('a' + (num * 7 + i) % 26);
+	}
+}
+
+static
+void
+checkrec(const char *buf, int num, const char *how)
+{
+	char want[RECSIZE];
+
+	fillrec(want, num);
+	if (memcmp(buf, want, RECSIZE) != 0) {
+		errx(1, "%s: record %d has the wrong contents", how, num);
+	}
+}
+
+static
+off_t
+getpos(int fd)
+{
+	off_t pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0) {
+		err(1, "lseek");
+	}
+	return pos;
+}
+
+/* Writes all the records, IOV_BATCH per writev. */
+static
+void
+writeall(int fd)
+{
+	static char bufs[IOV_BATCH][RECSIZE];
+	struct iovec iov[IOV_BATCH];
+	ssize_t r;
+	int i, j, n;
+
+	for (i = 0; i < nrecs; i += n) {
+		n = nrecs - i < IOV_BATCH ? nrecs - i : IOV_BATCH;
+		for (j = 0; j < n; j++) {
+			fillrec(bufs[j], i + j);
+			iov[j].iov_base = bufs[j];
+			iov[j].iov_len = RECSIZE;
+		}
+		r = writev(fd, iov, n);
+		if (r < 0) {
+			err(1, "writev");
+		}
+		if (r != n * RECSIZE) {
+			errx(1, "writev: short count %d", (int)r);
+		}
+	}
+}
+
+static
+void
+basics(int fd)
+{
+	char a[RECSIZE], b[RECSIZE / 2], c[RECSIZE / 2];
+	struct iovec iov[3];
+	off_t pos;
+	ssize_t r;
+	int i;
+
+	writeall(fd);
+	if (getpos(fd) != (off_t)nrecs * RECSIZE) {
+		errx(1, "writev didn't move the seek position");
+	}
+
+	/* readv splitting records across buffers of different sizes */
+	if (lseek(fd, RECSIZE, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	iov[0].iov_base = b;
+	iov[0].iov_len = sizeof(b);
+	iov[1].iov_base = c;
+	iov[1].iov_len = sizeof(c);
+	iov[2].iov_base = a;
+	iov[2].iov_len = sizeof(a);
+	r = readv(fd, iov, 3);
+	if (r != 2 * RECSIZE) {
+		errx(1, "readv: got %d, expected %d", (int)r, 2 * RECSIZE);
+	}
+	checkrec(a, 2, "readv");
+	fillrec(a, 1);
+	if (memcmp(a, b, sizeof(b)) || memcmp(a + sizeof(b), c, sizeof(c))) {
+		errx(1, "readv: record 1 has the wrong contents");
+	}
+
+	/* pread, and pwrite over a record, without moving */
+	pos = getpos(fd);
+	for (i = 0; i < nrecs; i += 17) {
+		r = pread(fd, a, RECSIZE, (off_t)i * RECSIZE);
+		if (r != RECSIZE) {
+			errx(1, "pread: record %d: got %d", i, (int)r);
+		}
+		checkrec(a, i, "pread");
+	}
+	fillrec(a, 5);
+	if (pwrite(fd, a, RECSIZE, (off_t)4 * RECSIZE) != RECSIZE) {
+		err(1, "pwrite");
+	}
+	if (getpos(fd) != pos) {
+		errx(1, "pread/pwrite moved the seek position");
+	}
+	if (pread(fd, b, RECSIZE, (off_t)4 * RECSIZE) != RECSIZE) {
+		err(1, "pread");
+	}
+	checkrec(b, 5, "pwrite");
+	fillrec(a, 4);
+	if (pwrite(fd, a, RECSIZE, (off_t)4 * RECSIZE) != RECSIZE) {
+		err(1, "pwrite");
+	}
+
+	/* errors */
+	if (pread(fd, a, RECSIZE, -1) >= 0 || errno != EINVAL) {
+		errx(1, "pread at -1 didn't fail with EINVAL");
+	}
+	if (pwrite(STDOUT_FILENO, a, 1, 0) >= 0 || errno != ESPIPE) {
+		errx(1, "pwrite to the console didn't fail with ESPIPE");
+	}
+	if (readv(fd, iov, 0) >= 0 || errno != EINVAL) {
+		errx(1, "readv of no buffers didn't fail with EINVAL");
+	}
+	if (readv(-1, iov, 1) >= 0 || errno != EBADF) {
+		errx(1, "readv on -1 didn't fail with EBADF");
+	}
+}
+
+/* Children pread random records through the parent's descriptor. */
+static
+void
+parallel(int fd)
+{
+	char buf[RECSIZE];
+	pid_t pids[MAXPROCS];
+	int i, j, rec, status, failed = 0;
+	off_t pos;
+
+	pos = getpos(fd);
+	for (i = 0; i < nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			srandom(i + 1);
+			for (j = 0; j < READS; j++) {
+				rec = random() % nrecs;
+				if (pread(fd, buf, RECSIZE,
+					  (off_t)rec * RECSIZE) != RECSIZE) {
+					err(1, "pread");
+				}
+				checkrec(buf, rec, "parallel pread");
+			}
+			_exit(0);
+		}
+	}
+	for (i = 0; i < nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "a pread child failed");
+	}
+	if (getpos(fd) != pos) {
+		errx(1, "the children's preads moved the shared seek position");
+	}
+}
+
+/* Milliseconds to write all the records, with writev or one by one. */
+static
+unsigned long
+timewrite(int fd, int vectored)
+{
+	char buf[RECSIZE];
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	int i;
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	__time(&s0, &ns0);
+	if (vectored) {
+		writeall(fd);
+	}
+	else {
+		for (i = 0; i < nrecs; i++) {
+			fillrec(buf, i);
+			if (write(fd, buf, RECSIZE) != RECSIZE) {
+				err(1, "write");
+			}
+		}
+	}
+	__time(&s1, &ns1);
+	return (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long onems, vecms;
+	int fd, i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			nrecs = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			nprocs = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: rwvtest [-r records] [-p procs]");
+		}
+	}
+	if (nrecs < 32 || nprocs < 1 || nprocs > MAXPROCS) {
+		errx(1, "rwvtest: need 32+ records and 1 to %d procs",
+		     MAXPROCS);
+	}
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	basics(fd);
+	parallel(fd);
+
+	onems = timewrite(fd, 0);
+	vecms = timewrite(fd, 1);
+	tprintf("%d records: write %lu ms, writev by %d %lu ms\n",
+		nrecs, onems, IOV_BATCH, vecms);
+
+	close(fd);
+	remove(FILENAME);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/rwvtest");
+	return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * schedtest - wakeup latency under load.
+ *
+ * Forks some CPU-bound children that spin for a while, and meanwhile
+ * sleeps repeatedly for a short time in the parent, timing how much
+ * later than asked for each sleep ends. A thread that mostly sleeps
+ * should get the CPU back promptly when it wakes up, however many
+ * spinners there are, so the average lateness should stay around a
+ * timer tick or two rather than growing with the number of children.
+ *
+ * It also counts context switches over the run, with cpustat(). The
+ * spinners should run for a time slice at a time rather than being
+ * switched on every timer tick, so apart from the two switches each
+ * nap costs there should be well under one switch per tick.
+ *
+ * usage: schedtest [-h hogs] [-s seconds]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define MAXHOGS    16
+#define NAP        10		/* ms the parent sleeps for each time */
+#define MAXLATE    100		/* ms of average lateness that fails */
+#define MAXSWITCH  3		/* switches per 4 ticks, past naps, that fail */
+
+static int nhogs = 4;
+static int seconds = 3;
+
+/* Milliseconds since some time in the past. */
+static
+unsigned long
+now_ms(void)
+{
+	time_t s;
+	unsigned long ns;
+
+	__time(&s, &ns);
+	return s * 1000 + ns / 1000000;
+}
+
+/* Add up the tick and switch counts of every cpu. */
+static
+void
+sched_counts(unsigned *ticks, unsigned *switches)
+{
+	struct cpustat cs;
+	unsigned i;
+
+	*ticks = *switches = 0;
+	for (i = 0; cpustat(i, &cs) == 0; i++) {
+		*ticks += cs.cs_hardclocks;
+		*switches += cs.cs_switches;
+	}
+	if (i == 0) {
+		err(1, "cpustat");
+	}
+}
+
+/* Spin, without sleeping, until the deadline. */
+static
+void
+hog(unsigned long until)
+{
+	volatile unsigned long n = 0;
+
+	while (now_ms() < until) {
+		n++;
+	}
+	_exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pid_t pids[MAXHOGS];
+	unsigned long until, t0, late, total, worst, naps, extra;
+	unsigned ticks0, switches0, ticks, switches;
+	int i, status;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+			nhogs = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			seconds = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: schedtest [-h hogs] [-s seconds]");
+		}
+	}
+	if (nhogs < 1 || nhogs > MAXHOGS) {
+		errx(1, "schedtest: need 1 to %d hogs", MAXHOGS);
+	}
+	if (seconds < 1) {
+		errx(1, "schedtest: need at least 1 second");
+	}
+
+	sched_counts(&ticks0, &switches0);
+	until = now_ms() + seconds * 1000;
+	for (i = 0; i < nhogs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			hog(until);
+		}
+	}
+
+	total = worst = naps = 0;
+	while (now_ms() + NAP < until) {
+		t0 = now_ms();
+		if (poll(NULL, 0, NAP) != 0) {
+			err(1, "poll as sleep");
+		}
+		late = now_ms() - t0;
+		late = late > NAP ? late - NAP : 0;
+		total += late;
+		if (late > worst) {
+			worst = late;
+		}
+		naps++;
+	}
+
+	for (i = 0; i < nhogs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "hog %d failed", i);
+		}
+	}
+	sched_counts(&ticks, &switches);
+	ticks -= ticks0;
+	switches -= switches0;
+
+	if (naps == 0) {
+		errx(1, "schedtest: never got to sleep");
+	}
+	tprintf("schedtest: %d hogs, %lu naps of %d ms: "
+		"%lu ms late on average, %lu at worst\n",
+		nhogs, naps, NAP, total / naps, worst);
+	if (total / naps > MAXLATE) {
+		errx(1, "schedtest: wakeups were too late");
+	}
+
+	/* Each nap switches to the sleeper and back again. */
+	extra = switches > 2 * naps ? switches - 2 * naps : 0;
+	tprintf("schedtest: %u switches in %u ticks, %lu past the naps\n",
+		switches, ticks, extra);
+	if (extra * 4 > (unsigned long)ticks * MAXSWITCH) {
+		errx(1, "schedtest: switched too often");
+	}
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/schedtest");
+	return 0;
+}
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * spawntest - test vfork() and spawn().
+ *
+ * Checks that a vforked child runs in our address space and that we
+ * don't get control back until it has exec'd or exited, that spawn
+ * applies its file actions and reports failures to the parent, and
+ * then times launching a program with fork, vfork and spawn from a
+ * parent with a big heap. With fork the cost grows with the parent;
+ * with the other two it shouldn't.
+ *
+ * usage: spawntest [-r ROUNDS] [-b KBYTES]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define PROG "/testbin/add"
+#define OUTFILE "spawntest.out"
+
+static char *progargv[] = { (char *)"add", (char *)"3", (char *)"8", NULL };
+
+static volatile int shared;
+
+/* libc has no strstr */
+static
+int
+contains(const char *s, const char *sub)
+{
+	size_t len = strlen(sub);
+
+	for (; *s; s++) {
+		if (strlen(s) >= len && !memcmp(s, sub, len)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Wait for PID and check that it exited with CODE. */
+static
+void
+expectexit(pid_t pid, int code, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "%s: waitpid", what);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != code) {
+		errx(1, "%s: child status %d, expected exit %d",
+		     what, status, code);
+	}
+}
+
+static
+void
+test_vfork_shared(void)
+{
+	pid_t pid;
+
+	shared = 0;
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		/* Only for the test; a real vfork child mustn't do this. */
+		shared = 1;
+		_exit(7);
+	}
+	if (shared != 1) {
+		errx(1, "vfork: child did not run in our address space "
+		     "before we got control back");
+	}
+	expectexit(pid, 7, "vfork");
+	nprintf(".");
+}
+
+static
+void
+test_vfork_exec(void)
+{
+	pid_t pid;
+
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		execv(PROG, progargv);
+		_exit(255);
+	}
+	expectexit(pid, 0, "vfork+execv");
+	nprintf(".");
+}
+
+static
+void
+test_spawn_actions(void)
+{
+	struct spawn_action acts[2];
+	char buf[128];
+	ssize_t len;
+	pid_t pid;
+	int fd;
+
+	/* Run add with its stdout sent to a file and no stdin. */
+	acts[0].sa_type = SPAWN_OPEN;
+	acts[0].sa_fd = STDOUT_FILENO;
+	acts[0].sa_flags = O_WRONLY|O_CREAT|O_TRUNC;
+	acts[0].sa_path = OUTFILE;
+	acts[1].sa_type = SPAWN_CLOSE;
+	acts[1].sa_fd = STDIN_FILENO;
+
+	pid = spawn(PROG, progargv, acts, 2);
+	if (pid < 0) {
+		err(1, "spawn");
+	}
+	expectexit(pid, 0, "spawn");
+
+	fd = open(OUTFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", OUTFILE);
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0) {
+		err(1, "%s: read", OUTFILE);
+	}
+	buf[len] = 0;
+	close(fd);
+	remove(OUTFILE);
+
+	if (!contains(buf, "Answer: 11")) {
+		errx(1, "spawn: child output not redirected (got: %s)", buf);
+	}
+	nprintf(".");
+}
+
+static
+void
+test_spawn_errors(void)
+{
+	struct spawn_action act;
+
+	if (spawn("/testbin/nonexistent", progargv, NULL, 0) >= 0) {
+		errx(1, "spawn of a missing program succeeded");
+	}
+	if (errno != ENOENT) {
+		err(1, "spawn of a missing program: wrong error");
+	}
+
+	act.sa_type = SPAWN_CLOSE;
+	act.sa_fd = 63;
+	if (spawn(PROG, progargv, &act, 1) >= 0 || errno != EBADF) {
+		errx(1, "spawn with a bad close action didn't fail with EBADF");
+	}
+
+	act.sa_type = 0;
+	act.sa_fd = 0;
+	if (spawn(PROG, progargv, &act, 1) >= 0 || errno != EINVAL) {
+		errx(1, "spawn with a bad action type didn't fail with EINVAL");
+	}
+
+	if (spawn(PROG, progargv, NULL, -1) >= 0 || errno != EINVAL) {
+		errx(1, "spawn with negative nactions didn't fail with EINVAL");
+	}
+
+	/* None of those may have left a child behind. */
+	if (waitpid(-1, NULL, WNOHANG) >= 0 || errno != ECHILD) {
+		errx(1, "failed spawn left a child process");
+	}
+	nprintf(".");
+}
+
+/* Launch PROG once with METHOD and wait for it. */
+static
+void
+launch(int method)
+{
+	pid_t pid;
+
+	switch (method) {
+	    case 0:
+		pid = fork();
+		break;
+	    case 1:
+		pid = vfork();
+		break;
+	    default:
+		pid = spawn(PROG, progargv, NULL, 0);
+		break;
+	}
+	if (pid < 0) {
+		err(1, "launch");
+	}
+	if (pid == 0) {
+		execv(PROG, progargv);
+		_exit(255);
+	}
+	expectexit(pid, 0, "launch");
+}
+
+static
+void
+timelaunch(int rounds)
+{
+	static const char *const names[] = { "fork", "vfork", "spawn" };
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	unsigned long msecs;
+	int method, i;
+
+	for (method = 0; method < 3; method++) {
+		__time(&startsecs, &startnsecs);
+		for (i = 0; i < rounds; i++) {
+			launch(method);
+		}
+		__time(&endsecs, &endnsecs);
+
+		msecs = (endsecs - startsecs) * 1000;
+		msecs += endnsecs / 1000000;
+		msecs -= startnsecs / 1000000;
+		tprintf("%-5s+exec: %d rounds in %lu ms\n",
+			names[method], rounds, msecs);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int rounds = 10;
+	size_t bloat = 512;
+	char *heap;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			rounds = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			bloat = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: spawntest [-r ROUNDS] [-b KBYTES]");
+		}
+	}
+
+	test_vfork_shared();
+	test_vfork_exec();
+	test_spawn_actions();
+	test_spawn_errors();
+	nprintf("\n");
+
+	/* Make ourselves big, so fork has something to copy. */
+	heap = malloc(bloat * 1024);
+	if (heap == NULL) {
+		err(1, "malloc");
+	}
+	memset(heap, 1, bloat * 1024);
+	timelaunch(rounds);
+	free(heap);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/spawntest");
+	return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * timertest - nanosleep and the interval timer.
+ *
+ * Checks that nanosleep sleeps about as long as asked, not less, both
+ * for a longer sleep and for a run of sleeps well under a hardclock;
+ * that it rejects bad times; that setitimer and getitimer agree; and
+ * that an alarm kills a child with SIGALRM whether it's running in
+ * user mode or asleep in nanosleep.
+ *
+ * usage: timertest [-n sleeps]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define SHORT_NS   2000000	/* 2 ms, a fifth of a hardclock */
+#define TICK_NS    10000000	/* one hardclock */
+
+static int nsleeps = 20;
+
+/* Nanoseconds since some time in the past. */
+static
+unsigned long long
+now_ns(void)
+{
+	time_t s;
+	unsigned long ns;
+
+	__time(&s, &ns);
+	return s * 1000000000ULL + ns;
+}
+
+static
+void
+nsleep(unsigned long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	if (nanosleep(&ts, NULL) < 0) {
+		err(1, "nanosleep");
+	}
+}
+
+static
+void
+sleeps(void)
+{
+	unsigned long long t0, t1, per;
+	int i;
+
+	t0 = now_ns();
+	nsleep(100000000);
+	t1 = now_ns();
+	if (t1 - t0 < 100000000) {
+		errx(1, "a 100 ms sleep ended after %llu ns", t1 - t0);
+	}
+	if (t1 - t0 > 100000000 + 5 * TICK_NS) {
+		errx(1, "a 100 ms sleep took %llu ns", t1 - t0);
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < nsleeps; i++) {
+		nsleep(SHORT_NS);
+	}
+	t1 = now_ns();
+	per = (t1 - t0) / nsleeps;
+	tprintf("%d sleeps of %d us took %llu us each\n",
+		nsleeps, SHORT_NS / 1000, per / 1000);
+	if (per < SHORT_NS) {
+		errx(1, "sleeps ended early");
+	}
+	if (per > 3 * TICK_NS) {
+		errx(1, "sleeps took over three hardclocks");
+	}
+}
+
+static
+void
+badsleep(long sec, long nsec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = sec;
+	ts.tv_nsec = nsec;
+	if (nanosleep(&ts, NULL) == 0 || errno != EINVAL) {
+		errx(1, "nanosleep of %ld s %ld ns wasn't EINVAL", sec, nsec);
+	}
+}
+
+static
+void
+itimers(void)
+{
+	struct itimerval it, old;
+
+	if (getitimer(ITIMER_REAL, &it) < 0) {
+		err(1, "getitimer");
+	}
+	if (it.it_value.tv_sec != 0 || it.it_value.tv_usec != 0) {
+		errx(1, "the timer was running to start with");
+	}
+
+	it.it_value.tv_sec = 5;
+	it.it_value.tv_usec = 0;
+	it.it_interval.tv_sec = 1;
+	it.it_interval.tv_usec = 500000;
+	if (setitimer(ITIMER_REAL, &it, NULL) < 0) {
+		err(1, "setitimer");
+	}
+	if (getitimer(ITIMER_REAL, &it) < 0) {
+		err(1, "getitimer");
+	}
+	if (it.it_value.tv_sec < 4 || it.it_value.tv_sec > 5 ||
+	    (it.it_value.tv_sec == 5 && it.it_value.tv_usec != 0)) {
+		errx(1, "a 5 s timer had %lld.%06d s left",
+		     (long long)it.it_value.tv_sec,
+		     (int)it.it_value.tv_usec);
+	}
+	if (it.it_interval.tv_sec != 1 || it.it_interval.tv_usec != 500000) {
+		errx(1, "the interval read back wrong");
+	}
+
+	/* Stop it; the old setting comes back. */
+	it.it_value.tv_sec = 0;
+	it.it_value.tv_usec = 0;
+	it.it_interval = it.it_value;
+	if (setitimer(ITIMER_REAL, &it, &old) < 0) {
+		err(1, "setitimer");
+	}
+	if (old.it_value.tv_sec < 4 || old.it_interval.tv_sec != 1) {
+		errx(1, "setitimer returned the wrong old setting");
+	}
+	if (getitimer(ITIMER_REAL, &it) < 0) {
+		err(1, "getitimer");
+	}
+	if (it.it_value.tv_sec != 0 || it.it_value.tv_usec != 0) {
+		errx(1, "the timer didn't stop");
+	}
+
+	if (setitimer(ITIMER_VIRTUAL, &it, NULL) == 0 || errno != EINVAL) {
+		errx(1, "ITIMER_VIRTUAL wasn't EINVAL");
+	}
+	it.it_value.tv_usec = 1000000;
+	if (setitimer(ITIMER_REAL, &it, NULL) == 0 || errno != EINVAL) {
+		errx(1, "a bad timeval wasn't EINVAL");
+	}
+}
+
+/*
+ * A child sets a 100 ms alarm and then spins or sleeps for much
+ * longer; it should die of SIGALRM soon after the alarm.
+ */
+static
+void
+alarmtest(int sleeping)
+{
+	struct itimerval it;
+	struct timespec ts;
+	unsigned long long t0, t1;
+	volatile unsigned long spin;
+	int status;
+	pid_t pid;
+
+	t0 = now_ns();
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		it.it_value.tv_sec = 0;
+		it.it_value.tv_usec = 100000;
+		it.it_interval.tv_sec = 0;
+		it.it_interval.tv_usec = 0;
+		if (setitimer(ITIMER_REAL, &it, NULL) < 0) {
+			err(1, "setitimer");
+		}
+		if (sleeping) {
+			ts.tv_sec = 10;
+			ts.tv_nsec = 0;
+			nanosleep(&ts, NULL);
+		}
+		else {
+			for (spin = 0; spin < 1000000000; spin++) {
+				/* nothing */
+			}
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	t1 = now_ns();
+	if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGALRM) {
+		errx(1, "%s child wasn't killed by SIGALRM (status 0x%x)",
+		     sleeping ? "sleeping" : "spinning", status);
+	}
+	if (t1 - t0 > 2000000000ULL) {
+		errx(1, "%s child took %llu ms to die",
+		     sleeping ? "sleeping" : "spinning", (t1 - t0) / 1000000);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			nsleeps = atoi(argv[++i]);
+		}
+		else {
+			errx(1, "Usage: timertest [-n sleeps]");
+		}
+	}
+	if (nsleeps < 1) {
+		errx(1, "timertest: need at least 1 sleep");
+	}
+
+	sleeps();
+	badsleep(0, 1000000000);
+	badsleep(0, -1);
+	badsleep(-1, 0);
+	tprintf("nanosleep ok\n");
+	itimers();
+	tprintf("itimers ok\n");
+	alarmtest(0);
+	alarmtest(1);
+	tprintf("alarms ok\n");
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/timertest");
+	return 0;
+}
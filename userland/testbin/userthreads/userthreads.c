@@ -28,32 +28,29 @@
  */
 
 /*
- * Test multiple user level threads inside a process. The program
- * forks 3 threads off 2 to functions, each of which displays a string
- * every once in a while.
+ * Test multiple user level threads inside a process.
  *
- * This won't do much of anything unless you implement user-level
- * threads.
+ * First the original demo: 3 threads run 2 functions, each of which
+ * displays a string every once in a while, racing on a shared
+ * counter. Then it checks that threads share the address space and
+ * that join hands back each thread's return value, times the same
+ * computation split over 1 and NTHREADS threads to show a process
+ * scaling across cpus, and finally returns from main with a thread
+ * still spinning, which must end the whole process.
  *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
- *
- * This is also a rather basic test and you'll probably want to write
- * some more of your own.
+ * usage: userthreads [nthreads]
  */
 
-
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <test161/test161.h>
 
-#define NTHREADS  3
-#define MAX       1<<25
+#define NTHREADS  4
+#define MAXTHREADS 32
+#define MAX       1<<22
+#define WORK      (1<<24)
 
 /* counter for the loop in the threads:
    This variable is shared and incremented by each
@@ -61,49 +58,160 @@
 volatile int count = 0;
 
 /* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
-
-int
-main(int argc, char *argv[])
-{
-    int i;
+static void *ThreadRunner(void *);
+static void *BladeRunner(void *);
 
-    (void)argc;
-    (void)argv;
+/* One slice of a computation, and where its result goes */
+struct slice {
+	unsigned start, end;
+	unsigned result;
+};
 
-    for (i=0; i<NTHREADS; i++) {
-	if (i)
-	    threadfork(ThreadRunner);
-        else
-	    threadfork(BladeRunner);
-    }
-
-    tprintf("Parent has left.\n");
-    return 0;
-}
+static struct slice slices[MAXTHREADS];
 
 /* multiple threads will simply print out the global variable.
    Even though there is no synchronization, we should get some
    random results.
 */
 
-void
-BladeRunner()
+static
+void *
+BladeRunner(void *arg)
 {
+    (void)arg;
     while (count < MAX) {
 	if (count % 500 == 0)
 	    tprintf("Blade ");
 	count++;
     }
+    return NULL;
 }
 
-void
-ThreadRunner()
+static
+void *
+ThreadRunner(void *arg)
 {
+    (void)arg;
     while (count < MAX) {
 	if (count % 513 == 0)
 	    tprintf(" Runner\n");
 	count++;
     }
+    return NULL;
+}
+
+/* Some arithmetic the compiler can't skip. */
+static
+void *
+sumslice(void *arg)
+{
+	struct slice *s = arg;
+	unsigned i, sum = 0;
+
+	for (i = s->start; i < s->end; i++) {
+		sum += i ^ (i >> 3);
+	}
+	s->result = sum;
+	return s;
+}
+
+static
+void *
+spinforever(void *arg)
+{
+	(void)arg;
+	while (1) {
+		count++;
+	}
+	return NULL;
+}
+
+/* Runs WORK split over N threads; returns elapsed ms and the sum. */
+static
+unsigned long
+runwork(int n, unsigned *sum)
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	int tids[MAXTHREADS];
+	void *ret;
+	int i;
+
+	__time(&startsecs, &startnsecs);
+	for (i = 0; i < n; i++) {
+		slices[i].start = (unsigned)((long long)WORK * i / n);
+		slices[i].end = (unsigned)((long long)WORK * (i + 1) / n);
+		slices[i].result = 0;
+		tids[i] = thread_create(sumslice, &slices[i]);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+	*sum = 0;
+	for (i = 0; i < n; i++) {
+		if (thread_join(tids[i], &ret) < 0) {
+			err(1, "thread_join");
+		}
+		if (ret != &slices[i]) {
+			errx(1, "thread %d returned %p, expected %p",
+			     tids[i], ret, &slices[i]);
+		}
+		/* Written by the thread, read here: one address space */
+		*sum += slices[i].result;
+	}
+	__time(&endsecs, &endnsecs);
+
+	return (endsecs - startsecs) * 1000
+		+ endnsecs / 1000000 - startnsecs / 1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int i, n = NTHREADS;
+    int tids[3];
+    unsigned long ms1, msn;
+    unsigned sum1, sumn;
+
+    if (argc > 1) {
+	n = atoi(argv[1]);
+    }
+    if (n < 1 || n > MAXTHREADS) {
+	errx(1, "Usage: userthreads [nthreads], 1 to %d", MAXTHREADS);
+    }
+
+    for (i=0; i<3; i++) {
+	if (i)
+	    tids[i] = thread_create(ThreadRunner, NULL);
+        else
+	    tids[i] = thread_create(BladeRunner, NULL);
+	if (tids[i] < 0)
+	    err(1, "thread_create");
+    }
+    for (i=0; i<3; i++) {
+	if (thread_join(tids[i], NULL) < 0)
+	    err(1, "thread_join");
+    }
+    tprintf("\n");
+
+    /* Each thread can only be joined once */
+    if (thread_join(tids[0], NULL) >= 0) {
+	errx(1, "joined the same thread twice");
+    }
+
+    ms1 = runwork(1, &sum1);
+    msn = runwork(n, &sumn);
+    if (sum1 != sumn) {
+	errx(1, "sum over %d threads is %u, over 1 it is %u", n, sumn, sum1);
+    }
+    tprintf("1 thread: %lu ms, %d threads: %lu ms\n", ms1, n, msn);
+
+    /* Leave one running; returning from main must still end us. */
+    if (thread_create(spinforever, NULL) < 0) {
+	err(1, "thread_create");
+    }
+
+    success(TEST161_SUCCESS, SECRET, "/testbin/userthreads");
+    tprintf("Parent has left.\n");
+    return 0;
 }